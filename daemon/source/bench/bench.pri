@@ -0,0 +1,15 @@
+
+OTHER_FILES += \
+	$$PWD/bench.pri
+
+INCLUDEPATH += \
+	$$PWD/
+
+HEADERS += \
+	$$PWD/gatt_audioreplay.h \
+	$$PWD/gatt_deviceinfobench.h
+
+SOURCES += \
+	$$PWD/main.cpp \
+	$$PWD/gatt_audioreplay.cpp \
+	$$PWD/gatt_deviceinfobench.cpp
@@ -0,0 +1,412 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  gatt_audioreplay.cpp
+//  SkyBluetoothRcu
+//
+
+#include "gatt_audioreplay.h"
+
+#include "utils/crc32.h"
+#include "utils/filedescriptor.h"
+#include "utils/logging.h"
+
+#include <QFile>
+#include <QMap>
+#include <QtEndian>
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+
+// btsnoop file and record header sizes, the layout matches what
+// HciMonitor::dumpBuffer() writes
+#define BTSNOOP_FILE_HDR_SIZE   16
+#define BTSNOOP_PKT_HDR_SIZE    24
+#define BTSNOOP_TYPE_UART       1002
+
+static const quint8 btsnoop_id[] = { 0x62, 0x74, 0x73, 0x6e, 0x6f, 0x6f, 0x70, 0x00 };
+
+#define HCI_ACLDATA_PKT         0x02
+#define L2CAP_CID_ATT           0x0004
+#define ATT_OP_HANDLE_NOTIFY    0x1b
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class GattAudioReplay
+	\brief Replays a recorded stream of voice audio notifications through a
+	GattAudioPipe to measure the decode and output path without an RCU.
+
+	The recording can either be a btsnoop file, as produced by
+	HciMonitor::dumpBuffer(), or a simple capture file that is just the
+	20 byte notification values back to back.  For btsnoop files the audio
+	notifications are the 20 byte ATT notifications received on the most
+	common attribute handle, which is the audio data characteristic for
+	any capture that includes a voice search.
+
+	The notifications can be fed in as fast as possible, to measure the
+	throughput of the pipe, or paced to match the original timing (or the
+	12ms frame clock for capture files) to measure the latency stats as
+	they'd be in the field.  The output is read back and checksummed so
+	changes to the decoder can be spotted.
+
+ */
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the current monotonic time in nanoseconds.
+
+ */
+static qint64 monotonicNsecs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (qint64(ts.tv_sec) * 1000000000LL) + qint64(ts.tv_nsec);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Reads everything currently in the non-blocking \a fd and adds it to the
+	\a crc, returns the number of bytes read.
+
+ */
+static qint64 drainOutput(int fd, Crc32 *crc)
+{
+	quint8 buffer[4096];
+	qint64 total = 0;
+
+	while (true) {
+		const ssize_t rd = TEMP_FAILURE_RETRY(::read(fd, buffer, sizeof(buffer)));
+		if (rd <= 0) {
+			if ((rd < 0) && (errno != EAGAIN))
+				qErrnoWarning(errno, "failed to read replay output");
+			break;
+		}
+
+		crc->addData(buffer, static_cast<int>(rd));
+		total += rd;
+	}
+
+	return total;
+}
+
+
+
+GattAudioReplay::GattAudioReplay()
+{
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Loads the notifications from the file at \a filePath, the format is
+	detected from the btsnoop header.  Returns \c false if the file couldn't
+	be read or doesn't contain any audio notifications.
+
+ */
+bool GattAudioReplay::load(const QString &filePath)
+{
+	m_packets.clear();
+	m_timestamps.clear();
+
+	QFile file(filePath);
+	if (!file.open(QFile::ReadOnly)) {
+		qWarning() << "failed to open" << filePath << "due to" << file.errorString();
+		return false;
+	}
+
+	const QByteArray data = file.readAll();
+	file.close();
+
+	bool success;
+	if ((data.size() >= BTSNOOP_FILE_HDR_SIZE) &&
+	    (memcmp(data.constData(), btsnoop_id, sizeof(btsnoop_id)) == 0))
+		success = parseBtSnoop(data);
+	else
+		success = parseCapture(data);
+
+	if (!success)
+		return false;
+
+	if (m_timestamps.isEmpty()) {
+		qWarning() << "no audio notifications found in" << filePath;
+		return false;
+	}
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Extracts the audio notifications from a btsnoop capture.  Only received
+	ACL packets that are a complete L2CAP ATT handle value notification with
+	a 20 byte value are considered, of those the ones on the handle with the
+	most notifications are kept.
+
+ */
+bool GattAudioReplay::parseBtSnoop(const QByteArray &data)
+{
+	const quint8 *ptr = reinterpret_cast<const quint8*>(data.constData());
+	const quint8 *end = ptr + data.size();
+
+	const quint32 type = qFromBigEndian<quint32>(ptr + 12);
+	if (type != BTSNOOP_TYPE_UART) {
+		qWarning("unsupported btsnoop datalink type %u", type);
+		return false;
+	}
+
+	ptr += BTSNOOP_FILE_HDR_SIZE;
+
+	struct Notification {
+		quint32 key;
+		qint64 timestamp;
+		const quint8 *value;
+	};
+
+	QVector<Notification> notifications;
+	QMap<quint32, int> handleCounts;
+
+	while ((end - ptr) >= BTSNOOP_PKT_HDR_SIZE) {
+
+		const quint32 length = qFromBigEndian<quint32>(ptr + 4);
+		const quint32 flags = qFromBigEndian<quint32>(ptr + 8);
+		const qint64 timestamp = qFromBigEndian<qint64>(ptr + 16);
+
+		const quint8 *pkt = ptr + BTSNOOP_PKT_HDR_SIZE;
+		if (length > quint32(end - pkt)) {
+			qWarning("truncated btsnoop record, ignoring rest of file");
+			break;
+		}
+
+		ptr = pkt + length;
+
+		// H4 type + ACL header + L2CAP header + ATT opcode and handle
+		if (!(flags & 0x1) || (length != (1 + 4 + 4 + 3 + m_packetSize)) ||
+		    (pkt[0] != HCI_ACLDATA_PKT))
+			continue;
+
+		// skip continuation fragments, the packet boundary flag is 0b01
+		const quint16 aclHandle = qFromLittleEndian<quint16>(pkt + 1);
+		if (((aclHandle >> 12) & 0x3) == 0x1)
+			continue;
+
+		if ((qFromLittleEndian<quint16>(pkt + 7) != L2CAP_CID_ATT) ||
+		    (pkt[9] != ATT_OP_HANDLE_NOTIFY))
+			continue;
+
+		const quint16 attHandle = qFromLittleEndian<quint16>(pkt + 10);
+
+		Notification notification;
+		notification.key = (quint32(aclHandle & 0x0fff) << 16) | attHandle;
+		notification.timestamp = timestamp;
+		notification.value = pkt + 12;
+
+		notifications.append(notification);
+		handleCounts[notification.key]++;
+	}
+
+	// pick the busiest handle
+	quint32 audioKey = 0;
+	int audioCount = 0;
+	QMap<quint32, int>::const_iterator it = handleCounts.constBegin();
+	for (; it != handleCounts.constEnd(); ++it) {
+		if (it.value() > audioCount) {
+			audioKey = it.key();
+			audioCount = it.value();
+		}
+	}
+
+	if (audioCount == 0)
+		return true;
+
+	qInfo("using %d notifications on acl handle 0x%03x, att handle 0x%04x",
+	      audioCount, (audioKey >> 16), (audioKey & 0xffff));
+
+	m_packets.reserve(audioCount * m_packetSize);
+	m_timestamps.reserve(audioCount);
+
+	qint64 firstTimestamp = -1;
+	for (const Notification &notification : notifications) {
+		if (notification.key != audioKey)
+			continue;
+
+		if (firstTimestamp < 0)
+			firstTimestamp = notification.timestamp;
+
+		m_packets.append(reinterpret_cast<const char*>(notification.value), m_packetSize);
+		m_timestamps.append(notification.timestamp - firstTimestamp);
+	}
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Loads a simple capture file, which is just 20 byte notification values
+	back to back.  There is no timing info so the notifications are given
+	timestamps on the 12ms frame clock, 5 notifications per frame.
+
+ */
+bool GattAudioReplay::parseCapture(const QByteArray &data)
+{
+	if ((data.size() % m_packetSize) != 0) {
+		qWarning("capture file size (%d bytes) is not a multiple of %d bytes",
+		         data.size(), m_packetSize);
+		return false;
+	}
+
+	const int count = data.size() / m_packetSize;
+
+	m_packets = data;
+	m_timestamps.resize(count);
+
+	for (int i = 0; i < count; i++)
+		m_timestamps[i] = (i / 5) * 12000;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the number of notifications loaded.
+
+ */
+int GattAudioReplay::packetCount() const
+{
+	return m_timestamps.size();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the loaded notifications joined into 100 byte voice frames, i.e.
+	5 notifications per frame.  Any notifications left over at the end that
+	don't make a whole frame are dropped.
+
+ */
+QByteArray GattAudioReplay::frames() const
+{
+	const int frameSize = m_packetSize * 5;
+	return m_packets.left((m_packets.size() / frameSize) * frameSize);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Feeds all the loaded notifications into a new GattAudioPipe with the
+	given output \a encoding.  If \a realTime is \c true the notifications
+	are delivered at the times they were recorded, otherwise as fast as
+	possible.
+
+	If \a dropInterval is greater than zero then every \a dropInterval'th
+	group of 5 notifications is skipped, simulating a voice frame lost over
+	the air, so the pipe's \a concealment mode has gaps to fill.
+
+	The \c processNsecs in the result is just the time spent in the audio
+	pipe, i.e. assembling, decoding and writing the frames, it doesn't
+	include reading the output back.
+
+	Each call uses its own audio pipe, so it's safe to run several replays
+	of the same recording at once from different threads.
+
+ */
+GattAudioReplay::Result GattAudioReplay::run(GattAudioPipe::OutputEncoding encoding,
+                                             bool realTime,
+                                             GattAudioPipe::ConcealmentMode concealment,
+                                             int dropInterval) const
+{
+	Result result;
+	memset(&result, 0x00, sizeof(result));
+
+	GattAudioPipe pipe(encoding);
+	if (!pipe.isValid()) {
+		qWarning("failed to create audio pipe for replay");
+		return result;
+	}
+
+	if ((concealment != GattAudioPipe::NoConcealment) &&
+	    !pipe.setConcealment(concealment, 8)) {
+		qWarning("failed to enable concealment for replay");
+		return result;
+	}
+
+	const FileDescriptor outputFd = pipe.takeOutputReadFd();
+	if (!outputFd.isValid()) {
+		qWarning("failed to get the audio pipe output");
+		return result;
+	}
+
+	Crc32 crc;
+
+	const quint8 *packets = reinterpret_cast<const quint8*>(m_packets.constData());
+	const int count = m_timestamps.size();
+
+	pipe.start();
+
+	const qint64 startNsecs = monotonicNsecs();
+
+	for (int i = 0; i < count; i++) {
+
+		if ((dropInterval > 0) && (((i / 5) % dropInterval) == (dropInterval - 1)))
+			continue;
+
+		if (realTime) {
+			const qint64 wakeNsecs = startNsecs + (m_timestamps[i] * 1000);
+
+			struct timespec ts;
+			ts.tv_sec = wakeNsecs / 1000000000LL;
+			ts.tv_nsec = wakeNsecs % 1000000000LL;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+				continue;
+		}
+
+		const qint64 beforeNsecs = monotonicNsecs();
+		pipe.addNotification(packets + (i * m_packetSize));
+		result.processNsecs += monotonicNsecs() - beforeNsecs;
+
+		result.outputBytes += drainOutput(outputFd.fd(), &crc);
+	}
+
+	pipe.stop();
+	result.outputBytes += drainOutput(outputFd.fd(), &crc);
+
+	result.elapsedNsecs = monotonicNsecs() - startNsecs;
+
+	result.valid = true;
+	result.packets = count;
+	result.frames = pipe.framesReceived();
+	result.outputWrites = pipe.outputWrites();
+	result.checksum = crc.result();
+	result.latency = pipe.latencyStats();
+	result.concealment = pipe.concealmentStats();
+
+	return result;
+}
@@ -0,0 +1,80 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  gatt_audioreplay.h
+//  SkyBluetoothRcu
+//
+
+#ifndef GATT_AUDIOREPLAY_H
+#define GATT_AUDIOREPLAY_H
+
+#include "blercu/bleservices/gatt/gatt_audiopipe.h"
+
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+
+
+class GattAudioReplay
+{
+public:
+	struct Result {
+		bool valid;
+		int packets;
+		int frames;
+		qint64 elapsedNsecs;
+		qint64 processNsecs;
+		int outputWrites;
+		qint64 outputBytes;
+		quint32 checksum;
+		GattAudioPipe::LatencyStats latency;
+		GattAudioPipe::ConcealmentStats concealment;
+	};
+
+public:
+	GattAudioReplay();
+	~GattAudioReplay() = default;
+
+public:
+	bool load(const QString &filePath);
+
+	int packetCount() const;
+	QByteArray frames() const;
+
+	Result run(GattAudioPipe::OutputEncoding encoding, bool realTime,
+	           GattAudioPipe::ConcealmentMode concealment = GattAudioPipe::NoConcealment,
+	           int dropInterval = 0) const;
+
+private:
+	bool parseBtSnoop(const QByteArray &data);
+	bool parseCapture(const QByteArray &data);
+
+private:
+	static const int m_packetSize = 20;
+
+	QByteArray m_packets;
+	QVector<qint64> m_timestamps;
+
+private:
+	Q_DISABLE_COPY(GattAudioReplay)
+};
+
+
+#endif // !defined(GATT_AUDIOREPLAY_H)
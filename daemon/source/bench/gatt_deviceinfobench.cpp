@@ -0,0 +1,355 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  gatt_deviceinfobench.cpp
+//  SkyBluetoothRcu
+//
+
+#include "gatt_deviceinfobench.h"
+#include "blercu/bleservices/gatt/gatt_deviceinfoservice.h"
+
+#include "blercu/blegattservice.h"
+#include "blercu/blegattcharacteristic.h"
+#include "blercu/blegattdescriptor.h"
+#include "utils/promise.h"
+#include "utils/logging.h"
+
+#include <QList>
+#include <QTimer>
+#include <QEventLoop>
+#include <QElapsedTimer>
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class GattDeviceInfoBench
+	\brief Measures how long the GattDeviceInfoService takes to become ready
+	against a mock characteristic backend.
+
+	The mock models the two costs of a GATT read made through bluez; the IPC
+	round trip to the bluez daemon, which reads can overlap, and the ATT
+	request / response over the air, which can't as ATT only allows one
+	outstanding request per connection.  So the gain from pipelining the
+	reads is in hiding the IPC latency and the gaps between requests, it
+	can't beat one ATT round trip per characteristic.
+
+	One of the characteristics can be made to fail to check the service
+	still becomes ready.
+
+ */
+
+
+
+namespace {
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Models the ATT bearer of the mock device, returns how long a read issued
+	now will take to complete, queuing it behind any reads already on the
+	bearer.
+
+ */
+class MockAttBearer
+{
+public:
+	MockAttBearer(int attMsecs, int ipcMsecs)
+		: m_attMsecs(attMsecs)
+		, m_ipcMsecs(ipcMsecs)
+		, m_attFreeAt(0)
+		, m_outstanding(0)
+		, m_maxOutstanding(0)
+		, m_reads(0)
+	{
+		m_clock.start();
+	}
+
+	qint64 queueRead()
+	{
+		const qint64 now = m_clock.elapsed();
+		const qint64 attStart = qMax(now + m_ipcMsecs, m_attFreeAt);
+
+		m_attFreeAt = attStart + m_attMsecs;
+
+		m_reads++;
+		m_outstanding++;
+		m_maxOutstanding = qMax(m_maxOutstanding, m_outstanding);
+
+		return (m_attFreeAt + m_ipcMsecs) - now;
+	}
+
+	void readCompleted()
+	{
+		m_outstanding--;
+	}
+
+	int reads() const               { return m_reads;           }
+	int maxOutstanding() const      { return m_maxOutstanding;  }
+
+private:
+	const int m_attMsecs;
+	const int m_ipcMsecs;
+	QElapsedTimer m_clock;
+	qint64 m_attFreeAt;
+	int m_outstanding;
+	int m_maxOutstanding;
+	int m_reads;
+};
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Mock characteristic that returns a fixed value (or an error) after the
+	delay given by the bearer.
+
+ */
+class MockGattCharacteristic : public BleGattCharacteristic
+{
+public:
+	MockGattCharacteristic(MockAttBearer *bearer, const BleUuid &uuid,
+	                       const QByteArray &value, bool fail)
+		: m_bearer(bearer)
+		, m_uuid(uuid)
+		, m_value(value)
+		, m_fail(fail)
+	{ }
+
+	bool isValid() const override                       { return true;                  }
+	BleUuid uuid() const override                       { return m_uuid;                }
+	int instanceId() const override                     { return 0;                     }
+	Flags flags() const override                        { return Read;                  }
+
+	void setCacheable(bool cacheable) override          { Q_UNUSED(cacheable);          }
+	bool cacheable() const override                     { return false;                 }
+	void invalidateCache() override                     { }
+	int cacheHits() const override                      { return 0;                     }
+	int cacheMisses() const override                    { return 0;                     }
+
+	QSharedPointer<BleGattService> service() const override
+	{
+		return QSharedPointer<BleGattService>();
+	}
+
+	QList< QSharedPointer<BleGattDescriptor> > descriptors() const override
+	{
+		return QList< QSharedPointer<BleGattDescriptor> >();
+	}
+
+	QSharedPointer<BleGattDescriptor> descriptor(BleUuid descUuid) const override
+	{
+		Q_UNUSED(descUuid);
+		return QSharedPointer<BleGattDescriptor>();
+	}
+
+	Future<QByteArray> readValue() override
+	{
+		QSharedPointer< Promise<QByteArray> > promise =
+			QSharedPointer< Promise<QByteArray> >::create();
+
+		const bool fail = m_fail;
+		const QByteArray value = m_value;
+		MockAttBearer *bearer = m_bearer;
+
+		QTimer::singleShot(int(m_bearer->queueRead()), this,
+			[promise, fail, value, bearer]() {
+				bearer->readCompleted();
+				if (fail)
+					promise->setError(QStringLiteral("com.sky.Error.Failed"),
+					                  QStringLiteral("Mock read failure"));
+				else
+					promise->setFinished(value);
+			});
+
+		return promise->future();
+	}
+
+	Future<> writeValue(const QByteArray &value) override
+	{
+		Q_UNUSED(value);
+		return Future<>::createErrored(QStringLiteral("com.sky.Error.NotSupported"));
+	}
+
+	Future<> writeValueWithoutResponse(const QByteArray &value) override
+	{
+		Q_UNUSED(value);
+		return Future<>::createErrored(QStringLiteral("com.sky.Error.NotSupported"));
+	}
+
+	Future<> enableNotifications(bool enable) override
+	{
+		Q_UNUSED(enable);
+		return Future<>::createErrored(QStringLiteral("com.sky.Error.NotSupported"));
+	}
+
+	FileDescriptor takeNotificationPipe() override
+	{
+		return FileDescriptor();
+	}
+
+	void setNotificationHandler(BleGattNotificationHandler *handler) override
+	{
+		Q_UNUSED(handler);
+	}
+
+	Future<> enableWritePipe(bool enable) override
+	{
+		Q_UNUSED(enable);
+		return Future<>::createErrored(QStringLiteral("com.sky.Error.NotSupported"));
+	}
+
+	int writePipeMtu() const override                   { return -1;                    }
+
+	int timeout() const override                        { return -1;                    }
+	void setTimeout(int timeout) override               { Q_UNUSED(timeout);            }
+
+private:
+	MockAttBearer *m_bearer;
+	const BleUuid m_uuid;
+	const QByteArray m_value;
+	const bool m_fail;
+};
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Mock device information service holding all the device info
+	characteristics.
+
+ */
+class MockGattService : public BleGattService
+{
+public:
+	MockGattService(MockAttBearer *bearer, const BleUuid &failingUuid)
+	{
+		const struct {
+			BleUuid::CharacteristicType uuid;
+			QByteArray value;
+		} characteristics[] = {
+			{ BleUuid::ManufacturerNameString,  QByteArrayLiteral("Mock")           },
+			{ BleUuid::ModelNumberString,       QByteArrayLiteral("MOCK01")         },
+			{ BleUuid::SerialNumberString,      QByteArrayLiteral("0123456789")     },
+			{ BleUuid::HardwareRevisionString,  QByteArrayLiteral("1.0")            },
+			{ BleUuid::FirmwareRevisionString,  QByteArrayLiteral("1.2.3")          },
+			{ BleUuid::SoftwareRevisionString,  QByteArrayLiteral("4.5.6")          },
+			{ BleUuid::SystemID,                QByteArray(8, '\x01')               },
+			{ BleUuid::PnPID,                   QByteArray(7, '\x02')               },
+		};
+
+		for (unsigned int i = 0; i < (sizeof(characteristics) / sizeof(characteristics[0])); i++) {
+			const BleUuid uuid(characteristics[i].uuid);
+			m_characteristics.append(
+				QSharedPointer<MockGattCharacteristic>::create(bearer, uuid,
+				                                               characteristics[i].value,
+				                                               (uuid == failingUuid)));
+		}
+	}
+
+	bool isValid() const override                       { return true;                  }
+	BleUuid uuid() const override                       { return BleUuid::DeviceInformation; }
+	int instanceId() const override                     { return 0;                     }
+	bool primary() const override                       { return true;                  }
+
+	QList< QSharedPointer<BleGattCharacteristic> > characteristics() const override
+	{
+		return m_characteristics;
+	}
+
+	QList< QSharedPointer<BleGattCharacteristic> > characteristics(BleUuid charUuid) const override
+	{
+		QList< QSharedPointer<BleGattCharacteristic> > matches;
+		for (const QSharedPointer<BleGattCharacteristic> &characteristic : m_characteristics) {
+			if (characteristic->uuid() == charUuid)
+				matches.append(characteristic);
+		}
+		return matches;
+	}
+
+	QSharedPointer<BleGattCharacteristic> characteristic(BleUuid charUuid) const override
+	{
+		for (const QSharedPointer<BleGattCharacteristic> &characteristic : m_characteristics) {
+			if (characteristic->uuid() == charUuid)
+				return characteristic;
+		}
+		return QSharedPointer<BleGattCharacteristic>();
+	}
+
+private:
+	QList< QSharedPointer<BleGattCharacteristic> > m_characteristics;
+};
+
+} // namespace
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	Creates a bench where every ATT read takes \a attMsecs over the air and
+	each request and reply takes \a ipcMsecs to get through bluez.
+
+ */
+GattDeviceInfoBench::GattDeviceInfoBench(int attMsecs, int ipcMsecs)
+	: m_attMsecs(qMax(attMsecs, 0))
+	, m_ipcMsecs(qMax(ipcMsecs, 0))
+{
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Starts a GattDeviceInfoService with the given \a readDepth on a new mock
+	service and waits for it to become ready, giving up after 10 seconds.  If
+	\a failingUuid is not null then reads of that characteristic fail.
+
+ */
+GattDeviceInfoBench::Result GattDeviceInfoBench::run(int readDepth,
+                                                     const BleUuid &failingUuid) const
+{
+	MockAttBearer bearer(m_attMsecs, m_ipcMsecs);
+
+	const QSharedPointer<MockGattService> gattService =
+		QSharedPointer<MockGattService>::create(&bearer, failingUuid);
+
+	GattDeviceInfoService deviceInfo(readDepth);
+
+	QEventLoop loop;
+	QObject::connect(&deviceInfo, &GattDeviceInfoService::ready,
+	                 &loop, &QEventLoop::quit);
+	QTimer::singleShot(10000, &loop, &QEventLoop::quit);
+
+	QElapsedTimer timer;
+	timer.start();
+
+	deviceInfo.start(gattService);
+	if (!deviceInfo.isReady())
+		loop.exec();
+
+	Result result;
+	result.ready = deviceInfo.isReady();
+	result.elapsedMsecs = timer.elapsed();
+	result.reads = bearer.reads();
+	result.maxOutstanding = bearer.maxOutstanding();
+
+	deviceInfo.stop();
+
+	return result;
+}
@@ -0,0 +1,59 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  gatt_deviceinfobench.h
+//  SkyBluetoothRcu
+//
+
+#ifndef GATT_DEVICEINFOBENCH_H
+#define GATT_DEVICEINFOBENCH_H
+
+#include "utils/bleuuid.h"
+
+#include <QtGlobal>
+
+
+class GattDeviceInfoBench
+{
+public:
+	struct Result {
+		bool ready;
+		qint64 elapsedMsecs;
+		int reads;
+		int maxOutstanding;
+	};
+
+public:
+	GattDeviceInfoBench(int attMsecs, int ipcMsecs);
+	~GattDeviceInfoBench() = default;
+
+public:
+	Result run(int readDepth, const BleUuid &failingUuid = BleUuid()) const;
+
+private:
+	const int m_attMsecs;
+	const int m_ipcMsecs;
+
+private:
+	Q_DISABLE_COPY(GattDeviceInfoBench)
+};
+
+
+#endif // !defined(GATT_DEVICEINFOBENCH_H)
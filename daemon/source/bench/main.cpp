@@ -0,0 +1,1569 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  main.cpp
+//  SkyBluetoothRcu
+//
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QtGlobal>
+#include <QSharedPointer>
+#include <QDebug>
+#include <QVector>
+#include <QList>
+#include <QMap>
+#include <QSet>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QLoggingCategory>
+#include <QSemaphore>
+#include <QThread>
+#include <QTimer>
+
+#include "gatt_audioreplay.h"
+#include "gatt_deviceinfobench.h"
+
+#include "utils/logging.h"
+#include "utils/crc32.h"
+#include "utils/adpcmcodec.h"
+#include "utils/statemachine.h"
+#include "utils/stategraph.h"
+#include "utils/bleaddress.h"
+#include "utils/bleuuid.h"
+
+#include "blercu/bluez/bluezobjectindex.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Replays the voice notifications in \a filePath through the audio pipe in
+	both PCM16 and ADPCM modes and prints the throughput, syscall and checksum
+	stats.  This is for measuring the voice path without an RCU, the real-time
+	factor gives a rough idea of how many voice sessions the box could handle.
+
+ */
+static int runVoiceReplay(const QString &filePath, bool realTime)
+{
+	GattAudioReplay replay;
+	if (!replay.load(filePath))
+		return EXIT_FAILURE;
+
+	printf("voice replay of %d notifications from '%s' (%s)\n",
+	       replay.packetCount(), qPrintable(filePath),
+	       realTime ? "real-time" : "as fast as possible");
+
+	const struct {
+		GattAudioPipe::OutputEncoding encoding;
+		const char *name;
+	} modes[2] = {
+		{ GattAudioPipe::PCM16,  "PCM16" },
+		{ GattAudioPipe::ADPCM,  "ADPCM" },
+	};
+
+	for (unsigned int i = 0; i < (sizeof(modes) / sizeof(modes[0])); i++) {
+
+		const GattAudioReplay::Result result = replay.run(modes[i].encoding, realTime);
+		if (!result.valid || (result.frames == 0)) {
+			printf("  %s: failed\n", modes[i].name);
+			return EXIT_FAILURE;
+		}
+
+		const double elapsedSecs = double(result.elapsedNsecs) / 1e9;
+		const double framesPerSec = double(result.frames) / elapsedSecs;
+
+		printf("  %s: %d frames in %.3fs, %.0f frames/s (%.1fx real-time)\n",
+		       modes[i].name, result.frames, elapsedSecs, framesPerSec,
+		       (framesPerSec * 0.012));
+		printf("  %s: %lld ns/frame in the pipe, %d writes (%.0f writes/s)\n",
+		       modes[i].name, (result.processNsecs / result.frames),
+		       result.outputWrites, (double(result.outputWrites) / elapsedSecs));
+		printf("  %s: %lld bytes output, crc32 0x%08x\n", modes[i].name,
+		       result.outputBytes, result.checksum);
+
+		if (realTime)
+			printf("  %s: notify-to-pipe latency avg %lldus, max %lldus\n",
+			       modes[i].name, result.latency.averageUsecs,
+			       result.latency.maxUsecs);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Thread used by the concurrent voice replay.  Waits on \a startGate and
+	then replays \a replay through its own audio pipe with the given
+	\a encoding, dropping one frame in every \a dropInterval and concealing
+	the gaps with \a concealment.
+
+ */
+class VoiceReplayThread : public QThread
+{
+public:
+	VoiceReplayThread(const GattAudioReplay *replay,
+	                  GattAudioPipe::OutputEncoding encoding, bool realTime,
+	                  GattAudioPipe::ConcealmentMode concealment,
+	                  int dropInterval, QSemaphore *startGate)
+		: m_replay(replay)
+		, m_encoding(encoding)
+		, m_realTime(realTime)
+		, m_concealment(concealment)
+		, m_dropInterval(dropInterval)
+		, m_startGate(startGate)
+	{
+		memset(&m_result, 0x00, sizeof(m_result));
+	}
+
+	const GattAudioReplay::Result &result() const
+	{
+		return m_result;
+	}
+
+protected:
+	void run() override
+	{
+		m_startGate->acquire();
+
+		m_result = m_replay->run(m_encoding, m_realTime, m_concealment,
+		                         m_dropInterval);
+	}
+
+private:
+	const GattAudioReplay * const m_replay;
+	const GattAudioPipe::OutputEncoding m_encoding;
+	const bool m_realTime;
+	const GattAudioPipe::ConcealmentMode m_concealment;
+	const int m_dropInterval;
+	QSemaphore * const m_startGate;
+	GattAudioReplay::Result m_result;
+};
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Replays the voice notifications in \a filePath through \a streams audio
+	pipes at once, each on its own thread, to check the voice path keeps up
+	with several RCUs streaming at the same time.  One frame in every 25 is
+	dropped and the gaps filled with the fade concealment, which is the most
+	expensive mode, so the concealment cost is included.
+
+	The real-time factor printed is for the slowest of the streams, anything
+	above 1.0x means every stream kept up.
+
+ */
+static int runConcurrentVoiceReplay(const QString &filePath, bool realTime,
+                                    int streams)
+{
+	const int dropInterval = 25;
+
+	GattAudioReplay replay;
+	if (!replay.load(filePath))
+		return EXIT_FAILURE;
+
+	printf("voice replay of %d notifications from '%s' through %d pipes at"
+	       " once (%s), dropping 1 in %d frames with fade concealment\n",
+	       replay.packetCount(), qPrintable(filePath), streams,
+	       realTime ? "real-time" : "as fast as possible", dropInterval);
+
+	const struct {
+		GattAudioPipe::OutputEncoding encoding;
+		const char *name;
+	} modes[2] = {
+		{ GattAudioPipe::PCM16,  "PCM16" },
+		{ GattAudioPipe::ADPCM,  "ADPCM" },
+	};
+
+	for (unsigned int i = 0; i < (sizeof(modes) / sizeof(modes[0])); i++) {
+
+		QSemaphore startGate;
+		QVector<VoiceReplayThread*> threads;
+
+		for (int j = 0; j < streams; j++) {
+			VoiceReplayThread *thread =
+				new VoiceReplayThread(&replay, modes[i].encoding, realTime,
+				                      GattAudioPipe::ConcealWithFade,
+				                      dropInterval, &startGate);
+			thread->start();
+			threads.append(thread);
+		}
+
+		QElapsedTimer timer;
+		timer.start();
+
+		startGate.release(streams);
+		for (VoiceReplayThread *thread : threads)
+			thread->wait();
+
+		const qint64 wallNsecs = timer.nsecsElapsed();
+
+		bool failed = false;
+		int totalFrames = 0;
+		double slowestFactor = -1.0;
+		qint64 maxLatencyUsecs = 0;
+		quint32 concealed = 0;
+		quint32 discontinuities = 0;
+
+		for (VoiceReplayThread *thread : threads) {
+			const GattAudioReplay::Result &result = thread->result();
+			if (!result.valid || (result.frames == 0)) {
+				failed = true;
+				continue;
+			}
+
+			// real-time factor of the stream including the concealed frames,
+			// as they are output audio just like the received ones
+			const int frames = result.frames + result.concealment.concealedFrames;
+			const double framesPerSec = double(frames) / (double(result.elapsedNsecs) / 1e9);
+			const double factor = framesPerSec * 0.012;
+			if ((slowestFactor < 0.0) || (factor < slowestFactor))
+				slowestFactor = factor;
+
+			totalFrames += frames;
+			maxLatencyUsecs = qMax(maxLatencyUsecs, result.latency.maxUsecs);
+			concealed += result.concealment.concealedFrames;
+			discontinuities += result.concealment.discontinuities;
+		}
+
+		qDeleteAll(threads);
+
+		if (failed) {
+			printf("  %s: failed\n", modes[i].name);
+			return EXIT_FAILURE;
+		}
+
+		const double wallSecs = double(wallNsecs) / 1e9;
+
+		printf("  %s: %d frames in %.3fs across %d streams, slowest stream"
+		       " %.1fx real-time\n", modes[i].name, totalFrames, wallSecs,
+		       streams, slowestFactor);
+		printf("  %s: %u frames concealed, %u discontinuities\n",
+		       modes[i].name, concealed, discontinuities);
+
+		if (realTime)
+			printf("  %s: notify-to-pipe latency max %lldus\n",
+			       modes[i].name, maxLatencyUsecs);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Decodes the voice frames in the recording at \a filePath with both the
+	reference and table ADPCM engines and prints the time per frame.  Each
+	engine decodes the same frames the same way the audio pipe does, i.e.
+	using the step index and previous value from each frame's header, and
+	the PCM output of the two is compared.
+
+ */
+static int runAdpcmBenchmark(const QString &filePath)
+{
+	GattAudioReplay replay;
+	if (!replay.load(filePath))
+		return EXIT_FAILURE;
+
+	const QByteArray frameData = replay.frames();
+	const int frameCount = frameData.size() / 100;
+	if (frameCount == 0) {
+		printf("no whole voice frames in '%s'\n", qPrintable(filePath));
+		return EXIT_FAILURE;
+	}
+
+	// decode the recording enough times to get a stable figure
+	const int iterations = qMax(1, 200000 / frameCount);
+
+	printf("adpcm benchmark decoding %d frames from '%s' %d times\n",
+	       frameCount, qPrintable(filePath), iterations);
+
+	const struct {
+		ADPCMCodec::Engine engine;
+		const char *name;
+	} engines[2] = {
+		{ ADPCMCodec::ReferenceEngine,  "reference" },
+		{ ADPCMCodec::TableEngine,      "table" },
+	};
+
+	const quint8 *frames = reinterpret_cast<const quint8*>(frameData.constData());
+
+	QVector<qint16> expected;
+
+	for (unsigned int i = 0; i < (sizeof(engines) / sizeof(engines[0])); i++) {
+
+		const ADPCMCodec codec(engines[i].engine);
+		QVector<qint16> output(frameCount * 192);
+
+		QElapsedTimer timer;
+		timer.start();
+
+		for (int n = 0; n < iterations; n++) {
+			for (int j = 0; j < frameCount; j++) {
+				const quint8 *frame = frames + (j * 100);
+
+				// the reference engine doesn't range check the step index in
+				// the header, so do it here to keep it in bounds on captures
+				// that don't start on a frame boundary
+				const int stepIndex = qMin<int>(frame[1], 88);
+				const qint16 prevValue = (qint16(frame[2]) << 0) | (qint16(frame[3]) << 8);
+
+				codec.decodeFrame(stepIndex, prevValue, frame + 4, (96 * 2),
+				                  output.data() + (j * 192));
+			}
+		}
+
+		const qint64 nsecs = qMax<qint64>(1, timer.nsecsElapsed());
+		const qint64 decoded = qint64(iterations) * frameCount;
+
+		printf("  %-9s %6lldns per frame, %.1fx real-time\n", engines[i].name,
+		       (nsecs / decoded), ((double(decoded) * 0.012 * 1e9) / double(nsecs)));
+
+		if (i == 0) {
+			expected = output;
+		} else if (output != expected) {
+			printf("  %s: output doesn't match the reference engine\n", engines[i].name);
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("  output of all engines matches\n");
+
+	return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Builds a synthetic bluez object list of \a devices devices, each with a
+	typical RCU GATT tree, then times building every device's object list by
+	scanning the full list (as the profile did before the index) against
+	looking it up in a BluezObjectIndex.  Also times applying the incremental
+	added / removed updates for a device to the index.
+
+ */
+static int runObjectIndexBenchmark(int devices)
+{
+	const QString adapterPath = QStringLiteral("/org/bluez/hci0");
+
+	// 5 services with 4 characteristics each, every characteristic has 2
+	// descriptors, which is roughly what an RCU exposes
+	const int services = 5;
+	const int characteristics = 4;
+	const int descriptors = 2;
+
+	DBusManagedObjectList objects;
+
+	QVariantMap adapterProps;
+	adapterProps[QStringLiteral("Address")] = QStringLiteral("00:11:22:33:44:55");
+	adapterProps[QStringLiteral("Modalias")] = QStringLiteral("usb:v1D6Bp0246d0530");
+	objects[QDBusObjectPath(adapterPath)][QStringLiteral("org.bluez.Adapter1")] = adapterProps;
+
+	QVector<QDBusObjectPath> devicePaths;
+	devicePaths.reserve(devices);
+
+	for (int d = 0; d < devices; d++) {
+
+		const BleAddress address(quint64(0x1c0000000000ULL) | quint64(d));
+		const QString devicePath = adapterPath + QStringLiteral("/dev_") +
+		                           address.toString().replace(':', '_');
+
+		devicePaths.append(QDBusObjectPath(devicePath));
+
+		QVariantMap deviceProps;
+		deviceProps[QStringLiteral("Address")] = address.toString();
+		deviceProps[QStringLiteral("Adapter")] = QVariant::fromValue(QDBusObjectPath(adapterPath));
+		objects[QDBusObjectPath(devicePath)][QStringLiteral("org.bluez.Device1")] = deviceProps;
+
+		for (int s = 0; s < services; s++) {
+
+			const QString servicePath = devicePath + QStringLiteral("/service%1").arg((s * 16), 4, 16, QChar('0'));
+
+			QVariantMap serviceProps;
+			serviceProps[QStringLiteral("UUID")] = QStringLiteral("0000180a-0000-1000-8000-00805f9b34fb");
+			serviceProps[QStringLiteral("Primary")] = true;
+			serviceProps[QStringLiteral("Device")] = QVariant::fromValue(QDBusObjectPath(devicePath));
+			objects[QDBusObjectPath(servicePath)][QStringLiteral("org.bluez.GattService1")] = serviceProps;
+
+			for (int c = 0; c < characteristics; c++) {
+
+				const QString charPath = servicePath + QStringLiteral("/char%1").arg(((s * 16) + (c * 3) + 1), 4, 16, QChar('0'));
+
+				QVariantMap charProps;
+				charProps[QStringLiteral("UUID")] = QStringLiteral("00002a29-0000-1000-8000-00805f9b34fb");
+				charProps[QStringLiteral("Service")] = QVariant::fromValue(QDBusObjectPath(servicePath));
+				charProps[QStringLiteral("Flags")] = QStringList({ QStringLiteral("read") });
+				objects[QDBusObjectPath(charPath)][QStringLiteral("org.bluez.GattCharacteristic1")] = charProps;
+
+				for (int n = 0; n < descriptors; n++) {
+
+					const QString descPath = charPath + QStringLiteral("/desc%1").arg(((s * 16) + (c * 3) + n + 2), 4, 16, QChar('0'));
+
+					QVariantMap descProps;
+					descProps[QStringLiteral("UUID")] = QStringLiteral("00002902-0000-1000-8000-00805f9b34fb");
+					descProps[QStringLiteral("Characteristic")] = QVariant::fromValue(QDBusObjectPath(charPath));
+					objects[QDBusObjectPath(descPath)][QStringLiteral("org.bluez.GattDescriptor1")] = descProps;
+				}
+			}
+		}
+	}
+
+	printf("object index benchmark with %d devices, %d objects\n",
+	       devices, objects.size());
+
+	QElapsedTimer timer;
+	int found;
+
+	// the old way; a full scan of all the objects for every device
+	timer.start();
+	found = 0;
+	for (const QDBusObjectPath &devicePath : devicePaths) {
+
+		const QString prefix = devicePath.path();
+
+		DBusManagedObjectList filtered;
+		DBusManagedObjectList::const_iterator object = objects.begin();
+		for (; object != objects.end(); ++object) {
+			if (object.key().path().startsWith(prefix))
+				filtered.insert(object.key(), object.value());
+		}
+
+		found += filtered.size();
+	}
+	const qint64 scanNsecs = timer.nsecsElapsed();
+
+	printf("  full scan: %d objects found in %.3fms, %lldns per device\n",
+	       found, double(scanNsecs) / 1e6, (scanNsecs / devices));
+
+	// populate the index once and then look up each device
+	BluezObjectIndex index;
+
+	timer.start();
+	index.populate(objects);
+	const qint64 populateNsecs = timer.nsecsElapsed();
+
+	timer.start();
+	found = 0;
+	for (const QDBusObjectPath &devicePath : devicePaths)
+		found += index.objectsUnder(devicePath).size();
+	const qint64 lookupNsecs = timer.nsecsElapsed();
+
+	printf("  index: populated in %.3fms\n", double(populateNsecs) / 1e6);
+	printf("  index: %d objects found in %.3fms, %lldns per device\n",
+	       found, double(lookupNsecs) / 1e6, (lookupNsecs / devices));
+
+	// remove and re-add every object of the last device, as happens when an
+	// RCU is unpaired and paired again
+	const DBusManagedObjectList deviceObjects = index.objectsUnder(devicePaths.last());
+
+	timer.start();
+	DBusManagedObjectList::const_iterator object = deviceObjects.begin();
+	for (; object != deviceObjects.end(); ++object)
+		index.onInterfacesRemoved(object.key(), object.value().keys());
+	for (object = deviceObjects.begin(); object != deviceObjects.end(); ++object)
+		index.onInterfacesAdded(object.key(), object.value());
+	const qint64 updateNsecs = timer.nsecsElapsed();
+
+	printf("  index: %d objects removed and re-added in %lldns\n",
+	       deviceObjects.size(), updateNsecs);
+
+	if (index.size() != objects.size()) {
+		printf("  index: size mismatch after updates (%d vs %d)\n",
+		       index.size(), objects.size());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Times how long the device info service takes to read all its
+	characteristics from a mock RCU where each ATT read takes \a attMsecs,
+	for a few different read pipeline depths.  Also checks the service still
+	becomes ready when one of the reads fails.
+
+ */
+static int runDeviceInfoBenchmark(int attMsecs)
+{
+	// rough round trip through the bluez daemon on a set-top box
+	const int ipcMsecs = 2;
+
+	printf("device info benchmark with %dms per ATT read, %dms IPC latency\n",
+	       attMsecs, ipcMsecs);
+
+	const GattDeviceInfoBench bench(attMsecs, ipcMsecs);
+
+	const int depths[] = { 1, 2, 4, 0 };
+	for (unsigned int i = 0; i < (sizeof(depths) / sizeof(depths[0])); i++) {
+
+		const GattDeviceInfoBench::Result result = bench.run(depths[i]);
+		if (!result.ready) {
+			printf("  depth %d: failed to become ready\n", depths[i]);
+			return EXIT_FAILURE;
+		}
+
+		printf("  depth %d: ready in %lldms, %d reads, max %d in flight\n",
+		       depths[i], result.elapsedMsecs, result.reads, result.maxOutstanding);
+	}
+
+	const GattDeviceInfoBench::Result result =
+		bench.run(0, BleUuid(BleUuid::SerialNumberString));
+	if (!result.ready) {
+		printf("  with a failed read: failed to become ready\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("  with a failed read: ready in %lldms\n", result.elapsedMsecs);
+
+	return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Times each of the CRC32 engines supported on this CPU hashing \a mbytes
+	megabytes of random data in a range of buffer sizes, from the size of a
+	f/w DATA packet up to a whole f/w image.  Also checks all the engines
+	produce the same result.
+
+ */
+static int runCrc32Benchmark(int mbytes)
+{
+	const struct {
+		Crc32::Engine engine;
+		const char *name;
+	} engines[3] = {
+		{ Crc32::ByteTable,  "byte table" },
+		{ Crc32::SliceBy8,   "slice-by-8" },
+		{ Crc32::Hardware,   "hardware" },
+	};
+
+	const int sizes[] = { 18, 64, 256, 1024, 4096, 65536, 1024 * 1024 };
+
+	// fill a buffer with random data, offset by one byte so the engines have
+	// to cope with an unaligned start
+	QByteArray buffer(sizes[(sizeof(sizes) / sizeof(sizes[0])) - 1] + 1, Qt::Uninitialized);
+	for (int i = 0; i < buffer.size(); i++)
+		buffer[i] = char(qrand() & 0xff);
+
+	const quint8 *data = reinterpret_cast<const quint8*>(buffer.constData()) + 1;
+	const qint64 totalBytes = qint64(mbytes) * 1024 * 1024;
+
+	printf("crc32 benchmark hashing %dMB per buffer size\n", mbytes);
+
+	for (unsigned int i = 0; i < (sizeof(sizes) / sizeof(sizes[0])); i++) {
+
+		const int size = sizes[i];
+		const qint64 iterations = qMax<qint64>(1, totalBytes / size);
+
+		quint32 expected = 0;
+
+		for (unsigned int j = 0; j < (sizeof(engines) / sizeof(engines[0])); j++) {
+
+			if (!Crc32::isSupported(engines[j].engine)) {
+				printf("  %7d bytes: %-10s not supported\n", size, engines[j].name);
+				continue;
+			}
+
+			QElapsedTimer timer;
+			timer.start();
+
+			Crc32 crc(0, engines[j].engine);
+			for (qint64 n = 0; n < iterations; n++)
+				crc.addData(data, size);
+
+			const qint64 nsecs = qMax<qint64>(1, timer.nsecsElapsed());
+
+			printf("  %7d bytes: %-10s %8.1f MB/s, %6lldns per buffer, crc32 0x%08x\n",
+			       size, engines[j].name,
+			       (double(iterations * size) * 1e9) / (double(nsecs) * 1024 * 1024),
+			       (nsecs / iterations), crc.result());
+
+			if (j == 0) {
+				expected = crc.result();
+			} else if (crc.result() != expected) {
+				printf("  %7d bytes: %s result mismatch\n", size, engines[j].name);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	The state graph lookups as StateMachine did them before the graph was
+	frozen into dense tables; each state in a QMap with a list of its
+	transitions, the parent chain walked on every event and the lists of
+	states exited and entered built on every transition.  Only used as the
+	baseline in the state machine benchmark.
+
+ */
+class MapWalkGraph
+{
+public:
+	void addState(int parentState, int state, int initialState = -1)
+	{
+		State &entry = m_states[state];
+		entry.parentState = parentState;
+		entry.initialState = initialState;
+	}
+
+	void addTransition(int fromState, QEvent::Type eventType, int toState)
+	{
+		m_states[fromState].transitions.append({ toState, eventType });
+	}
+
+	int eventTarget(int state, QEvent::Type eventType) const
+	{
+		do {
+			QMap<int, State>::const_iterator it = m_states.find(state);
+			if (Q_UNLIKELY(it == m_states.end()))
+				return -1;
+
+			for (const Transition &transition : it->transitions) {
+				if (transition.eventType == eventType)
+					return transition.targetState;
+			}
+
+			state = it->parentState;
+
+		} while (state != -1);
+
+		return -1;
+	}
+
+	int initialState(int state) const
+	{
+		return m_states[state].initialState;
+	}
+
+	QList<int> stateTreeFor(int state, bool bottomUp) const
+	{
+		QList<int> tree;
+
+		do {
+			if (bottomUp)
+				tree.append(state);
+			else
+				tree.prepend(state);
+
+			state = m_states[state].parentState;
+
+		} while (state >= 0);
+
+		return tree;
+	}
+
+	bool inState(int state, const QSet<int> &states) const
+	{
+		do {
+			if (states.contains(state))
+				return true;
+
+			QMap<int, State>::const_iterator it = m_states.find(state);
+			if (Q_UNLIKELY(it == m_states.end()))
+				return false;
+
+			state = it->parentState;
+
+		} while (state != -1);
+
+		return false;
+	}
+
+private:
+	struct Transition {
+		int targetState;
+		QEvent::Type eventType;
+	};
+
+	struct State {
+		int parentState;
+		int initialState;
+		QList<Transition> transitions;
+	};
+
+	QMap<int, State> m_states;
+};
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Times posting \a events events into a StateMachine with a graph shaped
+	like the ones the GATT services use, i.e. a couple of levels of super
+	states with the disconnect transition on the outer super state.  The
+	events alternate between ones that move the state and ones that have no
+	transition from the current state, and the time for inState() checks
+	against a set of super states is measured as well.
+
+	For a before and after comparison the same events are then dispatched
+	through a MapWalkGraph copy of the graph, which looks them up the way
+	StateMachine did before the graphs were frozen into tables, and through
+	the table lookups of the machine's StateGraph.
+
+ */
+static int runStateMachineBenchmark(int events)
+{
+	enum {
+		IdleState,
+		ConnectedSuperState,
+			SetupSuperState,
+				ReadingState,
+				WritingState,
+			RunningState
+	};
+
+	const QEvent::Type ConnectEvent = QEvent::Type(QEvent::User + 1);
+	const QEvent::Type ReadDoneEvent = QEvent::Type(QEvent::User + 2);
+	const QEvent::Type WriteDoneEvent = QEvent::Type(QEvent::User + 3);
+	const QEvent::Type DisconnectEvent = QEvent::Type(QEvent::User + 4);
+	const QEvent::Type UnusedEvent = QEvent::Type(QEvent::User + 5);
+
+	// don't want the transitions going to the log
+	QLoggingCategory category("benchmark.statemachine");
+	category.setEnabled(QtDebugMsg, false);
+
+	StateMachine machine;
+	machine.setTransistionLogLevel(QtDebugMsg, &category);
+
+	machine.addState(IdleState, QStringLiteral("Idle"));
+	machine.addState(ConnectedSuperState, QStringLiteral("ConnectedSuperState"));
+	machine.addState(ConnectedSuperState, SetupSuperState, QStringLiteral("SetupSuperState"));
+	machine.addState(SetupSuperState, ReadingState, QStringLiteral("Reading"));
+	machine.addState(SetupSuperState, WritingState, QStringLiteral("Writing"));
+	machine.addState(ConnectedSuperState, RunningState, QStringLiteral("Running"));
+
+	machine.setInitialState(SetupSuperState, ReadingState);
+
+	machine.addTransition(IdleState, ConnectEvent, SetupSuperState);
+	machine.addTransition(ReadingState, ReadDoneEvent, WritingState);
+	machine.addTransition(WritingState, WriteDoneEvent, RunningState);
+	machine.addTransition(ConnectedSuperState, DisconnectEvent, IdleState);
+
+	machine.setInitialState(IdleState);
+
+	int transitions = 0;
+	QObject::connect(&machine, &StateMachine::transition,
+	                 [&transitions]() { transitions++; });
+
+	if (!machine.start()) {
+		printf("failed to start state machine\n");
+		return EXIT_FAILURE;
+	}
+
+	// each cycle is 4 transitions interleaved with events that are ignored,
+	// the ignored ones are posted in the deepest states to cover the worst
+	// case of checking all the parent states
+	const QEvent::Type cycle[] = {
+		ConnectEvent, UnusedEvent, ReadDoneEvent, UnusedEvent,
+		WriteDoneEvent, UnusedEvent, DisconnectEvent, UnusedEvent
+	};
+	const int cycleLength = sizeof(cycle) / sizeof(cycle[0]);
+
+	// round up to whole cycles so the machine ends up back in idle
+	events = ((events + cycleLength - 1) / cycleLength) * cycleLength;
+
+	printf("state machine benchmark posting %d events\n", events);
+
+	QElapsedTimer timer;
+	timer.start();
+
+	for (int i = 0; i < events; i++)
+		machine.postEvent(cycle[i % cycleLength]);
+
+	const qint64 postNsecs = qMax<qint64>(1, timer.nsecsElapsed());
+
+	printf("  postEvent: %d transitions in %.3fms, %lldns per event, %.0f events/s\n",
+	       transitions, double(postNsecs) / 1e6, (postNsecs / events),
+	       (double(events) * 1e9) / double(postNsecs));
+
+	// now just the ignored events from the deepest state
+	machine.postEvent(ConnectEvent);
+
+	timer.start();
+
+	for (int i = 0; i < events; i++)
+		machine.postEvent(UnusedEvent);
+
+	const qint64 ignoredNsecs = qMax<qint64>(1, timer.nsecsElapsed());
+
+	printf("  postEvent (no transition): %lldns per event\n",
+	       (ignoredNsecs / events));
+
+	// and checking if in one of a set of states, which is done on most of the
+	// service api calls
+	const QSet<int> states = { RunningState, IdleState, WritingState };
+
+	timer.start();
+
+	int matches = 0;
+	for (int i = 0; i < events; i++)
+		matches += machine.inState(states) ? 1 : 0;
+
+	const qint64 inStateNsecs = qMax<qint64>(1, timer.nsecsElapsed());
+
+	printf("  inState (set of %d states): %lldns per call\n",
+	       states.size(), (inStateNsecs / events));
+
+	const QSharedPointer<const StateGraph> graph = machine.stateGraph();
+
+	machine.stop();
+
+	// sanity check the transitions happened and none of the inState checks
+	// matched (the machine was in the reading state)
+	const int expected = ((events / cycleLength) * 4) + 1;
+	if ((transitions != expected) || (matches != 0)) {
+		printf("  unexpected result, %d transitions (expected %d), %d matches\n",
+		       transitions, expected, matches);
+		return EXIT_FAILURE;
+	}
+
+	// the same graph for the lookups the way they used to be done
+	MapWalkGraph mapGraph;
+	mapGraph.addState(-1, IdleState);
+	mapGraph.addState(-1, ConnectedSuperState);
+	mapGraph.addState(ConnectedSuperState, SetupSuperState, ReadingState);
+	mapGraph.addState(SetupSuperState, ReadingState);
+	mapGraph.addState(SetupSuperState, WritingState);
+	mapGraph.addState(ConnectedSuperState, RunningState);
+	mapGraph.addTransition(IdleState, ConnectEvent, SetupSuperState);
+	mapGraph.addTransition(ReadingState, ReadDoneEvent, WritingState);
+	mapGraph.addTransition(WritingState, WriteDoneEvent, RunningState);
+	mapGraph.addTransition(ConnectedSuperState, DisconnectEvent, IdleState);
+
+	// dispatch the events through the old lookups, i.e. walk the parents to
+	// find the transition and on a move build the lists of states exited
+	// and entered
+	timer.start();
+
+	int state = IdleState;
+	int mapDepths = 0;
+	for (int i = 0; i < events; i++) {
+		int newState = mapGraph.eventTarget(state, cycle[i % cycleLength]);
+		if (newState < 0)
+			continue;
+
+		if (mapGraph.initialState(newState) >= 0)
+			newState = mapGraph.initialState(newState);
+
+		const QList<int> oldStates = mapGraph.stateTreeFor(state, true);
+		const QList<int> newStates = mapGraph.stateTreeFor(newState, false);
+		mapDepths += oldStates.size() + newStates.size();
+
+		state = newState;
+	}
+
+	const qint64 mapDispatchNsecs = qMax<qint64>(1, timer.nsecsElapsed());
+
+	// and through the tables of the frozen graph
+	timer.start();
+
+	state = IdleState;
+	int tableDepths = 0;
+	for (int i = 0; i < events; i++) {
+		int newState = graph->eventTarget(state, cycle[i % cycleLength]);
+		if (newState < 0)
+			continue;
+
+		if (graph->stateEntry(newState).hasChildren)
+			newState = graph->stateEntry(newState).initialState;
+
+		tableDepths += graph->stateEntry(state).depth +
+		               graph->stateEntry(newState).depth;
+
+		state = newState;
+	}
+
+	const qint64 tableDispatchNsecs = qMax<qint64>(1, timer.nsecsElapsed());
+
+	printf("  dispatch: %lldns per event with the map walk, %lldns with the"
+	       " tables (%.1fx)\n", (mapDispatchNsecs / events),
+	       (tableDispatchNsecs / events),
+	       (double(mapDispatchNsecs) / double(tableDispatchNsecs)));
+
+	// and the inState checks from the reading state
+	timer.start();
+
+	int mapMatches = 0;
+	for (int i = 0; i < events; i++)
+		mapMatches += mapGraph.inState(ReadingState, states) ? 1 : 0;
+
+	const qint64 mapInStateNsecs = qMax<qint64>(1, timer.nsecsElapsed());
+
+	printf("  inState (set of %d states): %lldns per call with the map walk\n",
+	       states.size(), (mapInStateNsecs / events));
+
+	if ((state != IdleState) || (mapDepths != tableDepths) || (mapMatches != 0)) {
+		printf("  map walk and table lookups disagree\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Times \a transitions transitions of a StateMachine that toggles between
+	two states, with logging disabled and nothing connected to its signals,
+	so the time per transition is mostly the lookup and the recording of the
+	transition in the flight recorder and time-in-state histograms.  That
+	figure is the upper bound of the recording cost.
+
+	Recording a transition is one read of the monotonic clock plus a few
+	stores, so the cost of a clock read is timed as well; it is most of the
+	recording cost.
+
+ */
+static int runTransitionRecordingBenchmark(int transitions)
+{
+	enum {
+		IdleState,
+		ActiveState
+	};
+
+	const QEvent::Type ToggleEvent = QEvent::Type(QEvent::User + 1);
+
+	// don't want the transitions going to the log
+	QLoggingCategory category("benchmark.statemachine");
+	category.setEnabled(QtDebugMsg, false);
+
+	StateMachine machine;
+	machine.setTransistionLogLevel(QtDebugMsg, &category);
+
+	machine.addState(IdleState, QStringLiteral("Idle"));
+	machine.addState(ActiveState, QStringLiteral("Active"));
+
+	machine.addTransition(IdleState, ToggleEvent, ActiveState);
+	machine.addTransition(ActiveState, ToggleEvent, IdleState);
+
+	machine.setInitialState(IdleState);
+
+	if (!machine.start()) {
+		printf("failed to start state machine\n");
+		return EXIT_FAILURE;
+	}
+
+	// round up to an even number so the machine ends up back in idle
+	transitions = (transitions + 1) & ~1;
+
+	printf("transition recording benchmark with %d transitions\n", transitions);
+
+	QElapsedTimer timer;
+	timer.start();
+
+	for (int i = 0; i < transitions; i++)
+		machine.postEvent(ToggleEvent);
+
+	const qint64 transitionNsecs = qMax<qint64>(1, timer.nsecsElapsed());
+
+	const bool backInIdle = (machine.state() == IdleState);
+	machine.stop();
+
+	printf("  transition: %lldns per transition, including the recording\n",
+	       (transitionNsecs / transitions));
+
+	// the clock read done for every recorded transition
+	timer.start();
+
+	struct timespec ts;
+	for (int i = 0; i < transitions; i++)
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	const qint64 clockNsecs = qMax<qint64>(1, timer.nsecsElapsed());
+
+	printf("  clock_gettime(CLOCK_MONOTONIC): %lldns per call\n",
+	       (clockNsecs / transitions));
+
+	if (!backInIdle) {
+		printf("  state machine didn't end up back in idle\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Thread used by the cross-thread event benchmark.  Waits on \a startGate
+	and then posts \a events events to either \a machine or, if \a machine
+	is \c nullptr, as QEvents to \a receiver.  Each producer cycles through
+	its own set of event types so the order they arrive in can be checked.
+
+ */
+class EventPosterThread : public QThread
+{
+public:
+	static const int EventTypes = 4;
+
+	EventPosterThread(int producer, int events, StateMachine *machine,
+	                  QObject *receiver, QSemaphore *startGate)
+		: m_producer(producer)
+		, m_events(events)
+		, m_machine(machine)
+		, m_receiver(receiver)
+		, m_startGate(startGate)
+	{
+	}
+
+	static QEvent::Type eventType(int producer, int index)
+	{
+		return QEvent::Type(QEvent::User + 1 + (producer * EventTypes) + index);
+	}
+
+protected:
+	void run() override
+	{
+		m_startGate->acquire();
+
+		for (int i = 0; i < m_events; i++) {
+			const QEvent::Type type = eventType(m_producer, (i % EventTypes));
+			if (m_machine)
+				m_machine->postEvent(type);
+			else
+				QCoreApplication::postEvent(m_receiver, new QEvent(type));
+		}
+	}
+
+private:
+	const int m_producer;
+	const int m_events;
+	StateMachine * const m_machine;
+	QObject * const m_receiver;
+	QSemaphore * const m_startGate;
+};
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Receiver for the QCoreApplication::postEvent() baseline in the
+	cross-thread event benchmark, quits \a loop once \a expected events have
+	been received.
+
+ */
+class PostedEventCounter : public QObject
+{
+public:
+	PostedEventCounter(int expected, QEventLoop *loop)
+		: m_expected(expected)
+		, m_received(0)
+		, m_loop(loop)
+	{
+	}
+
+	int received() const
+	{
+		return m_received;
+	}
+
+protected:
+	void customEvent(QEvent *event) override
+	{
+		Q_UNUSED(event);
+
+		if (++m_received == m_expected)
+			m_loop->quit();
+	}
+
+private:
+	const int m_expected;
+	int m_received;
+	QEventLoop * const m_loop;
+};
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Stress tests and times posting events to a StateMachine from several
+	threads at once.  Each of the producer threads posts \a events events,
+	every event moves the state machine to a state unique to the event so
+	the entered() signal shows the order they were processed in, which is
+	checked against the order each producer posted them.
+
+	The same number of events are then posted with QCoreApplication::postEvent()
+	to a plain QObject, which is what cross-thread posts used to cost.
+
+ */
+static int runCrossThreadEventBenchmark(int events)
+{
+	const int producers = 4;
+	const int eventTypes = EventPosterThread::EventTypes;
+	const int totalEvents = producers * events;
+
+	enum {
+		RootSuperState,
+			IdleState,
+			FirstPosterState
+	};
+
+	// don't want the transitions going to the log
+	QLoggingCategory category("benchmark.statemachine");
+	category.setEnabled(QtDebugMsg, false);
+
+	StateMachine machine;
+	machine.setTransistionLogLevel(QtDebugMsg, &category);
+
+	machine.addState(RootSuperState, QStringLiteral("RootSuperState"));
+	machine.addState(RootSuperState, IdleState, QStringLiteral("Idle"));
+
+	for (int producer = 0; producer < producers; producer++) {
+		for (int index = 0; index < eventTypes; index++) {
+			const int state = FirstPosterState + (producer * eventTypes) + index;
+
+			machine.addState(RootSuperState, state,
+			                 QString("Producer%1.%2").arg(producer).arg(index));
+			machine.addTransition(RootSuperState,
+			                      EventPosterThread::eventType(producer, index),
+			                      state);
+		}
+	}
+
+	machine.setInitialState(IdleState);
+
+	QEventLoop loop;
+
+	// give up if the events don't all arrive
+	QTimer watchdog;
+	watchdog.setSingleShot(true);
+	watchdog.setInterval(60000);
+	QObject::connect(&watchdog, &QTimer::timeout, &loop, &QEventLoop::quit);
+
+	QVector<int> nextIndex(producers, 0);
+	int received = 0;
+	int outOfOrder = 0;
+
+	QObject::connect(&machine, &StateMachine::entered,
+		[&](int state)
+		{
+			if (state < FirstPosterState)
+				return;
+
+			const int producer = (state - FirstPosterState) / eventTypes;
+			const int index = (state - FirstPosterState) % eventTypes;
+
+			if (index != nextIndex[producer])
+				outOfOrder++;
+			nextIndex[producer] = (index + 1) % eventTypes;
+
+			if (++received == totalEvents)
+				loop.quit();
+		});
+
+	if (!machine.start()) {
+		printf("failed to start state machine\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("cross-thread event benchmark with %d threads posting %d events each\n",
+	       producers, events);
+
+	for (int pass = 0; pass < 2; pass++) {
+
+		const bool toMachine = (pass == 0);
+
+		PostedEventCounter counter(totalEvents, &loop);
+
+		QSemaphore startGate;
+		QList< QSharedPointer<EventPosterThread> > threads;
+		for (int producer = 0; producer < producers; producer++) {
+			threads.append(QSharedPointer<EventPosterThread>::create(producer, events,
+			                                                          toMachine ? &machine : nullptr,
+			                                                          &counter, &startGate));
+			threads.last()->start();
+		}
+
+		QElapsedTimer timer;
+		timer.start();
+
+		watchdog.start();
+		startGate.release(producers);
+		loop.exec();
+		watchdog.stop();
+
+		const qint64 nsecs = qMax<qint64>(1, timer.nsecsElapsed());
+
+		for (const QSharedPointer<EventPosterThread> &thread : threads)
+			thread->wait();
+
+		const int processed = toMachine ? received : counter.received();
+
+		printf("  %-32s %d events in %.3fms, %lldns per event, %.0f events/s\n",
+		       toMachine ? "StateMachine::postEvent:" : "QCoreApplication::postEvent:",
+		       processed, double(nsecs) / 1e6, (nsecs / totalEvents),
+		       (double(processed) * 1e9) / double(nsecs));
+
+		if (processed != totalEvents) {
+			printf("  only %d of %d events were processed\n", processed, totalEvents);
+			return EXIT_FAILURE;
+		}
+	}
+
+	machine.stop();
+
+	if (outOfOrder != 0) {
+		printf("  %d events were processed out of order\n", outOfOrder);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the resident set size of the process in bytes, or \c -1 if it
+	couldn't be read.
+
+ */
+static qint64 residentBytes()
+{
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (!file)
+		return -1;
+
+	long size = 0;
+	long resident = 0;
+	const int fields = fscanf(file, "%ld %ld", &size, &resident);
+	fclose(file);
+
+	if (fields != 2)
+		return -1;
+
+	return qint64(resident) * sysconf(_SC_PAGESIZE);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Measures the construction time and memory used by the state machines of
+	\a devices paired RCUs, first with every state machine sharing the one
+	state graph and then with each state machine building its own copy of
+	the graph, as all the services did before StateGraph.
+
+	Each RCU is modelled as 20 state machines; the device, the services
+	object, the 7 GATT services and the 11 IR signals.  All of them use a
+	graph the same size as the IR signal one, which is the most common.
+	The shared graphs are measured first so any memory freed by them and
+	reused by the per instance graphs makes the difference look smaller,
+	not bigger.
+
+ */
+static int runStateGraphBenchmark(int devices)
+{
+	enum {
+		IdleState,
+		InitialisingState,
+		ReadyState,
+		ProgrammingSuperState,
+			DisablingState,
+			WritingState,
+			EnablingState,
+	};
+
+	const QEvent::Type StartRequestEvent = QEvent::Type(QEvent::User + 1);
+	const QEvent::Type StopRequestEvent = QEvent::Type(QEvent::User + 2);
+	const QEvent::Type ProgramRequestEvent = QEvent::Type(QEvent::User + 3);
+	const QEvent::Type AckEvent = QEvent::Type(QEvent::User + 4);
+	const QEvent::Type ErrorEvent = QEvent::Type(QEvent::User + 5);
+
+	static constexpr StateGraph::StateDef states[] = {
+		{ -1,                     IdleState,              "Idle"                  },
+		{ -1,                     InitialisingState,      "Initialising"          },
+		{ -1,                     ReadyState,             "Ready"                 },
+		{ -1,                     ProgrammingSuperState,  "ProgrammingSuperState" },
+		{ ProgrammingSuperState,  DisablingState,         "Disabling"             },
+		{ ProgrammingSuperState,  WritingState,           "Writing"               },
+		{ ProgrammingSuperState,  EnablingState,          "Enabling"              },
+	};
+
+	static constexpr StateGraph::TransitionDef transitions[] = {
+		{ IdleState,              StartRequestEvent,    InitialisingState },
+		{ InitialisingState,      AckEvent,             ReadyState        },
+		{ InitialisingState,      ErrorEvent,           IdleState         },
+		{ InitialisingState,      StopRequestEvent,     IdleState         },
+		{ ReadyState,             ProgramRequestEvent,  DisablingState    },
+		{ ProgrammingSuperState,  ErrorEvent,           ReadyState        },
+		{ ProgrammingSuperState,  StopRequestEvent,     IdleState         },
+		{ DisablingState,         AckEvent,             WritingState      },
+		{ WritingState,           AckEvent,             EnablingState     },
+		{ EnablingState,          AckEvent,             ReadyState        },
+	};
+
+	static_assert(StateGraph::isValid(states, transitions, IdleState),
+	              "invalid benchmark state graph");
+
+	const int machinesPerDevice = 20;
+	const int machineCount = devices * machinesPerDevice;
+
+	printf("state graph benchmark with %d RCUs, %d state machines\n",
+	       devices, machineCount);
+
+	for (int pass = 0; pass < 2; pass++) {
+
+		const bool shared = (pass == 0);
+
+		QList< QSharedPointer<StateMachine> > machines;
+		machines.reserve(machineCount);
+
+		const qint64 rssBefore = residentBytes();
+
+		QElapsedTimer timer;
+		timer.start();
+
+		for (int i = 0; i < machineCount; i++) {
+
+			QSharedPointer<StateMachine> machine = QSharedPointer<StateMachine>::create();
+			machine->setObjectName(QStringLiteral("StateGraphBenchmark"));
+
+			if (shared) {
+				static const QSharedPointer<const StateGraph> graph =
+					StateGraph::create(states, transitions, IdleState);
+
+				machine->setStateGraph(graph);
+
+			} else {
+				for (const StateGraph::StateDef &state : states)
+					machine->addState(state.parentState, state.state,
+					                  QString::fromLatin1(state.name));
+				for (const StateGraph::TransitionDef &transition : transitions)
+					machine->addTransition(transition.fromState,
+					                       transition.eventType,
+					                       transition.toState);
+
+				machine->setInitialState(IdleState);
+			}
+
+			if (!machine->start()) {
+				printf("  failed to start state machine\n");
+				return EXIT_FAILURE;
+			}
+
+			machines.append(machine);
+		}
+
+		const qint64 nsecs = timer.nsecsElapsed();
+		const qint64 rssAfter = residentBytes();
+
+		printf("  %-20s %8.3fms, %6lldns per state machine, RSS +%lldKB (%lldB per state machine)\n",
+		       shared ? "shared graph:" : "per instance graphs:",
+		       double(nsecs) / 1e6, (nsecs / machineCount),
+		       ((rssAfter - rssBefore) / 1024),
+		       ((rssAfter - rssBefore) / machineCount));
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Reads the integer value of \a option from \a parser into \a value, if the
+	option wasn't supplied then \a value is left untouched.  Returns \c false
+	and prints an error if the value isn't an integer between \a min and
+	\a max.
+
+ */
+static bool intOptionValue(const QCommandLineParser &parser,
+                           const QCommandLineOption &option,
+                           int min, int max, int *value)
+{
+	if (!parser.isSet(option))
+		return true;
+
+	bool isOk = false;
+	const int result = parser.value(option).toInt(&isOk);
+
+	if (!isOk || (result < min) || (result > max)) {
+		qWarning("failed to parse '%s' option, it should be an integer between"
+		         " %d and %d", qPrintable(option.names().first()), min, max);
+		return false;
+	}
+
+	*value = result;
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Entry point for the benchmark tool, runs each of the benchmarks selected
+	on the command line in turn and exits with \c EXIT_FAILURE if any of them
+	failed.
+
+ */
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("BleRcuBench");
+	QCoreApplication::setApplicationVersion(BLUETOOTHRCU_VERSION);
+
+	// only want warnings and errors from the daemon code getting in the way
+	// of the results
+	setupLogging(LoggingTarget::Console,
+	             LoggingLevel::Fatal | LoggingLevel::Error | LoggingLevel::Warning);
+
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Bluetooth RCU Daemon Benchmarks");
+	parser.addHelpOption();
+	parser.addVersionOption();
+
+	const QCommandLineOption voiceReplayOption("voice-replay", "Replays recorded voice notifications (btsnoop or capture file) through the audio pipe and prints the stats.", "path");
+	const QCommandLineOption voiceReplayRealTimeOption("voice-replay-realtime", "Paces the voice replay to the recorded timing rather than as fast as possible.");
+	const QCommandLineOption voiceReplayStreamsOption("voice-replay-streams", "Runs the voice replay through the given number of audio pipes at once, each on its own thread with lost frames simulated and concealed.", "streams");
+	const QCommandLineOption adpcmOption("adpcm", "Decodes the voice frames in the recording (btsnoop or capture file) with each of the ADPCM engines, checks the output matches and prints the time per frame.", "path");
+	const QCommandLineOption objectIndexOption("object-index", "Builds a synthetic bluez object list with the given number of devices and times the GATT profile lookups with and without the object index.", "devices");
+	const QCommandLineOption deviceInfoOption("device-info", "Times the device info service reads against a mock RCU where each ATT read takes the given milliseconds.", "msecs");
+	const QCommandLineOption crc32Option("crc32", "Times each of the CRC32 engines hashing the given number of megabytes in a range of buffer sizes.", "megabytes");
+	const QCommandLineOption stateMachineOption("statemachine", "Times posting the given number of events into a state machine and checking its state.", "events");
+	const QCommandLineOption stateGraphsOption("state-graphs", "Creates the state machines for the given number of RCUs (e.g. 10) with shared and per instance state graphs and prints the time taken and memory used.", "devices");
+	const QCommandLineOption transitionsOption("transitions", "Times the given number of state machine transitions, which are all recorded in the machine's flight recorder and histograms, and a read of the clock used for the recording.", "transitions");
+	const QCommandLineOption crossThreadEventsOption("cross-thread-events", "Posts the given number of events to a state machine from each of 4 threads and checks they're processed in order.", "events");
+
+	parser.addOptions({ voiceReplayOption, voiceReplayRealTimeOption,
+	                    voiceReplayStreamsOption, adpcmOption,
+	                    objectIndexOption, deviceInfoOption, crc32Option,
+	                    stateMachineOption, transitionsOption,
+	                    stateGraphsOption, crossThreadEventsOption });
+
+	parser.process(app);
+
+
+	int voiceReplayStreams = 1;
+	int objectIndexDevices = 0;
+	int deviceInfoAttMsecs = -1;
+	int crc32MBytes = 0;
+	int stateMachineEvents = 0;
+	int transitionCount = 0;
+	int stateGraphDevices = 0;
+	int crossThreadEvents = 0;
+
+	if (!intOptionValue(parser, voiceReplayStreamsOption, 1, 32, &voiceReplayStreams) ||
+	    !intOptionValue(parser, objectIndexOption, 1, 100000, &objectIndexDevices) ||
+	    !intOptionValue(parser, deviceInfoOption, 0, 1000, &deviceInfoAttMsecs) ||
+	    !intOptionValue(parser, crc32Option, 1, 4096, &crc32MBytes) ||
+	    !intOptionValue(parser, stateMachineOption, 1, 100000000, &stateMachineEvents) ||
+	    !intOptionValue(parser, transitionsOption, 1, 100000000, &transitionCount) ||
+	    !intOptionValue(parser, stateGraphsOption, 1, 10000, &stateGraphDevices) ||
+	    !intOptionValue(parser, crossThreadEventsOption, 1, 10000000, &crossThreadEvents))
+		return EXIT_FAILURE;
+
+
+	int benchmarks = 0;
+	int failures = 0;
+
+	// the state graph benchmark measures the growth in RSS so run it before
+	// the others have had a chance to grow the heap
+	if (stateGraphDevices > 0) {
+		benchmarks++;
+		if (runStateGraphBenchmark(stateGraphDevices) != EXIT_SUCCESS)
+			failures++;
+	}
+
+	if (parser.isSet(voiceReplayOption)) {
+		benchmarks++;
+
+		const QString filePath = parser.value(voiceReplayOption);
+		const bool realTime = parser.isSet(voiceReplayRealTimeOption);
+
+		if (voiceReplayStreams > 1) {
+			if (runConcurrentVoiceReplay(filePath, realTime, voiceReplayStreams) != EXIT_SUCCESS)
+				failures++;
+		} else {
+			if (runVoiceReplay(filePath, realTime) != EXIT_SUCCESS)
+				failures++;
+		}
+	}
+
+	if (parser.isSet(adpcmOption)) {
+		benchmarks++;
+		if (runAdpcmBenchmark(parser.value(adpcmOption)) != EXIT_SUCCESS)
+			failures++;
+	}
+
+	if (objectIndexDevices > 0) {
+		benchmarks++;
+		if (runObjectIndexBenchmark(objectIndexDevices) != EXIT_SUCCESS)
+			failures++;
+	}
+
+	if (deviceInfoAttMsecs >= 0) {
+		benchmarks++;
+		if (runDeviceInfoBenchmark(deviceInfoAttMsecs) != EXIT_SUCCESS)
+			failures++;
+	}
+
+	if (crc32MBytes > 0) {
+		benchmarks++;
+		if (runCrc32Benchmark(crc32MBytes) != EXIT_SUCCESS)
+			failures++;
+	}
+
+	if (stateMachineEvents > 0) {
+		benchmarks++;
+		if (runStateMachineBenchmark(stateMachineEvents) != EXIT_SUCCESS)
+			failures++;
+	}
+
+	if (transitionCount > 0) {
+		benchmarks++;
+		if (runTransitionRecordingBenchmark(transitionCount) != EXIT_SUCCESS)
+			failures++;
+	}
+
+	if (crossThreadEvents > 0) {
+		benchmarks++;
+		if (runCrossThreadEventBenchmark(crossThreadEvents) != EXIT_SUCCESS)
+			failures++;
+	}
+
+	if (benchmarks == 0)
+		parser.showHelp(EXIT_FAILURE);
+
+	return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
@@ -28,6 +28,7 @@
 
 #include "utils/bleuuid.h"
 #include "utils/future.h"
+#include "utils/filedescriptor.h"
 
 #include <QObject>
 #include <QList>
@@ -39,6 +40,17 @@ class BleGattService;
 class BleGattDescriptor;
 
 
+class BleGattNotificationHandler
+{
+public:
+	virtual ~BleGattNotificationHandler()
+	{ }
+
+	virtual void onNotifications(const quint8 *packets, size_t stride,
+	                             const quint16 *lengths, int count) = 0;
+};
+
+
 class BleGattCharacteristic : public QObject
 {
 	Q_OBJECT
@@ -78,6 +90,9 @@ public:
 
 	virtual void setCacheable(bool cacheable) = 0;
 	virtual bool cacheable() const = 0;
+	virtual void invalidateCache() = 0;
+	virtual int cacheHits() const = 0;
+	virtual int cacheMisses() const = 0;
 
 	virtual QSharedPointer<BleGattService> service() const = 0;
 
@@ -89,6 +104,11 @@ public:
 	virtual Future<> writeValueWithoutResponse(const QByteArray &value) = 0;
 
 	virtual Future<> enableNotifications(bool enable) = 0;
+	virtual FileDescriptor takeNotificationPipe() = 0;
+	virtual void setNotificationHandler(BleGattNotificationHandler *handler) = 0;
+
+	virtual Future<> enableWritePipe(bool enable) = 0;
+	virtual int writePipeMtu() const = 0;
 
 	virtual int timeout() const = 0;
 	virtual void setTimeout(int timeout) = 0;
@@ -68,6 +68,9 @@ public:
 
 	virtual void setCacheable(bool cacheable) = 0;
 	virtual bool cacheable() const = 0;
+	virtual void invalidateCache() = 0;
+	virtual int cacheHits() const = 0;
+	virtual int cacheMisses() const = 0;
 
 	virtual Future<QByteArray> readValue() = 0;
 	virtual Future<void> writeValue(const QByteArray &value) = 0;
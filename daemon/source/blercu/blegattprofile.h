@@ -55,12 +55,17 @@ public:
 
 	virtual void updateProfile() = 0;
 
+	virtual bool isCached() const = 0;
+	virtual void validateCache(const QString &firmwareRevision) = 0;
+	virtual void storeCache(const QString &firmwareRevision) = 0;
+
 	virtual QList< QSharedPointer<BleGattService> > services() const = 0;
 	virtual QList< QSharedPointer<BleGattService> > services(const BleUuid &serviceUuid) const = 0;
 	virtual QSharedPointer<BleGattService> service(const BleUuid &serviceUuid) const = 0;
 
 signals:
 	void updateCompleted();
+	void cacheInvalidated();
 };
 
 
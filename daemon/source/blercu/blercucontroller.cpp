@@ -31,6 +31,7 @@
 #include "utils/logging.h"
 #include "configsettings/configsettings.h"
 #include "utils/inputdevicemanager.h"
+#include "utils/timerwheel.h"
 
 #include <QCoreApplication>
 #include <QTimer>
@@ -223,6 +224,13 @@ void BleRcuControllerImpl::dump(Dumper out) const
 	// dump out the scanner status
 	out.printNewline();
 	m_scannerStateMachine.dump(out);
+
+	// dump out the timer counters for the main thread
+	out.printNewline();
+	out.printLine("Timer wheel:");
+	out.pushIndent(2);
+	TimerWheel::instance()->dump(out);
+	out.popIndent();
 }
 
 // -----------------------------------------------------------------------------
@@ -90,13 +90,13 @@ BleRcuPairingStateMachine::BleRcuPairingStateMachine(const QSharedPointer<const
 	m_unpairingTimer.setSingleShot(true);
 	m_unpairingTimer.setInterval(config->upairingTimeout());
 
-	QObject::connect(&m_discoveryTimer, &QTimer::timeout,
+	QObject::connect(&m_discoveryTimer, &WheelTimer::timeout,
 	                 this, &BleRcuPairingStateMachine::onDiscoveryTimeout);
-	QObject::connect(&m_pairingTimer, &QTimer::timeout,
+	QObject::connect(&m_pairingTimer, &WheelTimer::timeout,
 	                 this, &BleRcuPairingStateMachine::onPairingTimeout);
-	QObject::connect(&m_setupTimer, &QTimer::timeout,
+	QObject::connect(&m_setupTimer, &WheelTimer::timeout,
 	                 this, &BleRcuPairingStateMachine::onSetupTimeout);
-	QObject::connect(&m_unpairingTimer, &QTimer::timeout,
+	QObject::connect(&m_unpairingTimer, &WheelTimer::timeout,
 	                 this, &BleRcuPairingStateMachine::onUnpairingTimeout);
 
 }
@@ -199,6 +199,8 @@ void BleRcuPairingStateMachine::dump(Dumper out) const
 	out.printLine("pairing failures: %d", (m_pairingAttempts - m_pairingSuccesses));
 	out.popIndent();
 
+	m_stateMachine.dump(out);
+
 	out.popIndent();
 }
 
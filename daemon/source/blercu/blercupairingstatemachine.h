@@ -27,12 +27,12 @@
 
 #include "utils/bleaddress.h"
 #include "utils/statemachine.h"
+#include "utils/timerwheel.h"
 #include "utils/dumper.h"
 
 #include "btrmgradapter.h"
 
 #include <QObject>
-#include <QTimer>
 #include <QSharedPointer>
 #include <QMap>
 #include <QRegExp>
@@ -147,10 +147,10 @@ private:
 
 	StateMachine m_stateMachine;
 
-	QTimer m_discoveryTimer;
-	QTimer m_pairingTimer;
-	QTimer m_setupTimer;
-	QTimer m_unpairingTimer;
+	WheelTimer m_discoveryTimer;
+	WheelTimer m_pairingTimer;
+	WheelTimer m_setupTimer;
+	WheelTimer m_unpairingTimer;
 
 	int m_pairingAttempts;
 	int m_pairingSuccesses;
@@ -174,6 +174,8 @@ void BleRcuScannerStateMachine::dump(Dumper out) const
 			              (m_scanTimeoutMs - int(m_scanElapsedTime.elapsed())));
 	}
 
+	m_stateMachine.dump(out);
+
 	out.popIndent();
 }
 
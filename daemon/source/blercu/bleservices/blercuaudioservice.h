@@ -67,8 +67,17 @@ public:
 
 	virtual quint32 audioCodecs() const = 0;
 
-	virtual Future<FileDescriptor> startStreaming(Encoding encoding) = 0;
+	virtual Future<FileDescriptor> startStreaming(Encoding encoding,
+	                                              int latencyBudget) = 0;
 	virtual Future<> startStreamingTo(Encoding encoding, int pipeWriteFd) = 0;
+
+	struct SharedMemoryStream {
+		FileDescriptor memoryFd;
+		FileDescriptor eventFd;
+	};
+
+	virtual Future<SharedMemoryStream> startStreamingSharedMemory(Encoding encoding,
+	                                                              int latencyBudget) = 0;
 	virtual Future<> stopStreaming() = 0;
 
 public:
@@ -82,6 +91,12 @@ public:
 		quint32 lastError;
 		quint32 expectedPackets;
 		quint32 actualPackets;
+		quint32 bufferedBytes;
+		quint32 peakBufferedBytes;
+		quint32 droppedFrames;
+		quint32 concealedFrames;
+		quint32 discontinuities;
+		quint32 preRollFrames;
 	};
 
 	virtual Future<StatusInfo> status() = 0;
@@ -93,6 +108,7 @@ signals:
 };
 
 Q_DECLARE_METATYPE(BleRcuAudioService::StatusInfo)
+Q_DECLARE_METATYPE(BleRcuAudioService::SharedMemoryStream)
 
 
 #endif // !defined(BLERCUAUDIOSERVICE_H)
@@ -46,9 +46,11 @@
 
 
 BleRcuServicesFactory::BleRcuServicesFactory(const QSharedPointer<const ConfigSettings> &config,
-                                             const QSharedPointer<const IrDatabase> &irDatabase)
+                                             const QSharedPointer<const IrDatabase> &irDatabase,
+                                             const QSharedPointer<GattUpgradeResumeStore> &upgradeResumeStore)
 	: m_config(config)
 	, m_irDatabase(irDatabase)
+	, m_upgradeResumeStore(upgradeResumeStore)
 {
 }
 
@@ -87,7 +89,10 @@ QSharedPointer<BleRcuServices> BleRcuServicesFactory::createServices(const BleAd
 	switch (settings.servicesType()) {
 
 		case ConfigModelSettings::GattServiceType:
-			return QSharedPointer<GattServices>::create(address, gattProfile, m_irDatabase, settings);
+			return QSharedPointer<GattServices>::create(address, gattProfile, m_irDatabase, settings,
+			                                            m_config->audioSettings(),
+			                                            m_config->gattSettings(),
+			                                            m_upgradeResumeStore);
 
 		default:
 			qError("service interface not supported");
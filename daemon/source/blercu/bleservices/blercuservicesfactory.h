@@ -38,13 +38,16 @@ class IpcServicesFactory;
 class BleRcuServices;
 class BleGattProfile;
 
+class GattUpgradeResumeStore;
+
 
 class BleRcuServicesFactory
 {
 
 public:
 	BleRcuServicesFactory(const QSharedPointer<const ConfigSettings> &config,
-	                      const QSharedPointer<const IrDatabase> &irDatabase);
+	                      const QSharedPointer<const IrDatabase> &irDatabase,
+	                      const QSharedPointer<GattUpgradeResumeStore> &upgradeResumeStore);
 	~BleRcuServicesFactory() = default;
 
 public:
@@ -56,6 +59,7 @@ public:
 private:
 	const QSharedPointer<const ConfigSettings> m_config;
 	const QSharedPointer<const IrDatabase> m_irDatabase;
+	const QSharedPointer<GattUpgradeResumeStore> m_upgradeResumeStore;
 };
 
 
@@ -51,6 +51,28 @@ public:
 	virtual bool upgrading() const = 0;
 	virtual int progress() const = 0;
 
+public:
+	struct StatsInfo {
+		quint32 blockSize;
+		quint32 windowSize;
+		quint32 bytesAcked;
+		quint32 elapsedMsecs;
+		quint32 throughput;
+		quint32 packetsSent;
+		quint32 retransmits;
+		quint32 timeouts;
+		quint32 minRttMsecs;
+		quint32 avgRttMsecs;
+		quint32 maxRttMsecs;
+		quint32 bytesSent;
+		quint32 retransmitBytes;
+		quint32 resumedBytes;
+		quint32 wastedBytes;
+		quint32 attempts;
+	};
+
+	virtual Future<StatsInfo> stats() const = 0;
+
 signals:
 	void upgradingChanged(bool upgrading);
 	void progressChanged(int progress);
@@ -58,6 +80,8 @@ signals:
 
 };
 
+Q_DECLARE_METATYPE(BleRcuUpgradeService::StatsInfo)
+
 
 #endif // !defined(BLERCUUPGRADESERVICE_H)
 
@@ -23,17 +23,23 @@
 //
 
 #include "gatt_audiopipe.h"
+#include "gatt_audioring.h"
 
 #include "utils/unixpipenotifier.h"
+#include "utils/unixpacketreader.h"
 #include "utils/adpcmcodec.h"
 #include "utils/logging.h"
 
+#include <QTimer>
+
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 
 #if defined(__APPLE__)
@@ -61,6 +67,21 @@
 
 	When this object is destroyed both the input and output pipes are closed.
 
+	All the notifiers used by the object are children of it, so the whole pipe
+	can be moved onto a separate (real-time) thread with
+	\l{QObject::moveToThread()} once it has been started, in which case the
+	notifications are read, decoded and written to the output pipe entirely on
+	that thread.  The only methods that are safe to call from another thread
+	are framesReceived(), framesExpected() and stop() (using a blocking queued
+	invocation).
+
+	Optionally gaps in the audio, detected from the sequence numbers of the
+	frames, can be filled with synthesised frames so that the output stays
+	aligned with the RCU's 12ms frame clock, see setConcealment().
+
+	Instead of a pipe the output can be a shared memory ring, see
+	setSharedMemoryOutput().
+
  */
 
 
@@ -97,18 +118,67 @@ struct __attribute__((packed)) WaveFileHeader {
 	Use this constructor if you're manually injecting BLE GATT notifications
 	into the pipe.
 
+	The \a latencyBudget is the number of milliseconds the decoded frames may
+	be held before being written to the output pipe.  If \c 0 (the default)
+	each frame is written as soon as it's decoded, otherwise the frames are
+	coalesced and written in a single \c write() when either the budget expires
+	or it holds as many 12ms frames as fit in the budget.  Fewer, larger writes
+	means fewer context switches for both us and the client.  Coalesced output
+	is always written to a stream (not packet) pipe as the client will read
+	several frames at a time.
+
  */
-GattAudioPipe::GattAudioPipe(OutputEncoding encoding, int outputPipeFd, QObject *parent)
+GattAudioPipe::GattAudioPipe(OutputEncoding encoding, int outputPipeFd,
+                             int latencyBudget, QObject *parent)
 	: QObject(parent)
 	, m_encoding(encoding)
 	, m_codec(new ADPCMCodec)
 	, m_outputPipeRdFd(-1)
 	, m_outputPipeWrFd(-1)
+	, m_notifyPipeFd(-1)
+	, m_receivedNotification(false)
+	, m_notifyReader(nullptr)
+	, m_notifyWakeups(0)
+	, m_notifyPackets(0)
+	, m_maxNotifyPacketsPerWakeup(0)
 	, m_frameBufferOffset(0)
+	, m_concealmentMode(NoConcealment)
+	, m_maxConcealedGap(0)
+	, m_concealedFrames(0)
+	, m_discontinuities(0)
+	, m_deliveringPreRoll(false)
+	, m_preRollFrames(0)
+	, m_coalesceFrameLimit(qBound(1, (latencyBudget / 12), int(m_maxCoalescedFrames)))
+	, m_flushTimer(nullptr)
+	, m_coalesceBuffer(nullptr)
+	, m_coalescedBytes(0)
+	, m_coalescedFrames(0)
+	, m_outputWrites(0)
+	, m_outputFrameSize((encoding == PCM16) ? sizeof(m_decodeBuffer) : 100)
+	, m_outputBuffer(nullptr)
+	, m_outputBufferRxNsecs(nullptr)
+	, m_outputBufferSize(0)
+	, m_outputBufferHead(0)
+	, m_outputBufferCount(0)
+	, m_outputBufferHeadOffset(0)
+	, m_highWaterMark(0)
+	, m_lowWaterMark(0)
+	, m_aboveHighWaterMark(false)
+	, m_dropPolicy(DropNewest)
+	, m_packetMode(false)
+	, m_sharedMemoryRing(nullptr)
+	, m_pendingWakeupFrames(0)
+	, m_bufferedBytes(0)
+	, m_peakBufferedBytes(0)
+	, m_droppedFrames(0)
 	, m_running(false)
 	, m_frameCount(0)
+	, m_recordingStartMsecs(0)
 	, m_recordingDuration(0)
 	, m_missedSequences(0)
+	, m_latencySamples(0)
+	, m_maxLatencyUsecs(0)
+	, m_totalLatencyUsecs(0)
 {
 
 	if (outputPipeFd >= 0) {
@@ -125,10 +195,13 @@ GattAudioPipe::GattAudioPipe(OutputEncoding encoding, int outputPipeFd, QObject
 
 
 	} else {
-		// use O_DIRECT for 'packet' pipes if ADCPM encoding is used
+		// use O_DIRECT for 'packet' pipes if ADCPM encoding is used and each
+		// frame is written individually
 		int flags = O_CLOEXEC | O_NONBLOCK;
-		if (m_encoding == OutputEncoding::ADPCM)
+		if ((m_encoding == OutputEncoding::ADPCM) && (m_coalesceFrameLimit == 1)) {
 			flags |= O_DIRECT;
+			m_packetMode = true;
+		}
 
 		// create the new pipe for output
 		int fds[2];
@@ -141,15 +214,33 @@ GattAudioPipe::GattAudioPipe(OutputEncoding encoding, int outputPipeFd, QObject
 		m_outputPipeWrFd = fds[1];
 	}
 
-	// final stage is to create listeners for the output pipe
+	// final stage is to create listeners for the output pipe, nb: the notifier
+	// is a child so it follows this object if moved to another thread
 	m_outputPipeNotifier =
-		QSharedPointer<UnixPipeNotifier>(new UnixPipeNotifier(m_outputPipeWrFd),
+		QSharedPointer<UnixPipeNotifier>(new UnixPipeNotifier(m_outputPipeWrFd, this),
 		                                 &QObject::deleteLater);
 	QObject::connect(m_outputPipeNotifier.data(), &UnixPipeNotifier::exceptionActivated,
 	                 this, &GattAudioPipe::onOutputPipeException);
+	QObject::connect(m_outputPipeNotifier.data(), &UnixPipeNotifier::writeActivated,
+	                 this, &GattAudioPipe::onOutputPipeWritable);
 
 	// enable exception (pipe closed) events on the output pipe
 	m_outputPipeNotifier->setExceptionEnabled(true);
+
+	// if coalescing the output then create the buffer and a timer to flush
+	// it when the latency budget expires
+	if (m_coalesceFrameLimit > 1) {
+		m_coalesceBuffer = new quint8[m_coalesceFrameLimit * sizeof(m_decodeBuffer)];
+
+		m_flushTimer = new QTimer(this);
+		m_flushTimer->setSingleShot(true);
+		m_flushTimer->setInterval(latencyBudget);
+		QObject::connect(m_flushTimer, &QTimer::timeout,
+		                 this, &GattAudioPipe::flushOutput);
+
+		qInfo("coalescing up to %d audio frames with a %dms latency budget",
+		      m_coalesceFrameLimit, latencyBudget);
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -163,6 +254,13 @@ GattAudioPipe::~GattAudioPipe()
 	// destroy the notifiers
 	m_outputPipeNotifier.reset();
 
+	closeNotificationPipe();
+
+	if (m_notifyReader) {
+		delete m_notifyReader;
+		m_notifyReader = nullptr;
+	}
+
 	// close any fds that we may still have open
 	if ((m_outputPipeRdFd >= 0) && (::close(m_outputPipeRdFd) != 0))
 		qErrnoWarning(errno, "failed to close output read pipe fd");
@@ -175,6 +273,19 @@ GattAudioPipe::~GattAudioPipe()
 		delete m_codec;
 		m_codec = nullptr;
 	}
+
+	if (m_coalesceBuffer)
+		delete [] m_coalesceBuffer;
+
+	if (m_outputBuffer)
+		delete [] m_outputBuffer;
+	if (m_outputBufferRxNsecs)
+		delete [] m_outputBufferRxNsecs;
+
+	if (m_sharedMemoryRing) {
+		m_sharedMemoryRing->close();
+		delete m_sharedMemoryRing;
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -184,7 +295,7 @@ GattAudioPipe::~GattAudioPipe()
  */
 bool GattAudioPipe::isValid() const
 {
-	return (m_outputPipeWrFd >= 0);
+	return (m_outputPipeWrFd >= 0) || (m_sharedMemoryRing != nullptr);
 }
 
 // -----------------------------------------------------------------------------
@@ -195,6 +306,9 @@ bool GattAudioPipe::isValid() const
  */
 bool GattAudioPipe::isOutputOpen() const
 {
+	if (m_sharedMemoryRing)
+		return !m_sharedMemoryRing->isReaderClosed();
+
 	if (m_outputPipeWrFd < 0)
 		return false;
 
@@ -203,6 +317,146 @@ bool GattAudioPipe::isOutputOpen() const
 	return (::write(m_outputPipeWrFd, nullptr, 0) == 0);
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	Sets up an elastic buffer between the decoder and the output pipe, this is
+	used to hold frames when the client isn't reading the pipe fast enough
+	rather than discarding them.  The buffer is drained whenever the output
+	pipe becomes writable again.
+
+	The \a size, \a highWaterMark and \a lowWaterMark values are all in
+	frames.  When the buffer is full the \a dropPolicy determines whether the
+	oldest frame in the buffer or the new frame is discarded.  A warning is
+	logged when the buffer fills past the \a highWaterMark and again when it
+	has drained down to the \a lowWaterMark.
+
+	If \a size is \c 0 then no buffer is used and any frame that can't be
+	written to the pipe is discarded.  Must be called before start().
+
+ */
+bool GattAudioPipe::setOutputBuffer(int size, int highWaterMark, int lowWaterMark,
+                                    BufferDropPolicy dropPolicy)
+{
+	if (Q_UNLIKELY(m_running)) {
+		qWarning("can't change the output buffer while running");
+		return false;
+	}
+
+	if (m_outputBuffer) {
+		delete [] m_outputBuffer;
+		m_outputBuffer = nullptr;
+	}
+	if (m_outputBufferRxNsecs) {
+		delete [] m_outputBufferRxNsecs;
+		m_outputBufferRxNsecs = nullptr;
+	}
+
+	m_outputBufferSize = qMax(0, size);
+	m_outputBufferHead = 0;
+	m_outputBufferCount = 0;
+	m_outputBufferHeadOffset = 0;
+
+	m_highWaterMark = qBound(1, highWaterMark, qMax(1, m_outputBufferSize));
+	m_lowWaterMark = qBound(0, lowWaterMark, m_highWaterMark);
+	m_aboveHighWaterMark = false;
+
+	m_dropPolicy = dropPolicy;
+
+	if (m_outputBufferSize > 0) {
+		m_outputBuffer = new quint8[m_outputBufferSize * m_outputFrameSize];
+		m_outputBufferRxNsecs = new qint64[m_outputBufferSize];
+	}
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Enables concealment of lost audio frames.  When a gap is detected in the
+	sequence numbers of the received frames then, before the next frame is
+	written, the missing frames are replaced with synthesised frames using the
+	given \a mode:
+
+	\list
+		\li \c ConcealWithSilence writes silent frames.
+		\li \c ConcealWithRepeat repeats the last frame received.
+		\li \c ConcealWithFade repeats the last frame received with its
+		    amplitude ramped down to zero over the length of the gap.
+	\endlist
+
+	For \c ADPCM output the frames are written still encoded, each frame
+	carries its own decoder state in its header so a repeat is just a copy
+	of the last frame with a new sequence number.  Fading can't be done
+	without re-encoding so silence is used instead.
+
+	Only gaps of up to \a maxGapFrames are concealed, longer gaps are left as
+	a discontinuity in the output and counted as such in concealmentStats().
+
+	Must be called before start().
+
+ */
+bool GattAudioPipe::setConcealment(ConcealmentMode mode, int maxGapFrames)
+{
+	if (Q_UNLIKELY(m_running)) {
+		qWarning("can't change the concealment mode while running");
+		return false;
+	}
+
+	m_concealmentMode = mode;
+
+	// the sequence number is only 8-bits so can't detect longer gaps anyway
+	m_maxConcealedGap = qBound(0, maxGapFrames, 255);
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Switches the output from a pipe to a ring of \a slotCount frames in
+	shared memory, see GattAudioRing for the layout.  The client gets the
+	memfd and eventfd for the ring from sharedMemoryFd() and
+	sharedMemoryEventFd().
+
+	Each decoded frame is put straight into the ring tagged with the time it
+	was written, the eventfd wake-ups are batched within the latency budget
+	the object was constructed with in the same way that pipe writes are
+	coalesced.  If the ring is full the new frame is dropped.
+
+	On success the output pipe is closed, must be called before start().
+
+ */
+bool GattAudioPipe::setSharedMemoryOutput(int slotCount)
+{
+	if (Q_UNLIKELY(m_running)) {
+		qWarning("can't change the output transport while running");
+		return false;
+	}
+
+	GattAudioRing *ring = new GattAudioRing((m_encoding == ADPCM) ? 1 : 2,
+	                                        m_outputFrameSize, slotCount);
+	if (!ring->isValid()) {
+		delete ring;
+		return false;
+	}
+
+	if (m_sharedMemoryRing)
+		delete m_sharedMemoryRing;
+	m_sharedMemoryRing = ring;
+
+	// the output pipe is no longer needed
+	m_outputPipeNotifier.reset();
+
+	if ((m_outputPipeRdFd >= 0) && (::close(m_outputPipeRdFd) != 0))
+		qErrnoWarning(errno, "failed to close output read pipe fd");
+	m_outputPipeRdFd = -1;
+
+	if ((m_outputPipeWrFd >= 0) && (::close(m_outputPipeWrFd) != 0))
+		qErrnoWarning(errno, "failed to close output write pipe fd");
+	m_outputPipeWrFd = -1;
+
+	return true;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	Starts the recording and streaming of data to the output pipe.
@@ -219,9 +473,35 @@ bool GattAudioPipe::start()
 	}
 
 	m_recordingTimer.start();
-	m_frameCount = 0;
-	m_recordingDuration = 0;
-	m_missedSequences = 0;
+	m_frameCount.storeRelease(0);
+
+	// a negative duration means the recording is still in progress
+	m_recordingStartMsecs.storeRelease(m_recordingTimer.msecsSinceReference());
+	m_recordingDuration.storeRelease(-1);
+	m_missedSequences.storeRelease(0);
+
+	m_latencySamples = 0;
+	m_maxLatencyUsecs = 0;
+	m_totalLatencyUsecs = 0;
+
+	m_coalescedBytes = 0;
+	m_coalescedFrames = 0;
+	m_outputWrites = 0;
+
+	m_bufferedBytes.storeRelease(0);
+	m_peakBufferedBytes.storeRelease(0);
+	m_droppedFrames.storeRelease(0);
+
+	m_concealedFrames.storeRelease(0);
+	m_discontinuities.storeRelease(0);
+
+	m_preRollFrames.storeRelease(0);
+
+	m_pendingWakeupFrames = 0;
+
+	m_notifyWakeups = 0;
+	m_notifyPackets = 0;
+	m_maxNotifyPacketsPerWakeup = 0;
 
 	m_running = true;
 
@@ -232,6 +512,10 @@ bool GattAudioPipe::start()
 /*!
 	Stops streaming data to the output pipe.
 
+	If the object has been moved to another thread this must be invoked on that
+	thread, i.e. using \l{QMetaObject::invokeMethod()} with a
+	\c Qt::BlockingQueuedConnection.
+
  */
 void GattAudioPipe::stop()
 {
@@ -240,9 +524,18 @@ void GattAudioPipe::stop()
 		return;
 	}
 
+	// write out anything still being coalesced and try and get anything
+	// buffered into the pipe before it's closed
+	flushOutput();
+	drainOutputBuffer();
+
+	// let the client of a shared memory ring know nothing more is coming
+	if (m_sharedMemoryRing)
+		m_sharedMemoryRing->close();
+
 	m_running = false;
 
-	m_recordingDuration = m_recordingTimer.elapsed();
+	m_recordingDuration.storeRelease(m_recordingTimer.elapsed());
 	m_recordingTimer.invalidate();
 }
 
@@ -253,7 +546,7 @@ void GattAudioPipe::stop()
  */
 int GattAudioPipe::framesReceived() const
 {
-	return m_frameCount;
+	return m_frameCount.loadAcquire();
 }
 
 // -----------------------------------------------------------------------------
@@ -275,24 +568,179 @@ int GattAudioPipe::framesReceived() const
  */
 int GattAudioPipe::framesExpected() const
 {
-	// calculate the time estimate
-	const qint64 msecsElapsed = (m_recordingTimer.isValid()) ?
-		m_recordingTimer.elapsed() : m_recordingDuration;
+	// calculate the time estimate, nb: this may be called from a different
+	// thread to the one running the pipe so only the atomic copies of the
+	// recording times are used
+	qint64 msecsElapsed = m_recordingDuration.loadAcquire();
+	if (msecsElapsed < 0) {
+		QElapsedTimer now;
+		now.start();
+		msecsElapsed = now.msecsSinceReference() - m_recordingStartMsecs.loadAcquire();
+	}
 
 	int timeEstimate = static_cast<int>(msecsElapsed / 12);
 
+	const int seqNumberEstimate = m_frameCount.loadAcquire() +
+	                              m_missedSequences.loadAcquire();
+
 	qDebug("audio frames expected: timeBased=%d, seqNumberBased=%d",
-	       timeEstimate, (m_frameCount + m_missedSequences));
+	       timeEstimate, seqNumberEstimate);
 
 	// if the missed sequence count is within 16 frames of the time estimate
 	// then use that, otherwise use the time
-	int diff = timeEstimate - (m_frameCount + m_missedSequences);
+	int diff = timeEstimate - seqNumberEstimate;
 	if (abs(diff) <= 16)
-		return (m_frameCount + m_missedSequences);
+		return seqNumberEstimate;
 	else
 		return timeEstimate;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	Returns the notify-to-pipe latency stats for the current or last recording.
+
+	Each notification is timestamped when it's read from bluez, the latency
+	recorded for a frame is the time from reading the notification that
+	completed it to the write() that delivered the last of its bytes to the
+	output pipe (or the wake-up of a shared memory client).  So it includes
+	any time spent being coalesced or held in the output buffer.  Synthesised
+	and pre-roll frames aren't included.
+
+	This is not thread safe, if the pipe has been moved to another thread it
+	should only be called after stop() has been invoked.
+
+ */
+GattAudioPipe::LatencyStats GattAudioPipe::latencyStats() const
+{
+	LatencyStats stats = { 0, 0, 0 };
+
+	stats.frames = m_latencySamples;
+	if (stats.frames > 0) {
+		stats.averageUsecs = m_totalLatencyUsecs / stats.frames;
+		stats.maxUsecs = m_maxLatencyUsecs;
+	}
+
+	return stats;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the number of times notifications were delivered to the pipe and
+	the number of notifications delivered, either via addNotifications() or
+	read from the notification pipe.  Used to check how well the notifications
+	are being batched up on each wake-up.
+
+	This is not thread safe, if the pipe has been moved to another thread it
+	should only be called after stop() has been invoked.
+
+ */
+GattAudioPipe::NotificationStats GattAudioPipe::notificationStats() const
+{
+	NotificationStats stats;
+	stats.wakeups = m_notifyWakeups;
+	stats.packets = m_notifyPackets;
+	stats.maxPacketsPerWakeup = m_maxNotifyPacketsPerWakeup;
+
+	return stats;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the number of writes made to the output pipe for the current or
+	last recording.  Without a latency budget this is one per frame.
+
+ */
+int GattAudioPipe::outputWrites() const
+{
+	return m_outputWrites;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the output buffer stats for the current or last recording; the
+	total number of bytes that had to be buffered because the client wasn't
+	reading the pipe quickly enough, the peak number of bytes held in the
+	buffer and the number of decoded frames that were discarded because there
+	was no room for them.
+
+	The buffered byte count is cumulative over the recording, each frame adds
+	its size when it's put in the buffer, so it's not the current depth.  For
+	the shared memory ring every frame goes through the ring so only the peak
+	depth of the ring is reported.
+
+	This is thread safe.
+
+ */
+GattAudioPipe::BufferStats GattAudioPipe::bufferStats() const
+{
+	BufferStats stats;
+	stats.bufferedBytes = m_bufferedBytes.loadAcquire();
+	stats.peakBufferedBytes = m_peakBufferedBytes.loadAcquire();
+	stats.droppedFrames = m_droppedFrames.loadAcquire();
+
+	return stats;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns a dup of the memfd holding the shared memory ring, or an invalid
+	descriptor if the output isn't a shared memory ring.  This can be called
+	from any thread.
+
+ */
+FileDescriptor GattAudioPipe::sharedMemoryFd() const
+{
+	if (!m_sharedMemoryRing)
+		return FileDescriptor();
+
+	return m_sharedMemoryRing->memoryFd();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns a dup of the eventfd signalled when frames are put in the shared
+	memory ring, or an invalid descriptor if the output isn't a shared memory
+	ring.  This can be called from any thread.
+
+ */
+FileDescriptor GattAudioPipe::sharedMemoryEventFd() const
+{
+	if (!m_sharedMemoryRing)
+		return FileDescriptor();
+
+	return m_sharedMemoryRing->eventFd();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the number of synthesised frames written to fill gaps in the audio
+	and the number of gaps that were too long to be concealed.
+
+	This is thread safe.
+
+ */
+GattAudioPipe::ConcealmentStats GattAudioPipe::concealmentStats() const
+{
+	ConcealmentStats stats;
+	stats.concealedFrames = m_concealedFrames.loadAcquire();
+	stats.discontinuities = m_discontinuities.loadAcquire();
+
+	return stats;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the number of pre-roll frames written to the output at the start
+	of the stream.
+
+	This is thread safe.
+
+ */
+int GattAudioPipe::preRollFrames() const
+{
+	return m_preRollFrames.loadAcquire();
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	Takes the read end of the output pipe, this is typically then passed on
@@ -315,6 +763,157 @@ FileDescriptor GattAudioPipe::takeOutputReadFd()
 	return fd;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	Sets the bluez notification pipe that this object should read the audio
+	data notifications from, this is the alternative to calling
+	addNotification() for each notification received.
+
+	The \a notifyPipeFd is dup'ed, the notifier for it is a child of this
+	object so it will be moved with this object to another thread.
+
+	Returns \c true on success and \c false if the pipe couldn't be used.
+
+ */
+bool GattAudioPipe::setNotificationPipe(const FileDescriptor &notifyPipeFd)
+{
+	if (Q_UNLIKELY(m_notifyPipeFd >= 0)) {
+		qWarning("notification pipe already set");
+		return false;
+	}
+
+	if (!notifyPipeFd.isValid()) {
+		qWarning("invalid notification pipe fd");
+		return false;
+	}
+
+	// dup the notification fd
+	m_notifyPipeFd = fcntl(notifyPipeFd.fd(), F_DUPFD_CLOEXEC, 3);
+	if (m_notifyPipeFd < 0) {
+		qErrnoWarning(errno, "failed to dup notification pipe");
+		return false;
+	}
+
+	// put in non-blocking mode
+	int flags = fcntl(m_notifyPipeFd, F_GETFL);
+	if (!(flags & O_NONBLOCK))
+		fcntl(m_notifyPipeFd, F_SETFL, flags | O_NONBLOCK);
+
+	// create a listener for read and exception (pipe closed) events
+	m_notifyPipeNotifier =
+		QSharedPointer<UnixPipeNotifier>(new UnixPipeNotifier(m_notifyPipeFd, this),
+		                                 &QObject::deleteLater);
+	QObject::connect(m_notifyPipeNotifier.data(), &UnixPipeNotifier::readActivated,
+	                 this, &GattAudioPipe::onNotificationPipeActivated);
+	QObject::connect(m_notifyPipeNotifier.data(), &UnixPipeNotifier::exceptionActivated,
+	                 this, &GattAudioPipe::onNotificationPipeActivated);
+
+	m_notifyPipeNotifier->setReadEnabled(true);
+	m_notifyPipeNotifier->setExceptionEnabled(true);
+
+	// setup the buffers for reading the notifications in batches
+	if (!m_notifyReader)
+		m_notifyReader = new UnixPacketReader(m_notifyStride);
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Frees the notifier and closes the notification pipe (if open).
+
+ */
+void GattAudioPipe::closeNotificationPipe()
+{
+	if (m_notifyPipeNotifier) {
+		m_notifyPipeNotifier->setReadEnabled(false);
+		m_notifyPipeNotifier->setExceptionEnabled(false);
+		m_notifyPipeNotifier.reset();
+	}
+
+	if ((m_notifyPipeFd >= 0) && (::close(m_notifyPipeFd) != 0))
+		qErrnoWarning(errno, "failed to close notification pipe fd");
+	m_notifyPipeFd = -1;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Slot called when there are notifications to read from the bluez
+	notification pipe, or the pipe has been closed.
+
+ */
+void GattAudioPipe::onNotificationPipeActivated(int pipeFd)
+{
+	if (Q_UNLIKELY(pipeFd != m_notifyPipeFd))
+		return;
+
+	while (m_notifyPipeFd >= 0) {
+
+		bool closed;
+		const int count = m_notifyReader->read(m_notifyPipeFd, &closed);
+		if (count > 0) {
+			if (Q_UNLIKELY(!m_receivedNotification)) {
+				m_receivedNotification = true;
+				emit firstNotificationReceived();
+			}
+
+			addNotifications(m_notifyReader->packets(), m_notifyReader->stride(),
+			                 m_notifyReader->lengths(), count);
+		}
+
+		if (closed) {
+			// the RCU has disconnected, the owner will stop the recording but
+			// no more data is coming so don't hold back what we have
+			qInfo("audio notification pipe closed");
+
+			closeNotificationPipe();
+			flushOutput();
+			break;
+		}
+
+		// if we didn't fill the batch then the pipe has been drained
+		if (count < UnixPacketReader::MaxBatchSize)
+			break;
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Adds a batch of \a count notifications to the pipe, the notifications are
+	stored back to back every \a stride bytes in \a packets and their sizes
+	are in \a lengths.  All audio notifications should be 20 bytes in size,
+	any that aren't are discarded.
+
+	Each call is counted as a single wake-up in the notificationStats(), and
+	all the notifications in the batch are given the same receive time for
+	the latency stats.
+
+ */
+void GattAudioPipe::addNotifications(const quint8 *packets, size_t stride,
+                                     const quint16 *lengths, int count)
+{
+	const qint64 rxNsecs = m_recordingTimer.isValid() ?
+	                       m_recordingTimer.nsecsElapsed() : -1;
+
+	m_notifyWakeups++;
+	m_notifyPackets += count;
+	m_maxNotifyPacketsPerWakeup = qMax(m_maxNotifyPacketsPerWakeup, count);
+
+	for (int i = 0; i < count; i++) {
+		if (Q_UNLIKELY(lengths[i] != 20)) {
+			qWarning("audio data notification not 20 bytes in size (%hu bytes)",
+			         lengths[i]);
+			continue;
+		}
+
+		appendNotification(packets + (i * stride), rxNsecs);
+	}
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	Call to manually inject a 20 byte notification into the pipe.  Only use this
@@ -323,8 +922,22 @@ FileDescriptor GattAudioPipe::takeOutputReadFd()
  */
 void GattAudioPipe::addNotification(const quint8 value[20])
 {
-	// add the notification to the buffer, if we have a complete frame
-	// then pass on to the decoder
+	appendNotification(value, m_recordingTimer.isValid() ?
+	                          m_recordingTimer.nsecsElapsed() : -1);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Adds the notification  value to the frame buffer, if we have a complete
+	frame then it's passed on to the decoder.   rxNsecs is the time the
+	notification was read, it becomes the receive time of the frame it
+	completes.
+
+ */
+void GattAudioPipe::appendNotification(const quint8 value[20], qint64 rxNsecs)
+{
 	memcpy(m_frameBuffer + m_frameBufferOffset, value, 20);
 	m_frameBufferOffset += 20;
 
@@ -334,19 +947,65 @@ void GattAudioPipe::addNotification(const quint8 value[20])
 		if (Q_UNLIKELY(!m_running))
 			qWarning("received GATT notification before pipe was running");
 		else
-			processAudioFrame(m_frameBuffer);
+			processAudioFrame(m_frameBuffer, rxNsecs);
 	}
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	Writes the raw audio \a frames captured before the stream started to the
+	output, this must be called after start() and before any notifications
+	are added.  The frames are processed as if they had just been received,
+	but are excluded from the latency stats and in shared memory mode are
+	tagged with the \c PreRollFrame flag.
+
+	If \a frames ends with a partial frame then those bytes are kept and the
+	frame is completed by the next notifications.
+
+ */
+void GattAudioPipe::addPreRoll(const QByteArray &frames)
+{
+	if (Q_UNLIKELY(!m_running)) {
+		qWarning("pre-roll audio added before pipe was running");
+		return;
+	}
+
+	const quint8 *data = reinterpret_cast<const quint8*>(frames.constData());
+	const int count = frames.size() / 100;
+
+	// pre-roll frames are excluded from the latency stats, they're just given
+	// the current time so they aren't mistaken for synthesised frames
+	const qint64 nowNsecs = m_recordingTimer.nsecsElapsed();
+
+	m_deliveringPreRoll = true;
+
+	for (int i = 0; i < count; i++)
+		processAudioFrame(data + (i * 100), nowNsecs);
+
+	m_deliveringPreRoll = false;
+
+	m_preRollFrames.fetchAndAddRelease(count);
+
+	// carry on assembling any partial frame from the live notifications
+	m_frameBufferOffset = frames.size() % 100;
+	memcpy(m_frameBuffer, data + (count * 100), m_frameBufferOffset);
+
+	// don't hold the pre-roll for the latency budget, the client wants it
+	// as soon as possible
+	if (count > 0)
+		flushOutput();
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
 
 	Decodes the audio frame and then writes the PCM 16-bit samples into the
-	output pipe.
+	output pipe.  \a rxNsecs is the time the frame was received, used for
+	the latency stats.
 
  */
-void GattAudioPipe::processAudioFrame(const quint8 frame[100])
+void GattAudioPipe::processAudioFrame(const quint8 frame[100], qint64 rxNsecs)
 {
 	const quint8 sequenceNumber = frame[0];
 	const quint8 stepIndex = frame[1];
@@ -361,7 +1020,7 @@ void GattAudioPipe::processAudioFrame(const quint8 frame[100])
 		return;
 
 
-	if (Q_LIKELY(m_frameCount != 0)) {
+	if (Q_LIKELY(m_frameCount.loadAcquire() != 0)) {
 
 		// not the first frame so check the sequence number, this gives us how
 		// many frames where lost, however the catch is the sequence number is
@@ -370,7 +1029,12 @@ void GattAudioPipe::processAudioFrame(const quint8 frame[100])
 		const quint8 expectedSeqNumber = m_lastSequenceNumber + 1;
 		if (expectedSeqNumber != sequenceNumber) {
 			quint8 missed = sequenceNumber - expectedSeqNumber;
-			m_missedSequences += missed;
+			m_missedSequences.fetchAndAddRelease(missed);
+
+			// fill the gap, nb: this is done before decoding this frame so
+			// the decode buffer still holds the last frame received
+			if (m_concealmentMode != NoConcealment)
+				concealFrames(expectedSeqNumber, missed);
 		}
 
 	}
@@ -379,7 +1043,7 @@ void GattAudioPipe::processAudioFrame(const quint8 frame[100])
 	m_lastSequenceNumber = sequenceNumber;
 
 	// increment the count of audio frames received
-	m_frameCount++;
+	m_frameCount.ref();
 
 
 	size_t bufferSize;
@@ -400,37 +1064,483 @@ void GattAudioPipe::processAudioFrame(const quint8 frame[100])
 		return;
 	}
 
+	outputFrame(m_decodeBuffer, bufferSize, rxNsecs);
+}
 
-	// write the pcm data into the output pipe
-	if (Q_LIKELY(m_outputPipeWrFd >= 0)) {
+// -----------------------------------------------------------------------------
+/*!
+	\internal
 
-		ssize_t wr = TEMP_FAILURE_RETRY(::write(m_outputPipeWrFd, m_decodeBuffer,
-		                                        bufferSize));
-		if (wr < 0) {
+	Writes \a count synthesised frames to the output to fill a gap in the
+	audio, the \a firstSequenceNumber is the sequence number of the first
+	missing frame.  If the gap is longer than the limit then nothing is
+	written and the gap is counted as a discontinuity.
+
+	Expects the decode buffer to still contain the last frame received, that
+	is used as the source for the repeat and fade modes.
+
+ */
+void GattAudioPipe::concealFrames(quint8 firstSequenceNumber, int count)
+{
+	if (count > m_maxConcealedGap) {
+		qWarning("gap of %d audio frames is too long to conceal, leaving a"
+		         " discontinuity", count);
+		m_discontinuities.ref();
+		return;
+	}
 
-			// check if the pipe is full
-			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
-				qWarning("voice audio pipe is full, frame discarded");
+	ConcealmentMode mode = m_concealmentMode;
+	if ((mode == ConcealWithFade) && (m_encoding == OutputEncoding::ADPCM))
+		mode = ConcealWithSilence;
 
-			} else {
-				// check if AS closed the pipe, this is not an error so don't
-				// log it as such
-				if (errno == EPIPE)
-					qInfo("output voice audio pipe closed by client");
-				else
-					qErrnoWarning(errno, "output voice audio pipe write failed");
+	const int samplesPerFrame = static_cast<int>(sizeof(m_concealBuffer) / sizeof(qint16));
+	const qint32 totalSamples = count * samplesPerFrame;
 
-				// close down the pipe
-				onOutputPipeException(m_outputPipeWrFd);
-			}
+	quint8 *encodedFrame = reinterpret_cast<quint8*>(m_concealBuffer);
+
+	for (int i = 0; i < count; i++) {
+
+		switch (mode) {
+			case ConcealWithSilence:
+				// for ADPCM a zero step index and previous value with all
+				// zero samples decodes to silence
+				memset(m_concealBuffer, 0x00, m_outputFrameSize);
+				break;
+
+			case ConcealWithRepeat:
+				memcpy(m_concealBuffer, m_decodeBuffer, m_outputFrameSize);
+				break;
+
+			case ConcealWithFade:
+				// linear ramp down to zero over the whole gap
+				for (int j = 0; j < samplesPerFrame; j++) {
+					const qint32 remaining = totalSamples - ((i * samplesPerFrame) + j);
+					m_concealBuffer[j] = static_cast<qint16>((qint32(m_decodeBuffer[j]) * remaining)
+					                                         / totalSamples);
+				}
+				break;
+
+			default:
+				return;
+		}
+
+		// ADPCM frames need the sequence number of the frame they replace
+		if (m_encoding == OutputEncoding::ADPCM)
+			encodedFrame[0] = static_cast<quint8>(firstSequenceNumber + i);
+
+		outputFrame(m_concealBuffer, m_outputFrameSize, -1);
+	}
+
+	m_concealedFrames.fetchAndAddRelease(count);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Writes a single frame to the output pipe, or adds it to the coalesce
+	buffer if coalescing.  The \a rxNsecs is the time the frame was received
+	used for the latency stats, synthesised frames pass \c -1 so they aren't
+	included in the stats.
+
+ */
+void GattAudioPipe::outputFrame(const void *data, size_t length, qint64 rxNsecs)
+{
+	// if using shared memory the frame goes straight into the ring
+	if (m_sharedMemoryRing) {
+		writeSharedMemory(data, length, rxNsecs);
+		return;
+	}
+
+	// pre-roll frames were received before the stream started so would
+	// skew the latency stats
+	if (m_deliveringPreRoll)
+		rxNsecs = -1;
+
+	// if not coalescing then write the frame straight into the output pipe
+	if (m_coalesceFrameLimit <= 1) {
+		writeOutput(data, length, &rxNsecs);
+		return;
+	}
+
+	// otherwise add to the coalesce buffer and write when full, if this is
+	// the first frame in the buffer start the latency budget timer
+	memcpy(m_coalesceBuffer + m_coalescedBytes, data, length);
+	m_coalescedBytes += length;
+	m_coalescedRxNsecs[m_coalescedFrames++] = rxNsecs;
+
+	if (m_coalescedFrames >= m_coalesceFrameLimit)
+		flushOutput();
+	else if (m_coalescedFrames == 1)
+		m_flushTimer->start();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Writes all the frames in the coalesce buffer to the output pipe, called
+	when the buffer is full, the latency budget timer expires, the input pipe
+	is closed or the pipe is stopped.
+
+ */
+void GattAudioPipe::flushOutput()
+{
+	if (m_flushTimer)
+		m_flushTimer->stop();
+
+	// for shared memory the frames are already in the ring, just need to
+	// wake the client
+	if (m_sharedMemoryRing) {
+		if (m_pendingWakeupFrames > 0) {
+			m_sharedMemoryRing->notify();
+			m_outputWrites++;
+
+			for (int i = 0; i < m_pendingWakeupFrames; i++)
+				updateLatencyStats(m_coalescedRxNsecs[i]);
+
+			m_pendingWakeupFrames = 0;
+		}
+		return;
+	}
+
+	if (m_coalescedFrames == 0)
+		return;
+
+	writeOutput(m_coalesceBuffer, m_coalescedBytes, m_coalescedRxNsecs);
+
+	m_coalescedBytes = 0;
+	m_coalescedFrames = 0;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Writes the decoded audio \a data into the output pipe, the \a length is
+	always a whole number of frames and \a rxNsecs holds the receive time of
+	each frame.  If there is already data in the output buffer, or the pipe
+	is full, the frames are added to the buffer to be written later.
+
+ */
+void GattAudioPipe::writeOutput(const void *data, size_t length,
+                                const qint64 *rxNsecs)
+{
+	if (Q_UNLIKELY(m_outputPipeWrFd < 0))
+		return;
+
+	const quint8 *frames = reinterpret_cast<const quint8*>(data);
+
+	// if there is already data buffered then this must go behind it
+	if (m_outputBufferCount > 0) {
+		bufferOutput(frames, length, rxNsecs);
+		return;
+	}
+
+	m_outputWrites++;
+
+	ssize_t wr = TEMP_FAILURE_RETRY(::write(m_outputPipeWrFd, data, length));
+	if (wr < 0) {
+
+		// check if the pipe is full
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+			wr = 0;
+
+		} else {
+			// check if AS closed the pipe, this is not an error so don't
+			// log it as such
+			if (errno == EPIPE)
+				qInfo("output voice audio pipe closed by client");
+			else
+				qErrnoWarning(errno, "output voice audio pipe write failed");
+
+			// close down the pipe
+			onOutputPipeException(m_outputPipeWrFd);
+			return;
+		}
+	}
+
+	// the frames that were completely written have been delivered
+	const size_t framesWritten = static_cast<size_t>(wr) / m_outputFrameSize;
+	for (size_t i = 0; i < framesWritten; i++)
+		updateLatencyStats(rxNsecs[i]);
 
-		} else if (static_cast<size_t>(wr) != bufferSize) {
+	if (static_cast<size_t>(wr) == length)
+		return;
+
+	// couldn't write it all, if there is no buffer then the rest is lost
+	if (!m_outputBuffer) {
+		if (wr == 0)
+			qWarning("voice audio pipe is full, frame discarded");
+		else
 			qWarning("only %zd of the possible %zu bytes of audio data could be"
-			         " sent", wr, bufferSize);
+			         " sent", wr, length);
+
+		m_droppedFrames.fetchAndAddRelease((length - wr) / m_outputFrameSize);
+		return;
+	}
+
+	// otherwise buffer the rest starting from the frame that was only
+	// partially written (if any), the buffer is empty so that frame will be
+	// at the head
+	m_outputBufferHeadOffset = static_cast<size_t>(wr) % m_outputFrameSize;
+
+	bufferOutput(frames + (framesWritten * m_outputFrameSize),
+	             length - (framesWritten * m_outputFrameSize),
+	             rxNsecs + framesWritten);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Adds the whole frames in \a data to the tail of the output buffer, along
+	with their receive times from \a rxNsecs, and enables the write notifier
+	so the buffer is drained once the client has read from the pipe.  If the
+	buffer is full the drop policy is applied.
+
+ */
+void GattAudioPipe::bufferOutput(const quint8 *data, size_t length,
+                                 const qint64 *rxNsecs)
+{
+	// if the buffer is empty then the first frame may have been partially
+	// written already, those bytes were never buffered
+	int addedBytes = (m_outputBufferCount == 0) ? -int(m_outputBufferHeadOffset) : 0;
+
+	for (size_t offset = 0, i = 0; offset < length; offset += m_outputFrameSize, i++) {
+
+		if (m_outputBufferCount == m_outputBufferSize) {
+
+			// when dropping the oldest we can't drop a frame that has been
+			// partially written, instead the next frame is dropped by
+			// moving the partial frame up one slot
+			const bool canDropOldest = (m_outputBufferHeadOffset == 0) ||
+			                           (m_outputBufferCount > 1);
+
+			m_droppedFrames.ref();
+
+			if ((m_dropPolicy == DropNewest) || !canDropOldest)
+				continue;
+
+			const int nextSlot = (m_outputBufferHead + 1) % m_outputBufferSize;
+			if (m_outputBufferHeadOffset != 0) {
+				memcpy(m_outputBuffer + (nextSlot * m_outputFrameSize),
+				       m_outputBuffer + (m_outputBufferHead * m_outputFrameSize),
+				       m_outputFrameSize);
+				m_outputBufferRxNsecs[nextSlot] = m_outputBufferRxNsecs[m_outputBufferHead];
+			}
+
+			m_outputBufferHead = nextSlot;
+			m_outputBufferCount--;
 		}
 
+		const int tailSlot = (m_outputBufferHead + m_outputBufferCount) % m_outputBufferSize;
+		memcpy(m_outputBuffer + (tailSlot * m_outputFrameSize), data + offset,
+		       m_outputFrameSize);
+		m_outputBufferRxNsecs[tailSlot] = rxNsecs[i];
+		m_outputBufferCount++;
+
+		addedBytes += int(m_outputFrameSize);
+	}
+
+	// update the total and peak depth stats
+	if (addedBytes > 0)
+		m_bufferedBytes.fetchAndAddRelease(addedBytes);
+
+	const int depth = (m_outputBufferCount * m_outputFrameSize) - m_outputBufferHeadOffset;
+	if (depth > m_peakBufferedBytes.loadAcquire())
+		m_peakBufferedBytes.storeRelease(depth);
+
+	if (!m_aboveHighWaterMark && (m_outputBufferCount >= m_highWaterMark)) {
+		qWarning("voice audio pipe is full, %d frames buffered",
+		         m_outputBufferCount);
+		m_aboveHighWaterMark = true;
+	}
+
+	if ((m_outputBufferCount > 0) && m_outputPipeNotifier)
+		m_outputPipeNotifier->setWriteEnabled(true);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Writes as much of the output buffer to the pipe as it will take, the
+	buffer is a ring so this may require two io vectors.
+
+	If the output is a packet pipe (O_DIRECT) then each write() is a packet
+	the client reads as a frame, so in that case the frames are written one
+	at a time.  A packet pipe write of a single frame is atomic so there is
+	never a partially written frame at the head of the buffer.
+
+ */
+void GattAudioPipe::drainOutputBuffer()
+{
+	while ((m_outputBufferCount > 0) && (m_outputPipeWrFd >= 0)) {
+
+		struct iovec iov[2];
+		int iovCount = 1;
+		size_t totalLength;
+
+		const int firstSlots = qMin(m_outputBufferCount,
+		                            (m_outputBufferSize - m_outputBufferHead));
+
+		iov[0].iov_base = m_outputBuffer + (m_outputBufferHead * m_outputFrameSize)
+		                + m_outputBufferHeadOffset;
+		iov[0].iov_len = ((m_packetMode ? 1 : firstSlots) * m_outputFrameSize)
+		               - m_outputBufferHeadOffset;
+		totalLength = iov[0].iov_len;
+
+		if (!m_packetMode && (firstSlots < m_outputBufferCount)) {
+			iov[1].iov_base = m_outputBuffer;
+			iov[1].iov_len = (m_outputBufferCount - firstSlots) * m_outputFrameSize;
+			totalLength += iov[1].iov_len;
+			iovCount = 2;
+		}
+
+		m_outputWrites++;
+
+		ssize_t wr = TEMP_FAILURE_RETRY(::writev(m_outputPipeWrFd, iov, iovCount));
+		if (wr < 0) {
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN))
+				break;
+
+			if (errno == EPIPE)
+				qInfo("output voice audio pipe closed by client");
+			else
+				qErrnoWarning(errno, "output voice audio pipe write failed");
+
+			onOutputPipeException(m_outputPipeWrFd);
+			return;
+		}
+
+		// consume the bytes written from the head of the buffer
+		const size_t consumed = m_outputBufferHeadOffset + static_cast<size_t>(wr);
+		const int slots = static_cast<int>(consumed / m_outputFrameSize);
+
+		for (int i = 0; i < slots; i++)
+			updateLatencyStats(m_outputBufferRxNsecs[(m_outputBufferHead + i) % m_outputBufferSize]);
+
+		m_outputBufferHead = (m_outputBufferHead + slots) % m_outputBufferSize;
+		m_outputBufferCount -= slots;
+		m_outputBufferHeadOffset = consumed % m_outputFrameSize;
+
+		// if the write was short the pipe is full again
+		if (static_cast<size_t>(wr) != totalLength)
+			break;
+	}
+
+	if (m_aboveHighWaterMark && (m_outputBufferCount <= m_lowWaterMark)) {
+		qInfo("voice audio pipe drained, %d frames buffered", m_outputBufferCount);
+		m_aboveHighWaterMark = false;
 	}
 
+	if ((m_outputBufferCount == 0) && m_outputPipeNotifier)
+		m_outputPipeNotifier->setWriteEnabled(false);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Puts a frame into the shared memory ring and wakes the client once
+	enough frames have been added, or the latency budget expires.  Frames
+	with a negative \a rxNsecs are synthesised so are tagged as such in the
+	ring.  The latency stats for the frame are updated when the client is
+	woken.
+
+ */
+void GattAudioPipe::writeSharedMemory(const void *data, size_t length, qint64 rxNsecs)
+{
+	if (Q_UNLIKELY(m_sharedMemoryRing->isReaderClosed())) {
+		closeSharedMemoryOutput();
+		return;
+	}
+
+	quint16 flags = 0;
+	if (rxNsecs < 0)
+		flags |= GattAudioRing::ConcealedFrame;
+	if (m_deliveringPreRoll)
+		flags |= GattAudioRing::PreRollFrame;
+
+	if (!m_sharedMemoryRing->write(data, length, flags)) {
+		qWarning("voice audio ring is full, frame discarded");
+		m_droppedFrames.ref();
+		rxNsecs = -1;
+	}
+
+	// update the peak depth stat
+	const int depth = m_sharedMemoryRing->depth() * static_cast<int>(m_outputFrameSize);
+	if (depth > m_peakBufferedBytes.loadAcquire())
+		m_peakBufferedBytes.storeRelease(depth);
+
+	// batch the wake-ups within the latency budget
+	m_coalescedRxNsecs[m_pendingWakeupFrames] = m_deliveringPreRoll ? -1 : rxNsecs;
+	if (++m_pendingWakeupFrames >= m_coalesceFrameLimit)
+		flushOutput();
+	else if (m_pendingWakeupFrames == 1)
+		m_flushTimer->start();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when the client has flagged that it's no longer reading the shared
+	memory ring, equivalent to the client closing the output pipe.
+
+ */
+void GattAudioPipe::closeSharedMemoryOutput()
+{
+	qInfo("output voice audio ring closed by client");
+
+	if (m_flushTimer)
+		m_flushTimer->stop();
+	m_pendingWakeupFrames = 0;
+
+	delete m_sharedMemoryRing;
+	m_sharedMemoryRing = nullptr;
+
+	emit outputPipeClosed();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Slot called when the output pipe has room, used to drain the output
+	buffer.
+
+ */
+void GattAudioPipe::onOutputPipeWritable(int pipeFd)
+{
+	if (Q_UNLIKELY(pipeFd != m_outputPipeWrFd))
+		return;
+
+	drainOutputBuffer();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called after each frame has been delivered to the client to update the
+	latency stats, \a rxNsecs is the time the frame was received or \c -1
+	for frames that shouldn't be included.  See latencyStats() for details on
+	how they're calculated.
+
+ */
+void GattAudioPipe::updateLatencyStats(qint64 rxNsecs)
+{
+	// frames delivered after the recording was stopped aren't counted
+	if ((rxNsecs < 0) || !m_recordingTimer.isValid())
+		return;
+
+	const qint64 latencyUsecs = (m_recordingTimer.nsecsElapsed() - rxNsecs) / 1000;
+
+	m_latencySamples++;
+	m_maxLatencyUsecs = qMax(m_maxLatencyUsecs, latencyUsecs);
+	m_totalLatencyUsecs += latencyUsecs;
 }
 
 // -----------------------------------------------------------------------------
@@ -452,6 +1562,16 @@ void GattAudioPipe::onOutputPipeException(int pipeFd)
 	m_outputPipeNotifier->setExceptionEnabled(false);
 	m_outputPipeNotifier.reset();
 
+	// nowhere to write any coalesced frames so drop them
+	if (m_flushTimer)
+		m_flushTimer->stop();
+	m_coalescedBytes = 0;
+	m_coalescedFrames = 0;
+
+	m_outputBufferHead = 0;
+	m_outputBufferCount = 0;
+	m_outputBufferHeadOffset = 0;
+
 	// close the output pipe
 	if ((m_outputPipeWrFd >= 0) && (::close(m_outputPipeWrFd) != 0))
 		qErrnoWarning(errno, "failed to close output pipe");
@@ -29,12 +29,19 @@
 
 #include <QObject>
 #include <QString>
+#include <QByteArray>
+#include <QAtomicInt>
+#include <QAtomicInteger>
 #include <QElapsedTimer>
 #include <QSharedPointer>
 
 
 class VoiceCodec;
 class UnixPipeNotifier;
+class GattAudioRing;
+class UnixPacketReader;
+
+class QTimer;
 
 
 class GattAudioPipe final : public QObject
@@ -62,9 +69,54 @@ public:
 	Q_ENUMS(OutputEncoding)
 #endif
 
+	enum BufferDropPolicy {
+		DropOldest,
+		DropNewest
+	};
+#if QT_VERSION > QT_VERSION_CHECK(5, 4, 0)
+	Q_ENUM(BufferDropPolicy)
+#else
+	Q_ENUMS(BufferDropPolicy)
+#endif
+
+	enum ConcealmentMode {
+		NoConcealment,
+		ConcealWithSilence,
+		ConcealWithRepeat,
+		ConcealWithFade
+	};
+#if QT_VERSION > QT_VERSION_CHECK(5, 4, 0)
+	Q_ENUM(ConcealmentMode)
+#else
+	Q_ENUMS(ConcealmentMode)
+#endif
+
+	struct LatencyStats {
+		int frames;
+		qint64 averageUsecs;
+		qint64 maxUsecs;
+	};
+
+	struct NotificationStats {
+		int wakeups;
+		int packets;
+		int maxPacketsPerWakeup;
+	};
+
+	struct BufferStats {
+		quint32 bufferedBytes;
+		quint32 peakBufferedBytes;
+		quint32 droppedFrames;
+	};
+
+	struct ConcealmentStats {
+		quint32 concealedFrames;
+		quint32 discontinuities;
+	};
+
 public:
 	explicit GattAudioPipe(OutputEncoding encoding, int outputPipeFd = -1,
-	                       QObject *parent = nullptr);
+	                       int latencyBudget = 0, QObject *parent = nullptr);
 	~GattAudioPipe() final;
 
 public:
@@ -72,23 +124,61 @@ public:
 
 	bool isOutputOpen() const;
 
+	bool setOutputBuffer(int size, int highWaterMark, int lowWaterMark,
+	                     BufferDropPolicy dropPolicy);
+
+	bool setConcealment(ConcealmentMode mode, int maxGapFrames);
+
+	bool setSharedMemoryOutput(int slotCount);
+
 	bool start();
-	void stop();
+	Q_INVOKABLE void stop();
 
 	int framesReceived() const;
 	int framesExpected() const;
 
+	LatencyStats latencyStats() const;
+	NotificationStats notificationStats() const;
+	int outputWrites() const;
+	BufferStats bufferStats() const;
+	ConcealmentStats concealmentStats() const;
+
 	FileDescriptor takeOutputReadFd();
 
+	FileDescriptor sharedMemoryFd() const;
+	FileDescriptor sharedMemoryEventFd() const;
+
+	bool setNotificationPipe(const FileDescriptor &notifyPipeFd);
+
 	void addNotification(const quint8 value[20]);
+	void addNotifications(const quint8 *packets, size_t stride,
+	                      const quint16 *lengths, int count);
+
+	void addPreRoll(const QByteArray &frames);
+	int preRollFrames() const;
 
 signals:
 	void outputPipeClosed();
+	void firstNotificationReceived();
 
 private:
 	void onOutputPipeException(int pipeFd);
-
-	void processAudioFrame(const quint8 frame[100]);
+	void onOutputPipeWritable(int pipeFd);
+	void onNotificationPipeActivated(int pipeFd);
+
+	void closeNotificationPipe();
+
+	void appendNotification(const quint8 value[20], qint64 rxNsecs);
+	void processAudioFrame(const quint8 frame[100], qint64 rxNsecs);
+	void concealFrames(quint8 firstSequenceNumber, int count);
+	void outputFrame(const void *data, size_t length, qint64 rxNsecs);
+	void writeOutput(const void *data, size_t length, const qint64 *rxNsecs);
+	void flushOutput();
+	void bufferOutput(const quint8 *data, size_t length, const qint64 *rxNsecs);
+	void drainOutputBuffer();
+	void writeSharedMemory(const void *data, size_t length, qint64 rxNsecs);
+	void closeSharedMemoryOutput();
+	void updateLatencyStats(qint64 rxNsecs);
 
 private:
 	const OutputEncoding m_encoding;
@@ -100,19 +190,78 @@ private:
 
 	QSharedPointer<UnixPipeNotifier> m_outputPipeNotifier;
 
+	static const size_t m_notifyStride = 32;
+
+	int m_notifyPipeFd;
+	QSharedPointer<UnixPipeNotifier> m_notifyPipeNotifier;
+	bool m_receivedNotification;
+
+	UnixPacketReader *m_notifyReader;
+
+	int m_notifyWakeups;
+	int m_notifyPackets;
+	int m_maxNotifyPacketsPerWakeup;
+
 	quint8 m_frameBuffer[100];
 	size_t m_frameBufferOffset;
 
 	qint16 m_decodeBuffer[(96 * 2)];
 
+	ConcealmentMode m_concealmentMode;
+	int m_maxConcealedGap;
+	qint16 m_concealBuffer[(96 * 2)];
+
+	QAtomicInt m_concealedFrames;
+	QAtomicInt m_discontinuities;
+
+	bool m_deliveringPreRoll;
+	QAtomicInt m_preRollFrames;
+
+	static const int m_maxCoalescedFrames = 20;
+
+	int m_coalesceFrameLimit;
+	QTimer *m_flushTimer;
+	quint8 *m_coalesceBuffer;
+	size_t m_coalescedBytes;
+	int m_coalescedFrames;
+	qint64 m_coalescedRxNsecs[m_maxCoalescedFrames];
+	int m_outputWrites;
+
+	const size_t m_outputFrameSize;
+	quint8 *m_outputBuffer;
+	qint64 *m_outputBufferRxNsecs;
+	int m_outputBufferSize;
+	int m_outputBufferHead;
+	int m_outputBufferCount;
+	size_t m_outputBufferHeadOffset;
+	int m_highWaterMark;
+	int m_lowWaterMark;
+	bool m_aboveHighWaterMark;
+	BufferDropPolicy m_dropPolicy;
+	bool m_packetMode;
+
+	GattAudioRing *m_sharedMemoryRing;
+	int m_pendingWakeupFrames;
+
+	QAtomicInt m_bufferedBytes;
+	QAtomicInt m_peakBufferedBytes;
+	QAtomicInt m_droppedFrames;
+
 	bool m_running;
 
-	int m_frameCount;
+	QAtomicInt m_frameCount;
 	QElapsedTimer m_recordingTimer;
-	qint64 m_recordingDuration;
 
-	int m_missedSequences;
+	// read by framesExpected() on the main thread in worker thread mode
+	QAtomicInteger<qint64> m_recordingStartMsecs;
+	QAtomicInteger<qint64> m_recordingDuration;
+
+	QAtomicInt m_missedSequences;
 	quint8 m_lastSequenceNumber;
+
+	int m_latencySamples;
+	qint64 m_maxLatencyUsecs;
+	qint64 m_totalLatencyUsecs;
 };
 
 
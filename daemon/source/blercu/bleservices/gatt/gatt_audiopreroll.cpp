@@ -0,0 +1,185 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  gatt_audiopreroll.cpp
+//  SkyBluetoothRcu
+//
+
+#include "gatt_audiopreroll.h"
+
+#include "utils/logging.h"
+
+#include <string.h>
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class GattAudioPreRoll
+	\brief Bounded ring of the most recent raw ADPCM frames received from the
+	RCU while no audio stream is running.
+
+	The RCU can start sending audio before the state machine has finished
+	the start streaming handshake, without this those frames are discarded
+	and the start of the voice search is clipped.  Instead the notifications
+	are assembled into frames and kept here, when the stream starts the
+	frames are passed to the audio pipe ahead of the live audio.
+
+	Only the last \c maxFrames frames are kept, older ones are overwritten.
+	Each frame is timestamped so that stale audio, for example the tail of
+	a previous stream, can be skipped when the ring is flushed.
+
+ */
+
+
+// -----------------------------------------------------------------------------
+/*!
+	Creates a ring holding up to \a maxFrames frames, if \a maxFrames is zero
+	or less then pre-roll is disabled and all notifications are discarded.
+
+ */
+GattAudioPreRoll::GattAudioPreRoll(int maxFrames)
+	: m_maxFrames(qMax(maxFrames, 0))
+	, m_head(0)
+	, m_count(0)
+	, m_partialOffset(0)
+	, m_framesCaptured(0)
+{
+	if (m_maxFrames > 0) {
+		m_frames.resize(m_maxFrames * m_frameSize);
+		m_timestamps.resize(m_maxFrames);
+	}
+
+	m_clock.start();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns \c true if the ring has space for at least one frame.
+
+ */
+bool GattAudioPreRoll::isEnabled() const
+{
+	return (m_maxFrames > 0);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Adds a batch of audio data notifications to the ring, every 5 packets
+	make up a frame.  Packets that aren't 20 bytes in size are ignored, the
+	same as the audio pipe does.
+
+ */
+void GattAudioPreRoll::addNotifications(const quint8 *packets, size_t stride,
+                                        const quint16 *lengths, int count)
+{
+	if (Q_UNLIKELY(m_maxFrames == 0))
+		return;
+
+	for (int i = 0; i < count; i++) {
+		if (Q_UNLIKELY(lengths[i] != m_packetSize))
+			continue;
+
+		memcpy(m_partialFrame + m_partialOffset, packets + (i * stride), m_packetSize);
+		m_partialOffset += m_packetSize;
+
+		if (m_partialOffset < m_frameSize)
+			continue;
+
+		m_partialOffset = 0;
+
+		// store the complete frame in the next slot, overwriting the oldest
+		// frame if full
+		const int slot = (m_head + m_count) % m_maxFrames;
+		memcpy(m_frames.data() + (slot * m_frameSize), m_partialFrame, m_frameSize);
+		m_timestamps[slot] = m_clock.elapsed();
+
+		if (m_count < m_maxFrames)
+			m_count++;
+		else
+			m_head = (m_head + 1) % m_maxFrames;
+
+		m_framesCaptured++;
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the frames in the ring, oldest first, that were received within
+	the last \a maxAgeMsecs milliseconds and then empties the ring.  The
+	number of whole frames returned is stored in \a frameCount.
+
+	If a frame was only partially received the packets received so far are
+	appended after the whole frames, so the returned data may not be a
+	multiple of the frame size.  Whoever gets the data needs to carry on
+	assembling the frame from the next notification.
+
+ */
+QByteArray GattAudioPreRoll::takeFrames(qint64 maxAgeMsecs, int *frameCount)
+{
+	QByteArray frames;
+
+	// skip the stale frames
+	const qint64 oldest = m_clock.elapsed() - maxAgeMsecs;
+	while ((m_count > 0) && (m_timestamps[m_head] < oldest)) {
+		m_head = (m_head + 1) % m_maxFrames;
+		m_count--;
+	}
+
+	if (frameCount)
+		*frameCount = m_count;
+
+	frames.reserve((m_count * m_frameSize) + m_partialOffset);
+
+	for (int i = 0; i < m_count; i++) {
+		const int slot = (m_head + i) % m_maxFrames;
+		frames.append(m_frames.constData() + (slot * m_frameSize), m_frameSize);
+	}
+
+	frames.append(reinterpret_cast<const char*>(m_partialFrame), m_partialOffset);
+
+	clear();
+
+	return frames;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Discards all the frames in the ring including any partially received
+	frame.
+
+ */
+void GattAudioPreRoll::clear()
+{
+	m_head = 0;
+	m_count = 0;
+	m_partialOffset = 0;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the total number of frames added to the ring since it was
+	created, including ones that were overwritten or skipped as stale.
+
+ */
+int GattAudioPreRoll::framesCaptured() const
+{
+	return m_framesCaptured;
+}
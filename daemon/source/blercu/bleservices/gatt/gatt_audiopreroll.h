@@ -0,0 +1,73 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  gatt_audiopreroll.h
+//  SkyBluetoothRcu
+//
+
+#ifndef GATT_AUDIOPREROLL_H
+#define GATT_AUDIOPREROLL_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <QByteArray>
+#include <QElapsedTimer>
+
+
+class GattAudioPreRoll
+{
+public:
+	explicit GattAudioPreRoll(int maxFrames);
+	~GattAudioPreRoll() = default;
+
+public:
+	bool isEnabled() const;
+
+	void addNotifications(const quint8 *packets, size_t stride,
+	                      const quint16 *lengths, int count);
+
+	QByteArray takeFrames(qint64 maxAgeMsecs, int *frameCount);
+	void clear();
+
+	int framesCaptured() const;
+
+private:
+	static const int m_frameSize = 100;
+	static const int m_packetSize = 20;
+
+	const int m_maxFrames;
+
+	QByteArray m_frames;
+	QVector<qint64> m_timestamps;
+	int m_head;
+	int m_count;
+
+	quint8 m_partialFrame[m_frameSize];
+	int m_partialOffset;
+
+	QElapsedTimer m_clock;
+	int m_framesCaptured;
+
+private:
+	Q_DISABLE_COPY(GattAudioPreRoll)
+};
+
+
+#endif // !defined(GATT_AUDIOPREROLL_H)
@@ -0,0 +1,342 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  gatt_audioring.cpp
+//  SkyBluetoothRcu
+//
+
+#include "gatt_audioring.h"
+
+#include "utils/logging.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+
+// older C libraries don't have the memfd / sealing definitions
+#if !defined(MFD_CLOEXEC)
+#  define MFD_CLOEXEC           0x0001U
+#  define MFD_ALLOW_SEALING     0x0002U
+#endif
+
+#if !defined(F_ADD_SEALS)
+#  define F_ADD_SEALS           (1024 + 9)
+#  define F_SEAL_SEAL           0x0001
+#  define F_SEAL_SHRINK         0x0002
+#  define F_SEAL_GROW           0x0004
+#endif
+
+
+static_assert(sizeof(GattAudioRingHeader) == 192, "invalid ring header size");
+static_assert(sizeof(GattAudioRingSlot) == 16, "invalid ring slot size");
+
+#define BRAR   quint32(0x42524152)   // 'BRAR'
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class GattAudioRing
+	\brief Single producer / single consumer ring of audio frames in a sealed
+	memfd, used as an alternative to a pipe for sending voice audio to
+	clients.
+
+	The memory starts with a GattAudioRingHeader followed by \c slotCount
+	slots each \c slotSize bytes long, every slot contains one frame of audio
+	prefixed with a GattAudioRingSlot header holding the time the frame was
+	written.
+
+	The daemon only ever writes the \c writeIndex and the client only ever
+	writes the \c readIndex, both are free running 32-bit counters of frames
+	and the slot is the counter masked by (\c slotCount - 1).  The daemon
+	fills a slot then increments the \c writeIndex with release semantics,
+	the client reads the frames up to the \c writeIndex (with acquire
+	semantics) then updates the \c readIndex.  Nothing ever waits on the
+	other side, if the ring is full the new frame is dropped.
+
+	The daemon signals an eventfd after writing frames, the client can poll
+	it and read whenever it likes, the eventfd counter just accumulates so
+	the client can batch its own wake-ups.
+
+	When the daemon stops streaming it sets the \c WriterClosed flag, if the
+	client is no longer interested it should set the \c ReaderClosed flag.
+
+	The memfd is sealed against resizing so the client can safely map it,
+	the values the client writes are never used by the daemon for anything
+	other than the free space calculation so a misbehaving client can only
+	cause frames to be dropped.
+
+ */
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Wrapper around the memfd_create syscall, not all versions of the C library
+	we build against have the wrapper function.
+ */
+static int memfdCreate(const char *name, unsigned int flags)
+{
+#if defined(__NR_memfd_create)
+	return static_cast<int>(syscall(__NR_memfd_create, name, flags));
+#else
+	Q_UNUSED(name);
+	Q_UNUSED(flags);
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Creates a ring for frames of up to \a frameSize bytes, the number of slots
+	is \a slotCount rounded up to the next power of 2.  The \a encoding value
+	is just stored in the header for the client.
+
+	Use isValid() to check the ring was created.
+
+ */
+GattAudioRing::GattAudioRing(quint32 encoding, size_t frameSize, int slotCount)
+	: m_memFd(-1)
+	, m_eventFd(-1)
+	, m_mapSize(0)
+	, m_map(nullptr)
+	, m_header(nullptr)
+	, m_frameSize(frameSize)
+	, m_slotSize(0)
+	, m_slotMask(0)
+{
+	// round the slot count up to a power of 2 between 16 and 4096
+	quint32 slots = 16;
+	while ((slots < static_cast<quint32>(slotCount)) && (slots < 4096))
+		slots <<= 1;
+
+	m_slotMask = slots - 1;
+
+	// each slot is cache line aligned
+	m_slotSize = (sizeof(GattAudioRingSlot) + m_frameSize + 63) & ~size_t(63);
+	m_mapSize = sizeof(GattAudioRingHeader) + (m_slotSize * slots);
+
+
+	m_memFd = memfdCreate("blercu-voice", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (m_memFd < 0) {
+		qErrnoWarning(errno, "failed to create memfd for voice audio");
+		return;
+	}
+
+	if (ftruncate(m_memFd, m_mapSize) != 0) {
+		qErrnoWarning(errno, "failed to resize voice audio memfd");
+		return;
+	}
+
+	void *map = mmap(nullptr, m_mapSize, (PROT_READ | PROT_WRITE), MAP_SHARED,
+	                 m_memFd, 0);
+	if (map == MAP_FAILED) {
+		qErrnoWarning(errno, "failed to map voice audio memfd");
+		return;
+	}
+
+	// seal the size so the client can't shrink it from under us
+	if (fcntl(m_memFd, F_ADD_SEALS, (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) != 0)
+		qErrnoWarning(errno, "failed to seal voice audio memfd");
+
+
+	m_eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (m_eventFd < 0) {
+		qErrnoWarning(errno, "failed to create eventfd for voice audio");
+		munmap(map, m_mapSize);
+		return;
+	}
+
+
+	// the memfd is zero filled so only need to set the non-zero fields
+	m_map = reinterpret_cast<quint8*>(map);
+	m_header = reinterpret_cast<GattAudioRingHeader*>(map);
+
+	m_header->magic = BRAR;
+	m_header->version = 1;
+	m_header->headerSize = sizeof(GattAudioRingHeader);
+	m_header->slotSize = static_cast<quint32>(m_slotSize);
+	m_header->slotCount = slots;
+	m_header->frameSize = static_cast<quint32>(m_frameSize);
+	m_header->encoding = encoding;
+
+	qInfo("created voice audio ring with %u slots of %zu bytes", slots, m_slotSize);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Unmaps the memory and closes the descriptors, this doesn't set the
+	\c WriterClosed flag, call close() first if the client should be told.
+
+ */
+GattAudioRing::~GattAudioRing()
+{
+	if (m_map && (munmap(m_map, m_mapSize) != 0))
+		qErrnoWarning(errno, "failed to unmap voice audio ring");
+
+	if ((m_eventFd >= 0) && (::close(m_eventFd) != 0))
+		qErrnoWarning(errno, "failed to close voice audio eventfd");
+
+	if ((m_memFd >= 0) && (::close(m_memFd) != 0))
+		qErrnoWarning(errno, "failed to close voice audio memfd");
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns \c true if the memory was created and mapped.
+
+ */
+bool GattAudioRing::isValid() const
+{
+	return (m_header != nullptr);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns a dup of the memfd containing the ring, the descriptors are never
+	changed after construction so this is safe to call from any thread.
+
+ */
+FileDescriptor GattAudioRing::memoryFd() const
+{
+	return FileDescriptor(m_memFd);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns a dup of the eventfd signalled when frames have been written, the
+	descriptors are never changed after construction so this is safe to call
+	from any thread.
+
+ */
+FileDescriptor GattAudioRing::eventFd() const
+{
+	return FileDescriptor(m_eventFd);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Writes a frame of \a length bytes into the next slot and tags it with the
+	current monotonic time and the given \a flags.  The frame is visible to
+	the client straight away but it isn't woken, call notify() for that.
+
+	Returns \c false if the ring is full, in which case the frame is dropped.
+
+ */
+bool GattAudioRing::write(const void *data, size_t length, quint16 flags)
+{
+	if (Q_UNLIKELY(!m_header))
+		return false;
+
+	const quint32 writeIndex = m_header->writeIndex;
+	const quint32 readIndex = __atomic_load_n(&m_header->readIndex, __ATOMIC_ACQUIRE);
+
+	// nb: unsigned maths so correct across the counters wrapping
+	if ((writeIndex - readIndex) > m_slotMask)
+		return false;
+
+	quint8 *slotPtr = m_map + sizeof(GattAudioRingHeader)
+	                + ((writeIndex & m_slotMask) * m_slotSize);
+	GattAudioRingSlot *slot = reinterpret_cast<GattAudioRingSlot*>(slotPtr);
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	length = qMin(length, m_frameSize);
+
+	slot->timestamp = (quint64(ts.tv_sec) * 1000000000ULL) + quint64(ts.tv_nsec);
+	slot->length = static_cast<quint16>(length);
+	slot->flags = flags;
+	memcpy(slotPtr + sizeof(GattAudioRingSlot), data, length);
+
+	// publish the frame
+	__atomic_store_n(&m_header->writeIndex, (writeIndex + 1), __ATOMIC_RELEASE);
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Signals the eventfd to wake the client.
+
+ */
+void GattAudioRing::notify()
+{
+	if (Q_UNLIKELY(m_eventFd < 0))
+		return;
+
+	// nb: EAGAIN means the counter is saturated, which is fine as the client
+	// will still be woken
+	const uint64_t value = 1;
+	if ((TEMP_FAILURE_RETRY(::write(m_eventFd, &value, sizeof(value))) != sizeof(value)) &&
+	    (errno != EAGAIN))
+		qErrnoWarning(errno, "failed to signal voice audio eventfd");
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Sets the \c WriterClosed flag and wakes the client so it knows no more
+	frames will be written.
+
+ */
+void GattAudioRing::close()
+{
+	if (Q_UNLIKELY(!m_header))
+		return;
+
+	__atomic_store_n(&m_header->writerFlags, quint32(WriterClosed), __ATOMIC_RELEASE);
+	notify();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns \c true if the client has set the \c ReaderClosed flag.
+
+ */
+bool GattAudioRing::isReaderClosed() const
+{
+	if (Q_UNLIKELY(!m_header))
+		return true;
+
+	const quint32 flags = __atomic_load_n(&m_header->readerFlags, __ATOMIC_ACQUIRE);
+	return (flags & ReaderClosed);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the number of frames written but not yet read by the client.
+
+ */
+int GattAudioRing::depth() const
+{
+	if (Q_UNLIKELY(!m_header))
+		return 0;
+
+	const quint32 readIndex = __atomic_load_n(&m_header->readIndex, __ATOMIC_ACQUIRE);
+	return static_cast<int>(qMin(m_header->writeIndex - readIndex, m_slotMask + 1));
+}
@@ -0,0 +1,113 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  gatt_audioring.h
+//  SkyBluetoothRcu
+//
+
+#ifndef GATT_AUDIORING_H
+#define GATT_AUDIORING_H
+
+#include "utils/filedescriptor.h"
+
+#include <QtGlobal>
+
+
+// the layout of the shared memory, this is shared with clients so must not
+// be changed without bumping the version number
+struct GattAudioRingHeader {
+	quint32 magic;              // 'BRAR'
+	quint32 version;            // 1
+	quint32 headerSize;         // offset of the first slot
+	quint32 slotSize;           // size of each slot including the slot header
+	quint32 slotCount;          // number of slots, always a power of 2
+	quint32 frameSize;          // max number of audio bytes in a slot
+	quint32 encoding;           // 1 = ADPCM, 2 = PCM16 (same as dbus API)
+	quint32 writerFlags;        // written by the daemon only
+	quint8  reserved0[32];
+
+	quint32 writeIndex;         // written by the daemon only
+	quint8  reserved1[60];
+
+	quint32 readIndex;          // written by the client only
+	quint32 readerFlags;        // written by the client only
+	quint8  reserved2[56];
+};
+
+struct GattAudioRingSlot {
+	quint64 timestamp;          // CLOCK_MONOTONIC time in nanoseconds
+	quint16 length;             // number of bytes in data
+	quint16 flags;
+	quint32 reserved;
+	// followed by the audio data
+};
+
+
+class GattAudioRing
+{
+public:
+	enum WriterFlag {
+		WriterClosed = 0x0001
+	};
+
+	enum ReaderFlag {
+		ReaderClosed = 0x0001
+	};
+
+	enum SlotFlag {
+		ConcealedFrame = 0x0001,
+		PreRollFrame = 0x0002
+	};
+
+public:
+	GattAudioRing(quint32 encoding, size_t frameSize, int slotCount);
+	~GattAudioRing();
+
+public:
+	bool isValid() const;
+
+	FileDescriptor memoryFd() const;
+	FileDescriptor eventFd() const;
+
+	bool write(const void *data, size_t length, quint16 flags);
+	void notify();
+	void close();
+
+	bool isReaderClosed() const;
+	int depth() const;
+
+private:
+	int m_memFd;
+	int m_eventFd;
+
+	size_t m_mapSize;
+	quint8 *m_map;
+	GattAudioRingHeader *m_header;
+
+	size_t m_frameSize;
+	size_t m_slotSize;
+	quint32 m_slotMask;
+
+private:
+	Q_DISABLE_COPY(GattAudioRing)
+};
+
+
+#endif // !defined(GATT_AUDIORING_H)
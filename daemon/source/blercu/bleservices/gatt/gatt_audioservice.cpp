@@ -24,14 +24,17 @@
 
 #include "gatt_audioservice.h"
 #include "gatt_audiopipe.h"
+#include "gatt_audiopreroll.h"
 
 #include "blercu/blegattservice.h"
 #include "blercu/blegattcharacteristic.h"
 
 #include "utils/logging.h"
+#include "utils/threadrtsched.h"
 
 #include <QIODevice>
 #include <QFile>
+#include <QThread>
 #include <QtDBus>
 
 #include <unistd.h>
@@ -41,18 +44,31 @@
 const BleUuid GattAudioService::m_serviceUuid(BleUuid::SkyQVoice);
 
 
-GattAudioService::GattAudioService()
+GattAudioService::GattAudioService(const ConfigSettings::AudioSettings &settings)
 	: BleRcuAudioService(nullptr)
 	, m_packetsPerFrame(5)
+	, m_settings(settings)
 	, m_timeoutEventId(-1)
 	, m_gainLevel(0xFF)
 	, m_audioCodecs(0)
 	, m_emitOneTimeStreamingSignal(true)
+	, m_preRoll(new GattAudioPreRoll(settings.preRollSize / 12))
+	, m_audioThread(nullptr)
+	, m_lastLatencyFrames(0)
+	, m_lastLatencyAverageUsecs(0)
+	, m_lastLatencyMaxUsecs(0)
+	, m_lastNotifyWakeups(0)
+	, m_lastNotifyPackets(0)
+	, m_lastOutputWrites(0)
+	, m_notifyWasEnabled(false)
+	, m_unsolicitedPackets(0)
 {
+	// index 0 is for streams that had to enable notifications, index 1 for
+	// streams where they were already enabled
+	memset(m_firstFrameLatency, 0x00, sizeof(m_firstFrameLatency));
+
 	// clear the last stats
-	m_lastStats.lastError = NoError;
-	m_lastStats.actualPackets = 0;
-	m_lastStats.expectedPackets = 0;
+	resetStreamStats();
 
 	// setup the state machine
 	init();
@@ -62,6 +78,19 @@ GattAudioService::~GattAudioService()
 {
 	// ensure the service is stopped
 	stop();
+
+	// the characteristic may outlive us, so make sure it doesn't call us
+	if (m_audioDataCharacteristic)
+		m_audioDataCharacteristic->setNotificationHandler(nullptr);
+
+	// the audio pipe may be living on the worker thread, in which case it is
+	// freed there when the thread's event loop exits
+	m_audioPipe.reset();
+
+	if (m_audioThread) {
+		m_audioThread->quit();
+		m_audioThread->wait();
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -78,39 +107,62 @@ BleUuid GattAudioService::uuid()
 /*!
 	\internal
 
-	Configures and starts the state machine
+	Returns the state graph shared by the audio services of all the RCUs.
+
  */
-void GattAudioService::init()
+QSharedPointer<const StateGraph> GattAudioService::stateGraph()
 {
-	m_stateMachine.setObjectName(QStringLiteral("GattAudioService"));
-	m_stateMachine.setTransistionLogLevel(QtInfoMsg, &milestone());
+	// all the states and the super state groupings, parent states first
+	static constexpr StateGraph::StateDef states[] = {
+		{ -1,                   IdleState,                 "Idle"                },
+		{ -1,                   ReadyState,                "Ready"               },
 
-	// add all the states and the super state groupings
-	m_stateMachine.addState(IdleState, QStringLiteral("Idle"));
-	m_stateMachine.addState(ReadyState, QStringLiteral("Ready"));
+		{ -1,                   StreamingSuperState,       "StreamingSuperState" },
+		{ StreamingSuperState,  EnableNotificationsState,  "EnableNotifications" },
+		{ StreamingSuperState,  StartStreamingState,       "StartStreaming"      },
+		{ StreamingSuperState,  StreamingState,            "Streaming"           },
+		{ StreamingSuperState,  StopStreamingState,        "StopStreaming"       },
+	};
 
-	m_stateMachine.addState(StreamingSuperState, QStringLiteral("StreamingSuperState"));
-	m_stateMachine.addState(StreamingSuperState, EnableNotificationsState, QStringLiteral("EnableNotifications"));
-	m_stateMachine.addState(StreamingSuperState, StartStreamingState, QStringLiteral("StartStreaming"));
-	m_stateMachine.addState(StreamingSuperState, StreamingState, QStringLiteral("Streaming"));
-	m_stateMachine.addState(StreamingSuperState, StopStreamingState, QStringLiteral("StopStreaming"));
+	// the transitions, from state -> event -> to state
+	static constexpr StateGraph::TransitionDef transitions[] = {
+		{ IdleState,                 StartServiceRequestEvent,    ReadyState               },
+		{ ReadyState,                StopServiceRequestEvent,     IdleState                },
+		{ ReadyState,                StartStreamingRequestEvent,  EnableNotificationsState },
 
+		{ EnableNotificationsState,  NotificationsEnabledEvent,   StartStreamingState      },
 
-	// add the transitions:      From State         ->      Event                   ->  To State
-	m_stateMachine.addTransition(IdleState,                 StartServiceRequestEvent,   ReadyState);
-	m_stateMachine.addTransition(ReadyState,                StopServiceRequestEvent,    IdleState);
-	m_stateMachine.addTransition(ReadyState,                StartStreamingRequestEvent, EnableNotificationsState);
+		{ StartStreamingState,       StreamingStartedEvent,       StreamingState           },
 
-	m_stateMachine.addTransition(EnableNotificationsState,  NotificationsEnabledEvent,  StartStreamingState);
+		{ StreamingState,            StopStreamingRequestEvent,   StopStreamingState       },
+		{ StreamingState,            OutputPipeCloseEvent,        StopStreamingState       },
 
-	m_stateMachine.addTransition(StartStreamingState,       StreamingStartedEvent,      StreamingState);
+		{ StopStreamingState,        StreamingStoppedEvent,       ReadyState               },
 
-	m_stateMachine.addTransition(StreamingState,            StopStreamingRequestEvent,  StopStreamingState);
-	m_stateMachine.addTransition(StreamingState,            OutputPipeCloseEvent,       StopStreamingState);
+		{ StreamingSuperState,       GattErrorEvent,              ReadyState               },
+	};
 
-	m_stateMachine.addTransition(StopStreamingState,        StreamingStoppedEvent,      ReadyState);
+	static_assert(StateGraph::isValid(states, transitions, IdleState),
+	              "invalid GattAudioService state graph");
 
-	m_stateMachine.addTransition(StreamingSuperState,       GattErrorEvent,             ReadyState);
+	static const QSharedPointer<const StateGraph> graph =
+		StateGraph::create(states, transitions, IdleState);
+	return graph;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Configures and starts the state machine
+ */
+void GattAudioService::init()
+{
+	m_stateMachine.setObjectName(QStringLiteral("GattAudioService"));
+	m_stateMachine.setTransistionLogLevel(QtInfoMsg, &milestone());
+
+	// use the state graph shared by all instances
+	m_stateMachine.setStateGraph(stateGraph());
 
 
 	// connect to the state entry / exit signals
@@ -120,8 +172,7 @@ void GattAudioService::init()
 	                 this, &GattAudioService::onExitedState);
 
 
-	// set the initial state of the state machine and start it
-	m_stateMachine.setInitialState(IdleState);
+	// start the state machine
 	m_stateMachine.start();
 }
 
@@ -149,6 +200,10 @@ bool GattAudioService::getAudioCodecsCharacteristic(const QSharedPointer<const B
 	// set the timeout to two slave latencies, rather than the full 30 seconds
 	m_audioCodecsCharacteristic->setTimeout(11000);
 
+	// the supported codecs are fixed by the firmware so only read them once
+	// per connection
+	m_audioCodecsCharacteristic->setCacheable(true);
+
 	return true;
 }
 
@@ -229,11 +284,10 @@ bool GattAudioService::getAudioDataCharacteristic(const QSharedPointer<const Ble
 	// values when notifications are enabled
 
 
-	// connect to the value change notification, this is how we get the audio
-	// data notification packets which make up the frame
-	QObject::connect(m_audioDataCharacteristic.data(),
-	                 &BleGattCharacteristic::valueChanged,
-	                 this, &GattAudioService::onAudioDataNotification);
+	// install ourselves as the handler for the notifications, this is how we
+	// get the audio data notification packets which make up the frame, they
+	// are delivered in batches of all the packets waiting in the pipe
+	m_audioDataCharacteristic->setNotificationHandler(this);
 
 	return true;
 }
@@ -321,16 +375,25 @@ void GattAudioService::onEnteredState(int state)
 			if (m_audioDataCharacteristic) {
 				qInfo() << "Disabling notifications for m_audioDataCharacteristic";
 				m_audioDataCharacteristic->enableNotifications(false);
+				m_audioDataCharacteristic->setNotificationHandler(nullptr);
 			}
 			m_audioGainCharacteristic.reset();
 			m_audioCtrlCharacteristic.reset();
 			m_audioDataCharacteristic.reset();
+			m_notifyEnableResult = Future<>();
+			m_preRoll->clear();
 			break;
 
 		case ReadyState:
+			if (m_settings.preEnableNotifications)
+				preEnableNotifications();
 			emit ready();
 			break;
 
+		case StreamingSuperState:
+			m_firstFrameTimer.start();
+			break;
+
 		case EnableNotificationsState:
 			onEnteredEnableNotificationsState();
 			break;
@@ -404,8 +467,18 @@ void GattAudioService::onEnteredEnableNotificationsState()
 		};
 
 
-	// send a request to set CCCD for audio data characteristic
-	Future<> result = m_audioDataCharacteristic->enableNotifications(true);
+	// if notifications are pre-enabled the request may still be in flight, in
+	// which case wait for it rather than asking bluez again
+	Future<> result = m_notifyEnableResult;
+	if (!result.isValid() || result.isFinished()) {
+		// send a request to set CCCD for audio data characteristic, this
+		// completes straight away if notifications are already enabled
+		result = m_audioDataCharacteristic->enableNotifications(true);
+	}
+
+	// used to split the first frame latency stats
+	m_notifyWasEnabled = (result.isValid() && result.isFinished() && !result.isError());
+
 	if (!result.isValid() || result.isError()) {
 		errorCallback(result.errorName(), result.errorMessage());
 
@@ -505,9 +578,19 @@ void GattAudioService::onEnteredStreamingState()
 	QObject::connect(m_audioPipe.data(), &GattAudioPipe::outputPipeClosed,
 	                 this, &GattAudioService::onOutputPipeClosed,
 	                 Qt::QueuedConnection);
+	QObject::connect(m_audioPipe.data(), &GattAudioPipe::firstNotificationReceived,
+	                 this, &GattAudioService::onFirstAudioDataNotification,
+	                 Qt::QueuedConnection);
 
-	// and finally start the audio pipe
+	// and finally start the audio pipe, giving it any audio received before
+	// the stream started
 	m_audioPipe->start();
+	flushPreRoll();
+
+	// if configured hand the pipe over to the audio thread, from this point on
+	// it reads the notifications directly from bluez
+	if (m_settings.workerThread)
+		moveAudioPipeToThread();
 
 
 
@@ -518,6 +601,12 @@ void GattAudioService::onEnteredStreamingState()
 	} else if (m_startStreamingToPromise) {
 		m_startStreamingToPromise->setFinished();
 		m_startStreamingToPromise.reset();;
+	} else if (m_startStreamingShmPromise) {
+		SharedMemoryStream stream;
+		stream.memoryFd = m_audioPipe->sharedMemoryFd();
+		stream.eventFd = m_audioPipe->sharedMemoryEventFd();
+		m_startStreamingShmPromise->setFinished(stream);
+		m_startStreamingShmPromise.reset();
 	} else {
 		qError("odd, missing promise to send the reply to");
 	}
@@ -546,14 +635,14 @@ void GattAudioService::onExitedStreamingState()
 	} else {
 
 		// before destruction get the frame stats
-		m_audioPipe->stop();
-		m_lastStats.actualPackets = m_audioPipe->framesReceived() * m_packetsPerFrame;
-		m_lastStats.expectedPackets = m_audioPipe->framesExpected() * m_packetsPerFrame;
-		m_lastStats.expectedPackets = qMax(m_lastStats.expectedPackets,
-		                                   m_lastStats.actualPackets);
+		stopAudioPipe();
+		const quint32 lastError = m_lastStats.lastError;
+		m_lastStats = audioPipeStats();
+		m_lastStats.lastError = lastError;
 
-		qInfo("audio frame stats: actual=%u, expected=%u",
-		      m_lastStats.actualPackets, m_lastStats.expectedPackets);
+		qInfo("audio frame stats: actual=%u, expected=%u, dropped=%u, pre-roll=%u",
+		      m_lastStats.actualPackets, m_lastStats.expectedPackets,
+		      m_lastStats.droppedFrames, m_lastStats.preRollFrames);
 
 		// destroy the audio pipe (closes all file handles)
 		m_audioPipe.reset();
@@ -630,17 +719,21 @@ void GattAudioService::onExitedStreamingSuperState()
 {
 	// close the streaming pipe (if we haven't already)
 	if (m_audioPipe) {
-		m_lastStats.actualPackets = m_audioPipe->framesReceived() * m_packetsPerFrame;
-		m_lastStats.expectedPackets = m_audioPipe->framesExpected() * m_packetsPerFrame;
-		m_lastStats.expectedPackets = qMax(m_lastStats.expectedPackets,
-		                                   m_lastStats.actualPackets);
+		const quint32 lastError = m_lastStats.lastError;
+		m_lastStats = audioPipeStats();
+		m_lastStats.lastError = lastError;
 
 		m_audioPipe.reset();
 
-		qInfo("audio frame stats: actual=%u, expected=%u",
-		      m_lastStats.actualPackets, m_lastStats.expectedPackets);
+		qInfo("audio frame stats: actual=%u, expected=%u, dropped=%u, pre-roll=%u",
+		      m_lastStats.actualPackets, m_lastStats.expectedPackets,
+		      m_lastStats.droppedFrames, m_lastStats.preRollFrames);
 	}
 
+	// don't want any audio received during this stream ending up at the
+	// start of the next one
+	m_preRoll->clear();
+
 	// complete any promises that may still be outstanding
 	if (m_stopStreamingPromise) {
 		m_stopStreamingPromise->setFinished();
@@ -655,6 +748,10 @@ void GattAudioService::onExitedStreamingSuperState()
 		m_startStreamingToPromise->setError(BleRcuError::errorString(BleRcuError::General),
 		                                    QStringLiteral("Streaming stopped"));
 		m_startStreamingToPromise.reset();
+	} else if (m_startStreamingShmPromise) {
+		m_startStreamingShmPromise->setError(BleRcuError::errorString(BleRcuError::General),
+		                                     QStringLiteral("Streaming stopped"));
+		m_startStreamingShmPromise.reset();
 	}
 }
 
@@ -662,29 +759,115 @@ void GattAudioService::onExitedStreamingSuperState()
 /*!
 	\internal
 
-	Called when a notification is received from the Audio Data characteristic.
+	Called with a batch of notifications received from the Audio Data
+	characteristic, this is all the notifications that were waiting in the
+	bluez notification pipe when it was woken up.
 
  */
-void GattAudioService::onAudioDataNotification(const QByteArray &value)
+void GattAudioService::onNotifications(const quint8 *packets, size_t stride,
+                                       const quint16 *lengths, int count)
 {
+	// the RCU may send audio data before the stream has fully started, or
+	// if notifications are pre-enabled while we're not streaming at all, this
+	// is kept in the pre-roll ring (if enabled) for when the stream starts
+	if (m_preRoll->isEnabled() && !m_stateMachine.inState(StreamingState)) {
+		m_preRoll->addNotifications(packets, stride, lengths, count);
+		return;
+	}
+
+	if (Q_UNLIKELY(!m_audioPipe)) {
+		m_unsolicitedPackets += count;
+		return;
+	}
+
 	// This way the streamingChanged signal is emitted only when we actually receive
 	// audio data.  But this should only be emitted for the first notification.
 	if (m_emitOneTimeStreamingSignal) {
+		updateFirstFrameLatency();
 		emit streamingChanged(true);
 		m_emitOneTimeStreamingSignal = false;
 	}
 
-	// all notifications from the audio pipe should be 20 bytes in size, any
-	// other size is an error
-	if (Q_UNLIKELY(value.size() != 20)) {
-		qWarning("audio data notification not 20 bytes in size (%d bytes)",
-		         value.size());
-		return;
+	// add the notifications to the audio pipe, it checks they are all 20
+	// bytes in size
+	m_audioPipe->addNotifications(packets, stride, lengths, count);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when the audio pipe, running on the worker thread, has received the
+	first notification from the RCU.
+
+ */
+void GattAudioService::onFirstAudioDataNotification()
+{
+	if (m_emitOneTimeStreamingSignal) {
+		updateFirstFrameLatency();
+		emit streamingChanged(true);
+		m_emitOneTimeStreamingSignal = false;
 	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Stores the time from the start streaming request to the first audio data
+	notification.  The stats are kept separately for streams that had to
+	enable notifications and streams where they were already enabled, so the
+	benefit of pre-enabling them can be seen.
+
+	The request is the closest we get to the voice key press, the key event
+	itself goes to the input layer rather than through the daemon.
+
+ */
+void GattAudioService::updateFirstFrameLatency()
+{
+	if (!m_firstFrameTimer.isValid())
+		return;
+
+	const qint64 elapsed = m_firstFrameTimer.elapsed();
+	m_firstFrameTimer.invalidate();
+
+	FirstFrameLatency &latency = m_firstFrameLatency[m_notifyWasEnabled ? 1 : 0];
+	latency.streams++;
+	latency.lastMsecs = elapsed;
+	latency.totalMsecs += elapsed;
+	latency.maxMsecs = qMax(latency.maxMsecs, elapsed);
 
-	// add the notification to the audio pipe
-	if (m_audioPipe)
-		m_audioPipe->addNotification(reinterpret_cast<const quint8*>(value.constData()));
+	qInfo("first audio frame %lldms after start request (notifications %s)",
+	      elapsed, m_notifyWasEnabled ? "already enabled" : "enabled on demand");
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Passes the audio frames in the pre-roll ring to the audio pipe, called
+	just after the pipe is started.  Only frames received in the pre-roll
+	period before the stream was requested, or since, are used; anything
+	older is most likely the tail of a previous stream.
+
+ */
+void GattAudioService::flushPreRoll()
+{
+	if (!m_preRoll->isEnabled())
+		return;
+
+	qint64 maxAge = m_settings.preRollSize;
+	if (m_firstFrameTimer.isValid())
+		maxAge += m_firstFrameTimer.elapsed();
+
+	int frameCount = 0;
+	const QByteArray frames = m_preRoll->takeFrames(maxAge, &frameCount);
+	if (frames.isEmpty())
+		return;
+
+	qInfo("sending %d frames of pre-roll audio", frameCount);
+
+	m_audioPipe->addPreRoll(frames);
 }
 
 // -----------------------------------------------------------------------------
@@ -702,6 +885,47 @@ void GattAudioService::onOutputPipeClosed()
 	m_stateMachine.postEvent(OutputPipeCloseEvent);
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called on entry to the ready state if notifications should be kept enabled
+	while the RCU is connected.  This takes the \c AcquireNotify round trip to
+	bluez out of the start streaming path.
+
+	In worker thread mode the notification pipe is handed over to the audio
+	pipe for each stream, so this is called again when the stream finishes to
+	get a new one.  Failures are not fatal, notifications are just enabled
+	when the stream is started instead.
+
+ */
+void GattAudioService::preEnableNotifications()
+{
+	if (!m_audioDataCharacteristic)
+		return;
+
+	// already enabled or a request is already in flight
+	if (m_notifyEnableResult.isValid() && !m_notifyEnableResult.isFinished())
+		return;
+
+	m_notifyEnableResult = m_audioDataCharacteristic->enableNotifications(true);
+	if (!m_notifyEnableResult.isValid() || m_notifyEnableResult.isError()) {
+		qWarning() << "failed to pre-enable audio notifications due to"
+		           << m_notifyEnableResult.errorName()
+		           << m_notifyEnableResult.errorMessage();
+
+	} else if (!m_notifyEnableResult.isFinished()) {
+		const std::function<void(const QString&, const QString&)> errorCallback =
+			[](const QString &errorName, const QString &errorMessage)
+			{
+				qWarning() << "failed to pre-enable audio notifications due to"
+				           << errorName << errorMessage;
+			};
+
+		m_notifyEnableResult.connectErrored(this, errorCallback);
+	}
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\overload
@@ -886,12 +1110,238 @@ Future<T> GattAudioService::createErrorResult(BleRcuError::ErrorType type,
 	return Future<T>::createErrored(BleRcuError::errorString(type), message);
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Creates a new audio pipe for the given output \a encoding and sets up its
+	output buffer and frame loss concealment from the config settings, the
+	sizes in the config are in milliseconds so are converted to 12ms frames
+	here.
+
+	If the audio worker thread is enabled the pipe may end up living on that
+	thread, so in that case it must be deleted with
+	\l{QObject::deleteLater()}.
+
+	If \a sharedMemory is \c true the output of the pipe is a shared memory
+	ring rather than a pipe, the ring is sized from the output buffer size in
+	the config settings.
+
+	Returns an empty shared pointer if the encoding is not supported or the
+	shared memory ring couldn't be created.
+ */
+QSharedPointer<GattAudioPipe> GattAudioService::createAudioPipe(Encoding encoding,
+                                                                int outputPipeFd,
+                                                                int latencyBudget,
+                                                                bool sharedMemory) const
+{
+	GattAudioPipe::OutputEncoding outputEncoding;
+	switch (encoding) {
+		case BleRcuAudioService::PCM16:
+			outputEncoding = GattAudioPipe::PCM16;
+			break;
+		case BleRcuAudioService::ADPCM:
+			outputEncoding = GattAudioPipe::ADPCM;
+			break;
+		default:
+			return QSharedPointer<GattAudioPipe>();
+	}
+
+	GattAudioPipe *audioPipe = new GattAudioPipe(outputEncoding, outputPipeFd,
+	                                             latencyBudget);
+
+	if (sharedMemory) {
+
+		// the ring replaces the output buffer, so is the same size but with
+		// a sensible minimum
+		const int slotCount = qMax((m_settings.outputBufferSize / 12), 64);
+		if (!audioPipe->setSharedMemoryOutput(slotCount)) {
+			qError("failed to create shared memory output for audio");
+			delete audioPipe;
+			return QSharedPointer<GattAudioPipe>();
+		}
+
+	} else {
+
+		const GattAudioPipe::BufferDropPolicy dropPolicy =
+			m_settings.outputBufferDropOldest ? GattAudioPipe::DropOldest
+			                                  : GattAudioPipe::DropNewest;
+
+		if (!audioPipe->setOutputBuffer((m_settings.outputBufferSize / 12),
+		                                (m_settings.outputBufferHighWaterMark / 12),
+		                                (m_settings.outputBufferLowWaterMark / 12),
+		                                dropPolicy))
+			qWarning("failed to set audio output buffer, frames will be discarded"
+			         " if the client falls behind");
+	}
+
+	GattAudioPipe::ConcealmentMode concealment;
+	switch (m_settings.concealment) {
+		case ConfigSettings::AudioSettings::SilenceConcealment:
+			concealment = GattAudioPipe::ConcealWithSilence;
+			break;
+		case ConfigSettings::AudioSettings::RepeatConcealment:
+			concealment = GattAudioPipe::ConcealWithRepeat;
+			break;
+		case ConfigSettings::AudioSettings::FadeConcealment:
+			concealment = GattAudioPipe::ConcealWithFade;
+			break;
+		case ConfigSettings::AudioSettings::NoConcealment:
+		default:
+			concealment = GattAudioPipe::NoConcealment;
+			break;
+	}
+
+	audioPipe->setConcealment(concealment, (m_settings.concealmentMaxGap / 12));
+
+	if (m_settings.workerThread)
+		return QSharedPointer<GattAudioPipe>(audioPipe, &QObject::deleteLater);
+	else
+		return QSharedPointer<GattAudioPipe>(audioPipe);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the packet, output buffer and concealment stats of the current
+	audio pipe, the \c lastError field is always set to \c NoError.
+ */
+BleRcuAudioService::StatusInfo GattAudioService::audioPipeStats() const
+{
+	StatusInfo info;
+
+	info.lastError = NoError;
+	info.actualPackets = m_audioPipe->framesReceived() * m_packetsPerFrame;
+	info.expectedPackets = m_audioPipe->framesExpected() * m_packetsPerFrame;
+	info.expectedPackets = qMax(info.expectedPackets, info.actualPackets);
+
+	const GattAudioPipe::BufferStats bufferStats = m_audioPipe->bufferStats();
+	info.bufferedBytes = bufferStats.bufferedBytes;
+	info.peakBufferedBytes = bufferStats.peakBufferedBytes;
+	info.droppedFrames = bufferStats.droppedFrames;
+
+	const GattAudioPipe::ConcealmentStats concealStats = m_audioPipe->concealmentStats();
+	info.concealedFrames = concealStats.concealedFrames;
+	info.discontinuities = concealStats.discontinuities;
+
+	info.preRollFrames = m_audioPipe->preRollFrames();
+
+	return info;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Clears the stats of the last stream, called on construction and when
+	starting a new stream.
+ */
+void GattAudioService::resetStreamStats()
+{
+	m_lastStats.lastError = NoError;
+	m_lastStats.actualPackets = 0;
+	m_lastStats.expectedPackets = 0;
+	m_lastStats.bufferedBytes = 0;
+	m_lastStats.peakBufferedBytes = 0;
+	m_lastStats.droppedFrames = 0;
+	m_lastStats.concealedFrames = 0;
+	m_lastStats.discontinuities = 0;
+	m_lastStats.preRollFrames = 0;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Moves the running audio pipe onto the audio worker thread, creating the
+	thread if it doesn't already exist.  The bluez notification pipe is taken
+	from the audio data characteristic and given to the audio pipe, so from
+	then on the notifications are read, decoded and written to the client all
+	on the worker thread.  The only things that come back to this thread are
+	the first notification and pipe closed signals.
+
+	If the notification pipe can't be taken then the audio pipe stays on the
+	main thread and is fed by onNotifications() as normal.
+
+ */
+bool GattAudioService::moveAudioPipeToThread()
+{
+	const FileDescriptor notifyPipeFd = m_audioDataCharacteristic->takeNotificationPipe();
+	if (!notifyPipeFd.isValid()) {
+		qWarning("failed to take the audio notification pipe, audio will be"
+		         " processed on the main thread");
+		return false;
+	}
+
+	if (!m_audioPipe->setNotificationPipe(notifyPipeFd)) {
+		qError("failed to set the audio notification pipe");
+		return false;
+	}
+
+	// create the worker thread on first use, it's kept for the lifetime of
+	// the service
+	if (!m_audioThread) {
+		m_audioThread = new QThread(this);
+		m_audioThread->setObjectName(QStringLiteral("BleRcuAudio"));
+
+		ThreadRtSched::apply(m_audioThread, m_settings.workerThreadPolicy,
+		                     m_settings.workerThreadPriority);
+
+		m_audioThread->start();
+	}
+
+	m_audioPipe->moveToThread(m_audioThread);
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Stops the audio pipe, on whichever thread it is running, and then stores
+	and logs the latency stats of the recording.
+
+ */
+void GattAudioService::stopAudioPipe()
+{
+	const bool onWorkerThread = (m_audioPipe->thread() != QThread::currentThread());
+	if (onWorkerThread)
+		QMetaObject::invokeMethod(m_audioPipe.data(), "stop",
+		                          Qt::BlockingQueuedConnection);
+	else
+		m_audioPipe->stop();
+
+	const GattAudioPipe::LatencyStats latency = m_audioPipe->latencyStats();
+	m_lastLatencyFrames = latency.frames;
+	m_lastLatencyAverageUsecs = latency.averageUsecs;
+	m_lastLatencyMaxUsecs = latency.maxUsecs;
+
+	qInfo("audio notify-to-pipe latency (%s): frames=%d, avg=%lldus, max=%lldus",
+	      onWorkerThread ? "worker thread" : "main loop",
+	      latency.frames, latency.averageUsecs, latency.maxUsecs);
+
+	const GattAudioPipe::NotificationStats notifyStats = m_audioPipe->notificationStats();
+	m_lastNotifyWakeups = notifyStats.wakeups;
+	m_lastNotifyPackets = notifyStats.packets;
+	m_lastOutputWrites = m_audioPipe->outputWrites();
+
+	qInfo("audio notifications: %d packets in %d wakeups (max %d per wakeup),"
+	      " %d output writes", notifyStats.packets, notifyStats.wakeups,
+	      notifyStats.maxPacketsPerWakeup, m_lastOutputWrites);
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\overload
 
+	The \a latencyBudget is the number of milliseconds the client is happy for
+	the decoded audio frames to be held so they can be written to the pipe in
+	batches, \c 0 means every frame is written as soon as it is received.
+
  */
-Future<FileDescriptor> GattAudioService::startStreaming(Encoding encoding)
+Future<FileDescriptor> GattAudioService::startStreaming(Encoding encoding,
+                                                        int latencyBudget)
 {
 	// check the current state
 	if (m_stateMachine.state() != ReadyState)
@@ -899,24 +1349,19 @@ Future<FileDescriptor> GattAudioService::startStreaming(Encoding encoding)
 		                                         QStringLiteral("Service not ready"));
 
 	// check we don't already have an outstanding pending call
-	if (m_startStreamingPromise || m_startStreamingToPromise || m_stopStreamingPromise)
+	if (m_startStreamingPromise || m_startStreamingToPromise ||
+	    m_startStreamingShmPromise || m_stopStreamingPromise)
 		return createErrorResult<FileDescriptor>(BleRcuError::Busy,
 		                                         QStringLiteral("Service is busy"));
 
 	// clear the last stats
-	m_lastStats.lastError = NoError;
-	m_lastStats.actualPackets = 0;
-	m_lastStats.expectedPackets = 0;
+	resetStreamStats();
 
 
 	// check the encoding
-	GattAudioPipe::OutputEncoding outputEncoding = GattAudioPipe::PCM16;
 	switch (encoding) {
 		case BleRcuAudioService::PCM16:
-			outputEncoding = GattAudioPipe::PCM16;
-			break;
 		case BleRcuAudioService::ADPCM:
-			outputEncoding = GattAudioPipe::ADPCM;
 			break;
 		default:
 		m_lastStats.lastError = StreamingError::InternalError;
@@ -926,7 +1371,7 @@ Future<FileDescriptor> GattAudioService::startStreaming(Encoding encoding)
 
 
 	// create a new audio pipe for the client
-	m_audioPipe = QSharedPointer<GattAudioPipe>::create(outputEncoding);
+	m_audioPipe = createAudioPipe(encoding, -1, latencyBudget);
 	if (!m_audioPipe || !m_audioPipe->isValid()) {
 		m_audioPipe.reset();
 		m_lastStats.lastError = StreamingError::InternalError;
@@ -963,24 +1408,19 @@ Future<> GattAudioService::startStreamingTo(Encoding encoding, int fd)
 	// check we're not already stream or we already have an outstanding pending
 	// start/stop streaming call
 	if (m_stateMachine.inState(StreamingSuperState) ||
-	    (m_startStreamingPromise || m_startStreamingToPromise || m_stopStreamingPromise))
+	    (m_startStreamingPromise || m_startStreamingToPromise ||
+	     m_startStreamingShmPromise || m_stopStreamingPromise))
 		return createErrorResult<>(BleRcuError::Busy,
 		                           QStringLiteral("Service is busy"));
 
 	// clear the last stats
-	m_lastStats.lastError = NoError;
-	m_lastStats.actualPackets = 0;
-	m_lastStats.expectedPackets = 0;
+	resetStreamStats();
 
 
 	// check the encoding
-	GattAudioPipe::OutputEncoding outputEncoding = GattAudioPipe::PCM16;
 	switch (encoding) {
 		case BleRcuAudioService::PCM16:
-			outputEncoding = GattAudioPipe::PCM16;
-			break;
 		case BleRcuAudioService::ADPCM:
-			outputEncoding = GattAudioPipe::ADPCM;
 			break;
 		default:
 		m_lastStats.lastError = StreamingError::InternalError;
@@ -990,7 +1430,7 @@ Future<> GattAudioService::startStreamingTo(Encoding encoding, int fd)
 
 
 	// create a new audio pipe for the client
-	m_audioPipe = QSharedPointer<GattAudioPipe>::create(outputEncoding, fd);
+	m_audioPipe = createAudioPipe(encoding, fd, 0);
 	if (!m_audioPipe || !m_audioPipe->isValid()) {
 		m_audioPipe.reset();
 		m_lastStats.lastError = StreamingError::InternalError;
@@ -1012,6 +1452,69 @@ Future<> GattAudioService::startStreamingTo(Encoding encoding, int fd)
 	return futureResult;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\overload
+
+	Starts streaming into a shared memory ring rather than a pipe, the result
+	contains the memfd holding the ring and an eventfd that is signalled when
+	frames are added.  The \a latencyBudget is used to batch the eventfd
+	wake-ups.
+
+ */
+Future<BleRcuAudioService::SharedMemoryStream>
+	GattAudioService::startStreamingSharedMemory(Encoding encoding, int latencyBudget)
+{
+	// check the current state
+	if (m_stateMachine.state() != ReadyState)
+		return createErrorResult<SharedMemoryStream>(BleRcuError::Busy,
+		                                             QStringLiteral("Service not ready"));
+
+	// check we don't already have an outstanding pending call
+	if (m_startStreamingPromise || m_startStreamingToPromise ||
+	    m_startStreamingShmPromise || m_stopStreamingPromise)
+		return createErrorResult<SharedMemoryStream>(BleRcuError::Busy,
+		                                             QStringLiteral("Service is busy"));
+
+	// clear the last stats
+	resetStreamStats();
+
+
+	// check the encoding
+	switch (encoding) {
+		case BleRcuAudioService::PCM16:
+		case BleRcuAudioService::ADPCM:
+			break;
+		default:
+		m_lastStats.lastError = StreamingError::InternalError;
+		return createErrorResult<SharedMemoryStream>(BleRcuError::InvalidArg,
+		                                             QStringLiteral("Unsupported audio encoding"));
+	}
+
+
+	// create a new audio pipe writing into shared memory for the client
+	m_audioPipe = createAudioPipe(encoding, -1, latencyBudget, true);
+	if (!m_audioPipe || !m_audioPipe->isValid()) {
+		m_audioPipe.reset();
+		m_lastStats.lastError = StreamingError::InternalError;
+		return createErrorResult<SharedMemoryStream>(BleRcuError::General,
+		                                             QStringLiteral("Failed to create shared memory"));
+	}
+
+
+	// create a promise to store the result of the streaming
+	m_startStreamingShmPromise = QSharedPointer< Promise<SharedMemoryStream> >::create();
+	Future<SharedMemoryStream> futureResult = m_startStreamingShmPromise->future();
+
+
+	// post a message to the state machine to start moving into the streaming
+	// state
+	m_stateMachine.postEvent(StartStreamingRequestEvent);
+
+	// return the result (it may have already completed)
+	return futureResult;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\overload
@@ -1025,7 +1528,8 @@ Future<> GattAudioService::stopStreaming()
 		                         QStringLiteral("Service not currently streaming"));
 
 	// check we don't already have an outstanding pending call
-	if (m_startStreamingPromise || m_startStreamingToPromise || m_stopStreamingPromise)
+	if (m_startStreamingPromise || m_startStreamingToPromise ||
+	    m_startStreamingShmPromise || m_stopStreamingPromise)
 		return createErrorResult(BleRcuError::Busy, QStringLiteral("Service is busy"));
 
 
@@ -1054,10 +1558,7 @@ Future<BleRcuAudioService::StatusInfo> GattAudioService::status()
 
 	// if the audio pipe is still alive then use the lastest stats from that
 	if (m_audioPipe) {
-		info.lastError = NoError;
-		info.actualPackets = m_audioPipe->framesReceived() * m_packetsPerFrame;
-		info.expectedPackets = m_audioPipe->framesExpected() * m_packetsPerFrame;
-		info.expectedPackets = qMax(info.expectedPackets, info.actualPackets);
+		info = audioPipeStats();
 
 	} else {
 		// otherwise use the stored stats
@@ -1068,3 +1569,55 @@ Future<BleRcuAudioService::StatusInfo> GattAudioService::status()
 	return Future<StatusInfo>::createFinished(info);
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	Debugging function that dumps out the state of the service and the stats
+	from the last recording.
+
+ */
+void GattAudioService::dump(Dumper out) const
+{
+	out.printLine("audio service:");
+	out.pushIndent(2);
+
+	out.printLine("state: %s", qPrintable(m_stateMachine.stateName()));
+	out.printBoolean("worker thread:", m_settings.workerThread);
+	out.printBoolean("pre-enable notifications:", m_settings.preEnableNotifications);
+	out.printLine("unsolicited packets dropped: %d", m_unsolicitedPackets);
+	out.printLine("pre-roll: %dms, %d frames captured", m_settings.preRollSize,
+	              m_preRoll->framesCaptured());
+
+	static const char *latencyModes[2] = { "enabled on demand", "already enabled" };
+	for (int i = 0; i < 2; i++) {
+		const FirstFrameLatency &latency = m_firstFrameLatency[i];
+		if (latency.streams == 0)
+			continue;
+
+		out.printLine("first frame latency (notifications %s): last %lldms,"
+		              " avg %lldms, max %lldms (%d streams)", latencyModes[i],
+		              latency.lastMsecs, (latency.totalMsecs / latency.streams),
+		              latency.maxMsecs, latency.streams);
+	}
+
+	out.printLine("last recording:");
+	out.pushIndent(2);
+	out.printLine("packets: %u of %u", m_lastStats.actualPackets,
+	              m_lastStats.expectedPackets);
+	out.printLine("notify-to-pipe latency: avg %lldus, max %lldus (%d frames)",
+	              m_lastLatencyAverageUsecs, m_lastLatencyMaxUsecs,
+	              m_lastLatencyFrames);
+	out.printLine("notifications: %d packets in %d wakeups", m_lastNotifyPackets,
+	              m_lastNotifyWakeups);
+	out.printLine("output writes: %d", m_lastOutputWrites);
+	out.printLine("output buffer: %u bytes buffered, peak %u bytes, %u frames dropped",
+	              m_lastStats.bufferedBytes, m_lastStats.peakBufferedBytes,
+	              m_lastStats.droppedFrames);
+	out.printLine("concealment: %u frames concealed, %u discontinuities",
+	              m_lastStats.concealedFrames, m_lastStats.discontinuities);
+	out.printLine("pre-roll: %u frames", m_lastStats.preRollFrames);
+	out.popIndent();
+
+	m_stateMachine.dump(out);
+
+	out.popIndent();
+}
@@ -26,27 +26,36 @@
 #define GATT_AUDIOSERVICE_H
 
 #include "blercu/bleservices/blercuaudioservice.h"
+#include "blercu/blegattcharacteristic.h"
 #include "blercu/blercuerror.h"
 #include "utils/bleuuid.h"
 
 #include "utils/statemachine.h"
+#include "utils/dumper.h"
+
+#include "configsettings/configsettings.h"
 
 #include <QString>
 #include <QByteArray>
+#include <QElapsedTimer>
+#include <QScopedPointer>
 
 
 class BleGattService;
-class BleGattCharacteristic;
 
 class GattAudioPipe;
+class GattAudioPreRoll;
+
+class QThread;
 
 
 class GattAudioService : public BleRcuAudioService
+                       , public BleGattNotificationHandler
 {
 	Q_OBJECT
 
 public:
-	GattAudioService();
+	explicit GattAudioService(const ConfigSettings::AudioSettings &settings);
 	~GattAudioService() final;
 
 public:
@@ -59,6 +68,8 @@ public:
 	bool start(const QSharedPointer<const BleGattService> &gattService);
 	void stop();
 
+	void dump(Dumper out) const;
+
 signals:
 	void ready();
 
@@ -70,8 +81,11 @@ public:
 
 	quint32 audioCodecs() const override;
 
-	Future<FileDescriptor> startStreaming(Encoding encoding) override;
+	Future<FileDescriptor> startStreaming(Encoding encoding,
+	                                      int latencyBudget) override;
 	Future<> startStreamingTo(Encoding encoding, int pipeWriteFd) override;
+	Future<SharedMemoryStream> startStreamingSharedMemory(Encoding encoding,
+	                                                      int latencyBudget) override;
 	Future<> stopStreaming() override;
 
 	Future<StatusInfo> status() override;
@@ -88,6 +102,7 @@ private:
 			CancelStreamingState
 	};
 
+	static QSharedPointer<const StateGraph> stateGraph();
 	void init();
 
 	bool getAudioCodecsCharacteristic(const QSharedPointer<const BleGattService> &gattService);
@@ -98,10 +113,26 @@ private:
 	void requestGainLevel();
 	void requestAudioCodecs();
 
+	void preEnableNotifications();
+	void updateFirstFrameLatency();
+	void flushPreRoll();
+
+	void onNotifications(const quint8 *packets, size_t stride,
+	                     const quint16 *lengths, int count) override;
+
 	template<typename T = void>
 	Future<T> createErrorResult(BleRcuError::ErrorType type,
 	                            const QString &message) const;
 
+	QSharedPointer<GattAudioPipe> createAudioPipe(Encoding encoding,
+	                                              int outputPipeFd,
+	                                              int latencyBudget,
+	                                              bool sharedMemory = false) const;
+	StatusInfo audioPipeStats() const;
+	void resetStreamStats();
+	bool moveAudioPipeToThread();
+	void stopAudioPipe();
+
 private slots:
 	void onEnteredState(int state);
 	void onExitedState(int state);
@@ -114,16 +145,18 @@ private slots:
 
 	void onExitedStreamingSuperState();
 
-	void onAudioDataNotification(const QByteArray &value);
+	void onFirstAudioDataNotification();
 
 	void onOutputPipeClosed();
 
 private:
 	const int m_packetsPerFrame;
-	
+	const ConfigSettings::AudioSettings m_settings;
+
 private:
 	QSharedPointer<Promise<FileDescriptor>> m_startStreamingPromise;
 	QSharedPointer<Promise<>> m_startStreamingToPromise;
+	QSharedPointer<Promise<SharedMemoryStream>> m_startStreamingShmPromise;
 	QSharedPointer<Promise<>> m_stopStreamingPromise;
 
 
@@ -144,6 +177,32 @@ private:
 	QSharedPointer<GattAudioPipe> m_audioPipe;
 	bool m_emitOneTimeStreamingSignal;
 
+	QScopedPointer<GattAudioPreRoll> m_preRoll;
+
+	QThread *m_audioThread;
+
+	int m_lastLatencyFrames;
+	qint64 m_lastLatencyAverageUsecs;
+	qint64 m_lastLatencyMaxUsecs;
+
+	int m_lastNotifyWakeups;
+	int m_lastNotifyPackets;
+	int m_lastOutputWrites;
+
+	Future<> m_notifyEnableResult;
+	bool m_notifyWasEnabled;
+	int m_unsolicitedPackets;
+
+	struct FirstFrameLatency {
+		int streams;
+		qint64 lastMsecs;
+		qint64 totalMsecs;
+		qint64 maxMsecs;
+	};
+
+	QElapsedTimer m_firstFrameTimer;
+	FirstFrameLatency m_firstFrameLatency[2];
+
 private:
 	static const BleUuid m_serviceUuid;
 
@@ -28,7 +28,6 @@
 
 #include "utils/logging.h"
 
-#include <QTimer>
 
 
 const BleUuid GattBatteryService::m_serviceUuid(BleUuid::BatteryService);
@@ -43,7 +42,7 @@ GattBatteryService::GattBatteryService()
 	// setup the timer that polls the battery level and reports in the log
 	m_logTimer.setSingleShot(false);
 	m_logTimer.setInterval(5 * 60 * 1000);
-	QObject::connect(&m_logTimer, &QTimer::timeout,
+	QObject::connect(&m_logTimer, &WheelTimer::timeout,
 	                 this, &GattBatteryService::onLogTimerTimeout);
 
 	// create the basic statemachine
@@ -77,6 +76,45 @@ int GattBatteryService::sanitiseBatteryLevel(char level) const
 	return qBound<int>(0, level, 100);
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the state graph shared by the battery services of all the RCUs.
+
+ */
+QSharedPointer<const StateGraph> GattBatteryService::stateGraph()
+{
+	// all the states and the super state groupings, parent states first
+	static constexpr StateGraph::StateDef states[] = {
+		{ -1,  IdleState,         "Idle"        },
+		{ -1,  StartNotifyState,  "StartNotify" },
+		{ -1,  StartingState,     "Starting"    },
+		{ -1,  RunningState,      "Running"     },
+	};
+
+	// the transitions, from state -> event -> to state
+	static constexpr StateGraph::TransitionDef transitions[] = {
+		{ IdleState,         StartServiceRequestEvent,  StartNotifyState },
+
+		{ StartNotifyState,  RetryStartNotifyEvent,     StartNotifyState },
+		{ StartNotifyState,  StopServiceRequestEvent,   IdleState        },
+		{ StartNotifyState,  StartedNotifingEvent,      StartingState    },
+
+		{ StartingState,     ServiceReadyEvent,         RunningState     },
+		{ StartingState,     StopServiceRequestEvent,   IdleState        },
+
+		{ RunningState,      StopServiceRequestEvent,   IdleState        },
+	};
+
+	static_assert(StateGraph::isValid(states, transitions, IdleState),
+	              "invalid GattBatteryService state graph");
+
+	static const QSharedPointer<const StateGraph> graph =
+		StateGraph::create(states, transitions, IdleState);
+	return graph;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -87,24 +125,8 @@ void GattBatteryService::init()
 {
 	m_stateMachine.setObjectName(QStringLiteral("GattBatteryService"));
 
-	// add all the states and the super state groupings
-	m_stateMachine.addState(IdleState, QStringLiteral("Idle"));
-	m_stateMachine.addState(StartNotifyState, QStringLiteral("StartNotify"));
-	m_stateMachine.addState(StartingState, QStringLiteral("Starting"));
-	m_stateMachine.addState(RunningState, QStringLiteral("Running"));
-
-
-	// add the transitions:      From State     -> Event                   ->  To State
-	m_stateMachine.addTransition(IdleState,        StartServiceRequestEvent,   StartNotifyState);
-
-	m_stateMachine.addTransition(StartNotifyState, RetryStartNotifyEvent,      StartNotifyState);
-	m_stateMachine.addTransition(StartNotifyState, StopServiceRequestEvent,    IdleState);
-	m_stateMachine.addTransition(StartNotifyState, StartedNotifingEvent,       StartingState);
-
-	m_stateMachine.addTransition(StartingState,    ServiceReadyEvent,          RunningState);
-	m_stateMachine.addTransition(StartingState,    StopServiceRequestEvent,    IdleState);
-
-	m_stateMachine.addTransition(RunningState,     StopServiceRequestEvent,    IdleState);
+	// use the state graph shared by all instances
+	m_stateMachine.setStateGraph(stateGraph());
 
 
 	// connect to the state entry signal
@@ -112,8 +134,7 @@ void GattBatteryService::init()
 	                 this, &GattBatteryService::onEnteredState);
 
 
-	// set the initial state of the state machine and start it
-	m_stateMachine.setInitialState(IdleState);
+	// start the state machine
 	m_stateMachine.start();
 }
 
@@ -28,9 +28,9 @@
 #include "blercu/bleservices/blercubatteryservice.h"
 #include "utils/bleuuid.h"
 #include "utils/statemachine.h"
+#include "utils/timerwheel.h"
 
 #include <QString>
-#include <QTimer>
 #include <QSharedPointer>
 
 
@@ -69,6 +69,7 @@ private:
 		RunningState,
 	};
 
+	static QSharedPointer<const StateGraph> stateGraph();
 	void init();
 
 	int sanitiseBatteryLevel(char level) const;
@@ -91,7 +92,7 @@ private:
 	int m_batteryLevel;
 	int m_lastLoggedLevel;
 
-	QTimer m_logTimer;
+	WheelTimer m_logTimer;
 
 private:
 	static const BleUuid m_serviceUuid;
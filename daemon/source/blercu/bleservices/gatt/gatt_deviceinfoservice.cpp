@@ -70,11 +70,23 @@ const QMap<GattDeviceInfoService::InfoField, GattDeviceInfoService::StateHandler
 	Constructs the device info service which queries the info over the bluez
 	GATT interface.
 
+	The firmware revision is read first, on its own, and firmwareVersionRead()
+	is emitted before any other reads are issued.  This gives the owner the
+	chance to check any cached values against the firmware version before
+	they are served.  The other device info characteristics are then read in
+	a pipeline, the \a readDepth limits the number of reads outstanding at
+	any one time.  If \a readDepth is \c 0 or less then all the reads are
+	issued at once.
+
  */
-GattDeviceInfoService::GattDeviceInfoService()
+GattDeviceInfoService::GattDeviceInfoService(int readDepth)
 	: BleRcuDeviceInfoService(nullptr)
 	, m_forceRefresh(false)
 	, m_infoFlags(0)
+	, m_readDepth(readDepth)
+	, m_outstandingReads(0)
+	, m_completedFlags(0)
+	, m_readGeneration(0)
 	, m_systemId(0)
 	, m_vendorIdSource(Invalid)
 	, m_vendorId(0)
@@ -103,31 +115,54 @@ BleUuid GattDeviceInfoService::uuid()
 // -----------------------------------------------------------------------------
 /*!
 	\internal
- 
-	Initailises the state machine used internally by the class.
+
+	Returns the state graph shared by the device info services of all the RCUs.
 
  */
-void GattDeviceInfoService::init()
+QSharedPointer<const StateGraph> GattDeviceInfoService::stateGraph()
 {
-	m_stateMachine.setObjectName(QStringLiteral("GattDeviceInfoService"));
+	// all the states and the super state groupings, parent states first
+	static constexpr StateGraph::StateDef states[] = {
+		{ -1,  IdleState,          "Idle"         },
+		{ -1,  InitialisingState,  "Initialising" },
+		{ -1,  RunningState,       "Running"      },
+		{ -1,  StoppedState,       "Stopped"      },
+	};
+
+	// the transitions, from state -> event -> to state
+	static constexpr StateGraph::TransitionDef transitions[] = {
+		{ IdleState,          StartServiceRequestEvent,              InitialisingState },
+		{ IdleState,          StartServiceForceRefreshRequestEvent,  InitialisingState },
+
+		{ InitialisingState,  StopServiceRequestEvent,               IdleState         },
+		{ InitialisingState,  InitialisedEvent,                      RunningState      },
 
-	// add all the states and the super state groupings
-	m_stateMachine.addState(IdleState, QStringLiteral("Idle"));
-	m_stateMachine.addState(InitialisingState, QStringLiteral("Initialising"));
-	m_stateMachine.addState(RunningState, QStringLiteral("Running"));
-	m_stateMachine.addState(StoppedState, QStringLiteral("Stopped"));
+		{ RunningState,       StopServiceRequestEvent,               StoppedState      },
+		{ StoppedState,       StartServiceRequestEvent,              RunningState      },
+		{ StoppedState,       StartServiceForceRefreshRequestEvent,  InitialisingState },
+	};
 
+	static_assert(StateGraph::isValid(states, transitions, IdleState),
+	              "invalid GattDeviceInfoService state graph");
 
-	// add the transitions:      From State        ->   Event                               ->  To State
-	m_stateMachine.addTransition(IdleState,             StartServiceRequestEvent,               InitialisingState);
-	m_stateMachine.addTransition(IdleState,             StartServiceForceRefreshRequestEvent,   InitialisingState);
+	static const QSharedPointer<const StateGraph> graph =
+		StateGraph::create(states, transitions, IdleState);
+	return graph;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+ 
+	Initailises the state machine used internally by the class.
 
-	m_stateMachine.addTransition(InitialisingState,     StopServiceRequestEvent,                IdleState);
-	m_stateMachine.addTransition(InitialisingState,     InitialisedEvent,                       RunningState);
+ */
+void GattDeviceInfoService::init()
+{
+	m_stateMachine.setObjectName(QStringLiteral("GattDeviceInfoService"));
 
-	m_stateMachine.addTransition(RunningState,          StopServiceRequestEvent,                StoppedState);
-	m_stateMachine.addTransition(StoppedState,          StartServiceRequestEvent,               RunningState);
-	m_stateMachine.addTransition(StoppedState,          StartServiceForceRefreshRequestEvent,   InitialisingState);
+	// use the state graph shared by all instances
+	m_stateMachine.setStateGraph(stateGraph());
 
 
 	// connect to the state entry signal
@@ -137,8 +172,7 @@ void GattDeviceInfoService::init()
 	                 this, &GattDeviceInfoService::onExitedState);
 
 
-	// set the initial state of the state machine and start it
-	m_stateMachine.setInitialState(IdleState);
+	// start the state machine
 	m_stateMachine.start();
 }
 
@@ -211,17 +245,13 @@ void GattDeviceInfoService::onEnteredState(int state)
 {
 	switch (state) {
 		case InitialisingState:
-			// clear the bitmask of recceived fields and go and request them
-			// all in one big lump
+			// clear the bitmasks of received fields and read the firmware
+			// version, the other fields are queued once that has completed
 			m_infoFlags = 0;
-			sendCharacteristicReadRequest(ManufacturerName);
-			sendCharacteristicReadRequest(ModelNumber);
-			sendCharacteristicReadRequest(SerialNumber);
-			sendCharacteristicReadRequest(HardwareRevision);
-			sendCharacteristicReadRequest(FirmwareVersion);
-			sendCharacteristicReadRequest(SoftwareVersion);
-			sendCharacteristicReadRequest(PnPId);
-			sendCharacteristicReadRequest(SystemId);
+			m_completedFlags = 0;
+			m_outstandingReads = 0;
+			m_pendingReads = { FirmwareVersion };
+			sendPendingReadRequests();
 			break;
 
 		case RunningState:
@@ -242,6 +272,13 @@ void GattDeviceInfoService::onExitedState(int state)
 	// device info fields, so at this point log a milestone message with all
 	// the details
 	if (state == InitialisingState) {
+
+		// any replies still to arrive are from this initialisation so should
+		// be ignored
+		m_readGeneration++;
+		m_pendingReads.clear();
+		m_outstandingReads = 0;
+
 		qProdLog("bluetooth rcu device info [ %s / %s / hw:%s / fw:%s / sw:%s ]",
 		         qPrintable(m_manufacturerName), qPrintable(m_modelNumber),
 		         qPrintable(m_hardwareRevision), qPrintable(m_firmwareVersion),
@@ -253,6 +290,28 @@ void GattDeviceInfoService::onExitedState(int state)
 /*!
 	\internal
 
+	Sends read requests for the queued fields until either there are no more
+	or the read depth is reached.  Reads that complete synchronously, i.e.
+	from the cache, call back into here via onCharacteristicReadCompleted()
+	which is fine as each call just takes the next field from the queue.
+
+ */
+void GattDeviceInfoService::sendPendingReadRequests()
+{
+	while (!m_pendingReads.isEmpty() &&
+	       ((m_readDepth <= 0) || (m_outstandingReads < m_readDepth))) {
+		sendCharacteristicReadRequest(m_pendingReads.takeFirst());
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Sends a read request for the characteristic of the given \a field.  If the
+	characteristic is missing or the read fails the field is still marked as
+	completed, so a missing or broken characteristic doesn't stop the service
+	from becoming ready.
 
  */
 void GattDeviceInfoService::sendCharacteristicReadRequest(InfoField field)
@@ -265,6 +324,7 @@ void GattDeviceInfoService::sendCharacteristicReadRequest(InfoField field)
 
 	if (Q_UNLIKELY(!m_gattService || !m_gattService->isValid())) {
 		qError("gatt service info is not valid");
+		onCharacteristicReadCompleted(field);
 		return;
 	}
 
@@ -283,9 +343,15 @@ void GattDeviceInfoService::sendCharacteristicReadRequest(InfoField field)
 			           << uuid << "skipping device info characteristic";
 		}
 
+		onCharacteristicReadCompleted(field);
 		return;
 	}
 
+	// the device info values don't change while connected so allow them to
+	// be served from the cache, except the firmware revision which is used
+	// to check the cached values so must always come from the device
+	characteristic->setCacheable(field != FirmwareVersion);
+
 	// request a read on the characteristic
 	Future<QByteArray> result = characteristic->readValue();
 	if (!result.isValid() || result.isError()) {
@@ -296,14 +362,30 @@ void GattDeviceInfoService::sendCharacteristicReadRequest(InfoField field)
 		return;
 	}
 
-	// bind the field the request is for as well
+	// the functors check the reply is for the current initialisation, the
+	// service may have been stopped and restarted while the read was in
+	// flight
+	const quint32 generation = m_readGeneration;
+
 	const std::function<void(const QByteArray&)> successFunctor =
-		std::bind(&GattDeviceInfoService::onCharacteristicReadSuccess,
-		          this, std::placeholders::_1, field);
+		[this, generation, field](const QByteArray &value) {
+			if (generation != m_readGeneration)
+				return;
+
+			m_outstandingReads--;
+			onCharacteristicReadSuccess(value, field);
+		};
 
 	const std::function<void(const QString&, const QString&)> errorFunctor =
-		std::bind(&GattDeviceInfoService::onCharacteristicReadError,
-		          this, std::placeholders::_1, std::placeholders::_2, field);
+		[this, generation, field](const QString &error, const QString &message) {
+			if (generation != m_readGeneration)
+				return;
+
+			m_outstandingReads--;
+			onCharacteristicReadError(error, message, field);
+		};
+
+	m_outstandingReads++;
 
 	// connect functors to the future async completion
 	result.connectErrored(this, errorFunctor);
@@ -334,22 +416,10 @@ void GattDeviceInfoService::onCharacteristicReadSuccess(const QByteArray &value,
 		(this->*(handler.handler))(value);
 
 
-	// add the field to our bitmask of received fields, if we've got them all
-	// then can signal we're initialised
+	// add the field to our bitmask of received fields
 	m_infoFlags |= field;
 
-
-	// check if we now have all the required fields
-	static const InfoFieldFlags requiredFields = ManufacturerName
-	                                           | ModelNumber
-	                                           | SerialNumber
-	                                           | HardwareRevision
-	                                           | FirmwareVersion
-	                                           | SoftwareVersion
-	                                           | PnPId;
-
-	if ((requiredFields & m_infoFlags) == requiredFields)
-		m_stateMachine.postEvent(InitialisedEvent);
+	onCharacteristicReadCompleted(field);
 }
 
 // -----------------------------------------------------------------------------
@@ -374,6 +444,60 @@ void GattDeviceInfoService::onCharacteristicReadError(const QString &error,
 	const StateHandler &handler = m_stateHandler[field];
 	qWarning() << "failed to read value for characteristic with uuid"
 	           << handler.uuid << "due to" << error << message;
+
+	onCharacteristicReadCompleted(field);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when the read of a \a field has completed, either successfully or
+	not.  Once all the fields have completed the service is initialised,
+	otherwise the next queued read is sent.
+
+	When the firmware version read completes firmwareVersionRead() is emitted
+	and then the reads for the rest of the fields are queued.
+
+	A failed read isn't retried, the field just keeps its last value (which
+	is empty if it's never been read).
+
+ */
+void GattDeviceInfoService::onCharacteristicReadCompleted(InfoField field)
+{
+	m_completedFlags |= field;
+
+	static const InfoFieldFlags allFields = ManufacturerName
+	                                      | ModelNumber
+	                                      | SerialNumber
+	                                      | HardwareRevision
+	                                      | FirmwareVersion
+	                                      | SoftwareVersion
+	                                      | SystemId
+	                                      | PnPId;
+
+	// the system id is optional so isn't reported as missing
+	static const InfoFieldFlags requiredFields = allFields & ~InfoFieldFlags(SystemId);
+
+	if (field == FirmwareVersion) {
+		emit firmwareVersionRead((m_infoFlags & FirmwareVersion) ?
+		                         m_firmwareVersion : QString());
+
+		m_pendingReads = { ManufacturerName, ModelNumber, SerialNumber,
+		                   HardwareRevision, SoftwareVersion, PnPId, SystemId };
+	}
+
+	if ((m_completedFlags & allFields) == allFields) {
+
+		if ((m_infoFlags & requiredFields) != requiredFields)
+			qWarning("failed to read some device info fields (0x%02x), continuing anyway",
+			         unsigned(requiredFields & ~m_infoFlags));
+
+		m_stateMachine.postEvent(InitialisedEvent);
+		return;
+	}
+
+	sendPendingReadRequests();
 }
 
 // -----------------------------------------------------------------------------
@@ -31,6 +31,7 @@
 #include "utils/bleuuid.h"
 
 #include <QMap>
+#include <QList>
 #include <QLatin1String>
 
 
@@ -42,7 +43,7 @@ class GattDeviceInfoService : public BleRcuDeviceInfoService
 	Q_OBJECT
 
 public:
-	GattDeviceInfoService();
+	explicit GattDeviceInfoService(int readDepth = 0);
 	~GattDeviceInfoService() final;
 
 public:
@@ -59,6 +60,7 @@ public:
 	
 signals:
 	void ready();
+	void firmwareVersionRead(const QString &firmwareVersion);
 
 public:
 	Future<qint16> rssi() const override;
@@ -86,6 +88,7 @@ private:
 		StoppedState
 	};
 
+	static QSharedPointer<const StateGraph> stateGraph();
 	void init();
 
 public:
@@ -105,10 +108,12 @@ private:
 	void onEnteredState(int state);
 	void onExitedState(int state);
 
+	void sendPendingReadRequests();
 	void sendCharacteristicReadRequest(InfoField field);
 	void onCharacteristicReadSuccess(const QByteArray &data, InfoField field);
 	void onCharacteristicReadError(const QString &error, const QString &message,
 	                               InfoField field);
+	void onCharacteristicReadCompleted(InfoField field);
 
 private:
 	void setManufacturerName(const QByteArray &value);
@@ -136,6 +141,12 @@ private:
 
 	InfoFieldFlags m_infoFlags;
 
+	const int m_readDepth;
+	QList<InfoField> m_pendingReads;
+	int m_outstandingReads;
+	InfoFieldFlags m_completedFlags;
+	quint32 m_readGeneration;
+
 private:
 	QString m_manufacturerName;
 	QString m_modelNumber;
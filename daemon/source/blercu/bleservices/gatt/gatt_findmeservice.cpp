@@ -57,6 +57,38 @@ BleUuid GattFindMeService::uuid()
 	return m_serviceUuid;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the state graph shared by the find me services of all the RCUs.
+
+ */
+QSharedPointer<const StateGraph> GattFindMeService::stateGraph()
+{
+	// all the states and the super state groupings, parent states first
+	static constexpr StateGraph::StateDef states[] = {
+		{ -1,  IdleState,      "Idle"     },
+		{ -1,  StartingState,  "Starting" },
+		{ -1,  RunningState,   "Running"  },
+	};
+
+	// the transitions, from state -> event -> to state
+	static constexpr StateGraph::TransitionDef transitions[] = {
+		{ IdleState,      StartServiceRequestEvent,  StartingState },
+		{ StartingState,  ServiceReadyEvent,         RunningState  },
+		{ StartingState,  StopServiceRequestEvent,   IdleState     },
+		{ RunningState,   StopServiceRequestEvent,   IdleState     },
+	};
+
+	static_assert(StateGraph::isValid(states, transitions, IdleState),
+	              "invalid GattFindMeService state graph");
+
+	static const QSharedPointer<const StateGraph> graph =
+		StateGraph::create(states, transitions, IdleState);
+	return graph;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -69,17 +101,8 @@ void GattFindMeService::init()
 {
 	m_stateMachine.setObjectName(QStringLiteral("GattFindMeService"));
 
-	// add all the states and the super state groupings
-	m_stateMachine.addState(IdleState, QStringLiteral("Idle"));
-	m_stateMachine.addState(StartingState, QStringLiteral("Starting"));
-	m_stateMachine.addState(RunningState, QStringLiteral("Running"));
-
-
-	// add the transitions:      From State  -> Event                   ->  To State
-	m_stateMachine.addTransition(IdleState,     StartServiceRequestEvent,   StartingState);
-	m_stateMachine.addTransition(StartingState, ServiceReadyEvent,          RunningState);
-	m_stateMachine.addTransition(StartingState, StopServiceRequestEvent,    IdleState);
-	m_stateMachine.addTransition(RunningState,  StopServiceRequestEvent,    IdleState);
+	// use the state graph shared by all instances
+	m_stateMachine.setStateGraph(stateGraph());
 
 
 	// connect to the state entry signal
@@ -89,8 +112,7 @@ void GattFindMeService::init()
 	                 this, &GattFindMeService::onExitedState);
 
 
-	// set the initial state of the state machine and start it
-	m_stateMachine.setInitialState(IdleState);
+	// start the state machine
 	m_stateMachine.start();
 }
 
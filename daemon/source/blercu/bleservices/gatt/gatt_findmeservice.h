@@ -70,6 +70,7 @@ private:
 		RunningState,
 	};
 
+	static QSharedPointer<const StateGraph> stateGraph();
 	void init();
 
 	Future<> setFindMeLevel(quint8 level);
@@ -101,6 +101,45 @@ BleUuid GattInfraredService::uuid()
 	return m_serviceUuid;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the state graph shared by the infrared services of all the RCUs.
+
+ */
+QSharedPointer<const StateGraph> GattInfraredService::stateGraph()
+{
+	// all the states and the super state groupings, parent states first
+	static constexpr StateGraph::StateDef states[] = {
+		{ -1,                  IdleState,            "Idle"               },
+		{ -1,                  StartingSuperState,   "StartingSuperState" },
+		{ StartingSuperState,  SetStandbyModeState,  "SetStandbyMode"     },
+		{ StartingSuperState,  GetCodeIdState,       "GetCodeId"          },
+		{ StartingSuperState,  GetIrSignalsState,    "GetIrSignals"       },
+		{ -1,                  RunningState,         "Running"            },
+	};
+
+	// the transitions, from state -> event -> to state
+	static constexpr StateGraph::TransitionDef transitions[] = {
+		{ IdleState,            StartServiceRequestEvent,  SetStandbyModeState },
+
+		{ SetStandbyModeState,  SetIrStandbyModeEvent,     GetCodeIdState      },
+		{ GetCodeIdState,       ReceivedCodeIdEvent,       GetIrSignalsState   },
+		{ GetIrSignalsState,    IrSignalsReadyEvent,       RunningState        },
+
+		{ StartingSuperState,   StopServiceRequestEvent,   IdleState           },
+		{ RunningState,         StopServiceRequestEvent,   IdleState           },
+	};
+
+	static_assert(StateGraph::isValid(states, transitions, IdleState),
+	              "invalid GattInfraredService state graph");
+
+	static const QSharedPointer<const StateGraph> graph =
+		StateGraph::create(states, transitions, IdleState);
+	return graph;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -111,24 +150,8 @@ void GattInfraredService::init()
 {
 	m_stateMachine.setObjectName(QStringLiteral("GattInfraredService"));
 
-	// add all the states and the super state groupings
-	m_stateMachine.addState(IdleState, QStringLiteral("Idle"));
-	m_stateMachine.addState(StartingSuperState, QStringLiteral("StartingSuperState"));
-	m_stateMachine.addState(StartingSuperState, SetStandbyModeState, QStringLiteral("SetStandbyMode"));
-	m_stateMachine.addState(StartingSuperState, GetCodeIdState, QStringLiteral("GetCodeId"));
-	m_stateMachine.addState(StartingSuperState, GetIrSignalsState, QStringLiteral("GetIrSignals"));
-	m_stateMachine.addState(RunningState, QStringLiteral("Running"));
-
-
-	// add the transitions:      From State         ->  Event                   ->  To State
-	m_stateMachine.addTransition(IdleState,             StartServiceRequestEvent,   SetStandbyModeState);
-
-	m_stateMachine.addTransition(SetStandbyModeState,   SetIrStandbyModeEvent,      GetCodeIdState);
-	m_stateMachine.addTransition(GetCodeIdState,        ReceivedCodeIdEvent,        GetIrSignalsState);
-	m_stateMachine.addTransition(GetIrSignalsState,     IrSignalsReadyEvent,        RunningState);
-
-	m_stateMachine.addTransition(StartingSuperState,    StopServiceRequestEvent,    IdleState);
-	m_stateMachine.addTransition(RunningState,          StopServiceRequestEvent,    IdleState);
+	// use the state graph shared by all instances
+	m_stateMachine.setStateGraph(stateGraph());
 
 
 	// add a slot for state machine notifications
@@ -136,8 +159,7 @@ void GattInfraredService::init()
 	                 this, &GattInfraredService::onEnteredState);
 
 
-	// set the initial state of the state machine and start it
-	m_stateMachine.setInitialState(IdleState);
+	// start the state machine
 	m_stateMachine.start();
 }
 
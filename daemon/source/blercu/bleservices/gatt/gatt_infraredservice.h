@@ -105,6 +105,7 @@ private:
 		RunningState,
 	};
 
+	static QSharedPointer<const StateGraph> stateGraph();
 	void init();
 
 private slots:
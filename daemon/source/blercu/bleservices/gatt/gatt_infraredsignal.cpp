@@ -93,39 +93,63 @@ GattInfraredSignal::~GattInfraredSignal()
 /*!
 	\internal
 
-	Sets up the state machine and starts it in the Idle state.
+	Returns the state graph shared by all the infrared signal objects, one is
+	created for each IR key of each RCU.
 
  */
-void GattInfraredSignal::initStateMachine()
+QSharedPointer<const StateGraph> GattInfraredSignal::stateGraph()
 {
-	m_stateMachine.setObjectName(QStringLiteral("GattInfraredSignal"));
-
-
-	// add all the states and the super state groupings
-	m_stateMachine.addState(IdleState, QStringLiteral("Idle"));
-	m_stateMachine.addState(InitialisingState, QStringLiteral("Initialising"));
-	m_stateMachine.addState(ReadyState, QStringLiteral("Ready"));
-	m_stateMachine.addState(ProgrammingSuperState, QStringLiteral("ProgrammingSuperState"));
-	m_stateMachine.addState(ProgrammingSuperState, DisablingState, QStringLiteral("Disabling"));
-	m_stateMachine.addState(ProgrammingSuperState, WritingState, QStringLiteral("Writing"));
-	m_stateMachine.addState(ProgrammingSuperState, EnablingState, QStringLiteral("Enabling"));
-
+	// all the states and the super state groupings, parent states first
+	static constexpr StateGraph::StateDef states[] = {
+		{ -1,                     IdleState,              "Idle"                  },
+		{ -1,                     InitialisingState,      "Initialising"          },
+		{ -1,                     ReadyState,             "Ready"                 },
+		{ -1,                     ProgrammingSuperState,  "ProgrammingSuperState" },
+		{ ProgrammingSuperState,  DisablingState,         "Disabling"             },
+		{ ProgrammingSuperState,  WritingState,           "Writing"               },
+		{ ProgrammingSuperState,  EnablingState,          "Enabling"              },
+	};
+
+	// the transitions, from state -> event -> to state
+	static constexpr StateGraph::TransitionDef transitions[] = {
+		{ IdleState,              StartRequestEvent,    InitialisingState },
+
+		{ InitialisingState,      AckEvent,             ReadyState        },
+		{ InitialisingState,      ErrorEvent,           IdleState         },
+		{ InitialisingState,      StopRequestEvent,     IdleState         },
+
+		{ ReadyState,             ProgramRequestEvent,  DisablingState    },
+
+		{ ProgrammingSuperState,  ErrorEvent,           ReadyState        },
+		{ ProgrammingSuperState,  StopRequestEvent,     IdleState         },
+
+		{ DisablingState,         AckEvent,             WritingState      },
+		{ WritingState,           AckEvent,             EnablingState     },
+		{ EnablingState,          AckEvent,             ReadyState        },
+	};
+
+	static_assert(StateGraph::isValid(states, transitions, IdleState),
+	              "invalid GattInfraredSignal state graph");
+
+	static const QSharedPointer<const StateGraph> graph =
+		StateGraph::create(states, transitions, IdleState);
+	return graph;
+}
 
-	// add the transitions:      From State         ->  Event               ->  To State
-	m_stateMachine.addTransition(IdleState,             StartRequestEvent,      InitialisingState);
+// -----------------------------------------------------------------------------
+/*!
+	\internal
 
-	m_stateMachine.addTransition(InitialisingState,     AckEvent,               ReadyState);
-	m_stateMachine.addTransition(InitialisingState,     ErrorEvent,             IdleState);
-	m_stateMachine.addTransition(InitialisingState,     StopRequestEvent,       IdleState);
+	Sets up the state machine and starts it in the Idle state.
 
-	m_stateMachine.addTransition(ReadyState,            ProgramRequestEvent,    DisablingState);
+ */
+void GattInfraredSignal::initStateMachine()
+{
+	m_stateMachine.setObjectName(QStringLiteral("GattInfraredSignal"));
 
-	m_stateMachine.addTransition(ProgrammingSuperState, ErrorEvent,             ReadyState);
-	m_stateMachine.addTransition(ProgrammingSuperState, StopRequestEvent,       IdleState);
 
-	m_stateMachine.addTransition(DisablingState,        AckEvent,               WritingState);
-	m_stateMachine.addTransition(WritingState,          AckEvent,               EnablingState);
-	m_stateMachine.addTransition(EnablingState,         AckEvent,               ReadyState);
+	// use the state graph shared by all instances
+	m_stateMachine.setStateGraph(stateGraph());
 
 
 	// add a slot for state machine notifications
@@ -135,8 +159,7 @@ void GattInfraredSignal::initStateMachine()
 	                 this, &GattInfraredSignal::onExitedState);
 
 
-	// set the initial state of the state machine and start it
-	m_stateMachine.setInitialState(IdleState);
+	// start the state machine
 	m_stateMachine.start();
 }
 
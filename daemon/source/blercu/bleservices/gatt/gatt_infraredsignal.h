@@ -78,6 +78,7 @@ private:
 			EnablingState,
 	};
 
+	static QSharedPointer<const StateGraph> stateGraph();
 	void initStateMachine();
 
 private slots:
@@ -70,6 +70,56 @@ BleUuid GattRemoteControlService::uuid()
 	return m_serviceUuid;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the state graph shared by the remote control services of all the RCUs.
+
+ */
+QSharedPointer<const StateGraph> GattRemoteControlService::stateGraph()
+{
+	// all the states and the super state groupings, parent states first
+	static constexpr StateGraph::StateDef states[] = {
+		{ -1,  IdleState,                   "Idle"                  },
+		{ -1,  StartReadLastKeypressState,  "StartReadLastKeypress" },
+		{ -1,  StartUnpairNotifyState,      "StartUnpairNotify"     },
+		{ -1,  StartRebootNotifyState,      "StartRebootNotify"     },
+		{ -1,  StartingState,               "Starting"              },
+		{ -1,  RunningState,                "Running"               },
+	};
+
+	// the transitions, from state -> event -> to state
+	static constexpr StateGraph::TransitionDef transitions[] = {
+		{ IdleState,                   StartServiceRequestEvent,  StartReadLastKeypressState },
+
+		// Need to read last keypress characteristic first so we can notify its initial value at the earliest possible time.
+		{ StartReadLastKeypressState,  RetryStartNotifyEvent,     StartReadLastKeypressState },
+		{ StartReadLastKeypressState,  StopServiceRequestEvent,   IdleState                  },
+		{ StartReadLastKeypressState,  StartedNotifingEvent,      StartUnpairNotifyState     },
+
+		{ StartUnpairNotifyState,      RetryStartNotifyEvent,     StartUnpairNotifyState     },
+		{ StartUnpairNotifyState,      StopServiceRequestEvent,   IdleState                  },
+		{ StartUnpairNotifyState,      StartedNotifingEvent,      StartRebootNotifyState     },
+
+		{ StartRebootNotifyState,      RetryStartNotifyEvent,     StartRebootNotifyState     },
+		{ StartRebootNotifyState,      StopServiceRequestEvent,   IdleState                  },
+		{ StartRebootNotifyState,      StartedNotifingEvent,      StartingState              },
+
+		{ StartingState,               ServiceReadyEvent,         RunningState               },
+		{ StartingState,               StopServiceRequestEvent,   IdleState                  },
+
+		{ RunningState,                StopServiceRequestEvent,   IdleState                  },
+	};
+
+	static_assert(StateGraph::isValid(states, transitions, IdleState),
+	              "invalid GattRemoteControlService state graph");
+
+	static const QSharedPointer<const StateGraph> graph =
+		StateGraph::create(states, transitions, IdleState);
+	return graph;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -80,35 +130,8 @@ void GattRemoteControlService::init()
 {
 	m_stateMachine.setObjectName(QStringLiteral("GattRemoteControlService"));
 
-	// add all the states and the super state groupings
-	m_stateMachine.addState(IdleState, QStringLiteral("Idle"));
-	m_stateMachine.addState(StartReadLastKeypressState, QStringLiteral("StartReadLastKeypress"));
-	m_stateMachine.addState(StartUnpairNotifyState, QStringLiteral("StartUnpairNotify"));
-	m_stateMachine.addState(StartRebootNotifyState, QStringLiteral("StartRebootNotify"));
-	m_stateMachine.addState(StartingState, QStringLiteral("Starting"));
-	m_stateMachine.addState(RunningState, QStringLiteral("Running"));
-
-
-	// add the transitions:      From State                  -> Event                    ->  To State
-	m_stateMachine.addTransition(IdleState,                  StartServiceRequestEvent,   StartReadLastKeypressState);
-
-	// Need to read last keypress characteristic first so we can notify its initial value at the earliest possible time.
-	m_stateMachine.addTransition(StartReadLastKeypressState, RetryStartNotifyEvent,      StartReadLastKeypressState);
-	m_stateMachine.addTransition(StartReadLastKeypressState, StopServiceRequestEvent,    IdleState);
-	m_stateMachine.addTransition(StartReadLastKeypressState, StartedNotifingEvent,       StartUnpairNotifyState);
-
-	m_stateMachine.addTransition(StartUnpairNotifyState,     RetryStartNotifyEvent,      StartUnpairNotifyState);
-	m_stateMachine.addTransition(StartUnpairNotifyState,     StopServiceRequestEvent,    IdleState);
-	m_stateMachine.addTransition(StartUnpairNotifyState,     StartedNotifingEvent,       StartRebootNotifyState);
-
-	m_stateMachine.addTransition(StartRebootNotifyState,     RetryStartNotifyEvent,      StartRebootNotifyState);
-	m_stateMachine.addTransition(StartRebootNotifyState,     StopServiceRequestEvent,    IdleState);
-	m_stateMachine.addTransition(StartRebootNotifyState,     StartedNotifingEvent,       StartingState);
-
-	m_stateMachine.addTransition(StartingState,              ServiceReadyEvent,          RunningState);
-	m_stateMachine.addTransition(StartingState,              StopServiceRequestEvent,    IdleState);
-
-	m_stateMachine.addTransition(RunningState,               StopServiceRequestEvent,    IdleState);
+	// use the state graph shared by all instances
+	m_stateMachine.setStateGraph(stateGraph());
 
 
 	// connect to the state entry signal
@@ -116,8 +139,7 @@ void GattRemoteControlService::init()
 	                 this, &GattRemoteControlService::onEnteredState);
 
 
-	// set the initial state of the state machine and start it
-	m_stateMachine.setInitialState(IdleState);
+	// start the state machine
 	m_stateMachine.start();
 }
 
@@ -154,6 +176,8 @@ bool GattRemoteControlService::start(const QSharedPointer<const BleGattService>
 		m_advConfigCharacteristic = gattService->characteristic(m_advConfigCharUuid);
 		if (!m_advConfigCharacteristic || !m_advConfigCharacteristic->isValid()) {
 			qWarning("Failed to get advertising config characteristic, check that remote firmware supports this feature.  Continuing anyway...");
+		} else {
+			m_advConfigCharacteristic->setCacheable(true);
 		}
 	}
 	// create the bluez dbus proxy to the characteristic
@@ -162,6 +186,8 @@ bool GattRemoteControlService::start(const QSharedPointer<const BleGattService>
 		m_advConfigCustomListCharacteristic = gattService->characteristic(m_advConfigCustomListCharUuid);
 		if (!m_advConfigCustomListCharacteristic || !m_advConfigCustomListCharacteristic->isValid()) {
 			qWarning("Failed to get advertising config custom list characteristic, check that remote firmware supports this feature.  Continuing anyway...");
+		} else {
+			m_advConfigCustomListCharacteristic->setCacheable(true);
 		}
 	}
 	// create the bluez dbus proxy to the characteristic
@@ -173,6 +199,9 @@ bool GattRemoteControlService::start(const QSharedPointer<const BleGattService>
 			return false;
 		}
 
+		// the value only changes on a notification, which clears the cache
+		m_unpairReasonCharacteristic->setCacheable(true);
+
 		// connect to the notification signal from the bluez daemon
 		QObject::connect(m_unpairReasonCharacteristic.data(),
 		                 &BleGattCharacteristic::valueChanged,
@@ -187,6 +216,9 @@ bool GattRemoteControlService::start(const QSharedPointer<const BleGattService>
 			return false;
 		}
 
+		// the value only changes on a notification, which clears the cache
+		m_rebootReasonCharacteristic->setCacheable(true);
+
 		// connect to the notification signal from the bluez daemon
 		QObject::connect(m_rebootReasonCharacteristic.data(),
 		                 &BleGattCharacteristic::valueChanged,
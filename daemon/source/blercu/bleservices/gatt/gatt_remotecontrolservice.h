@@ -78,6 +78,7 @@ private:
 		RunningState,
 	};
 
+	static QSharedPointer<const StateGraph> stateGraph();
 	void init();
 
 private slots:
@@ -35,10 +35,15 @@
 
 #include "blercu/blegattprofile.h"
 #include "blercu/blegattservice.h"
+#include "blercu/blegattcharacteristic.h"
+#include "blercu/blegattdescriptor.h"
+#include "utils/futureaggregator.h"
 #include "utils/logging.h"
 
 #include <QTimer>
 
+#include <string.h>
+
 
 // -----------------------------------------------------------------------------
 /*!
@@ -46,32 +51,91 @@
 	daemon and attempt to register the device with the supplied
 	\a bluezDeviceObjPath.
 
+	The \a gattSettings determine whether the services are started one after
+	the other or in parallel, see startPendingServices() for the details.
+
+	If \a upgradeResumeStore is not null then interrupted f/w upgrades are
+	recorded in it so they can be resumed, see GattUpgradeService.
 
  */
 GattServices::GattServices(const BleAddress &address,
                            const QSharedPointer<BleGattProfile> &gattProfile,
                            const QSharedPointer<const IrDatabase> &irDatabase,
                            const ConfigModelSettings &settings,
+                           const ConfigSettings::AudioSettings &audioSettings,
+                           const ConfigSettings::GattSettings &gattSettings,
+                           const QSharedPointer<GattUpgradeResumeStore> &upgradeResumeStore,
                            QObject *parent)
 	: BleRcuServices(parent)
 	, m_address(address)
 	, m_gattProfile(gattProfile)
 	, m_irDatabase(irDatabase)
-	, m_audioService(QSharedPointer<GattAudioService>::create())
-	, m_deviceInfoService(QSharedPointer<GattDeviceInfoService>::create())
+	, m_audioService(QSharedPointer<GattAudioService>::create(audioSettings))
+	, m_deviceInfoService(QSharedPointer<GattDeviceInfoService>::create(gattSettings.deviceInfoReadDepth))
 	, m_batteryService(QSharedPointer<GattBatteryService>::create())
 	, m_findMeService(QSharedPointer<GattFindMeService>::create())
 	, m_infraredService(QSharedPointer<GattInfraredService>::create(irDatabase, settings, m_deviceInfoService))
 	, m_touchService(QSharedPointer<GattTouchService>::create())
-	, m_upgradeService(QSharedPointer<GattUpgradeService>::create())
+	, m_upgradeService(QSharedPointer<GattUpgradeService>::create(address, upgradeResumeStore,
+	                                                              settings.upgradeBlockSize(),
+	                                                              settings.upgradeResume(),
+	                                                              settings.upgradeAdaptiveWindow()))
 	, m_remoteControlService(QSharedPointer<GattRemoteControlService>::create())
+	, m_restartServices(false)
+	, m_parallelStart(gattSettings.parallelServiceStart)
+	, m_maxServiceStarts(qMax(gattSettings.maxParallelServiceStarts, 1))
+	, m_schedulingServices(false)
 {
+	memset(m_readyTimes, 0x00, sizeof(m_readyTimes));
+
+	// the services and the only real ordering constraints between them; the
+	// infrared service uses the software version read by the device info
+	// service to pick the standby mode.  The order of the table is also the
+	// order services are started in when there is a choice, the remote
+	// control service is first so that the last keypress characteristic is
+	// read as soon as possible
+	const struct {
+		ServiceId id;
+		const char *name;
+		QEvent::Type readyEvent;
+		quint32 dependencies;
+	} services[ServiceIdCount] = {
+		{ RemoteControlServiceId,   "RemoteControl",    RemoteControlServiceReadyEvent, 0                               },
+		{ DeviceInfoServiceId,      "DeviceInfo",       DeviceInfoServiceReadyEvent,    0                               },
+		{ BatteryServiceId,         "Battery",          BatteryServiceReadyEvent,       0                               },
+		{ FindMeServiceId,          "FindMe",           FindMeServiceReadyEvent,        0                               },
+		{ AudioServiceId,           "Audio",            AudioServiceReadyEvent,         0                               },
+		{ InfraredServiceId,        "Infrared",         InfraredServiceReadyEvent,      (1U << DeviceInfoServiceId)     },
+		{ UpgradeServiceId,         "Upgrade",          UpgradeServiceReadyEvent,       0                               },
+	};
+
+	for (int i = 0; i < ServiceIdCount; i++) {
+		ServiceStartup &startup = m_serviceStartups[services[i].id];
+		startup.name = services[i].name;
+		startup.readyEvent = services[i].readyEvent;
+		startup.dependencies = services[i].dependencies;
+		startup.status = ServiceStartup::Pending;
+		startup.startedMsecs = -1;
+		startup.readyMsecs = -1;
+	}
 
 	// connect to the gatt profile update completed event
 	QObject::connect(gattProfile.data(), &BleGattProfile::updateCompleted,
 	                 this, &GattServices::onGattProfileUpdated,
 	                 Qt::QueuedConnection);
 
+	// and if the profile was loaded from the cache but turned out to be
+	// stale then we need to restart the services on the new profile
+	QObject::connect(gattProfile.data(), &BleGattProfile::cacheInvalidated,
+	                 this, &GattServices::onGattCacheInvalidated,
+	                 Qt::QueuedConnection);
+
+	// the device info service reads the firmware version before anything
+	// else, the cached values are checked against it before any of them are
+	// used (including by the rest of the device info service)
+	QObject::connect(m_deviceInfoService.data(), &GattDeviceInfoService::firmwareVersionRead,
+	                 this, &GattServices::onFirmwareVersionRead);
+
 	// connect to the upgradeFinished signal of the upgrade service to the
 	// device info service so that the device info service re-queries it's
 	// cached values after an upgrade
@@ -96,53 +160,101 @@ GattServices::~GattServices()
 /*!
 	\internal
 
-	Configures and starts the state machine
+	Returns the state graph shared by the services of all the RCUs.  There are
+	two graphs, if \a parallelStart is \c true all the services are started
+	from the one state in dependency order, otherwise each service is started
+	in turn from its own state.
+
  */
-void GattServices::init()
+QSharedPointer<const StateGraph> GattServices::stateGraph(bool parallelStart)
 {
-	m_stateMachine.setObjectName(QStringLiteral("GattServices"));
+	// all the states and the super state groupings, parent states first
+	static constexpr StateGraph::StateDef states[] = {
+		{ -1,                          IdleState,                          "Idle"                              },
+		{ -1,                          GettingGattServicesState,           "GettingGattServicesState"          },
+
+		{ -1,                          ResolvedServicesSuperState,         "ResolvedServicesSuperState"        },
+		{ ResolvedServicesSuperState,  StartingDeviceInfoServiceState,     "StartingDeviceInfoService"         },
+		{ ResolvedServicesSuperState,  StartingBatteryServiceState,        "StartingBatteryService"            },
+		{ ResolvedServicesSuperState,  StartingFindMeServiceState,         "StartingFindMeService"             },
+		{ ResolvedServicesSuperState,  StartingAudioServiceState,          "StartingAudioService"              },
+		{ ResolvedServicesSuperState,  StartingInfraredServiceState,       "StartingInfraredService"           },
+		{ ResolvedServicesSuperState,  StartingTouchServiceState,          "StartingTouchService"              },
+		{ ResolvedServicesSuperState,  StartingUpgradeServiceState,        "StartingUpgradeServiceState"       },
+		{ ResolvedServicesSuperState,  StartingRemoteControlServiceState,  "StartingRemoteControlServiceState" },
+		{ ResolvedServicesSuperState,  StartingServicesState,              "StartingServices"                  },
+		{ ResolvedServicesSuperState,  ReadyState,                         "Ready"                             },
+
+		{ -1,                          StoppingState,                      "Stopping"                          },
+	};
 
-	// add all the states and the super state groupings
-	m_stateMachine.addState(IdleState, QStringLiteral("Idle"));
-	m_stateMachine.addState(GettingGattServicesState, QStringLiteral("GettingGattServicesState"));
+	// the transitions when starting the services in parallel, from state ->
+	// event -> to state
+	static constexpr StateGraph::TransitionDef parallelTransitions[] = {
+		{ IdleState,                          StartServicesRequestEvent,       GettingGattServicesState           },
 
-	m_stateMachine.addState(ResolvedServicesSuperState, QStringLiteral("ResolvedServicesSuperState"));
-	m_stateMachine.addState(ResolvedServicesSuperState, StartingDeviceInfoServiceState, QStringLiteral("StartingDeviceInfoService"));
-	m_stateMachine.addState(ResolvedServicesSuperState, StartingBatteryServiceState, QStringLiteral("StartingBatteryService"));
-	m_stateMachine.addState(ResolvedServicesSuperState, StartingFindMeServiceState, QStringLiteral("StartingFindMeService"));
-	m_stateMachine.addState(ResolvedServicesSuperState, StartingAudioServiceState, QStringLiteral("StartingAudioService"));
-	m_stateMachine.addState(ResolvedServicesSuperState, StartingInfraredServiceState, QStringLiteral("StartingInfraredService"));
-	m_stateMachine.addState(ResolvedServicesSuperState, StartingTouchServiceState, QStringLiteral("StartingTouchService"));
-	m_stateMachine.addState(ResolvedServicesSuperState, StartingUpgradeServiceState, QStringLiteral("StartingUpgradeServiceState"));
-	m_stateMachine.addState(ResolvedServicesSuperState, StartingRemoteControlServiceState, QStringLiteral("StartingRemoteControlServiceState"));
-	m_stateMachine.addState(ResolvedServicesSuperState, ReadyState, QStringLiteral("Ready"));
+		{ GettingGattServicesState,           StopServicesRequestEvent,        IdleState                          },
 
-	m_stateMachine.addState(StoppingState, QStringLiteral("Stopping"));
+		// all the services are started from the one state, in dependency order
+		{ GettingGattServicesState,           GotGattServicesEvent,            StartingServicesState              },
+		{ StartingServicesState,              AllServicesReadyEvent,           ReadyState                         },
 
+		{ ResolvedServicesSuperState,         StopServicesRequestEvent,        StoppingState                      },
+		{ StoppingState,                      ServicesStoppedEvent,            IdleState                          },
+	};
 
-	// set the initial state of the state machine
-	m_stateMachine.setInitialState(IdleState);
+	// the transitions when starting the services one after the other
+	static constexpr StateGraph::TransitionDef serialTransitions[] = {
+		{ IdleState,                          StartServicesRequestEvent,       GettingGattServicesState           },
 
+		{ GettingGattServicesState,           StopServicesRequestEvent,        IdleState                          },
 
-	// add the transitions:      From State                    ->   Event                       ->  To State
-	m_stateMachine.addTransition(IdleState,                         StartServicesRequestEvent,      GettingGattServicesState);
+		{ GettingGattServicesState,           GotGattServicesEvent,            StartingRemoteControlServiceState  },
 
-	m_stateMachine.addTransition(GettingGattServicesState,          StopServicesRequestEvent,       IdleState);
-	m_stateMachine.addTransition(GettingGattServicesState,          GotGattServicesEvent,           StartingRemoteControlServiceState);
+		// Need to start RemoteControl service first so that we read the last keypress characterisitic as soon as possible
+		{ StartingRemoteControlServiceState,  RemoteControlServiceReadyEvent,  StartingDeviceInfoServiceState     },
+		{ StartingDeviceInfoServiceState,     DeviceInfoServiceReadyEvent,     StartingBatteryServiceState        },
+		{ StartingBatteryServiceState,        BatteryServiceReadyEvent,        StartingFindMeServiceState         },
+		{ StartingFindMeServiceState,         FindMeServiceReadyEvent,         StartingAudioServiceState          },
+		{ StartingAudioServiceState,          AudioServiceReadyEvent,          StartingInfraredServiceState       },
+		{ StartingInfraredServiceState,       InfraredServiceReadyEvent,       StartingUpgradeServiceState        },
+//		{ StartingInfraredServiceState,       InfraredServiceReadyEvent,       StartingTouchServiceState          },
+//		{ StartingTouchServiceState,          TouchServiceReadyEvent,          StartingUpgradeServiceState        },
+		{ StartingUpgradeServiceState,        UpgradeServiceReadyEvent,        ReadyState                         },
 
-	// Need to start RemoteControl service first so that we read the last keypress characterisitic as soon as possible
-	m_stateMachine.addTransition(StartingRemoteControlServiceState, RemoteControlServiceReadyEvent, StartingDeviceInfoServiceState);
-	m_stateMachine.addTransition(StartingDeviceInfoServiceState,    DeviceInfoServiceReadyEvent,    StartingBatteryServiceState);
-	m_stateMachine.addTransition(StartingBatteryServiceState,       BatteryServiceReadyEvent,       StartingFindMeServiceState);
-	m_stateMachine.addTransition(StartingFindMeServiceState,        FindMeServiceReadyEvent,        StartingAudioServiceState);
-	m_stateMachine.addTransition(StartingAudioServiceState,         AudioServiceReadyEvent,         StartingInfraredServiceState);
-	m_stateMachine.addTransition(StartingInfraredServiceState,      InfraredServiceReadyEvent,      StartingUpgradeServiceState);
-//	m_stateMachine.addTransition(StartingInfraredServiceState,      InfraredServiceReadyEvent,      StartingTouchServiceState);
-//	m_stateMachine.addTransition(StartingTouchServiceState,         TouchServiceReadyEvent,         StartingUpgradeServiceState);
-	m_stateMachine.addTransition(StartingUpgradeServiceState,       UpgradeServiceReadyEvent,       ReadyState);
+		{ ResolvedServicesSuperState,         StopServicesRequestEvent,        StoppingState                      },
+		{ StoppingState,                      ServicesStoppedEvent,            IdleState                          },
+	};
 
-	m_stateMachine.addTransition(ResolvedServicesSuperState,        StopServicesRequestEvent,       StoppingState);
-	m_stateMachine.addTransition(StoppingState,                     ServicesStoppedEvent,           IdleState);
+	static_assert(StateGraph::isValid(states, parallelTransitions, IdleState),
+	              "invalid GattServices parallel start state graph");
+	static_assert(StateGraph::isValid(states, serialTransitions, IdleState),
+	              "invalid GattServices serial start state graph");
+
+	if (parallelStart) {
+		static const QSharedPointer<const StateGraph> graph =
+			StateGraph::create(states, parallelTransitions, IdleState);
+		return graph;
+
+	} else {
+		static const QSharedPointer<const StateGraph> graph =
+			StateGraph::create(states, serialTransitions, IdleState);
+		return graph;
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Configures and starts the state machine
+ */
+void GattServices::init()
+{
+	m_stateMachine.setObjectName(QStringLiteral("GattServices"));
+
+	// use the state graph shared by all instances with the same start mode
+	m_stateMachine.setStateGraph(stateGraph(m_parallelStart));
 
 
 	// connect to the state entry and exit signals
@@ -183,6 +295,7 @@ void GattServices::stop()
 {
 	qInfo("stopping services");
 
+	m_restartServices = false;
 	m_stateMachine.postEvent(StopServicesRequestEvent);
 }
 
@@ -203,35 +316,39 @@ void GattServices::onEnteredState(int state)
 			break;
 
 		case StartingDeviceInfoServiceState:
-			startService(m_deviceInfoService, DeviceInfoServiceReadyEvent);
+			startService(DeviceInfoServiceId);
 			break;
 
 		case StartingBatteryServiceState:
-			startService(m_batteryService, BatteryServiceReadyEvent);
+			startService(BatteryServiceId);
 			break;
 
 		case StartingFindMeServiceState:
-			startService(m_findMeService, FindMeServiceReadyEvent);
+			startService(FindMeServiceId);
 			break;
 
 		case StartingAudioServiceState:
-			startService(m_audioService, AudioServiceReadyEvent);
+			startService(AudioServiceId);
 			break;
 
 		case StartingInfraredServiceState:
-			startService(m_infraredService, InfraredServiceReadyEvent);
+			startService(InfraredServiceId);
 			break;
 
 		case StartingUpgradeServiceState:
-			startService(m_upgradeService, UpgradeServiceReadyEvent);
+			startService(UpgradeServiceId);
 			break;
 
 		case StartingRemoteControlServiceState:
-			startService(m_remoteControlService, RemoteControlServiceReadyEvent);
+			startService(RemoteControlServiceId);
+			break;
+
+		case StartingServicesState:
+			onEnteredStartingServicesState();
 			break;
 
 		case ReadyState:
-			emit ready();
+			onEnteredReadyState();
 			break;
 
 		default:
@@ -251,10 +368,12 @@ void GattServices::onStateTransition(int fromState, int toState)
 
 		// if we're moving to the stopping state then we stop all the services
 		// that have been started - this code assumes the start-up order of
-		// the services matches the following switch statement
+		// the services matches the following switch statement, when started
+		// in parallel any service may have been started so all are stopped
 
 		switch (fromState) {
 			case ReadyState:
+			case StartingServicesState:
 			case StartingRemoteControlServiceState:
 				m_remoteControlService->stop();
 			case StartingUpgradeServiceState:
@@ -273,10 +392,38 @@ void GattServices::onStateTransition(int fromState, int toState)
 				break;
 		}
 
+		// drop any in-progress startup so late ready signals are ignored
+		resetServiceStartups();
+
+		// the device has (or is about to) disconnect, the attribute values
+		// may change before it reconnects so drop anything cached
+		invalidateGattCache();
+
 		m_stateMachine.postEvent(ServicesStoppedEvent);
 	}
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Discards the cached values of all the characteristics and descriptors in
+	the GATT profile.
+
+	\see BleGattCharacteristic::invalidateCache()
+ */
+void GattServices::invalidateGattCache()
+{
+	const QList< QSharedPointer<BleGattService> > gattServices = m_gattProfile->services();
+	for (const QSharedPointer<BleGattService> &gattService : gattServices) {
+
+		const QList< QSharedPointer<BleGattCharacteristic> > characteristics =
+			gattService->characteristics();
+		for (const QSharedPointer<BleGattCharacteristic> &characteristic : characteristics)
+			characteristic->invalidateCache();
+	}
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -285,6 +432,11 @@ void GattServices::onStateTransition(int fromState, int toState)
  */
 void GattServices::onEnteredIdleState()
 {
+	// if stopped because the gatt profile changed then start again
+	if (m_restartServices) {
+		m_restartServices = false;
+		m_stateMachine.postEvent(StartServicesRequestEvent);
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -299,6 +451,14 @@ void GattServices::onEnteredIdleState()
  */
 void GattServices::onEnteredGetGattServicesState()
 {
+	m_readyTimer.start();
+
+	resetServiceStartups();
+	for (int i = 0; i < ServiceIdCount; i++) {
+		m_serviceStartups[i].startedMsecs = -1;
+		m_serviceStartups[i].readyMsecs = -1;
+	}
+
 	// request an update of all the gatt details from bluez / android, this will
 	// emit the update signal when done which will trigger onGattProfileUpdated()
 	m_gattProfile->updateProfile();
@@ -321,10 +481,82 @@ void GattServices::onGattProfileUpdated()
 /*!
 	\internal
 
+	Slot called when the GATT profile was built from the persistent cache but
+	bluez reported a different set of attributes.  The services may be using
+	stale characteristics so they are stopped and restarted.
+
+ */
+void GattServices::onGattCacheInvalidated()
+{
+	if (!m_stateMachine.inState( { GettingGattServicesState, ResolvedServicesSuperState } ))
+		return;
+
+	qWarning("gatt profile changed, restarting services");
+
+	m_restartServices = true;
+	m_stateMachine.postEvent(StopServicesRequestEvent);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Slot called by the device info service once it has read the
+	\a firmwareVersion, before it reads any of the other device info fields.
+	If the profile came from the persistent cache the cached values are
+	discarded if they were stored for a different firmware version, so
+	neither the device info service nor any of the services that wait on it
+	are given stale values.
+
+ */
+void GattServices::onFirmwareVersionRead(const QString &firmwareVersion)
+{
+	m_gattProfile->validateCache(firmwareVersion);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called on entry to the ready state, records the time it took to get the
+	services ready and updates the persistent GATT cache with any values
+	read while starting.
+
+ */
+void GattServices::onEnteredReadyState()
+{
+	const bool cached = m_gattProfile->isCached();
+	const qint64 elapsed = m_readyTimer.elapsed();
+
+	ReadyTime &readyTime = m_readyTimes[cached ? 1 : 0];
+	readyTime.starts++;
+	readyTime.lastMsecs = elapsed;
+	readyTime.totalMsecs += elapsed;
+	readyTime.maxMsecs = qMax(readyTime.maxMsecs, elapsed);
+
+	qInfo("services ready in %lldms (%s gatt cache)", elapsed,
+	      cached ? "with" : "without");
+
+	m_gattProfile->storeCache(m_deviceInfoService->firmwareVersion());
+
+	emit ready();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Starts the service with the given \a id and records the time it was
+	started, onServiceReady() is called once the service is ready.
+
  */
 template <typename T>
-void GattServices::startService(const QSharedPointer<T> &service, QEvent::Type readyEvent)
+void GattServices::startService(const QSharedPointer<T> &service, ServiceId id)
 {
+	ServiceStartup &startup = m_serviceStartups[id];
+	startup.status = ServiceStartup::Starting;
+	startup.startedMsecs = m_readyTimer.elapsed();
+
 	// get the service uuid and use it to try and find a matching bluez service
 	// in the profile
 	if (!service->isReady()) {
@@ -333,9 +565,12 @@ void GattServices::startService(const QSharedPointer<T> &service, QEvent::Type r
 		if (!gattService || !gattService->isValid()) {
 			if (T::uuid() == BleUuid(BleUuid::ComcastRemoteControl)) {
 				qWarning() << "failed to find optional gatt service" << T::uuid() << ", ignoring...";
-				m_stateMachine.postEvent(readyEvent);
+				onServiceReady(id);
 			} else {
 				qError() << "failed to find gatt service with uuid" << T::uuid();
+#if !defined(EC101_WORKAROUND_MISSING_IR_SERVICE)
+				onServiceFailed(id);
+#endif
 			}
 #if !defined(EC101_WORKAROUND_MISSING_IR_SERVICE)
 			return;
@@ -345,22 +580,304 @@ void GattServices::startService(const QSharedPointer<T> &service, QEvent::Type r
 		// try and start the service
 		if (!service->start(gattService)) {
 			qError("failed to start service");
+			onServiceFailed(id);
 			return;
 		}
 	}
 
 	// check if it's ready now
 	if (service->isReady()) {
-		m_stateMachine.postEvent(readyEvent);
+		onServiceReady(id);
 		return;
 	}
 
 	// otherwise install a functor to deliver the 'ready' event to the
-	// state machine when it becomes ready
-	std::function<void()> functor = [this,readyEvent]() {
-		m_stateMachine.postEvent(readyEvent);
+	// state machine when it becomes ready, any connection from a previous
+	// start is removed first so we don't get duplicate events
+	std::function<void()> functor = [this,id]() {
+		onServiceReady(id);
 	};
-	QObject::connect(service.data(), &T::ready, this, functor);
+
+	QObject::disconnect(startup.readyConnection);
+	startup.readyConnection = QObject::connect(service.data(), &T::ready, this, functor);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Starts the service with the given \a id.
+
+ */
+void GattServices::startService(ServiceId id)
+{
+	switch (id) {
+		case RemoteControlServiceId:
+			startService(m_remoteControlService, id);
+			break;
+		case DeviceInfoServiceId:
+			startService(m_deviceInfoService, id);
+			break;
+		case BatteryServiceId:
+			startService(m_batteryService, id);
+			break;
+		case FindMeServiceId:
+			startService(m_findMeService, id);
+			break;
+		case AudioServiceId:
+			startService(m_audioService, id);
+			break;
+		case InfraredServiceId:
+			startService(m_infraredService, id);
+			break;
+		case UpgradeServiceId:
+			startService(m_upgradeService, id);
+			break;
+		default:
+			break;
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when the service with the given \a id is ready.  In sequential mode
+	this just posts the service's ready event to the state machine, in
+	parallel mode it completes the service's promise and starts any services
+	that were waiting on it.
+
+ */
+void GattServices::onServiceReady(ServiceId id)
+{
+	ServiceStartup &startup = m_serviceStartups[id];
+	if (startup.status != ServiceStartup::Starting)
+		return;
+
+	startup.status = ServiceStartup::Ready;
+	startup.readyMsecs = m_readyTimer.elapsed();
+
+	qDebug("%s service ready in %lldms", startup.name,
+	       (startup.readyMsecs - startup.startedMsecs));
+
+	if (!m_parallelStart) {
+		m_stateMachine.postEvent(startup.readyEvent);
+		return;
+	}
+
+	if (startup.promise) {
+		startup.promise->setFinished();
+		startup.promise.reset();
+	}
+
+	startPendingServices();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when the service with the given \a id failed to start.  The
+	services will never become ready, but in parallel mode the other services
+	are still started so that they are usable.
+
+	In parallel mode any pending services that depend on the failed one can
+	never start, so they are failed as well rather than left pending.
+
+ */
+void GattServices::onServiceFailed(ServiceId id)
+{
+	ServiceStartup &startup = m_serviceStartups[id];
+	startup.status = ServiceStartup::Failed;
+
+	if (startup.promise) {
+		startup.promise->setError(QStringLiteral("com.sky.Error.Failed"),
+		                          QStringLiteral("%1 service failed to start")
+		                              .arg(QLatin1String(startup.name)));
+		startup.promise.reset();
+	}
+
+	if (!m_parallelStart)
+		return;
+
+	for (int i = 0; i < ServiceIdCount; i++) {
+		if ((m_serviceStartups[i].status == ServiceStartup::Pending) &&
+		    (serviceDependencies(i) & (1U << id))) {
+			qWarning("not starting %s service as %s service failed",
+			         m_serviceStartups[i].name, startup.name);
+			onServiceFailed(ServiceId(i));
+		}
+	}
+
+	// the failed service no longer counts towards the starting limit
+	startPendingServices();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called on entry to the parallel 'StartingServices' state.  Creates a
+	promise for each service and aggregates them, when all have finished the
+	state machine moves to the ready state.
+
+ */
+void GattServices::onEnteredStartingServicesState()
+{
+	QList< Future<> > futures;
+
+	for (int i = 0; i < ServiceIdCount; i++) {
+		ServiceStartup &startup = m_serviceStartups[i];
+
+		startup.promise = QSharedPointer< Promise<> >::create();
+		futures.append(startup.promise->future());
+	}
+
+	m_startupAggregator = QSharedPointer<FutureAggregator>::create(std::move(futures));
+
+	QObject::connect(m_startupAggregator.data(), &FutureAggregator::finished,
+	                 this, [this]() {
+	                     m_stateMachine.postEvent(AllServicesReadyEvent);
+	                 });
+	QObject::connect(m_startupAggregator.data(), &FutureAggregator::errored,
+	                 this, [](const QString &errorName, const QString &errorMessage) {
+	                     qError() << "failed to start services" << errorName << errorMessage;
+	                 });
+
+	startPendingServices();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Starts as many of the pending services as are allowed.  A service is
+	started once all the services it depends on are ready and fewer than
+	\c maxParallelServiceStarts services are still starting.
+
+	Each service only does a few GATT reads / writes one after the other while
+	starting, so limiting the number of services starting at once also limits
+	the number of ATT operations queued up in bluez.
+
+	If the profile came from the persistent cache then every service also
+	waits on the device info service, as the cached values can't be used
+	until the firmware version has been checked.
+
+	A service can become ready synchronously within startService(), which
+	calls back into here, so re-entrant calls just return and the outer call
+	loops round again.
+
+ */
+void GattServices::startPendingServices()
+{
+	if (m_schedulingServices)
+		return;
+
+	m_schedulingServices = true;
+
+	bool started;
+	do {
+		started = false;
+
+		for (int i = 0; i < ServiceIdCount; i++) {
+			ServiceStartup &startup = m_serviceStartups[i];
+			if (startup.status != ServiceStartup::Pending)
+				continue;
+
+			if (servicesStarting() >= m_maxServiceStarts)
+				break;
+
+			const quint32 dependencies = serviceDependencies(i);
+
+			// check all the dependencies are ready
+			bool blocked = false;
+			for (int j = 0; j < ServiceIdCount; j++) {
+				if ((dependencies & (1U << j)) &&
+				    (m_serviceStartups[j].status != ServiceStartup::Ready)) {
+					blocked = true;
+					break;
+				}
+			}
+
+			if (blocked)
+				continue;
+
+			startService(ServiceId(i));
+			started = true;
+		}
+
+	} while (started && m_stateMachine.inState(StartingServicesState));
+
+	m_schedulingServices = false;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the number of services that have been started but aren't yet
+	ready.
+
+ */
+int GattServices::servicesStarting() const
+{
+	int starting = 0;
+	for (int i = 0; i < ServiceIdCount; i++) {
+		if (m_serviceStartups[i].status == ServiceStartup::Starting)
+			starting++;
+	}
+
+	return starting;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the bitmask of services that the service with the given \a id
+	has to wait on before it can be started.  If the profile came from the
+	persistent cache this includes the device info service for every other
+	service.
+
+ */
+quint32 GattServices::serviceDependencies(int id) const
+{
+	quint32 dependencies = m_serviceStartups[id].dependencies;
+	if (m_gattProfile->isCached() && (id != DeviceInfoServiceId))
+		dependencies |= (1U << DeviceInfoServiceId);
+
+	return dependencies;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Clears the start-up status of all the services, ready for them to be
+	started again.  The start-up times are kept for dump().  Any outstanding
+	promises are errored and the ready signal connections are removed so a
+	late ready signal from a previous start is ignored.
+
+ */
+void GattServices::resetServiceStartups()
+{
+	// release the aggregator first so it doesn't see the errors below
+	m_startupAggregator.reset();
+
+	for (int i = 0; i < ServiceIdCount; i++) {
+		ServiceStartup &startup = m_serviceStartups[i];
+
+		QObject::disconnect(startup.readyConnection);
+		startup.readyConnection = QMetaObject::Connection();
+
+		if (startup.promise) {
+			startup.promise->setError(QStringLiteral("com.sky.Error.Cancelled"),
+			                          QStringLiteral("Services stopped"));
+			startup.promise.reset();
+		}
+
+		startup.status = ServiceStartup::Pending;
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -483,6 +1000,102 @@ void GattServices::dump(Dumper out) const
 	out.printLine("state: %s",
 	              qPrintable(m_stateMachine.stateName(m_stateMachine.state())));
 
-	// TODO: dump out individual service states
+	static const char *cacheModes[2] = { "without", "with" };
+	for (int i = 0; i < 2; i++) {
+		const ReadyTime &readyTime = m_readyTimes[i];
+		if (readyTime.starts == 0)
+			continue;
+
+		out.printLine("time to ready (%s gatt cache): last %lldms, avg %lldms,"
+		              " max %lldms (%d starts)", cacheModes[i],
+		              readyTime.lastMsecs, (readyTime.totalMsecs / readyTime.starts),
+		              readyTime.maxMsecs, readyTime.starts);
+	}
+
+	dumpServiceStartups(out);
+
+	m_stateMachine.dump(out);
+
+	m_audioService->dump(out);
+
+	dumpGattCache(out);
+
+	// TODO: dump out the rest of the individual service states
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Dumps out when each service was started and became ready on the last
+	start-up, the times are relative to when the GATT profile was requested.
+
+ */
+void GattServices::dumpServiceStartups(Dumper out) const
+{
+	out.printLine("service start-up (%s, max %d at once):",
+	              m_parallelStart ? "parallel" : "sequential",
+	              m_parallelStart ? m_maxServiceStarts : 1);
+	out.pushIndent(2);
+
+	for (int i = 0; i < ServiceIdCount; i++) {
+		const ServiceStartup &startup = m_serviceStartups[i];
+
+		if (startup.readyMsecs >= 0)
+			out.printLine("%s: started at %lldms, ready at %lldms (%lldms)",
+			              startup.name, startup.startedMsecs, startup.readyMsecs,
+			              (startup.readyMsecs - startup.startedMsecs));
+		else if (startup.startedMsecs >= 0)
+			out.printLine("%s: started at %lldms, %s", startup.name, startup.startedMsecs,
+			              (startup.status == ServiceStartup::Failed) ? "failed" : "not ready");
+		else
+			out.printLine("%s: not started", startup.name);
+	}
+
+	out.popIndent();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Dumps out the cache hit / miss counts for all the cacheable characteristics
+	and descriptors in the GATT profile.
+
+ */
+void GattServices::dumpGattCache(Dumper out) const
+{
+	out.printLine("gatt cache:");
+	out.pushIndent(2);
+
+	const QList< QSharedPointer<BleGattService> > gattServices = m_gattProfile->services();
+	for (const QSharedPointer<BleGattService> &gattService : gattServices) {
+
+		const QList< QSharedPointer<BleGattCharacteristic> > characteristics =
+			gattService->characteristics();
+		for (const QSharedPointer<BleGattCharacteristic> &characteristic : characteristics) {
+
+			if (characteristic->cacheable()) {
+				out.printLine("%s: %d hits, %d misses",
+				              qPrintable(characteristic->uuid().name()),
+				              characteristic->cacheHits(),
+				              characteristic->cacheMisses());
+			}
+
+			const QList< QSharedPointer<BleGattDescriptor> > descriptors =
+				characteristic->descriptors();
+			for (const QSharedPointer<BleGattDescriptor> &descriptor : descriptors) {
+				if (!descriptor->cacheable())
+					continue;
+
+				out.printLine("%s / %s: %d hits, %d misses",
+				              qPrintable(characteristic->uuid().name()),
+				              qPrintable(descriptor->uuid().name()),
+				              descriptor->cacheHits(), descriptor->cacheMisses());
+			}
+		}
+	}
+
+	out.popIndent();
 }
 
@@ -28,13 +28,18 @@
 #include "blercu/bleservices/blercuservices.h"
 #include "utils/bleaddress.h"
 #include "utils/statemachine.h"
+#include "utils/promise.h"
 #include "configsettings/configsettings.h"
 
+#include <QElapsedTimer>
+
 
 class BleGattProfile;
 
 class IrDatabase;
 
+class FutureAggregator;
+
 class GattAudioService;
 class GattDeviceInfoService;
 class GattBatteryService;
@@ -42,6 +47,7 @@ class GattFindMeService;
 class GattInfraredService;
 class GattTouchService;
 class GattUpgradeService;
+class GattUpgradeResumeStore;
 class GattRemoteControlService;
 
 
@@ -55,6 +61,9 @@ public:
 	             const QSharedPointer<BleGattProfile> &gattProfile,
 	             const QSharedPointer<const IrDatabase> &irDatabase,
 	             const ConfigModelSettings &settings,
+	             const ConfigSettings::AudioSettings &audioSettings,
+	             const ConfigSettings::GattSettings &gattSettings,
+	             const QSharedPointer<GattUpgradeResumeStore> &upgradeResumeStore,
 	             QObject *parent = nullptr);
 	~GattServices() final;
 
@@ -77,14 +86,30 @@ public:
 	QSharedPointer<BleRcuRemoteControlService> remoteControlService() const override;
 
 private:
+	enum ServiceId {
+		RemoteControlServiceId,
+		DeviceInfoServiceId,
+		BatteryServiceId,
+		FindMeServiceId,
+		AudioServiceId,
+		InfraredServiceId,
+		UpgradeServiceId,
+		ServiceIdCount
+	};
+
 	template <typename T>
-	void startService(const QSharedPointer<T> &service, QEvent::Type readyEvent);
+	void startService(const QSharedPointer<T> &service, ServiceId id);
+	void startService(ServiceId id);
+	void onServiceReady(ServiceId id);
+	void onServiceFailed(ServiceId id);
 
 private slots:
 	void onEnteredState(int state);
 	void onStateTransition(int fromState, int toState);
 
 	void onGattProfileUpdated();
+	void onGattCacheInvalidated();
+	void onFirmwareVersionRead(const QString &firmwareVersion);
 
 private:
 	enum State {
@@ -99,15 +124,28 @@ private:
 			StartingTouchServiceState,
 			StartingUpgradeServiceState,
 			StartingRemoteControlServiceState,
+			StartingServicesState,
 			ReadyState,
 		StoppingState
 	};
 
+	static QSharedPointer<const StateGraph> stateGraph(bool parallelStart);
 	void init();
 
 	void onEnteredIdleState();
 	void onEnteredResolvingGattServicesState();
 	void onEnteredGetGattServicesState();
+	void onEnteredStartingServicesState();
+	void onEnteredReadyState();
+
+	void resetServiceStartups();
+	void startPendingServices();
+	int servicesStarting() const;
+	quint32 serviceDependencies(int id) const;
+	void dumpServiceStartups(Dumper out) const;
+
+	void invalidateGattCache();
+	void dumpGattCache(Dumper out) const;
 
 private:
 	const BleAddress m_address;
@@ -125,6 +163,38 @@ private:
 	mutable QSharedPointer<GattUpgradeService> m_upgradeService;
 	QSharedPointer<GattRemoteControlService> m_remoteControlService;
 
+	bool m_restartServices;
+
+	const bool m_parallelStart;
+	const int m_maxServiceStarts;
+
+	struct ServiceStartup {
+		enum Status { Pending, Starting, Ready, Failed };
+
+		const char *name;
+		QEvent::Type readyEvent;
+		quint32 dependencies;
+		Status status;
+		qint64 startedMsecs;
+		qint64 readyMsecs;
+		QSharedPointer< Promise<> > promise;
+		QMetaObject::Connection readyConnection;
+	};
+
+	ServiceStartup m_serviceStartups[ServiceIdCount];
+	QSharedPointer<FutureAggregator> m_startupAggregator;
+	bool m_schedulingServices;
+
+	struct ReadyTime {
+		int starts;
+		qint64 lastMsecs;
+		qint64 totalMsecs;
+		qint64 maxMsecs;
+	};
+
+	QElapsedTimer m_readyTimer;
+	ReadyTime m_readyTimes[2];
+
 private:
 	static const QEvent::Type StartServicesRequestEvent = QEvent::Type(QEvent::User + 1);
 	static const QEvent::Type StopServicesRequestEvent = QEvent::Type(QEvent::User + 2);
@@ -139,6 +209,7 @@ private:
 	static const QEvent::Type UpgradeServiceReadyEvent = QEvent::Type(QEvent::User + 10);
 	static const QEvent::Type RemoteControlServiceReadyEvent = QEvent::Type(QEvent::User + 11);
 	static const QEvent::Type ServicesStoppedEvent = QEvent::Type(QEvent::User + 12);
+	static const QEvent::Type AllServicesReadyEvent = QEvent::Type(QEvent::User + 13);
 
 };
 
@@ -0,0 +1,178 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  gatt_upgraderesume.cpp
+//  SkyBluetoothRcu
+//
+
+#include "gatt_upgraderesume.h"
+
+#include "utils/logging.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class GattUpgradeResumeStore
+	\brief Persistent record of how far an interrupted f/w upgrade got for each
+	RCU.
+
+	When an upgrade fails part way through, for example because the RCU went
+	out of range or to sleep, the image crc, version and length are stored
+	along with the last block the RCU ACKed.  The next upgrade of the same
+	image can then offer the RCU a resume from that block rather than
+	starting again from the beginning.
+
+	Each RCU gets it's own small JSON file in the directory, the same
+	directory as the GATT cache is used.  The entries are only written when
+	an upgrade finishes, not on every ACK.
+
+ */
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	Constructs a store that keeps it's files in \a directory, the directory
+	must already exist.
+
+ */
+GattUpgradeResumeStore::GattUpgradeResumeStore(const QString &directory)
+	: m_directory(directory)
+{
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the path of the resume file for the RCU with the given \a address.
+
+ */
+QString GattUpgradeResumeStore::filePath(const BleAddress &address) const
+{
+	QString name = address.toString().toLower();
+	name.remove(QChar(':'));
+
+	return QStringLiteral("%1/upgraderesume_%2.json").arg(m_directory, name);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Loads the resume entry for the RCU with the given \a address into \a entry.
+	Returns \c false if there is no entry or it is invalid.
+
+ */
+bool GattUpgradeResumeStore::load(const BleAddress &address, Entry *entry) const
+{
+	QFile file(filePath(address));
+	if (!file.exists())
+		return false;
+
+	if (!file.open(QFile::ReadOnly)) {
+		qWarning() << "failed to open upgrade resume file" << file.fileName()
+		           << "due to" << file.errorString();
+		return false;
+	}
+
+	QJsonParseError error;
+	const QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &error);
+	if (doc.isNull() || !doc.isObject()) {
+		qWarning() << "failed to parse upgrade resume file for" << address
+		           << "due to" << error.errorString();
+		return false;
+	}
+
+	const QJsonObject json = doc.object();
+
+	const int version = json[QStringLiteral("version")].toInt(-1);
+	if (version != m_version) {
+		qInfo() << "ignoring upgrade resume file for" << address
+		        << "as it has unsupported version" << version;
+		return false;
+	}
+
+	entry->crc32 = static_cast<quint32>(json[QStringLiteral("crc32")].toDouble(0));
+	entry->version = static_cast<quint32>(json[QStringLiteral("fwVersion")].toDouble(0));
+	entry->length = static_cast<quint32>(json[QStringLiteral("length")].toDouble(0));
+	entry->blockSize = json[QStringLiteral("blockSize")].toInt(-1);
+	entry->lastAckBlockId = json[QStringLiteral("lastAckBlockId")].toInt(-1);
+	entry->attempts = json[QStringLiteral("attempts")].toInt(0);
+	entry->bytesSent = static_cast<qint64>(json[QStringLiteral("bytesSent")].toDouble(0));
+
+	return (entry->length > 0) && (entry->blockSize > 0);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Stores the \a entry for the RCU with the given \a address, replacing any
+	existing entry.
+
+ */
+bool GattUpgradeResumeStore::store(const BleAddress &address, const Entry &entry)
+{
+	QJsonObject json;
+	json.insert(QStringLiteral("version"), m_version);
+	json.insert(QStringLiteral("address"), address.toString());
+	json.insert(QStringLiteral("crc32"), double(entry.crc32));
+	json.insert(QStringLiteral("fwVersion"), double(entry.version));
+	json.insert(QStringLiteral("length"), double(entry.length));
+	json.insert(QStringLiteral("blockSize"), entry.blockSize);
+	json.insert(QStringLiteral("lastAckBlockId"), entry.lastAckBlockId);
+	json.insert(QStringLiteral("attempts"), entry.attempts);
+	json.insert(QStringLiteral("bytesSent"), double(entry.bytesSent));
+
+	const QByteArray contents = QJsonDocument(json).toJson(QJsonDocument::Compact);
+
+	// write to a temporary file and then rename so we never leave a partial
+	// file behind
+	QSaveFile file(filePath(address));
+	if (!file.open(QFile::WriteOnly)) {
+		qWarning() << "failed to open upgrade resume file" << file.fileName()
+		           << "due to" << file.errorString();
+		return false;
+	}
+
+	if ((file.write(contents) != contents.size()) || !file.commit()) {
+		qWarning() << "failed to write upgrade resume file" << file.fileName()
+		           << "due to" << file.errorString();
+		return false;
+	}
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Removes the resume entry and file for the RCU with the given \a address.
+
+ */
+void GattUpgradeResumeStore::remove(const BleAddress &address)
+{
+	QFile file(filePath(address));
+	if (file.exists() && !file.remove())
+		qWarning() << "failed to remove upgrade resume file" << file.fileName()
+		           << "due to" << file.errorString();
+}
@@ -0,0 +1,68 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  gatt_upgraderesume.h
+//  SkyBluetoothRcu
+//
+
+#ifndef GATT_UPGRADERESUME_H
+#define GATT_UPGRADERESUME_H
+
+#include "utils/bleaddress.h"
+
+#include <QString>
+
+
+class GattUpgradeResumeStore
+{
+public:
+	struct Entry {
+		quint32 crc32;
+		quint32 version;
+		quint32 length;
+		int blockSize;
+		int lastAckBlockId;
+		int attempts;
+		qint64 bytesSent;
+	};
+
+public:
+	explicit GattUpgradeResumeStore(const QString &directory);
+	~GattUpgradeResumeStore() = default;
+
+public:
+	bool load(const BleAddress &address, Entry *entry) const;
+	bool store(const BleAddress &address, const Entry &entry);
+	void remove(const BleAddress &address);
+
+private:
+	QString filePath(const BleAddress &address) const;
+
+private:
+	static const int m_version = 1;
+
+	const QString m_directory;
+
+private:
+	Q_DISABLE_COPY(GattUpgradeResumeStore)
+};
+
+
+#endif // !defined(GATT_UPGRADERESUME_H)
@@ -23,12 +23,14 @@
 //
 
 #include "gatt_upgradeservice.h"
+#include "gatt_upgraderesume.h"
 
 #include "blercu/blegattservice.h"
 #include "blercu/blegattcharacteristic.h"
 #include "blercu/blegattdescriptor.h"
 
 #include "utils/fwimagefile.h"
+#include "utils/fwupgradeprotocol.h"
 #include "utils/logging.h"
 #include "utils/crc32.h"
 
@@ -40,16 +42,19 @@
 #include <sys/stat.h>
 
 
-/// Possible packet opcodes
-#define OPCODE_WRQ                    quint8(0x0 << 6)
-#define OPCODE_DATA                   quint8(0x1 << 6)
-#define OPCODE_ACK                    quint8(0x2 << 6)
-#define OPCODE_ERROR                  quint8(0x3 << 6)
+/// The size of the ATT write command header
+#define ATT_WRITE_CMD_HDR_SIZE        3
 
-#define OPCODE_MASK                   quint8(0x3 << 6)
+/// The limits on the retransmit timeout, the maximum is slightly longer than
+/// the 5s slave latency and is used until we have an RTT sample
+#define MIN_RETRANSMIT_TIMEOUT        1000
+#define MAX_RETRANSMIT_TIMEOUT        6000
 
-/// The maximum number of data bytes in a DATA packet
-#define FIRMWARE_PACKET_MTU           18
+/// Flag set in the reserved byte of the WRQ packet to ask the RCU to carry on
+/// from the last block it received of the same image, this isn't part of the
+/// original protocol so is only ever set for models with 'upgradeResume'
+/// enabled in the config
+#define WRQ_FLAG_RESUME               quint8(0x01)
 
 
 /// The structure representing the contents of the control point characteristic
@@ -61,23 +66,72 @@ struct Q_PACKED ControlPoint {
 Q_STATIC_ASSERT(sizeof(ControlPoint) == 12);
 
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the f/w \a version packed in the format used in the WRQ packet.
+
+ */
+static quint32 packedVersion(const QVersionNumber &version)
+{
+	return quint32(version.majorVersion() & 0xffff) << 16
+	     | quint32(version.minorVersion() & 0xff)   << 8
+	     | quint32(version.microVersion() & 0xff)   << 0;
+}
 
 
-GattUpgradeService::GattUpgradeService()
+
+
+GattUpgradeService::GattUpgradeService(const BleAddress &address,
+                                       const QSharedPointer<GattUpgradeResumeStore> &resumeStore,
+                                       int maxBlockSize,
+                                       bool resumeSupported,
+                                       bool adaptiveWindow)
 	: BleRcuUpgradeService(nullptr)
+	, m_address(address)
+	, m_resumeStore(resumeStore)
 	, m_ready(false)
 	, m_progress(-1)
 	, m_windowSize(5)
+	, m_maxBlockSize(qMax(maxBlockSize, FIRMWARE_PACKET_MTU))
+	, m_resumeSupported(resumeSupported)
+	, m_adaptiveWindow(adaptiveWindow)
+	, m_blockSize(FIRMWARE_PACKET_MTU)
+	, m_blockCount(0)
+	, m_sendWindow(5)
+	, m_lastAckBlockId(-1)
+	, m_nextBlockId(1)
+	, m_highestSentBlockId(-1)
+	, m_recoveryBlockId(-1)
+	, m_srttMsecs(-1)
+	, m_rttVarMsecs(0)
+	, m_elapsedMsecs(0)
+	, m_bytesAcked(0)
+	, m_packetsSent(0)
+	, m_retransmits(0)
+	, m_timeouts(0)
+	, m_minRttMsecs(-1)
+	, m_maxRttMsecs(-1)
+	, m_totalRttMsecs(0)
+	, m_rttSamples(0)
+	, m_resumeBlockId(-1)
+	, m_discardResume(false)
+	, m_attempts(0)
+	, m_previousBytesSent(0)
+	, m_bytesSent(0)
+	, m_retransmitBytes(0)
+	, m_resumedBytes(0)
 {
 
 	// set the timer as single shot and set the default timeout time
 	// (6000ms is chosen because it's slightly longer than the 5s slave latency)
-	m_timeoutTimer.setInterval(6000);
+	m_timeoutTimer.setInterval(MAX_RETRANSMIT_TIMEOUT);
 	m_timeoutTimer.setSingleShot(true);
 
 	// connect up the timer signal, the timer is not started till the upgrade
 	// process is begun
-	QObject::connect(&m_timeoutTimer, &QTimer::timeout,
+	QObject::connect(&m_timeoutTimer, &WheelTimer::timeout,
 	                 this, &GattUpgradeService::onTimeout);
 
 
@@ -88,10 +142,63 @@ GattUpgradeService::GattUpgradeService()
 
 GattUpgradeService::~GattUpgradeService()
 {
+	// if destroyed mid-transfer, i.e. the RCU was removed, then record how far
+	// we got before cleaning up
+	if (m_stateMachine.isRunning() && m_transferTimer.isValid())
+		storeResume();
+
 	// clean up the firmware file
 	m_fwFile.reset();
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the state graph shared by the upgrade services of all the RCUs.
+
+ */
+QSharedPointer<const StateGraph> GattUpgradeService::stateGraph()
+{
+	// all the states and the super state groupings, parent states first
+	static constexpr StateGraph::StateDef states[] = {
+		{ -1,                 InitialState,              "Initial"             },
+
+		{ -1,                 SendingSuperState,         "SendingSuperState"   },
+		{ SendingSuperState,  SendingWriteRequestState,  "SendingWriteRequest" },
+		{ SendingSuperState,  SendingDataState,          "SendingData"         },
+
+		{ -1,                 ErroredState,              "Errored"             },
+		{ -1,                 FinishedState,             "Finished"            },
+	};
+
+	// the transitions, from state -> event -> to state
+	static constexpr StateGraph::TransitionDef transitions[] = {
+		{ InitialState,              CancelledEvent,          FinishedState            },
+		{ InitialState,              StopServiceEvent,        ErroredState             },
+		{ InitialState,              EnableNotifyErrorEvent,  ErroredState             },
+		{ InitialState,              ReadErrorEvent,          ErroredState             },
+		{ InitialState,              FinishedSetupEvent,      SendingWriteRequestState },
+
+		{ SendingSuperState,         CancelledEvent,          FinishedState            },
+		{ SendingSuperState,         StopServiceEvent,        ErroredState             },
+		{ SendingSuperState,         WriteErrorEvent,         ErroredState             },
+		{ SendingSuperState,         PacketErrorEvent,        ErroredState             },
+		{ SendingSuperState,         TimeoutErrorEvent,       ErroredState             },
+		{ SendingWriteRequestState,  PacketAckEvent,          SendingDataState         },
+		{ SendingDataState,          CompleteEvent,           FinishedState            },
+
+		{ ErroredState,              CompleteEvent,           FinishedState            },
+	};
+
+	static_assert(StateGraph::isValid(states, transitions, InitialState, FinishedState),
+	              "invalid GattUpgradeService state graph");
+
+	static const QSharedPointer<const StateGraph> graph =
+		StateGraph::create(states, transitions, InitialState, FinishedState);
+	return graph;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -107,33 +214,8 @@ void GattUpgradeService::init()
 	// log the transitions at milestone level
 	m_stateMachine.setTransistionLogLevel(QtInfoMsg, &milestone());
 
-	// add all the states
-	m_stateMachine.addState(InitialState, QStringLiteral("Initial"));
-
-	m_stateMachine.addState(SendingSuperState, QStringLiteral("SendingSuperState"));
-	m_stateMachine.addState(SendingSuperState, SendingWriteRequestState, QStringLiteral("SendingWriteRequest"));
-	m_stateMachine.addState(SendingSuperState, SendingDataState, QStringLiteral("SendingData"));
-
-	m_stateMachine.addState(ErroredState, QStringLiteral("Errored"));
-	m_stateMachine.addState(FinishedState, QStringLiteral("Finished"));
-
-
-	// add the transitions       From State           ->    Event              ->   To State
-	m_stateMachine.addTransition(InitialState,              CancelledEvent,         FinishedState);
-	m_stateMachine.addTransition(InitialState,              StopServiceEvent,       ErroredState);
-	m_stateMachine.addTransition(InitialState,              EnableNotifyErrorEvent, ErroredState);
-	m_stateMachine.addTransition(InitialState,              ReadErrorEvent,         ErroredState);
-	m_stateMachine.addTransition(InitialState,              FinishedSetupEvent,     SendingWriteRequestState);
-
-	m_stateMachine.addTransition(SendingSuperState,         CancelledEvent,         FinishedState);
-	m_stateMachine.addTransition(SendingSuperState,         StopServiceEvent,       ErroredState);
-	m_stateMachine.addTransition(SendingSuperState,         WriteErrorEvent,        ErroredState);
-	m_stateMachine.addTransition(SendingSuperState,         PacketErrorEvent,       ErroredState);
-	m_stateMachine.addTransition(SendingSuperState,         TimeoutErrorEvent,      ErroredState);
-	m_stateMachine.addTransition(SendingWriteRequestState,  PacketAckEvent,         SendingDataState);
-	m_stateMachine.addTransition(SendingDataState,          CompleteEvent,          FinishedState);
-
-	m_stateMachine.addTransition(ErroredState,              CompleteEvent,          FinishedState);
+	// use the state graph shared by all instances
+	m_stateMachine.setStateGraph(stateGraph());
 
 
 	// connect to the state entry and exit signals
@@ -141,11 +223,6 @@ void GattUpgradeService::init()
 	                 this, &GattUpgradeService::onStateEntry);
 	QObject::connect(&m_stateMachine, &StateMachine::exited,
 	                 this, &GattUpgradeService::onStateExit);
-
-
-	// set the initial state
-	m_stateMachine.setInitialState(InitialState);
-	m_stateMachine.setFinalState(FinishedState);
 }
 
 // -----------------------------------------------------------------------------
@@ -342,6 +419,47 @@ int GattUpgradeService::progress() const
 	return m_progress;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	Returns the transfer statistics for the current upgrade, or the last one
+	if an upgrade is not in progress.  The RTTs are the times between sending
+	a DATA packet and receiving the ACK for it, retransmitted packets are not
+	included.
+
+	The wasted bytes are the DATA bytes sent, including in any earlier
+	interrupted attempts at sending the same image, that didn't end up
+	ACKed.  Without a resume all the bytes sent in the earlier attempts are
+	wasted, with a resume only the ones that were retransmitted or were
+	still in flight when the attempt failed.
+
+ */
+Future<BleRcuUpgradeService::StatsInfo> GattUpgradeService::stats() const
+{
+	StatsInfo info;
+
+	const qint64 elapsed = m_transferTimer.isValid() ? m_transferTimer.elapsed()
+	                                                 : m_elapsedMsecs;
+
+	info.blockSize = static_cast<quint32>(m_blockSize);
+	info.windowSize = static_cast<quint32>(m_sendWindow);
+	info.bytesAcked = static_cast<quint32>(m_bytesAcked);
+	info.elapsedMsecs = static_cast<quint32>(qMax<qint64>(elapsed, 0));
+	info.throughput = (elapsed > 0) ? static_cast<quint32>((m_bytesAcked * 1000) / elapsed) : 0;
+	info.packetsSent = static_cast<quint32>(m_packetsSent);
+	info.retransmits = static_cast<quint32>(m_retransmits);
+	info.timeouts = static_cast<quint32>(m_timeouts);
+	info.minRttMsecs = static_cast<quint32>(qMax(m_minRttMsecs, 0));
+	info.avgRttMsecs = (m_rttSamples > 0) ? static_cast<quint32>(m_totalRttMsecs / m_rttSamples) : 0;
+	info.maxRttMsecs = static_cast<quint32>(qMax(m_maxRttMsecs, 0));
+	info.bytesSent = static_cast<quint32>(m_bytesSent);
+	info.retransmitBytes = static_cast<quint32>(m_retransmitBytes);
+	info.resumedBytes = static_cast<quint32>(m_resumedBytes);
+	info.wastedBytes = static_cast<quint32>(qMax<qint64>(0, (m_previousBytesSent + m_bytesSent) - m_bytesAcked));
+	info.attempts = static_cast<quint32>(m_attempts);
+
+	return Future<StatsInfo>::createFinished(info);
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -404,6 +522,10 @@ void GattUpgradeService::onEnteredInitialState()
 	// enable notifications from the packet characteristic
 	enablePacketNotifications();
 
+	// try and get a write pipe for the packet characteristic, this is optional
+	// if it fails the packets are written over dbus
+	acquirePacketWritePipe();
+
 	// read the control point, used to verify the f/w image is indeed for the
 	// target RCU device
 	readControlPoint();
@@ -481,6 +603,60 @@ void GattUpgradeService::enablePacketNotifications()
 	result.connectFinished(this, successCallback);
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Requests a write pipe for the f/w packet characteristic so that the DATA
+	packets can be written directly to bluez rather than a dbus call per
+	packet.  The pipe is optional, so the AcquiredWritePipe flag is set
+	whether or not it was acquired, if it wasn't then the packets are sent
+	over dbus as before.
+
+	This is done as part of the setup so that all the packets of a window go
+	through the same path and therefore are sent in order.
+
+ */
+void GattUpgradeService::acquirePacketWritePipe()
+{
+	// sanity checks
+	if (Q_UNLIKELY(m_packetCharacteristic.isNull()))
+		return;
+
+
+	// lambda called when the acquire completes, successfully or otherwise
+	const std::function<void()> completeCallback =
+		[this]()
+		{
+			if (m_stateMachine.isRunning())
+				setSetupFlag(AcquiredWritePipe);
+		};
+
+	// lambda called if an error occurs acquiring the pipe, just log it
+	const std::function<void(const QString&, const QString&)> errorCallback =
+		[completeCallback](const QString &errorName, const QString &errorMessage)
+		{
+			qWarning() << "failed to acquire OTA packet write pipe due to"
+			           << errorName << errorMessage << ", falling back to dbus";
+			completeCallback();
+		};
+
+
+	// request the pipe and check for any immediate success or failures
+	Future<> result = m_packetCharacteristic->enableWritePipe(true);
+	if (!result.isValid() || result.isError()) {
+		errorCallback(result.errorName(), result.errorMessage());
+		return;
+	} else if (result.isFinished()) {
+		completeCallback();
+		return;
+	}
+
+	// connect functors to the future async completion
+	result.connectErrored(this, errorCallback);
+	result.connectFinished(this, completeCallback);
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -685,7 +861,8 @@ void GattUpgradeService::setSetupFlag(SetupFlag flag)
 
 	if (m_setupFlags.testFlag(EnabledNotifications) &&
 		m_setupFlags.testFlag(ReadWindowSize) &&
-	    m_setupFlags.testFlag(VerifiedDeviceModel)) {
+	    m_setupFlags.testFlag(VerifiedDeviceModel) &&
+	    m_setupFlags.testFlag(AcquiredWritePipe)) {
 		m_stateMachine.postEvent(FinishedSetupEvent);
 	}
 }
@@ -699,8 +876,8 @@ void GattUpgradeService::setSetupFlag(SetupFlag flag)
  */
 void GattUpgradeService::onEnteredSendWriteRequestState()
 {
-	// reset the last ACK'ed block
-	m_lastAckBlockId = -1;
+	// reset the last ACK'ed block, the block size, window and stats
+	initTransfer();
 
 	// send the initial write request
 	sendWRQ();
@@ -780,15 +957,38 @@ void GattUpgradeService::onEnteredFinishedState()
 
 	// get the number of blocks in the f/w file
 	const int fwBlockCount =
-		static_cast<int>((m_fwFile->size() + (FIRMWARE_PACKET_MTU - 1)) / FIRMWARE_PACKET_MTU);
+		static_cast<int>((m_fwFile->size() + (m_blockSize - 1)) / m_blockSize);
+
+	// store the stats for the transfer
+	if (m_transferTimer.isValid()) {
+		m_elapsedMsecs = m_transferTimer.elapsed();
+		m_transferTimer.invalidate();
+
+		const StatsInfo info = stats().result();
+		qInfo("f/w transfer stats: %u bytes in %ums (%u bytes/s), block size %u,"
+		      " window %u, %u packets sent, %u retransmits, %u timeouts,"
+		      " rtt min/avg/max %u/%u/%ums", info.bytesAcked, info.elapsedMsecs,
+		      info.throughput, info.blockSize, info.windowSize, info.packetsSent,
+		      info.retransmits, info.timeouts, info.minRttMsecs, info.avgRttMsecs,
+		      info.maxRttMsecs);
+		qInfo("f/w transfer attempt %u: %u bytes sent, %u retransmitted,"
+		      " %u resumed, %u wasted over all attempts", info.attempts,
+		      info.bytesSent, info.retransmitBytes, info.resumedBytes,
+		      info.wastedBytes);
+
+		// record how far we got (or that we're done) for the next attempt
+		storeResume();
+	}
 
 	// close / release the firmware file
 	m_fwFile.reset();
 
 	// disable notifications from the packet characteristic (we don't care
 	// about the result of the operation FIXME).
-	if (m_packetCharacteristic)
+	if (m_packetCharacteristic) {
 		m_packetCharacteristic->enableNotifications(false);
+		m_packetCharacteristic->enableWritePipe(false);
+	}
 
 	// it's possible we never completed the start promise as the user could
 	// have cancelled, if this happens we complete with an error
@@ -857,30 +1057,29 @@ void GattUpgradeService::sendWRQ()
 	// construct the WRQ packet
 	struct Q_PACKED {
 		quint8 opCode;
-		quint8 reserved;
+		quint8 flags;
 		quint32 length;
 		quint32 version;
 		quint32 crc32;
 	} writePacket;
 
-	QVersionNumber version = m_fwFile->version();
-	quint32 fwVersion = quint32(version.majorVersion() & 0xffff) << 16
-	                  | quint32(version.minorVersion() & 0xff)   << 8
-	                  | quint32(version.microVersion() & 0xff)   << 0;
-
+	// the reserved byte is left as 0 unless offering to resume, which is only
+	// done if the model's firmware supports it
 	writePacket.opCode = OPCODE_WRQ;
-	writePacket.reserved = 0x00;
+	writePacket.flags = (m_resumeSupported && (m_resumeBlockId > 0)) ? WRQ_FLAG_RESUME : 0x00;
 	writePacket.length = qToLittleEndian<quint32>(static_cast<quint32>(m_fwFile->size()));
-	writePacket.version = qToLittleEndian<quint32>(fwVersion);
+	writePacket.version = qToLittleEndian<quint32>(packedVersion(m_fwFile->version()));
 	writePacket.crc32 = qToLittleEndian<quint32>(m_fwFile->crc32());
 
-	qDebug("sending WRQ packet (length:0x%08x version:0x%08x crc32:0x%08x)",
-	       writePacket.length, writePacket.version, writePacket.crc32);
+	qDebug("sending WRQ packet (flags:0x%02hhx length:0x%08x version:0x%08x crc32:0x%08x)",
+	       writePacket.flags, writePacket.length, writePacket.version, writePacket.crc32);
 
 	QByteArray value(reinterpret_cast<const char*>(&writePacket), sizeof(writePacket));
 
 
-	// send the WRQ packet
+	// send the WRQ packet, it's treated as block 0 for the RTT and retransmit
+	// stats
+	markBlockSent(0);
 	doPacketWrite(value);
 }
 
@@ -888,60 +1087,359 @@ void GattUpgradeService::sendWRQ()
 /*!
 	\internal
 
-	Sends the next window of firmware upgrade packets.
+	Resets the transfer state and stats for a new upgrade and picks the block
+	size for the DATA packets.
+
+	The block size is the original 18 bytes unless the model's firmware
+	supports larger blocks and the MTU of the packet write pipe is big enough
+	to carry them; the RCU works out the block size from the first DATA
+	packet.  The window starts at the size read from the RCU, which is also
+	the maximum.  For models with an adaptive window it is then adjusted by
+	updateWindowSize() and onPacketLoss(), otherwise it stays at that size as
+	the RCU only ACKs once it has received a full window.
+
+ */
+void GattUpgradeService::initTransfer()
+{
+	m_blockSize = FIRMWARE_PACKET_MTU;
+
+	if (m_maxBlockSize > FIRMWARE_PACKET_MTU) {
+		const int mtu = m_packetCharacteristic ? m_packetCharacteristic->writePipeMtu() : -1;
+		const int maxPayload = mtu - ATT_WRITE_CMD_HDR_SIZE - FIRMWARE_PACKET_HDR_SIZE;
+		if (maxPayload > FIRMWARE_PACKET_MTU)
+			m_blockSize = qMin(maxPayload, m_maxBlockSize);
+	}
+
+	// if the last attempt at sending this image was interrupted then we
+	// offer to resume it, which needs the same block size as before
+	m_blockSize = checkResume(m_blockSize);
+
+	// slice the image into packets of the chosen block size, if the image is
+	// too large for that block size then fall back to the default
+	if (!m_fwFile->buildPacketTable(m_blockSize)) {
+		m_blockSize = FIRMWARE_PACKET_MTU;
+		m_fwFile->buildPacketTable(m_blockSize);
+	}
+
+	// the number of blocks includes the final short (or empty) block that
+	// marks the end of the transfer
+	m_blockCount = m_fwFile->packetCount();
+
+	m_sendWindow = m_windowSize;
+
+	m_lastAckBlockId = -1;
+	m_nextBlockId = 1;
+	m_highestSentBlockId = -1;
+	m_recoveryBlockId = -1;
+
+	m_blockSentMsecs.fill(-1, m_windowSize + 1);
+
+	m_srttMsecs = -1;
+	m_rttVarMsecs = 0;
+	m_timeoutTimer.setInterval(MAX_RETRANSMIT_TIMEOUT);
+
+	m_elapsedMsecs = 0;
+	m_bytesAcked = 0;
+	m_packetsSent = 0;
+	m_retransmits = 0;
+	m_timeouts = 0;
+	m_minRttMsecs = -1;
+	m_maxRttMsecs = -1;
+	m_totalRttMsecs = 0;
+	m_rttSamples = 0;
+
+	m_discardResume = false;
+	m_bytesSent = 0;
+	m_retransmitBytes = 0;
+	m_resumedBytes = 0;
+
+	m_transferTimer.start();
+
+	qInfo("starting f/w transfer of %d blocks of %d bytes with window of %d packets",
+	      m_blockCount, m_blockSize, m_windowSize);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Checks for a record of an interrupted upgrade of the same image to this
+	RCU, if there is one then m_resumeBlockId is set to the last block the
+	RCU ACKed and the block size used for that attempt is returned.  If
+	there isn't one, or it can't be resumed, then \a blockSize is returned.
+
+	Records of other images are stale and are removed, whereas a record of
+	the same image that can't be resumed is kept for the attempt count and
+	wasted bytes stats.  The records are also kept for models whose firmware
+	doesn't support resuming, but for those a resume is never offered.
+
+ */
+int GattUpgradeService::checkResume(int blockSize)
+{
+	m_resumeBlockId = -1;
+	m_attempts = 1;
+	m_previousBytesSent = 0;
+
+	GattUpgradeResumeStore::Entry entry;
+	if (!m_resumeStore || !m_resumeStore->load(m_address, &entry))
+		return blockSize;
+
+	if ((entry.crc32 != m_fwFile->crc32()) ||
+	    (entry.version != packedVersion(m_fwFile->version())) ||
+	    (entry.length != static_cast<quint32>(m_fwFile->size()))) {
+		qInfo("discarding resume record of a different f/w image");
+		m_resumeStore->remove(m_address);
+		return blockSize;
+	}
+
+	m_attempts = entry.attempts + 1;
+	m_previousBytesSent = entry.bytesSent;
+
+	if ((entry.lastAckBlockId <= 0) || !m_resumeSupported)
+		return blockSize;
+
+	if (!m_fwFile->buildPacketTable(entry.blockSize) ||
+	    (entry.lastAckBlockId >= m_fwFile->packetCount())) {
+		qWarning("can't resume f/w transfer with block size %d from block %d",
+		         entry.blockSize, entry.lastAckBlockId);
+		return blockSize;
+	}
+
+	m_resumeBlockId = entry.lastAckBlockId;
+
+	qInfo("offering to resume f/w transfer after block %d (attempt %d, block size %d)",
+	      m_resumeBlockId, m_attempts, entry.blockSize);
+
+	return entry.blockSize;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called at the end of a transfer to update the resume record for the RCU.
+	If the transfer completed, or the RCU reported an error with the image,
+	the record is removed.  Otherwise the last block ACKed is stored so the
+	next attempt can offer to carry on from there.
+
+ */
+void GattUpgradeService::storeResume()
+{
+	if (!m_resumeStore || !m_fwFile)
+		return;
+
+	// the final check is the same workaround for UEI RCUs that don't ACK the
+	// last block as used for the upgradeComplete() signal
+	const int fwBlockCount =
+		static_cast<int>((m_fwFile->size() + (m_blockSize - 1)) / m_blockSize);
+	const bool complete = (m_lastAckBlockId >= m_blockCount) ||
+	                      ((fwBlockCount > m_windowSize) &&
+	                       (m_lastAckBlockId >= (fwBlockCount - m_windowSize)));
+
+	if (complete || m_discardResume) {
+		m_resumeStore->remove(m_address);
+		return;
+	}
+
+	GattUpgradeResumeStore::Entry entry;
+	entry.crc32 = m_fwFile->crc32();
+	entry.version = packedVersion(m_fwFile->version());
+	entry.length = static_cast<quint32>(m_fwFile->size());
+	entry.blockSize = m_blockSize;
+	entry.attempts = m_attempts;
+	entry.bytesSent = m_previousBytesSent + m_bytesSent;
 
-	If any packets were queued but not written to the pipe then they are
-	discarded before new packets are pushed into the q
+	// if the WRQ was never ACKed then the RCU still has whatever it had
+	entry.lastAckBlockId = (m_lastAckBlockId >= 0) ? m_lastAckBlockId : m_resumeBlockId;
+
+	m_resumeStore->store(m_address, entry);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Sends all the blocks that are within the current window and haven't been
+	sent yet.  The window starts at the block after the last one ACKed, so
+	after an ACK only the new blocks are sent rather than the whole window.
 
  */
 void GattUpgradeService::sendDATA()
 {
-	//
-	quint16 blockId = static_cast<quint16>(m_lastAckBlockId + 1);
+	const int windowEnd = qMin(m_lastAckBlockId + m_sendWindow, m_blockCount);
+
+	while (m_nextBlockId <= windowEnd) {
+		if (!sendBlock(m_nextBlockId))
+			return;
+
+		m_nextBlockId++;
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
 
-	// (re)seek to the right block
-	if (!m_fwFile->seek((blockId - 1) * FIRMWARE_PACKET_MTU)) {
-		qWarning("failed to seek to location of block %hu", blockId);
+	Sends the DATA packet for block \a blockId from the firmware file's
+	packet table.  Returns \c false if the block doesn't exist, in which case a
+	WriteErrorEvent has been posted to the state machine.
 
-		m_lastError = "Failed seeking to correct place in firmware file";
+ */
+bool GattUpgradeService::sendBlock(int blockId)
+{
+	// the packets are pre-built by the f/w file, so this is just a lookup
+	const QByteArray packet = m_fwFile->packet(blockId);
+	if (Q_UNLIKELY(packet.isEmpty())) {
+		qWarning("failed to get packet for block %d", blockId);
+
+		m_lastError = "Failed to read block from firmware file";
 		m_stateMachine.postEvent(WriteErrorEvent);
-		return;
+		return false;
 	}
 
-	// buffer for storing DATA packets
-	struct Q_PACKED {
-		quint8 header[2];
-		quint8 body[18];
-	} packet;
+	const int dataBytes = packet.size() - FIRMWARE_PACKET_HDR_SIZE;
+	m_bytesSent += dataBytes;
+	if (blockId <= m_highestSentBlockId)
+		m_retransmitBytes += dataBytes;
 
-	// fire off a bunch of DATA packets for the next window
-	for (int i = 0; i < m_windowSize; i++) {
+	// do the packet write
+	markBlockSent(blockId);
+	doPacketWrite(packet);
 
-		// read up to 18 bytes of data
-		qint64 rd = m_fwFile->read(packet.body, FIRMWARE_PACKET_MTU);
-		if ((rd != FIRMWARE_PACKET_MTU) && !m_fwFile->atEnd())
-			qWarning("read too few bytes but not at end of file?");
+	return true;
+}
 
-		// set the block id
-		packet.header[0] = OPCODE_DATA | quint8((blockId >> 8) & 0x3f);
-		packet.header[1] = quint8(blockId & 0xff);
+// -----------------------------------------------------------------------------
+/*!
+	\internal
 
-		// send / queue the data packet
-		QByteArray value(reinterpret_cast<const char*>(&packet),
-		                 static_cast<int>(2 + rd));
+	Updates the stats for a packet sent with \a blockId and stores the time
+	it was sent.  If the block has been sent before then it's a retransmit,
+	in which case no RTT sample is taken for the block as the ACK could be for
+	either of the packets.
 
-		// do the packet write
-		doPacketWrite(value);
+ */
+void GattUpgradeService::markBlockSent(int blockId)
+{
+	m_packetsSent++;
 
-		// increment the block number
-		blockId++;
+	qint64 &sentMsecs = m_blockSentMsecs[blockId % m_blockSentMsecs.size()];
 
-		// break out if we've sent a packet smaller than 18 bytes
-		if (rd < FIRMWARE_PACKET_MTU)
-			break;
+	if (blockId <= m_highestSentBlockId) {
+		m_retransmits++;
+		sentMsecs = -1;
+	} else {
+		m_highestSentBlockId = blockId;
+		sentMsecs = m_transferTimer.elapsed();
 	}
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Rewinds the transfer so the next block sent is \a blockId, the blocks
+	after it that were already sent are resent as the window allows.
+
+ */
+void GattUpgradeService::retransmitFrom(int blockId)
+{
+	qDebug("retransmitting from block %d (sent up to %d)",
+	       blockId, m_highestSentBlockId);
+
+	m_nextBlockId = blockId;
+	sendDATA();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Takes an RTT sample from the ACK of \a blockId and recalculates the
+	retransmit timeout, this is the same as TCP (RFC 6298) except the limits
+	are suited to the BLE connection.
+
+ */
+void GattUpgradeService::updateRtt(int blockId)
+{
+	qint64 &sentMsecs = m_blockSentMsecs[blockId % m_blockSentMsecs.size()];
+	if (sentMsecs < 0)
+		return;
+
+	const int rtt = static_cast<int>(m_transferTimer.elapsed() - sentMsecs);
+	sentMsecs = -1;
+
+	if (m_srttMsecs < 0) {
+		m_srttMsecs = rtt;
+		m_rttVarMsecs = rtt / 2;
+	} else {
+		m_rttVarMsecs = ((3 * m_rttVarMsecs) + qAbs(m_srttMsecs - rtt)) / 4;
+		m_srttMsecs = ((7 * m_srttMsecs) + rtt) / 8;
+	}
+
+	m_timeoutTimer.setInterval(qBound(MIN_RETRANSMIT_TIMEOUT,
+	                                  m_srttMsecs + (4 * m_rttVarMsecs),
+	                                  MAX_RETRANSMIT_TIMEOUT));
+
+	if ((m_minRttMsecs < 0) || (rtt < m_minRttMsecs))
+		m_minRttMsecs = rtt;
+	m_maxRttMsecs = qMax(m_maxRttMsecs, rtt);
+	m_totalRttMsecs += rtt;
+	m_rttSamples++;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when a window has been ACKed without any loss.  The window grows
+	by one packet, up to the size read from the RCU, while the RTT is close
+	to the minimum seen.  If the RTT is a lot longer than the minimum then
+	the packets are being queued somewhere, in the controller or the RCU, so
+	the window is shrunk by one packet instead.
+
+	This is only done for models with an adaptive window, which ACK every
+	block.  Other RCUs only ACK once they've received a full window of the
+	size they advertise, so a smaller window would stall until the timeout.
+
+ */
+void GattUpgradeService::updateWindowSize()
+{
+	if (!m_adaptiveWindow || (m_srttMsecs < 0) || (m_minRttMsecs < 0))
+		return;
+
+	if (m_srttMsecs > (4 * qMax(m_minRttMsecs, 1)))
+		m_sendWindow = qMax(m_sendWindow - 1, 1);
+	else if (m_srttMsecs <= (2 * qMax(m_minRttMsecs, 1)))
+		m_sendWindow = qMin(m_sendWindow + 1, m_windowSize);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when packets have been lost, i.e. the RCU repeated an ACK or we
+	timed-out.  Until the blocks that were outstanding are ACKed we're in
+	recovery and further losses are assumed to be part of the same event.
+	For models with an adaptive window the window is halved, but only once
+	for each window of lost packets.
+
+ */
+void GattUpgradeService::onPacketLoss()
+{
+	if (m_lastAckBlockId < m_recoveryBlockId)
+		return;
+
+	m_recoveryBlockId = m_highestSentBlockId;
+
+	if (!m_adaptiveWindow)
+		return;
+
+	m_sendWindow = qMax(m_sendWindow / 2, 1);
+
+	qDebug("packet loss, window reduced to %d packets", m_sendWindow);
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -958,8 +1456,13 @@ void GattUpgradeService::onTimeout()
 
 	qDebug("f/w upgrade timed-out in state %d", m_stateMachine.state());
 
+	// only count the timeouts once backed off to the maximum, if the RTT
+	// estimate was too short then we'll get a few early timeouts first
+	m_timeouts++;
+
 	// check if we've timed-out to many times
-	if (m_timeoutCounter++ > 3) {
+	if ((m_timeoutTimer.interval() >= MAX_RETRANSMIT_TIMEOUT) &&
+	    (m_timeoutCounter++ > 3)) {
 		qWarning("timeout counter exceeded in state %d", m_stateMachine.state());
 
 		// simply inject the timeout event into the state machine if running
@@ -968,8 +1471,8 @@ void GattUpgradeService::onTimeout()
 		return;
 	}
 
-	// (re)start the timer
-	m_timeoutTimer.start();
+	// back-off and (re)start the timer
+	m_timeoutTimer.start(qMin(m_timeoutTimer.interval() * 2, MAX_RETRANSMIT_TIMEOUT));
 
 	// re-send the data based on current state
 	if (m_stateMachine.inState(SendingWriteRequestState)) {
@@ -979,8 +1482,9 @@ void GattUpgradeService::onTimeout()
 
 	} else if (m_stateMachine.inState(SendingDataState)) {
 
-		// send the next window of DATA packets
-		sendDATA();
+		// shrink the window and resend everything after the last ACK
+		onPacketLoss();
+		retransmitFrom(m_lastAckBlockId + 1);
 
 	}
 }
@@ -1024,6 +1528,59 @@ void GattUpgradeService::onPacketNotification(const QByteArray &value)
 
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when the ACK for the WRQ packet has been received.  Normally this
+	is for block 0, but if we offered to resume the transfer and the RCU
+	supports it then it's the last block the RCU has, in which case we carry
+	on from the block after.  An RCU that can't resume ACKs block 0 and the
+	transfer restarts from the beginning.
+
+ */
+void GattUpgradeService::onWriteRequestACK(int blockId)
+{
+	if (blockId != 0) {
+
+		// only valid if we offered a resume
+		if (!m_resumeSupported || (m_resumeBlockId <= 0) ||
+		    (blockId >= m_blockCount)) {
+			qWarning("unexpected ACK %d for WRQ", blockId);
+			return;
+		}
+
+		qInfo("RCU resuming f/w transfer after block %d (offered %d)",
+		      blockId, m_resumeBlockId);
+
+		m_resumedBytes = qMin(qint64(blockId) * m_blockSize, m_fwFile->size());
+		m_highestSentBlockId = blockId;
+		m_nextBlockId = blockId + 1;
+
+	} else if (m_resumeBlockId > 0) {
+		qInfo("RCU didn't resume f/w transfer, restarting from the beginning");
+	}
+
+	// the RTT sample is for the WRQ
+	updateRtt(0);
+
+	m_lastAckBlockId = blockId;
+	m_bytesAcked = m_resumedBytes;
+
+	const int progress = static_cast<int>((m_bytesAcked * 100) / m_fwFile->size());
+	if (progress != m_progress) {
+		m_progress = progress;
+		emit progressChanged(progress);
+	}
+
+	// move into the sending data state and send the first window
+	m_stateMachine.postEvent(PacketAckEvent);
+
+	sendDATA();
+
+	m_timeoutTimer.start();
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -1049,15 +1606,25 @@ void GattUpgradeService::onACKPacket(const quint8 data[2])
 	// reset the timeout counter
 	m_timeoutCounter = 0;
 
+	// the first ACK is the reply to the WRQ
+	if ((m_lastAckBlockId < 0) && m_stateMachine.inState(SendingWriteRequestState)) {
+		onWriteRequestACK(blockId);
+		return;
+	}
+
 	//
-	const int fwDataSize = static_cast<int>(m_fwFile->size());
+	const qint64 fwDataSize = m_fwFile->size();
 
 	// check if the ACK is for the last block
-	if ((blockId * FIRMWARE_PACKET_MTU) > fwDataSize) {
+	if (blockId >= m_blockCount) {
 
 		// stop the timeout
 		m_timeoutTimer.stop();
 
+		updateRtt(m_blockCount);
+		m_lastAckBlockId = blockId;
+		m_bytesAcked = fwDataSize;
+
 		// set progress at 100% and emit the final progress change
 		m_progress = 100;
 		emit progressChanged(m_progress);
@@ -1071,26 +1638,39 @@ void GattUpgradeService::onACKPacket(const quint8 data[2])
 
 	} else if (blockId > m_lastAckBlockId) {
 
+		updateRtt(blockId);
+
 		// update the confirmation of the last block ACKed
 		m_lastAckBlockId = blockId;
-
-		// if this is the first ack then post a message to the state machine
-		// so we move into the sending data state
-		if (blockId == 0)
-			m_stateMachine.postEvent(PacketAckEvent);
+		m_bytesAcked = qMin(qint64(blockId) * m_blockSize, fwDataSize);
 
 		// emit a signal for the progress update
-		int progress = (blockId * FIRMWARE_PACKET_MTU * 100) / fwDataSize;
+		int progress = static_cast<int>((m_bytesAcked * 100) / fwDataSize);
 		if (progress != m_progress) {
 			m_progress = progress;
 			emit progressChanged(progress);
 		}
 
-		// send the next window of packets
+		// an ACK short of the last block sent isn't a loss, the rest of
+		// the blocks may still be in flight, so just slide the window on;
+		// lost blocks are detected by a repeated ACK or the timeout
+		if (m_lastAckBlockId >= m_recoveryBlockId)
+			updateWindowSize();
+
 		sendDATA();
 
 		// (re)start the timeout timer
 		m_timeoutTimer.start();
+
+	} else if ((blockId == m_lastAckBlockId) && (blockId < m_highestSentBlockId) &&
+	           (m_lastAckBlockId >= m_recoveryBlockId)) {
+
+		// a repeated ACK means the RCU is still waiting for the block after
+		// it, resend now rather than wait for the timeout
+		onPacketLoss();
+		retransmitFrom(blockId + 1);
+
+		m_timeoutTimer.start();
 	}
 }
 
@@ -1113,6 +1693,10 @@ void GattUpgradeService::onERRORPacket(const quint8 data[2])
 	               !m_stateMachine.inState(SendingSuperState)))
 		return;
 
+	// the RCU has rejected the image so don't try and resume it, unless it's
+	// just the battery being low
+	m_discardResume = (data[1] != 0x04);
+
 	// set the error string based on the code
 	switch (data[1]) {
 		case 0x01:
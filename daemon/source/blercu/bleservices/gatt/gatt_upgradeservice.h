@@ -28,12 +28,15 @@
 #include "blercu/bleservices/blercuupgradeservice.h"
 #include "blercu/blercuerror.h"
 #include "utils/bleuuid.h"
+#include "utils/bleaddress.h"
 
 #include "utils/statemachine.h"
+#include "utils/timerwheel.h"
 
 #include <QFile>
-#include <QTimer>
 #include <QString>
+#include <QVector>
+#include <QElapsedTimer>
 #include <QSharedPointer>
 
 
@@ -41,13 +44,19 @@ class BleGattService;
 class BleGattCharacteristic;
 class BleGattDescriptor;
 
+class GattUpgradeResumeStore;
+
 
 class GattUpgradeService : public BleRcuUpgradeService
 {
 	Q_OBJECT
 
 public:
-	GattUpgradeService();
+	GattUpgradeService(const BleAddress &address,
+	                   const QSharedPointer<GattUpgradeResumeStore> &resumeStore,
+	                   int maxBlockSize = 18,
+	                   bool resumeSupported = false,
+	                   bool adaptiveWindow = false);
 	~GattUpgradeService() final;
 
 public:
@@ -71,6 +80,8 @@ public:
 	bool upgrading() const override;
 	int progress() const override;
 
+	Future<StatsInfo> stats() const override;
+
 private:
 	enum State {
 		InitialState,
@@ -81,12 +92,14 @@ private:
 		FinishedState
 	};
 
+	static QSharedPointer<const StateGraph> stateGraph();
 	void init();
 
 	enum SetupFlag {
 		EnabledNotifications = 0x01,
 		ReadWindowSize = 0x02,
 		VerifiedDeviceModel = 0x04,
+		AcquiredWritePipe = 0x08,
 	};
 	Q_DECLARE_FLAGS(SetupFlags, SetupFlag)
 
@@ -109,6 +122,7 @@ private:
 	                           const QString &message) const;
 
 	void enablePacketNotifications();
+	void acquirePacketWritePipe();
 	void readControlPoint();
 	void readWindowSize();
 
@@ -119,10 +133,25 @@ private:
 	void sendWRQ();
 	void sendDATA();
 
+	void initTransfer();
+	int checkResume(int blockSize);
+	void storeResume();
+	bool sendBlock(int blockId);
+	void markBlockSent(int blockId);
+	void retransmitFrom(int blockId);
+
+	void updateRtt(int blockId);
+	void updateWindowSize();
+	void onPacketLoss();
+
+	void onWriteRequestACK(int blockId);
 	void onACKPacket(const quint8 data[2]);
 	void onERRORPacket(const quint8 data[2]);
 
 private:
+	const BleAddress m_address;
+	const QSharedPointer<GattUpgradeResumeStore> m_resumeStore;
+
 	bool m_ready;
 
 	QSharedPointer<BleGattCharacteristic> m_controlCharacteristic;
@@ -135,16 +164,50 @@ private:
 
 	int m_windowSize;
 
+	const int m_maxBlockSize;
+	const bool m_resumeSupported;
+	const bool m_adaptiveWindow;
+	int m_blockSize;
+	int m_blockCount;
+	int m_sendWindow;
+
 	QSharedPointer<FwImageFile> m_fwFile;
 
 	QSharedPointer< Promise<> > m_startPromise;
 
-	QTimer m_timeoutTimer;
+	WheelTimer m_timeoutTimer;
 
 	StateMachine m_stateMachine;
 
 private:
 	int m_lastAckBlockId;
+	int m_nextBlockId;
+	int m_highestSentBlockId;
+	int m_recoveryBlockId;
+
+	QVector<qint64> m_blockSentMsecs;
+	QElapsedTimer m_transferTimer;
+
+	int m_srttMsecs;
+	int m_rttVarMsecs;
+
+	qint64 m_elapsedMsecs;
+	qint64 m_bytesAcked;
+	int m_packetsSent;
+	int m_retransmits;
+	int m_timeouts;
+	int m_minRttMsecs;
+	int m_maxRttMsecs;
+	qint64 m_totalRttMsecs;
+	int m_rttSamples;
+
+	int m_resumeBlockId;
+	bool m_discardResume;
+	int m_attempts;
+	qint64 m_previousBytesSent;
+	qint64 m_bytesSent;
+	qint64 m_retransmitBytes;
+	qint64 m_resumedBytes;
 
 	int m_timeoutCounter;
 
@@ -0,0 +1,210 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  blegattcache.cpp
+//  SkyBluetoothRcu
+//
+
+#include "blegattcache.h"
+
+#include "utils/logging.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class BleGattCache
+	\brief Persistent store of the GATT profile and static attribute values of
+	each paired RCU.
+
+	Each RCU gets it's own JSON file in the cache directory containing the
+	bluez objects that make up the GATT attribute tree, the bluez version
+	they were read from, the firmware revision of the RCU and the values of
+	any static characteristics.  The store doesn't interpret the data, that
+	is left to BleGattProfileBluez, it just handles the file I/O.
+
+	The file contents are kept in memory once read or written, so a reconnect
+	doesn't need to touch the disk and an unchanged entry isn't rewritten.
+
+	The files are versioned, if the format changes then \c m_version should
+	be bumped and any old files will be discarded.
+
+ */
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	Constructs a cache that stores it's files in \a directory, the directory
+	must already exist.
+
+ */
+BleGattCache::BleGattCache(const QString &directory)
+	: m_directory(directory)
+{
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the path of the cache file for the RCU with the given \a address.
+
+ */
+QString BleGattCache::filePath(const BleAddress &address) const
+{
+	QString name = address.toString().toLower();
+	name.remove(QChar(':'));
+
+	return QStringLiteral("%1/gattcache_%2.json").arg(m_directory, name);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Loads the cache entry for the RCU with the given \a address into \a entry.
+	Returns \c false if there is no entry or it is invalid, invalid entries are
+	removed.
+
+ */
+bool BleGattCache::load(const BleAddress &address, Entry *entry)
+{
+	// read the file the first time only, if there is no file then an empty
+	// value is stored so we don't keep trying
+	QMap<BleAddress, QByteArray>::iterator it = m_contents.find(address);
+	if (it == m_contents.end()) {
+
+		QByteArray contents;
+
+		QFile file(filePath(address));
+		if (file.exists()) {
+			if (!file.open(QFile::ReadOnly))
+				qWarning() << "failed to open gatt cache file" << file.fileName()
+				           << "due to" << file.errorString();
+			else
+				contents = file.readAll();
+		}
+
+		it = m_contents.insert(address, contents);
+	}
+
+	if (it->isEmpty())
+		return false;
+
+
+	QJsonParseError error;
+	const QJsonDocument doc = QJsonDocument::fromJson(*it, &error);
+	if (doc.isNull() || !doc.isObject()) {
+		qWarning() << "failed to parse gatt cache for" << address
+		           << "due to" << error.errorString();
+		remove(address);
+		return false;
+	}
+
+	const QJsonObject json = doc.object();
+
+	const int version = json[QStringLiteral("version")].toInt(-1);
+	if (version != m_version) {
+		qInfo() << "discarding gatt cache for" << address
+		        << "as it has unsupported version" << version;
+		remove(address);
+		return false;
+	}
+
+	entry->firmwareRevision = json[QStringLiteral("firmwareRevision")].toString();
+	entry->bluezVersion =
+		QVersionNumber::fromString(json[QStringLiteral("bluezVersion")].toString());
+	entry->objects = json[QStringLiteral("objects")].toArray();
+
+	entry->values.clear();
+
+	const QJsonObject values = json[QStringLiteral("values")].toObject();
+	QJsonObject::const_iterator value = values.begin();
+	for (; value != values.end(); ++value)
+		entry->values.insert(value.key(),
+		                     QByteArray::fromHex(value.value().toString().toLatin1()));
+
+	return !entry->objects.isEmpty();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Stores the \a entry for the RCU with the given \a address, replacing any
+	existing entry.  The file is only written if the contents have changed.
+
+ */
+bool BleGattCache::store(const BleAddress &address, const Entry &entry)
+{
+	QJsonObject values;
+	QMap<QString, QByteArray>::const_iterator value = entry.values.begin();
+	for (; value != entry.values.end(); ++value)
+		values.insert(value.key(), QString::fromLatin1(value.value().toHex()));
+
+	QJsonObject json;
+	json.insert(QStringLiteral("version"), m_version);
+	json.insert(QStringLiteral("address"), address.toString());
+	json.insert(QStringLiteral("firmwareRevision"), entry.firmwareRevision);
+	json.insert(QStringLiteral("bluezVersion"), entry.bluezVersion.toString());
+	json.insert(QStringLiteral("objects"), entry.objects);
+	json.insert(QStringLiteral("values"), values);
+
+	const QByteArray contents = QJsonDocument(json).toJson(QJsonDocument::Compact);
+	if (m_contents.value(address) == contents)
+		return true;
+
+	// write to a temporary file and then rename so we never leave a partial
+	// file behind
+	QSaveFile file(filePath(address));
+	if (!file.open(QFile::WriteOnly)) {
+		qWarning() << "failed to open gatt cache file" << file.fileName()
+		           << "due to" << file.errorString();
+		return false;
+	}
+
+	if ((file.write(contents) != contents.size()) || !file.commit()) {
+		qWarning() << "failed to write gatt cache file" << file.fileName()
+		           << "due to" << file.errorString();
+		return false;
+	}
+
+	m_contents[address] = contents;
+
+	qInfo() << "updated gatt cache for" << address;
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Removes the cache entry and file for the RCU with the given \a address.
+
+ */
+void BleGattCache::remove(const BleAddress &address)
+{
+	m_contents[address] = QByteArray();
+
+	QFile file(filePath(address));
+	if (file.exists() && !file.remove())
+		qWarning() << "failed to remove gatt cache file" << file.fileName()
+		           << "due to" << file.errorString();
+}
@@ -0,0 +1,71 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  blegattcache.h
+//  SkyBluetoothRcu
+//
+
+#ifndef BLEGATTCACHE_H
+#define BLEGATTCACHE_H
+
+#include "utils/bleaddress.h"
+
+#include <QMap>
+#include <QString>
+#include <QByteArray>
+#include <QJsonArray>
+#include <QVersionNumber>
+
+
+class BleGattCache
+{
+public:
+	struct Entry {
+		QString firmwareRevision;
+		QVersionNumber bluezVersion;
+		QJsonArray objects;
+		QMap<QString, QByteArray> values;
+	};
+
+public:
+	explicit BleGattCache(const QString &directory);
+	~BleGattCache() = default;
+
+public:
+	bool load(const BleAddress &address, Entry *entry);
+	bool store(const BleAddress &address, const Entry &entry);
+	void remove(const BleAddress &address);
+
+private:
+	QString filePath(const BleAddress &address) const;
+
+private:
+	static const int m_version = 1;
+
+	const QString m_directory;
+
+	QMap<BleAddress, QByteArray> m_contents;
+
+private:
+	Q_DISABLE_COPY(BleGattCache)
+};
+
+
+#endif // !defined(BLEGATTCACHE_H)
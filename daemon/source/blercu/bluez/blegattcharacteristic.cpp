@@ -25,6 +25,7 @@
 #include "blegattcharacteristic_p.h"
 #include "blegattdescriptor_p.h"
 #include "blegattnotifypipe.h"
+#include "blegattwritepipe.h"
 #include "blegatthelpers.h"
 #include "blercu/blercuerror.h"
 
@@ -84,6 +85,11 @@ BleGattCharacteristicBluez::BleGattCharacteristicBluez(const QDBusConnection &co
 	, m_valid(false)
 	, m_flags(0)
 	, m_instanceId(0)
+	, m_cacheable(false)
+	, m_cacheGeneration(0)
+	, m_cacheHits(0)
+	, m_cacheMisses(0)
+	, m_notifyHandler(nullptr)
 {
 	// get the uuid of the service
 	const QVariant uuidVar = properties[QStringLiteral("UUID")];
@@ -341,28 +347,83 @@ void BleGattCharacteristicBluez::addDescriptor(const QSharedPointer<BleGattDescr
 	request to the remote device, instead will return the last read / written
 	value.
 
+	The cached value is discarded when a notification is received on the
+	characteristic, as the value has changed, or when invalidateCache() is
+	called.  A write without response also discards the cached value as
+	there is no confirmation the remote device accepted it.
+
 	By default the cacheable property is \c false.
 
  */
 void BleGattCharacteristicBluez::setCacheable(bool cacheable)
 {
-	Q_UNUSED(cacheable);
+	// the value may have been seeded from the persistent cache before the
+	// characteristic was made cacheable, so only clear it when disabling
+	if (!cacheable) {
+		m_lastValue.clear();
+		m_cacheGeneration++;
+	}
 
-	qWarning("cacheable not yet implemented for characteristic");
+	m_cacheable = cacheable;
 }
 
 // -----------------------------------------------------------------------------
 /*!
-	\fn bool BleGattDescriptor::cacheable() const
+	\fn bool BleGattCharacteristic::cacheable() const
 
 	Returns the current cacheable property value.
 
-	\see BleGattDescriptor::setCacheable()
+	\see BleGattCharacteristic::setCacheable()
  */
 bool BleGattCharacteristicBluez::cacheable() const
 {
-	qWarning("cacheable not yet implemented for characteristic");
-	return false;
+	return m_cacheable;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\fn void BleGattCharacteristic::invalidateCache()
+
+	Discards the cached value of the characteristic and all it's descriptors,
+	the next read will be sent to the remote device.  This should be called
+	whenever the remote device disconnects, as the value may have changed
+	before it reconnects.
+
+	\see BleGattCharacteristic::setCacheable()
+ */
+void BleGattCharacteristicBluez::invalidateCache()
+{
+	m_lastValue.clear();
+	m_cacheGeneration++;
+
+	for (const QSharedPointer<BleGattDescriptorBluez> &descriptor : m_descriptors)
+		descriptor->invalidateCache();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\fn int BleGattCharacteristic::cacheHits() const
+
+	Returns the number of reads that were completed from the cached value
+	rather than sent to the remote device.
+
+ */
+int BleGattCharacteristicBluez::cacheHits() const
+{
+	return m_cacheHits;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\fn int BleGattCharacteristic::cacheMisses() const
+
+	Returns the number of reads on a cacheable characteristic that had to be
+	sent to the remote device because there was no cached value.
+
+ */
+int BleGattCharacteristicBluez::cacheMisses() const
+{
+	return m_cacheMisses;
 }
 
 // -----------------------------------------------------------------------------
@@ -380,9 +441,45 @@ Future<QByteArray> BleGattCharacteristicBluez::readValue()
 		return Future<QByteArray>::createErrored(QStringLiteral("com.sky.Error.Failed"),
 		                                         QStringLiteral("no proxy connection"));
 
+	// if the characteristic is cacheable and we have the last read / written
+	// value stored then just return that
+	if (m_cacheable) {
+		if (!m_lastValue.isNull()) {
+			m_cacheHits++;
+			return Future<QByteArray>::createFinished(m_lastValue);
+		}
+
+		m_cacheMisses++;
+	}
+
 	// send the read request and put the reply on in future
 	QDBusPendingReply<QByteArray> reply = m_proxy->ReadValue();
-	return dbusPendingReplyToFuture<QByteArray>(reply);
+	Future<QByteArray> result = dbusPendingReplyToFuture<QByteArray>(reply);
+
+	// if the result is cacheable then install a functor on the result to store
+	// the value read
+	if (m_cacheable) {
+
+		// if the cache is invalidated while the read is in flight then the
+		// value read may already be stale, so don't store it
+		const quint32 generation = m_cacheGeneration;
+
+		std::function<void(const QByteArray&)> functor =
+			[this, generation](const QByteArray &value)
+			{
+				if (generation == m_cacheGeneration)
+					m_lastValue = value;
+			};
+
+		if (!result.isError()) {
+			if (result.isFinished())
+				m_lastValue = result.result();
+			else
+				result.connectFinished(this, functor);
+		}
+	}
+
+	return result;
 }
 
 // -----------------------------------------------------------------------------
@@ -402,7 +499,30 @@ Future<> BleGattCharacteristicBluez::writeValue(const QByteArray &value)
 
 	// send the read request and put the reply on in future
 	QDBusPendingReply<> reply = m_proxy->WriteValue(value);
-	return dbusPendingReplyToFuture<>(reply);
+	Future<> result = dbusPendingReplyToFuture<>(reply);
+
+	// if the result is cacheable then install a functor on the positive
+	// result to save the written value
+	if (m_cacheable) {
+
+		const quint32 generation = m_cacheGeneration;
+
+		std::function<void()> functor =
+			[this, value, generation]()
+			{
+				if (generation == m_cacheGeneration)
+					m_lastValue = value;
+			};
+
+		if (!result.isError()) {
+			if (result.isFinished())
+				m_lastValue = value;
+			else
+				result.connectFinished(this, functor);
+		}
+	}
+
+	return result;
 }
 
 // -----------------------------------------------------------------------------
@@ -412,9 +532,29 @@ Future<> BleGattCharacteristicBluez::writeValue(const QByteArray &value)
 	Requests a writeWithoutResponse (aka WRITE_CMD) on the characteristic. This
 	is an async operation, the result is returned in the Future object.
 
+	If a write pipe has been acquired with enableWritePipe() then the value is
+	written straight to the pipe and the returned future is already finished,
+	otherwise, or if the pipe has been closed, the write is sent over dbus.
+
  */
 Future<> BleGattCharacteristicBluez::writeValueWithoutResponse(const QByteArray &value)
 {
+	// there is no ack for the write so we don't know what the value is
+	m_lastValue.clear();
+	m_cacheGeneration++;
+
+	// if we have a write pipe then use that
+	if (m_writePipe) {
+		if (m_writePipe->write(value))
+			return Future<>::createFinished();
+
+		// if the pipe is still open then the packet was rejected, otherwise
+		// fall back to sending it over dbus
+		if (m_writePipe && m_writePipe->isValid())
+			return Future<>::createErrored(BleRcuError::errorString(BleRcuError::General),
+			                               QStringLiteral("Failed to write to pipe"));
+	}
+
 	// sanity check
 	if (Q_UNLIKELY(!m_proxy || !m_proxy->isValid()))
 		return Future<>::createErrored(QStringLiteral("com.sky.Error.Failed"),
@@ -475,6 +615,134 @@ Future<> BleGattCharacteristicBluez::enableNotifications(bool enable)
 	return promise->future();
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\fn FileDescriptor BleGattCharacteristic::takeNotificationPipe()
+
+	Takes ownership of the notification pipe, this is used by clients that want
+	to read the notifications directly from the bluez pipe rather than via the
+	valueChanged() signal, for example on another thread.
+
+	After this call the characteristic behaves as if notifications were
+	disabled; no valueChanged() signals are emitted and a subsequent call to
+	enableNotifications() will acquire a new pipe from bluez.  Bluez stops
+	sending notifications when the returned descriptor (and any dups of it) are
+	closed.
+
+	If notifications are not enabled then an invalid descriptor is returned.
+
+ */
+FileDescriptor BleGattCharacteristicBluez::takeNotificationPipe()
+{
+	if (!m_notifyPipe)
+		return FileDescriptor();
+
+	FileDescriptor pipeFd = m_notifyPipe->takeFileDescriptor();
+
+	// the pipe object is now invalid so free it
+	m_notifyPipe.reset();
+
+	return pipeFd;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\fn void BleGattCharacteristic::setNotificationHandler(BleGattNotificationHandler *handler)
+
+	Sets a \a handler to receive notifications in batches rather than via the
+	valueChanged() signal.  When a handler is set, every notification waiting
+	on the notification pipe is read in one go and passed to
+	BleGattNotificationHandler::onNotifications() as a single contiguous span,
+	and valueChanged() is not emitted.  This is intended for high rate
+	characteristics like the voice audio data.
+
+	Pass \c nullptr to revert back to the valueChanged() signal.  The handler
+	must outlive the characteristic or be cleared before it is destroyed.
+
+ */
+void BleGattCharacteristicBluez::setNotificationHandler(BleGattNotificationHandler *handler)
+{
+	m_notifyHandler = handler;
+
+	// the pipe calls us so the cache is invalidated before passing them on
+	if (m_notifyPipe)
+		m_notifyPipe->setHandler(m_notifyHandler ? this : nullptr);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\fn Future<void> BleGattCharacteristic::enableWritePipe(bool enable)
+
+	Requests a write pipe from bluez for the characteristic, or closes it if
+	\a enable is \c false.  Once acquired writeValueWithoutResponse() writes
+	the values directly to the pipe rather than making a dbus call for each
+	one, this is intended for characteristics with a high rate of writes like
+	the firmware upgrade packets.
+
+	The pipe is closed by bluez when the remote device disconnects, after
+	which writes fall back to dbus.  If the pipe couldn't be acquired, for
+	example because the bluez version doesn't support \c AcquireWrite, then
+	the returned future has an error but the characteristic can still be
+	written to over dbus.
+
+ */
+Future<> BleGattCharacteristicBluez::enableWritePipe(bool enable)
+{
+	// sanity check write without response is supported
+	if (!m_flags.testFlag(WriteWithoutResponse)) {
+		qError() << "write without response not supported for" << m_uuid;
+		return Future<>::createErrored(QStringLiteral("not supported"));
+	}
+
+	// check if the write pipe is already opened / closed
+	if ((enable && m_writePipe) || (!enable && !m_writePipe))
+		return Future<>::createFinished();
+
+	// check if disabling, in which case we just need to close pipe
+	if (!enable) {
+		m_writePipe.reset();
+		return Future<>::createFinished();
+	}
+
+	// sanity check
+	if (Q_UNLIKELY(!m_proxy || !m_proxy->isValid()))
+		return Future<>::createErrored(QStringLiteral("com.sky.Error.Failed"),
+		                               QStringLiteral("no proxy connection"));
+
+
+	// so must be enabling, in which case we need to request the write pipe
+	// from bluez
+	QDBusPendingReply<QDBusUnixFileDescriptor, quint16> reply = m_proxy->AcquireWrite();
+	QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(reply, this);
+
+	// create a promise to signal the result of the acquire
+	QSharedPointer<Promise<>> promise = QSharedPointer<Promise<>>::create();
+
+	// install a callback on the completion of the request
+	QObject::connect(watcher, &QDBusPendingCallWatcher::finished,
+	                 this, std::bind(&BleGattCharacteristicBluez::onWritePipeEnableReply,
+	                                 this, std::placeholders::_1, promise));
+
+	// return the future (triggered when the promise completes)
+	return promise->future();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\fn int BleGattCharacteristic::writePipeMtu() const
+
+	Returns the MTU reported by bluez when the write pipe was acquired, or -1
+	if there is no write pipe.
+
+ */
+int BleGattCharacteristicBluez::writePipeMtu() const
+{
+	if (!m_writePipe || !m_writePipe->isValid())
+		return -1;
+
+	return m_writePipe->mtu();
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -529,10 +797,13 @@ void BleGattCharacteristicBluez::onNotificationEnableReply(QDBusPendingCallWatch
 	// connect to the events signalled when the pipe closes or a
 	// notification is received
 	QObject::connect(m_notifyPipe.data(), &BleGattNotifyPipe::notification,
-	                 this, &BleGattCharacteristicBluez::valueChanged);
+	                 this, &BleGattCharacteristicBluez::onNotification);
 	QObject::connect(m_notifyPipe.data(), &BleGattNotifyPipe::closed,
 	                 this, &BleGattCharacteristicBluez::onNotifyPipeClosed);
 
+	// if someone wants the notifications in batches then install the handler
+	m_notifyPipe->setHandler(m_notifyHandler ? this : nullptr);
+
 	// success
 	promise->setFinished();
 }
@@ -552,3 +823,121 @@ void BleGattCharacteristicBluez::onNotifyPipeClosed()
 	// the event loop
 	m_notifyPipe.reset();
 }
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Slot called when a notification is received on the pipe, the value has
+	changed so any cached value is discarded before emitting the valueChanged()
+	signal.
+
+ */
+void BleGattCharacteristicBluez::onNotification(const QByteArray &value)
+{
+	m_lastValue.clear();
+	m_cacheGeneration++;
+
+	emit valueChanged(value);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called by the notify pipe with a batch of notifications when a handler is
+	installed, the equivalent of onNotification() for the batched path.  Any
+	cached value is discarded before the batch is passed to the handler.
+
+ */
+void BleGattCharacteristicBluez::onNotifications(const quint8 *packets, size_t stride,
+                                                 const quint16 *lengths, int count)
+{
+	m_lastValue.clear();
+	m_cacheGeneration++;
+
+	if (m_notifyHandler)
+		m_notifyHandler->onNotifications(packets, stride, lengths, count);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when we receive a dbus reply to our request to acquire the write
+	pipe for the characteristic.
+
+ */
+void BleGattCharacteristicBluez::onWritePipeEnableReply(QDBusPendingCallWatcher *call,
+                                                        QSharedPointer<Promise<>> promise)
+{
+	// clean up the pending call on the next time through the event loop
+	call->deleteLater();
+
+	// check for error and log it
+	QDBusPendingReply<QDBusUnixFileDescriptor, quint16> reply = *call;
+	if (reply.isError()) {
+		const QDBusError error = reply.error();
+		qWarning() << "failed to acquire write pipe due to" << error;
+		promise->setError(error.name(), error.message());
+		return;
+	}
+
+	// get / check the args
+	QDBusUnixFileDescriptor pipeFd = reply.argumentAt<0>();
+	if (!pipeFd.isValid()) {
+		qError("invalid write pipe fd from bluez");
+		promise->setError(BleRcuError::errorString(BleRcuError::General),
+		                  QStringLiteral("Invalid write pipe fd from bluez"));
+		return;
+	}
+
+	quint16 mtu = reply.argumentAt<1>();
+	if (mtu < 20) {
+		qError("invalid MTU size on the write pipe (%hd bytes)", mtu);
+		promise->setError(BleRcuError::errorString(BleRcuError::General),
+		                  QStringLiteral("Invalid MTU size from bluez"));
+		return;
+	}
+
+	// it's possible the pipe was acquired twice, in which case just keep
+	// the first one
+	if (m_writePipe) {
+		promise->setFinished();
+		return;
+	}
+
+	// wrap the file descriptor in a new GATT write pipe object
+	m_writePipe = QSharedPointer<BleGattWritePipe>(new BleGattWritePipe(pipeFd, mtu),
+	                                               &QObject::deleteLater);
+	if (!m_writePipe || !m_writePipe->isValid()) {
+		m_writePipe.reset();
+		promise->setError(BleRcuError::errorString(BleRcuError::General),
+		                  QStringLiteral("Invalid pipe fd from bluez"));
+		return;
+	}
+
+	// connect to the event signalled when the pipe closes
+	QObject::connect(m_writePipe.data(), &BleGattWritePipe::closed,
+	                 this, &BleGattCharacteristicBluez::onWritePipeClosed);
+
+	qInfo() << "acquired write pipe for" << m_uuid << "with mtu" << mtu;
+
+	// success
+	promise->setFinished();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Slot called when the write pipe is closed, bluez does this if the remote
+	device disconnects.  Any subsequent writes are sent over dbus.
+
+ */
+void BleGattCharacteristicBluez::onWritePipeClosed()
+{
+	// the shared pointer uses deleteLater so this is safe even though the
+	// signal came from the pipe object
+	m_writePipe.reset();
+}
@@ -34,6 +34,7 @@
 
 
 class BleGattNotifyPipe;
+class BleGattWritePipe;
 class BleGattDescriptorBluez;
 class BluezGattCharacteristicInterface;
 
@@ -41,6 +42,7 @@ class QDBusPendingCallWatcher;
 
 
 class BleGattCharacteristicBluez : public BleGattCharacteristic
+                                 , private BleGattNotificationHandler
 {
 	Q_OBJECT
 
@@ -59,6 +61,9 @@ public:
 
 	void setCacheable(bool cacheable) override;
 	bool cacheable() const override;
+	void invalidateCache() override;
+	int cacheHits() const override;
+	int cacheMisses() const override;
 
 	QSharedPointer<BleGattService> service() const override;
 
@@ -70,6 +75,11 @@ public:
 	Future<> writeValueWithoutResponse(const QByteArray &value) override;
 
 	Future<> enableNotifications(bool enable) override;
+	FileDescriptor takeNotificationPipe() override;
+	void setNotificationHandler(BleGattNotificationHandler *handler) override;
+
+	Future<> enableWritePipe(bool enable) override;
+	int writePipeMtu() const override;
 
 	int timeout() const override;
 	void setTimeout(int timeout) override;
@@ -80,12 +90,20 @@ private slots:
 	void onNotificationEnableReply(QDBusPendingCallWatcher *watcher,
 	                               QSharedPointer<Promise<>> promise);
 	void onNotifyPipeClosed();
+	void onNotification(const QByteArray &value);
+
+	void onWritePipeEnableReply(QDBusPendingCallWatcher *watcher,
+	                            QSharedPointer<Promise<>> promise);
+	void onWritePipeClosed();
 
 private:
 	friend class BleGattProfileBluez;
 
 	void addDescriptor(const QSharedPointer<BleGattDescriptorBluez> &descriptor);
 
+	void onNotifications(const quint8 *packets, size_t stride,
+	                     const quint16 *lengths, int count) override;
+
 private:
 	const QDBusObjectPath m_path;
 
@@ -101,7 +119,16 @@ private:
 
 	bool m_useNewDBusApi;
 
+	bool m_cacheable;
+	QByteArray m_lastValue;
+	quint32 m_cacheGeneration;
+	int m_cacheHits;
+	int m_cacheMisses;
+
 	QSharedPointer<BleGattNotifyPipe> m_notifyPipe;
+	BleGattNotificationHandler *m_notifyHandler;
+
+	QSharedPointer<BleGattWritePipe> m_writePipe;
 
 	QMap<BleUuid, QSharedPointer<BleGattDescriptorBluez>> m_descriptors;
 };
@@ -72,6 +72,9 @@ BleGattDescriptorBluez::BleGattDescriptorBluez(const QDBusConnection &conn,
 	, m_valid(false)
 	, m_flags(0)
 	, m_cacheable(false)
+	, m_cacheGeneration(0)
+	, m_cacheHits(0)
+	, m_cacheMisses(0)
 {
 	// get the uuid of the service
 	const QVariant uuidVar = properties[QStringLiteral("UUID")];
@@ -243,8 +246,10 @@ QSharedPointer<BleGattCharacteristic> BleGattDescriptorBluez::characteristic() c
  */
 void BleGattDescriptorBluez::setCacheable(bool cacheable)
 {
-	if (m_cacheable != cacheable)
+	if (m_cacheable != cacheable) {
 		m_lastValue.clear();
+		m_cacheGeneration++;
+	}
 
 	m_cacheable = cacheable;
 }
@@ -262,6 +267,48 @@ bool BleGattDescriptorBluez::cacheable() const
 	return m_cacheable;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\fn void BleGattDescriptor::invalidateCache()
+
+	Discards the cached value, the next read will be sent to the remote device
+	and the value read becomes the new cached value.  This is a no-op if the
+	descriptor is not cacheable.
+
+	\see BleGattDescriptor::setCacheable()
+ */
+void BleGattDescriptorBluez::invalidateCache()
+{
+	m_lastValue.clear();
+	m_cacheGeneration++;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\fn int BleGattDescriptor::cacheHits() const
+
+	Returns the number of reads that were completed from the cached value
+	rather than sent to the remote device.
+
+ */
+int BleGattDescriptorBluez::cacheHits() const
+{
+	return m_cacheHits;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\fn int BleGattDescriptor::cacheMisses() const
+
+	Returns the number of reads on a cacheable descriptor that had to be sent
+	to the remote device because there was no cached value.
+
+ */
+int BleGattDescriptorBluez::cacheMisses() const
+{
+	return m_cacheMisses;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\fn Future<QByteArray> BleGattDescriptor::readValue()
@@ -279,8 +326,14 @@ Future<QByteArray> BleGattDescriptorBluez::readValue()
 
 	// if the descriptor is cacheable and we have the last read / written value
 	// store then just return that
-	if (m_cacheable && !m_lastValue.isNull())
-		return Future<QByteArray>::createFinished(m_lastValue);
+	if (m_cacheable) {
+		if (!m_lastValue.isNull()) {
+			m_cacheHits++;
+			return Future<QByteArray>::createFinished(m_lastValue);
+		}
+
+		m_cacheMisses++;
+	}
 
 	// otherwise start the transaction
 	QDBusPendingReply<QByteArray> reply = m_proxy->ReadValue();
@@ -290,10 +343,15 @@ Future<QByteArray> BleGattDescriptorBluez::readValue()
 	// the value read
 	if (m_cacheable) {
 
+		// if the cache is invalidated while the read is in flight then the
+		// value read may already be stale, so don't store it
+		const quint32 generation = m_cacheGeneration;
+
 		std::function<void(const QByteArray&)> functor =
-			[this](const QByteArray &value)
+			[this, generation](const QByteArray &value)
 			{
-				m_lastValue = value;
+				if (generation == m_cacheGeneration)
+					m_lastValue = value;
 			};
 
 		if (!result.isError()) {
@@ -329,10 +387,13 @@ Future<> BleGattDescriptorBluez::writeValue(const QByteArray &value)
 	// result to save the written value
 	if (m_cacheable) {
 
+		const quint32 generation = m_cacheGeneration;
+
 		std::function<void()> functor =
-			[this, value]()
+			[this, value, generation]()
 			{
-				m_lastValue = value;
+				if (generation == m_cacheGeneration)
+					m_lastValue = value;
 			};
 
 		if (!result.isError()) {
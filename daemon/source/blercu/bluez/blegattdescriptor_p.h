@@ -56,6 +56,9 @@ public:
 	void setCacheable(bool cacheable) override;
 
 	bool cacheable() const override;
+	void invalidateCache() override;
+	int cacheHits() const override;
+	int cacheMisses() const override;
 
 	QSharedPointer<BleGattCharacteristic> characteristic() const override;
 
@@ -84,6 +87,9 @@ private:
 
 	bool m_cacheable;
 	QByteArray m_lastValue;
+	quint32 m_cacheGeneration;
+	int m_cacheHits;
+	int m_cacheMisses;
 
 };
 
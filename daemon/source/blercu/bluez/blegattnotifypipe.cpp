@@ -23,8 +23,10 @@
 //
 
 #include "blegattnotifypipe.h"
+#include "../blegattcharacteristic.h"
 
 #include "utils/unixpipenotifier.h"
+#include "utils/unixpacketreader.h"
 #include "utils/logging.h"
 
 #include <QDebug>
@@ -53,6 +55,11 @@ BleGattNotifyPipe::BleGattNotifyPipe(const QDBusUnixFileDescriptor &notifyPipeFd
 	, m_notifier(nullptr)
 	, m_bufferSize(23)
 	, m_buffer(nullptr)
+	, m_handler(nullptr)
+	, m_batchReader(nullptr)
+	, m_wakeupCount(0)
+	, m_packetCount(0)
+	, m_maxPacketsPerWakeup(0)
 {
 	// sanity check the input notify pipe
 	if (!notifyPipeFd.isValid()) {
@@ -114,6 +121,13 @@ BleGattNotifyPipe::~BleGattNotifyPipe()
 
 	if (m_buffer)
 		delete [] m_buffer;
+
+	if (m_batchReader)
+		delete m_batchReader;
+
+	if (m_wakeupCount > 0)
+		qInfo("notification pipe stats: %llu packets in %llu wakeups (max %d"
+		      " per wakeup)", m_packetCount, m_wakeupCount, m_maxPacketsPerWakeup);
 }
 
 // -----------------------------------------------------------------------------
@@ -126,6 +140,94 @@ bool BleGattNotifyPipe::isValid() const
 	return (m_pipeFd >= 0);
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	Takes the notification pipe away from this object, after this call no
+	more notification() signals will be emitted and the object is no longer
+	valid.  The returned descriptor is a dup of the bluez notification pipe,
+	the caller is then responsible for reading the notifications from it.
+
+	If the pipe has already been closed then an invalid descriptor is returned.
+
+ */
+FileDescriptor BleGattNotifyPipe::takeFileDescriptor()
+{
+	if (Q_UNLIKELY(m_pipeFd < 0))
+		return FileDescriptor();
+
+	// stop listening for events on the pipe
+	if (m_notifier) {
+		m_notifier->setReadEnabled(false);
+		m_notifier->setExceptionEnabled(false);
+		m_notifier->deleteLater();
+		m_notifier = nullptr;
+	}
+
+	// the following will dup and store the fd
+	FileDescriptor fd(m_pipeFd);
+
+	// now close our internal copy
+	if (::close(m_pipeFd) != 0)
+		qErrnoWarning(errno, "failed to close notification pipe fd");
+	m_pipeFd = -1;
+
+	return fd;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Sets the \a handler to pass the notifications to in batches.  If a
+	handler is set then the notification() signal is no longer emitted,
+	instead on each wake-up all the notifications waiting in the pipe are
+	read (using a single \c recvmmsg call where possible) and passed to the
+	handler as one span.
+
+	The packets in the span are stored back to back every \c stride bytes,
+	where the stride is the MTU of the pipe, the actual length of each packet
+	is in the \c lengths array.  The span is only valid for the duration of
+	the call.
+
+	Set \a handler to \c nullptr to revert back to the notification() signal.
+
+ */
+void BleGattNotifyPipe::setHandler(BleGattNotificationHandler *handler)
+{
+	m_handler = handler;
+
+	// allocate the batch buffers on first use
+	if (!m_handler || m_batchReader)
+		return;
+
+	m_batchReader = new UnixPacketReader(m_bufferSize);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when the remote end of the pipe has been closed, this usually just
+	means that the RCU has disconnected.  Frees the notifier, closes the pipe
+	and emits the closed() signal.
+
+ */
+void BleGattNotifyPipe::onPipeClosed()
+{
+	qInfo("notification pipe closed");
+
+	if (m_notifier) {
+		m_notifier->setReadEnabled(false);
+		m_notifier->setExceptionEnabled(false);
+		m_notifier->deleteLater();
+		m_notifier = nullptr;
+	}
+
+	if (::close(m_pipeFd) != 0)
+		qErrnoWarning(errno, "failed to close pipe fd");
+	m_pipeFd = -1;
+
+	emit closed();
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -138,6 +240,39 @@ void BleGattNotifyPipe::onActivated(int pipeFd)
 	if (Q_UNLIKELY(pipeFd != m_pipeFd))
 		return;
 
+	m_wakeupCount++;
+
+	int packetsThisWakeup = 0;
+
+	// if a handler is installed then drain the pipe in batches
+	if (m_handler) {
+
+		while (m_pipeFd >= 0) {
+
+			bool closed;
+			const int count = m_batchReader->read(m_pipeFd, &closed);
+			if (count > 0) {
+				packetsThisWakeup += count;
+				m_handler->onNotifications(m_batchReader->packets(),
+				                           m_batchReader->stride(),
+				                           m_batchReader->lengths(), count);
+			}
+
+			if (closed) {
+				onPipeClosed();
+				break;
+			}
+
+			// if we didn't fill the batch then the pipe has been drained
+			if (count < UnixPacketReader::MaxBatchSize)
+				break;
+		}
+
+		m_packetCount += packetsThisWakeup;
+		m_maxPacketsPerWakeup = qMax(m_maxPacketsPerWakeup, packetsThisWakeup);
+		return;
+	}
+
 	// read as much as we can from the pipe
 	while (m_pipeFd >= 0) {
 
@@ -157,28 +292,17 @@ void BleGattNotifyPipe::onActivated(int pipeFd)
 			// a read of zero bytes means the remote end of the pipe has been
 			// closed, this usually just means that the RCU has disconnected,
 			// this will stop the recording,
-			qInfo("notification pipe closed");
-
-			if (m_notifier) {
-				m_notifier->setReadEnabled(false);
-				m_notifier->setExceptionEnabled(false);
-				m_notifier->deleteLater();
-				m_notifier = nullptr;
-			}
-
-			if (::close(m_pipeFd) != 0)
-				qErrnoWarning(errno, "failed to close pipe fd");
-			m_pipeFd = -1;
-
-			emit closed();
-
+			onPipeClosed();
 			break;
 
 		} else {
 			// emit a notification signal
+			packetsThisWakeup++;
 			emit notification(QByteArray::fromRawData(reinterpret_cast<const char*>(m_buffer), rd));
 
 		}
 	}
 
+	m_packetCount += packetsThisWakeup;
+	m_maxPacketsPerWakeup = qMax(m_maxPacketsPerWakeup, packetsThisWakeup);
 }
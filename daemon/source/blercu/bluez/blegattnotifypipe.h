@@ -25,12 +25,16 @@
 #ifndef BLEGATTNOTIFYPIPE_H
 #define BLEGATTNOTIFYPIPE_H
 
+#include "utils/filedescriptor.h"
+
 #include <QObject>
 #include <QByteArray>
 #include <QDBusUnixFileDescriptor>
 
 
 class UnixPipeNotifier;
+class UnixPacketReader;
+class BleGattNotificationHandler;
 
 
 class BleGattNotifyPipe : public QObject
@@ -45,6 +49,10 @@ public:
 public:
 	bool isValid() const;
 
+	FileDescriptor takeFileDescriptor();
+
+	void setHandler(BleGattNotificationHandler *handler);
+
 signals:
 	void notification(const QByteArray &value);
 	void closed();
@@ -52,12 +60,22 @@ signals:
 private:
 	void onActivated(int pipeFd);
 
+	void onPipeClosed();
+
 private:
 	int m_pipeFd;
 	UnixPipeNotifier *m_notifier;
 
 	size_t m_bufferSize;
 	quint8 *m_buffer;
+
+	BleGattNotificationHandler *m_handler;
+
+	UnixPacketReader *m_batchReader;
+
+	quint64 m_wakeupCount;
+	quint64 m_packetCount;
+	int m_maxPacketsPerWakeup;
 };
 
 
@@ -26,6 +26,7 @@
 #include "blegattservice_p.h"
 #include "blegattcharacteristic_p.h"
 #include "blegattdescriptor_p.h"
+#include "bluezobjectindex.h"
 
 #include "interfaces/bluezadapterinterface.h"
 #include "interfaces/bluezgattserviceinterface.h"
@@ -36,17 +37,25 @@
 #include "dbus/dbusobjectmanager.h"
 
 #include <QTimer>
+#include <QJsonObject>
 #include <QDBusPendingCallWatcher>
 
 
 BleGattProfileBluez::BleGattProfileBluez(const QDBusConnection &bluezDBusConn,
                                          const QDBusObjectPath &bluezDBusPath,
+                                         const BleAddress &address,
+                                         const QSharedPointer<BleGattCache> &cache,
+                                         const QSharedPointer<const BluezObjectIndex> &objectIndex,
                                          QObject *parent)
 	: BleGattProfile(parent)
 	, m_dbusConn(bluezDBusConn)
 	, m_dbusPath(bluezDBusPath)
+	, m_address(address)
 	, m_bluezVersion(5, 47)
 	, m_valid(false)
+	, m_cache(cache)
+	, m_cached(false)
+	, m_objectIndex(objectIndex)
 {
 
 	m_valid = true;
@@ -88,12 +97,31 @@ bool BleGattProfileBluez::isEmpty() const
 	is no need to do anything here, except clients expect that the updateComplete
 	signal is emitted once done.
 
+	If there is a persistent cache entry for the device then the profile is
+	built from that rather than querying bluez, the cache is then checked
+	against bluez in the background.
+
  */
 void BleGattProfileBluez::updateProfile()
 {
+	// if the daemon wide object index is populated then it already holds
+	// the objects for this device, so no need to ask bluez for everything
+	if (m_objectIndex && m_objectIndex->isPopulated()) {
+		loadFromIndex();
+		return;
+	}
+
+	if (m_cache && m_cache->load(m_address, &m_cacheEntry)) {
+		loadFromCache();
+		return;
+	}
+
+	m_cached = false;
+
 	// clear the old data first, will also clean-up any slot receiver details
 	// that haven't yet been called
 	m_services.clear();
+	m_objects = QJsonArray();
 
 	// construct a method call to get all the objects
 	QDBusMessage request = QDBusMessage::createMethodCall(QStringLiteral("org.bluez"),
@@ -133,11 +161,81 @@ void BleGattProfileBluez::onGetObjectsReply(QDBusPendingCallWatcher *call)
 		return;
 	}
 
-	const QString adapterInterfaceName = BluezAdapterInterface::staticInterfaceName();
+	// get just the objects for this device and build the tree from them
+	const DBusManagedObjectList objects = deviceObjects(reply.value());
 
-	const DBusManagedObjectList objects = reply.value();
+	buildTree(objects);
+	m_objects = objectsToJson(objects);
+
+	// debugging
+	dumpGattTree();
+
+	// finally finished so notify the original caller that all objects are
+	// fetched, use a singleShot timer so the event is triggered from the
+	// main event loop
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+	QTimer::singleShot(0, this, &BleGattProfile::updateCompleted);
+#else
+	{
+		QTimer* timer = new QTimer(this);
+		QObject::connect(timer, &QTimer::timeout, this, &BleGattProfile::updateCompleted);
+		QObject::connect(timer, &QTimer::timeout, timer, &QObject::deleteLater);
+		timer->setSingleShot(true);
+		timer->start(0);
+	}
+#endif
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the objects from the full bluez object list in \a objects that
+	belong to this device.  Also if the list contains the adapter object it is
+	used to update the bluez version.
+
+ */
+DBusManagedObjectList BleGattProfileBluez::deviceObjects(const DBusManagedObjectList &objects)
+{
+	const QString adapterInterfaceName = BluezAdapterInterface::staticInterfaceName();
 	const QString bluezDevicePathStr = m_dbusPath.path();
 
+	DBusManagedObjectList filtered;
+
+	DBusManagedObjectList::const_iterator object = objects.begin();
+	for (; object != objects.end(); ++object) {
+
+		// get the object path and interfaces
+		const QString path = object.key().path();
+		const DBusInterfaceList &interfaces = object.value();
+
+		// if the object contains the "org.bluez.Adapter1" interface then
+		// we read it so that we can get the version of bluez, this is needed
+		// later when using some of the GATT APIs
+		if (interfaces.contains(adapterInterfaceName))
+			updateBluezVersion(interfaces[adapterInterfaceName]);
+
+		// check the object path is under the one we are looking for, i.e. the
+		// object belongs to this rcu device
+		if (path.startsWith(bluezDevicePathStr))
+			filtered.insert(object.key(), interfaces);
+	}
+
+	return filtered;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Builds the tree of services, characteristics and descriptors from the
+	bluez \a objects of this device.  Any existing tree is discarded.
+
+ */
+void BleGattProfileBluez::buildTree(const DBusManagedObjectList &objects)
+{
+	m_services.clear();
+
 	// we are looking for objects that have the following interfaces
 	//   org.bluez.GattService1
 	//   org.bluez.GattCharacteristic1
@@ -159,17 +257,6 @@ void BleGattProfileBluez::onGetObjectsReply(QDBusPendingCallWatcher *call)
 		const QString path = object.key().path();
 		const DBusInterfaceList &interfaces = object.value();
 
-		// if the object contains the "org.bluez.Adapter1" interface then
-		// we read it so that we can get the version of bluez, this is needed
-		// later when using some of the GATT APIs
-		if (interfaces.contains(adapterInterfaceName))
-			updateBluezVersion(interfaces[adapterInterfaceName]);
-
-		// check the object path is under the one we are looking for, i.e. the
-		// object belongs to this rcu device
-		if (!path.startsWith(bluezDevicePathStr))
-			continue;
-
 		DBusInterfaceList::const_iterator interface = interfaces.begin();
 		for (; interface != interfaces.end(); ++interface) {
 
@@ -288,28 +375,377 @@ void BleGattProfileBluez::onGetObjectsReply(QDBusPendingCallWatcher *call)
 			++it;
 		}
 	}
+}
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
 
-	// debugging
-	dumpGattTree();
+	Builds the profile from the cache entry rather than querying bluez.  If
+	the tree in the cache matches the current tree then the existing objects
+	are kept, the services hold on to their characteristics across reconnects
+	so this means the cached values get seeded into the objects they use.
 
-	// finally finished so notify the original caller that all objects are
-	// fetched, use a singleShot timer so the event is triggered from the
-	// main event loop
-#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+	The cache is validated by asking bluez for the objects in the background,
+	if they don't match the cache then the cacheInvalidated() signal is
+	emitted.
+
+ */
+void BleGattProfileBluez::loadFromCache()
+{
+	if (m_services.isEmpty() || (m_objects != m_cacheEntry.objects)) {
+
+		if (!m_cacheEntry.bluezVersion.isNull())
+			m_bluezVersion = m_cacheEntry.bluezVersion;
+
+		buildTree(objectsFromJson(m_cacheEntry.objects));
+		m_objects = m_cacheEntry.objects;
+
+		dumpGattTree();
+	}
+
+	seedCachedValues();
+
+	m_cached = true;
+
+	qInfo() << "using cached gatt profile for" << m_address
+	        << "with firmware" << m_cacheEntry.firmwareRevision;
+
+	// check the cache against bluez once the services have started
+	QDBusMessage request = QDBusMessage::createMethodCall(QStringLiteral("org.bluez"),
+	                                                      QStringLiteral("/"),
+	                                                      QStringLiteral("org.freedesktop.DBus.ObjectManager"),
+	                                                      QStringLiteral("GetManagedObjects"));
+
+	QDBusPendingCall pendingReply = m_dbusConn.asyncCall(request);
+	QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pendingReply, this);
+
+	QObject::connect(watcher, &QDBusPendingCallWatcher::finished,
+	                 this, &BleGattProfileBluez::onValidateObjectsReply);
+
+	// tell the caller the profile is ready
 	QTimer::singleShot(0, this, &BleGattProfile::updateCompleted);
-#else
-	{
-		QTimer* timer = new QTimer(this);
-		QObject::connect(timer, &QTimer::timeout, this, &BleGattProfile::updateCompleted);
-		QObject::connect(timer, &QTimer::timeout, timer, &QObject::deleteLater);
-		timer->setSingleShot(true);
-		timer->start(0);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Builds the profile from the objects for this device in the shared object
+	index, the lookup is a range scan over just this device's objects so is
+	cheap however many other objects bluez has.
+
+	The index is always current so if there is a cache entry it is checked
+	against the index straight away, if it matches the cached values are
+	seeded into the characteristics otherwise the entry is discarded.  As
+	with loadFromCache() the existing objects are kept if the tree hasn't
+	changed.
+
+ */
+void BleGattProfileBluez::loadFromIndex()
+{
+	// the adapter object gives us the bluez version
+	const QString adapterInterfaceName = BluezAdapterInterface::staticInterfaceName();
+	const DBusManagedObjectList adapters =
+		m_objectIndex->objectsWithInterface(adapterInterfaceName);
+	if (!adapters.isEmpty())
+		updateBluezVersion(adapters.first().value(adapterInterfaceName));
+
+	const DBusManagedObjectList objects = m_objectIndex->objectsUnder(m_dbusPath);
+	const QJsonArray json = objectsToJson(objects);
+
+	m_cached = false;
+	if (m_cache && m_cache->load(m_address, &m_cacheEntry)) {
+
+		if (json == m_cacheEntry.objects) {
+			m_cached = true;
+
+		} else {
+			qWarning() << "cached gatt profile for" << m_address
+			           << "doesn't match bluez, discarding cache";
+
+			m_cache->remove(m_address);
+			m_cacheEntry = BleGattCache::Entry();
+		}
 	}
-#endif
+
+	if (m_services.isEmpty() || (m_objects != json)) {
+
+		buildTree(objects);
+		m_objects = json;
+
+		dumpGattTree();
+	}
+
+	if (m_cached) {
+		seedCachedValues();
+
+		qInfo() << "using cached gatt values for" << m_address
+		        << "with firmware" << m_cacheEntry.firmwareRevision;
+	}
+
+	// tell the caller the profile is ready
+	QTimer::singleShot(0, this, &BleGattProfile::updateCompleted);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Copies the cached values into the characteristics, a subsequent read on a
+	cacheable characteristic will return the value without going to the
+	remote device.
+
+ */
+void BleGattProfileBluez::seedCachedValues()
+{
+	for (const QSharedPointer<BleGattServiceBluez> &service : m_services) {
+		for (const QSharedPointer<BleGattCharacteristicBluez> &characteristic : service->m_characteristics) {
+
+			QMap<QString, QByteArray>::const_iterator it =
+				m_cacheEntry.values.find(characteristic->m_path.path());
+			if (it != m_cacheEntry.values.end())
+				characteristic->m_lastValue = it.value();
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when bluez replies with the list of objects used to validate the
+	cache.  If the objects for the device don't match the cached tree then
+	the cache entry is discarded, the tree is rebuilt from the bluez objects
+	and cacheInvalidated() is emitted.
+
+ */
+void BleGattProfileBluez::onValidateObjectsReply(QDBusPendingCallWatcher *call)
+{
+	// clean up the pending call on the next time through the event loop
+	call->deleteLater();
+
+	QDBusPendingReply<DBusManagedObjectList> reply = *call;
+	if (reply.isError()) {
+		qWarning() << "failed to get bluez object list to validate the gatt cache"
+		           << reply.error();
+		return;
+	}
+
+	// check the profile hasn't been updated from bluez since
+	if (!m_cached)
+		return;
+
+	const DBusManagedObjectList objects = deviceObjects(reply.value());
+	const QJsonArray json = objectsToJson(objects);
+	if (json == m_cacheEntry.objects) {
+		qDebug() << "validated cached gatt profile for" << m_address;
+		return;
+	}
+
+	qWarning() << "cached gatt profile for" << m_address
+	           << "doesn't match bluez, discarding cache";
+
+	m_cache->remove(m_address);
+	m_cacheEntry = BleGattCache::Entry();
+	m_cached = false;
+
+	buildTree(objects);
+	m_objects = json;
+
+	dumpGattTree();
+
+	emit cacheInvalidated();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\overload
+
+	Returns \c true if the profile was built from the persistent cache on the
+	last update.
+
+ */
+bool BleGattProfileBluez::isCached() const
+{
+	return m_cached;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\overload
+
+	Checks that the cache entry the profile was built from is for the same
+	\a firmwareRevision as the device is running, if not then all the cached
+	values are discarded.
+
+	The firmware revision itself is never cached, so it is always read from
+	the device.
+
+ */
+void BleGattProfileBluez::validateCache(const QString &firmwareRevision)
+{
+	if (!m_cached || (firmwareRevision == m_cacheEntry.firmwareRevision))
+		return;
+
+	qInfo() << "firmware of" << m_address << "changed from"
+	        << m_cacheEntry.firmwareRevision << "to" << firmwareRevision
+	        << ", discarding cached gatt values";
+
+	m_cacheEntry.values.clear();
+
+	for (const QSharedPointer<BleGattServiceBluez> &service : m_services) {
+		for (const QSharedPointer<BleGattCharacteristicBluez> &characteristic : service->m_characteristics)
+			characteristic->invalidateCache();
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\overload
+
+	Writes the current profile and the values of all the cacheable
+	characteristics to the persistent cache, keyed by the device address and
+	\a firmwareRevision.
+
+	Values of characteristics that support notifications or indications are
+	not stored as they may change while the device is disconnected.
+
+ */
+void BleGattProfileBluez::storeCache(const QString &firmwareRevision)
+{
+	if (!m_cache || m_objects.isEmpty() || firmwareRevision.isEmpty())
+		return;
+
+	BleGattCache::Entry entry;
+	entry.firmwareRevision = firmwareRevision;
+	entry.bluezVersion = m_bluezVersion;
+	entry.objects = m_objects;
+
+	const BleGattCharacteristic::Flags dynamicFlags =
+		BleGattCharacteristic::Notify | BleGattCharacteristic::Indicate;
+	const BleUuid firmwareRevisionUuid(BleUuid::FirmwareRevisionString);
+
+	for (const QSharedPointer<BleGattServiceBluez> &service : m_services) {
+		for (const QSharedPointer<BleGattCharacteristicBluez> &characteristic : service->m_characteristics) {
+
+			if (!characteristic->m_cacheable || characteristic->m_lastValue.isNull() ||
+			    (characteristic->m_flags & dynamicFlags) ||
+			    (characteristic->m_uuid == firmwareRevisionUuid))
+				continue;
+
+			entry.values.insert(characteristic->m_path.path(),
+			                    characteristic->m_lastValue);
+		}
+	}
+
+	if (m_cache->store(m_address, entry))
+		m_cacheEntry = entry;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Converts the bluez \a objects to the JSON form stored in the cache.  Only
+	the GATT interfaces and the properties used to build the tree are kept,
+	so the result can also be used to check if the tree has changed.
+
+ */
+QJsonArray BleGattProfileBluez::objectsToJson(const DBusManagedObjectList &objects)
+{
+	static const QStringList gattInterfaces = {
+		BluezGattServiceInterface::staticInterfaceName(),
+		BluezGattCharacteristicInterface::staticInterfaceName(),
+		BluezGattDescriptorInterface::staticInterfaceName(),
+	};
+
+	QJsonArray json;
+
+	DBusManagedObjectList::const_iterator object = objects.begin();
+	for (; object != objects.end(); ++object) {
+
+		const DBusInterfaceList &interfaces = object.value();
+
+		DBusInterfaceList::const_iterator interface = interfaces.begin();
+		for (; interface != interfaces.end(); ++interface) {
+
+			if (!gattInterfaces.contains(interface.key()))
+				continue;
+
+			const QVariantMap &properties = interface.value();
+
+			QJsonObject entry;
+			entry.insert(QStringLiteral("path"), object.key().path());
+			entry.insert(QStringLiteral("interface"), interface.key());
+
+			QVariantMap::const_iterator property = properties.begin();
+			for (; property != properties.end(); ++property) {
+
+				const QString &name = property.key();
+				const QVariant &value = property.value();
+
+				if (name == QLatin1String("UUID"))
+					entry.insert(name, value.toString());
+				else if (name == QLatin1String("Primary"))
+					entry.insert(name, value.toBool());
+				else if (name == QLatin1String("Flags"))
+					entry.insert(name, QJsonArray::fromStringList(value.toStringList()));
+				else if ((name == QLatin1String("Device")) ||
+				         (name == QLatin1String("Service")) ||
+				         (name == QLatin1String("Characteristic")))
+					entry.insert(name, value.value<QDBusObjectPath>().path());
+			}
+
+			json.append(entry);
+		}
+	}
+
+	return json;
 }
 
 // -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Converts the cached \a json back into the form bluez would have supplied
+	the objects in.
+
+ */
+DBusManagedObjectList BleGattProfileBluez::objectsFromJson(const QJsonArray &json)
+{
+	DBusManagedObjectList objects;
+
+	for (const QJsonValue &value : json) {
+
+		const QJsonObject entry = value.toObject();
+
+		QVariantMap properties;
+
+		QJsonObject::const_iterator field = entry.begin();
+		for (; field != entry.end(); ++field) {
+
+			const QString &name = field.key();
+
+			if ((name == QLatin1String("path")) || (name == QLatin1String("interface")))
+				continue;
+			else if ((name == QLatin1String("Device")) ||
+			         (name == QLatin1String("Service")) ||
+			         (name == QLatin1String("Characteristic")))
+				properties.insert(name, QVariant::fromValue(QDBusObjectPath(field.value().toString())));
+			else if (name == QLatin1String("Flags"))
+				properties.insert(name, field.value().toVariant().toStringList());
+			else
+				properties.insert(name, field.value().toVariant());
+		}
+
+		const QDBusObjectPath path(entry[QStringLiteral("path")].toString());
+		objects[path].insert(entry[QStringLiteral("interface")].toString(), properties);
+	}
+
+	return objects;
+}
+
 /*!
 	\internal
 
@@ -26,9 +26,13 @@
 #define BLUEZ_BLEGATTPROFILE_P_H
 
 #include "../blegattprofile.h"
+#include "blegattcache.h"
+#include "dbus/dbusobjectmanager.h"
+#include "utils/bleaddress.h"
 
 #include <QMultiMap>
 #include <QVariantMap>
+#include <QJsonArray>
 #include <QVersionNumber>
 #include <QDBusConnection>
 #include <QDBusObjectPath>
@@ -37,6 +41,7 @@
 
 class BleGattManager;
 class BleGattServiceBluez;
+class BluezObjectIndex;
 
 
 class BleGattProfileBluez : public BleGattProfile
@@ -46,6 +51,9 @@ class BleGattProfileBluez : public BleGattProfile
 public:
 	BleGattProfileBluez(const QDBusConnection &bluezDBusConn,
 	                    const QDBusObjectPath &bluezDBusPath,
+	                    const BleAddress &address,
+	                    const QSharedPointer<BleGattCache> &cache,
+	                    const QSharedPointer<const BluezObjectIndex> &objectIndex,
 	                    QObject *parent = nullptr);
 	~BleGattProfileBluez() final;
 
@@ -55,25 +63,48 @@ public:
 
 	void updateProfile() override;
 
+	bool isCached() const override;
+	void validateCache(const QString &firmwareRevision) override;
+	void storeCache(const QString &firmwareRevision) override;
+
 	QList< QSharedPointer<BleGattService> > services() const override;
 	QList< QSharedPointer<BleGattService> > services(const BleUuid &serviceUuid) const override;
 	QSharedPointer<BleGattService> service(const BleUuid &serviceUuid) const override;
 
 private slots:
 	void onGetObjectsReply(QDBusPendingCallWatcher *call);
+	void onValidateObjectsReply(QDBusPendingCallWatcher *call);
 
 private:
 	void updateBluezVersion(const QVariantMap &properties);
 	void dumpGattTree();
 
+	DBusManagedObjectList deviceObjects(const DBusManagedObjectList &objects);
+	void buildTree(const DBusManagedObjectList &objects);
+
+	void loadFromCache();
+	void loadFromIndex();
+	void seedCachedValues();
+
+	static QJsonArray objectsToJson(const DBusManagedObjectList &objects);
+	static DBusManagedObjectList objectsFromJson(const QJsonArray &json);
+
 private:
 	const QDBusConnection m_dbusConn;
 	const QDBusObjectPath m_dbusPath;
+	const BleAddress m_address;
 
 	QVersionNumber m_bluezVersion;
 
 	bool m_valid;
 	QMultiMap<BleUuid, QSharedPointer<BleGattServiceBluez>> m_services;
+	QJsonArray m_objects;
+
+	const QSharedPointer<BleGattCache> m_cache;
+	BleGattCache::Entry m_cacheEntry;
+	bool m_cached;
+
+	const QSharedPointer<const BluezObjectIndex> m_objectIndex;
 };
 
 
@@ -0,0 +1,313 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  blegattwritepipe.cpp
+//  SkyBluetoothRcu
+//
+
+#include "blegattwritepipe.h"
+
+#include "utils/unixpipenotifier.h"
+#include "utils/logging.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+
+/// The size of the opcode and handle at the start of an ATT write command,
+/// the value written can be at most the ATT MTU less this
+#define ATT_WRITE_CMD_HDR_SIZE        3
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class BleGattWritePipe
+	\brief Wraps the socket returned by the bluez \c AcquireWrite method.
+
+	Writing through the pipe avoids a dbus method call per packet, each
+	write() on the pipe is sent by bluez as a single ATT write command to
+	the characteristic.  Newer versions of bluez use a \c SOCK_SEQPACKET
+	socket for the pipe so the packet boundaries are kept.
+
+	The pipe is non-blocking, if it is full then the packets are queued and
+	written once there is space, so the order of the writes is preserved.
+
+ */
+
+
+// -----------------------------------------------------------------------------
+/*!
+	Constructs a BleGattWritePipe object wrapping the supplied \a writePipeFd
+	descriptor.  The \a mtu value is the ATT MTU reported by bluez, each write
+	can be at most the MTU less the 3 byte ATT write command header.
+
+	The class dup's the supplied descriptor so it should / can be closed after
+	construction.
+
+ */
+BleGattWritePipe::BleGattWritePipe(const QDBusUnixFileDescriptor &writePipeFd,
+                                   quint16 mtu, QObject *parent)
+	: QObject(parent)
+	, m_pipeFd(-1)
+	, m_notifier(nullptr)
+	, m_mtu(mtu)
+	, m_packetCount(0)
+	, m_byteCount(0)
+	, m_blockedCount(0)
+	, m_maxQueueDepth(0)
+{
+	// sanity check the input write pipe
+	if (!writePipeFd.isValid()) {
+		qError("invalid write pipe fd");
+		return;
+	}
+
+	// dup the supplied fd
+	m_pipeFd = fcntl(writePipeFd.fileDescriptor(), F_DUPFD_CLOEXEC, 3);
+	if (m_pipeFd < 0) {
+		qErrnoWarning(errno, "failed to dup bluez write pipe");
+		return;
+	}
+
+	// put in non-blocking mode
+	int flags = fcntl(m_pipeFd, F_GETFL);
+	if (!(flags & O_NONBLOCK))
+		fcntl(m_pipeFd, F_SETFL, flags | O_NONBLOCK);
+
+
+	// create a listener on the pipe, write events are only enabled when
+	// there are packets queued
+	m_notifier = new UnixPipeNotifier(m_pipeFd);
+	QObject::connect(m_notifier, &UnixPipeNotifier::writeActivated,
+	                 this, &BleGattWritePipe::onWriteActivated);
+	QObject::connect(m_notifier, &UnixPipeNotifier::exceptionActivated,
+	                 this, &BleGattWritePipe::onExceptionActivated);
+
+	// enable exception (pipe closed) events on the pipe
+	m_notifier->setExceptionEnabled(true);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Closes the pipe, any packets still queued are discarded.  The write
+	stats for the pipe are logged if anything was written.
+
+ */
+BleGattWritePipe::~BleGattWritePipe()
+{
+	if (m_notifier) {
+		delete m_notifier;
+		m_notifier = nullptr;
+	}
+
+	if ((m_pipeFd >= 0) && (::close(m_pipeFd) != 0))
+		qErrnoWarning(errno, "failed to close write pipe fd");
+
+	if (!m_queue.isEmpty())
+		qWarning("discarding %d queued packets on write pipe", m_queue.size());
+
+	if (m_packetCount > 0)
+		qInfo("write pipe stats: %llu packets, %llu bytes, blocked %llu times"
+		      " (max queue depth %d)", m_packetCount, m_byteCount,
+		      m_blockedCount, m_maxQueueDepth);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns \c true if the write pipe is valid.
+
+ */
+bool BleGattWritePipe::isValid() const
+{
+	return (m_pipeFd >= 0);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the ATT MTU of the pipe, the largest value that can be written
+	in a single packet is 3 bytes less than this.
+
+ */
+int BleGattWritePipe::mtu() const
+{
+	return m_mtu;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Writes the \a value to the pipe as a single packet.  If the pipe is full
+	the packet is queued and written when there is space.
+
+	Returns \c false if the pipe is closed, the value is larger than the MTU
+	or too many packets are already queued.  If the pipe was closed by the
+	write then the closed() signal is emitted before this returns.
+
+ */
+bool BleGattWritePipe::write(const QByteArray &value)
+{
+	if (Q_UNLIKELY(m_pipeFd < 0))
+		return false;
+
+	if (Q_UNLIKELY(value.size() > (m_mtu - ATT_WRITE_CMD_HDR_SIZE))) {
+		qWarning("packet of %d bytes is too large for the write pipe mtu (%d bytes)",
+		         value.size(), m_mtu);
+		return false;
+	}
+
+	// if there are already packets queued then add to the end of the queue
+	// so they are written in order
+	if (m_queue.isEmpty()) {
+
+		bool wouldBlock;
+		if (writePacket(value, &wouldBlock))
+			return true;
+		if (!wouldBlock)
+			return false;
+
+		m_blockedCount++;
+		m_notifier->setWriteEnabled(true);
+
+	} else if (m_queue.size() >= m_maxQueuedPackets) {
+		qWarning("too many packets queued on write pipe");
+		return false;
+	}
+
+	// the value may be a raw reference into someone else's buffer (i.e. the
+	// f/w image packet table), so take a deep copy as it may be queued for
+	// a while
+	m_queue.enqueue(QByteArray(value.constData(), value.size()));
+	m_maxQueueDepth = qMax(m_maxQueueDepth, m_queue.size());
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Performs the non-blocking write of a single packet, \a wouldBlock is set
+	to \c true if the pipe is full.  If the write failed for any other reason
+	then the pipe is closed.
+
+ */
+bool BleGattWritePipe::writePacket(const QByteArray &value, bool *wouldBlock)
+{
+	*wouldBlock = false;
+
+	const ssize_t wr = TEMP_FAILURE_RETRY(::write(m_pipeFd, value.constData(),
+	                                              value.size()));
+	if (wr < 0) {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+			*wouldBlock = true;
+			return false;
+		}
+
+		if ((errno != EPIPE) && (errno != ECONNRESET) && (errno != ENOTCONN))
+			qErrnoWarning(errno, "failed to write to pipe");
+
+		onPipeClosed();
+		return false;
+	}
+
+	if (Q_UNLIKELY(wr != value.size()))
+		qWarning("short write on write pipe (%zd of %d bytes)", wr, value.size());
+
+	m_packetCount++;
+	m_byteCount += wr;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when the remote end of the pipe has been closed, this usually just
+	means that the RCU has disconnected.  Frees the notifier, closes the pipe,
+	discards any queued packets and emits the closed() signal.
+
+ */
+void BleGattWritePipe::onPipeClosed()
+{
+	qInfo("write pipe closed");
+
+	if (m_notifier) {
+		m_notifier->setWriteEnabled(false);
+		m_notifier->setExceptionEnabled(false);
+		m_notifier->deleteLater();
+		m_notifier = nullptr;
+	}
+
+	if (::close(m_pipeFd) != 0)
+		qErrnoWarning(errno, "failed to close pipe fd");
+	m_pipeFd = -1;
+
+	if (!m_queue.isEmpty()) {
+		qWarning("discarding %d queued packets on write pipe", m_queue.size());
+		m_queue.clear();
+	}
+
+	emit closed();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Slot called when there is space in the pipe, writes as many of the queued
+	packets as possible.
+
+ */
+void BleGattWritePipe::onWriteActivated(int pipeFd)
+{
+	if (Q_UNLIKELY(pipeFd != m_pipeFd))
+		return;
+
+	while (!m_queue.isEmpty()) {
+
+		bool wouldBlock;
+		if (!writePacket(m_queue.head(), &wouldBlock)) {
+			if (wouldBlock)
+				m_blockedCount++;
+			return;
+		}
+
+		m_queue.dequeue();
+	}
+
+	// queue drained so no longer need the write events
+	m_notifier->setWriteEnabled(false);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Slot called when the remote end of the pipe has been closed.
+
+ */
+void BleGattWritePipe::onExceptionActivated(int pipeFd)
+{
+	if (Q_UNLIKELY(pipeFd != m_pipeFd))
+		return;
+
+	onPipeClosed();
+}
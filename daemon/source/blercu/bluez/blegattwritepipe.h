@@ -0,0 +1,79 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  blegattwritepipe.h
+//  SkyBluetoothRcu
+//
+
+#ifndef BLEGATTWRITEPIPE_H
+#define BLEGATTWRITEPIPE_H
+
+#include <QObject>
+#include <QQueue>
+#include <QByteArray>
+#include <QDBusUnixFileDescriptor>
+
+
+class UnixPipeNotifier;
+
+
+class BleGattWritePipe : public QObject
+{
+	Q_OBJECT
+
+public:
+	BleGattWritePipe(const QDBusUnixFileDescriptor &writePipeFd,
+	                 quint16 mtu, QObject *parent = nullptr);
+	~BleGattWritePipe();
+
+public:
+	bool isValid() const;
+	int mtu() const;
+
+	bool write(const QByteArray &value);
+
+signals:
+	void closed();
+
+private:
+	void onWriteActivated(int pipeFd);
+	void onExceptionActivated(int pipeFd);
+
+	bool writePacket(const QByteArray &value, bool *wouldBlock);
+	void onPipeClosed();
+
+private:
+	static const int m_maxQueuedPackets = 64;
+
+	int m_pipeFd;
+	UnixPipeNotifier *m_notifier;
+
+	int m_mtu;
+
+	QQueue<QByteArray> m_queue;
+
+	quint64 m_packetCount;
+	quint64 m_byteCount;
+	quint64 m_blockedCount;
+	int m_maxQueueDepth;
+};
+
+
+#endif // !defined(BLEGATTWRITEPIPE_H)
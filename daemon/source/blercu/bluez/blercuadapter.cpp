@@ -25,6 +25,7 @@
 #include "blercuadapter_p.h"
 #include "blercudevice_p.h"
 #include "blercurecovery.h"
+#include "bluezobjectindex.h"
 #include "blercu/bleservices/blercuservicesfactory.h"
 
 #include "dbus/dbusobjectmanager.h"
@@ -115,10 +116,12 @@ QVector<QRegExp> BleRcuAdapterBluez::getSupportedPairingNames(const QList<Config
 
 BleRcuAdapterBluez::BleRcuAdapterBluez(const QSharedPointer<const ConfigSettings> &config,
                                        const QSharedPointer<BleRcuServicesFactory> &servicesFactory,
+                                       const QSharedPointer<BleGattCache> &gattCache,
                                        const QDBusConnection &bluezBusConn,
                                        QObject *parent)
 	: BleRcuAdapter(parent)
 	, m_servicesFactory(servicesFactory)
+	, m_gattCache(gattCache)
 	, m_bluezDBusConn(bluezBusConn)
 	, m_bluezService("org.bluez")
 	, m_discovering(false)
@@ -130,6 +133,10 @@ BleRcuAdapterBluez::BleRcuAdapterBluez(const QSharedPointer<const ConfigSettings
 	, m_retryEventId(-1)
 {
 
+	// create the index of bluez objects, shared with the devices so they don't
+	// need to fetch all the bluez objects to build their GATT profile
+	m_objectIndex = QSharedPointer<BluezObjectIndex>::create();
+
 	// we always want monotonic elapsed timers, however we carry on if we don't
 	// but just log it as a warning
 	if (!QElapsedTimer::isMonotonic())
@@ -179,7 +186,7 @@ BleRcuAdapterBluez::BleRcuAdapterBluez(const QSharedPointer<const ConfigSettings
 	// been left running
 	m_discoveryWatchdog.setSingleShot(false);
 	m_discoveryWatchdog.setInterval(5000);
-	QObject::connect(&m_discoveryWatchdog, &QTimer::timeout,
+	QObject::connect(&m_discoveryWatchdog, &WheelTimer::timeout,
 	                 this, &BleRcuAdapterBluez::onDiscoveryWatchdog);
 }
 
@@ -356,8 +363,15 @@ void BleRcuAdapterBluez::onEnteredServiceUnavailableState()
 		}
 
 
-		// install handlers for interfaces added / removed notifications
+		// install handlers for interfaces added / removed notifications, the
+		// object index is connected first so it is up to date by the time our
+		// handlers are called
 		if (m_bluezObjectMgr) {
+			QObject::connect(m_bluezObjectMgr.data(), &DBusObjectManagerInterface::InterfacesAdded,
+			                 m_objectIndex.data(), &BluezObjectIndex::onInterfacesAdded);
+			QObject::connect(m_bluezObjectMgr.data(), &DBusObjectManagerInterface::InterfacesRemoved,
+			                 m_objectIndex.data(), &BluezObjectIndex::onInterfacesRemoved);
+
 			QObject::connect(m_bluezObjectMgr.data(), &DBusObjectManagerInterface::InterfacesAdded,
 			                 this, &BleRcuAdapterBluez::onBluezInterfacesAdded);
 			QObject::connect(m_bluezObjectMgr.data(), &DBusObjectManagerInterface::InterfacesRemoved,
@@ -386,6 +400,7 @@ void BleRcuAdapterBluez::onEnteredServiceUnavailableState()
 void BleRcuAdapterBluez::onExitedServiceAvailableSuperState()
 {
 	m_bluezObjectMgr.reset();
+	m_objectIndex->clear();
 }
 
 // -----------------------------------------------------------------------------
@@ -697,6 +712,8 @@ void BleRcuAdapterBluez::dump(Dumper out) const
 	out.printBoolean("powered:   ", isPowered());
 	out.printBoolean("scanning:  ", m_discovering);
 	out.printBoolean("pairable:  ", m_pairable);
+
+	m_stateMachine.dump(out);
 }
 
 // -----------------------------------------------------------------------------
@@ -740,6 +757,10 @@ QDBusObjectPath BleRcuAdapterBluez::findAdapter(int timeout)
 
 	const DBusManagedObjectList objects = reply.value();
 
+	// we have the full list so use it to (re)populate the object index, from
+	// now on it's kept up to date by the interface added / removed signals
+	m_objectIndex->populate(objects);
+
 	DBusManagedObjectList::const_iterator object = objects.begin();
 	for (; object != objects.end(); ++object) {
 
@@ -875,46 +896,42 @@ bool BleRcuAdapterBluez::setAdapterDiscoveryFilter()
 	Called at start-up to get the list of devices already available in the
 	bluez daemon.
 
+	The devices are taken from the object index, which was populated when the
+	adapter was found, so this doesn't need to query bluez again.  If for
+	some reason the index isn't populated then it is populated here.
+
 	For each device found we call addDevice().
 
  */
 void BleRcuAdapterBluez::getRegisteredDevices()
 {
-	// get all the managed objects on the remote 'org.bluez' object
-	QDBusPendingReply<DBusManagedObjectList> reply = m_bluezObjectMgr->GetManagedObjects();
-	reply.waitForFinished();
+	if (!m_objectIndex->isPopulated()) {
 
-	// check for an error
-	if (reply.isError()) {
-		qWarning() << "failed to get managed object due to" << reply.error();
-		return;
-	}
-
-	const DBusManagedObjectList objects = reply.value();
+		// get all the managed objects on the remote 'org.bluez' object
+		QDBusPendingReply<DBusManagedObjectList> reply = m_bluezObjectMgr->GetManagedObjects();
+		reply.waitForFinished();
 
-	// find an object with all the following interfaces
-	DBusManagedObjectList::const_iterator object = objects.begin();
-	for (; object != objects.end(); ++object) {
+		// check for an error
+		if (reply.isError()) {
+			qWarning() << "failed to get managed object due to" << reply.error();
+			return;
+		}
 
-		// get the object path and interfaces
-		const QDBusObjectPath &path = object.key();
-		const DBusInterfaceList &interfaces = object.value();
+		m_objectIndex->populate(reply.value());
+	}
 
-		DBusInterfaceList::const_iterator interface = interfaces.begin();
-		for (; interface != interfaces.end(); ++interface) {
+	const QString deviceInterfaceName = BluezDeviceInterface::staticInterfaceName();
 
-			// get the interface name and properties
-			const QString &name = interface.key();
-			const QVariantMap &properties = interface.value();
+	// get all the objects with an 'org.bluez.Device1' interface and attempt
+	// to add the device
+	const DBusManagedObjectList objects =
+		m_objectIndex->objectsWithInterface(deviceInterfaceName);
 
-			// if this object has an 'org.bluez.Device1' interface then attempt
-			// to add the device
-			if (name == BluezDeviceInterface::staticInterfaceName()) {
+	DBusManagedObjectList::const_iterator object = objects.begin();
+	for (; object != objects.end(); ++object) {
 
-				// add the device to our internal map
-				onDeviceAdded(path, properties);
-			}
-		}
+		// add the device to our internal map
+		onDeviceAdded(object.key(), object.value().value(deviceInterfaceName));
 	}
 
 }
@@ -1536,7 +1553,9 @@ void BleRcuAdapterBluez::onDeviceAdded(const QDBusObjectPath &path,
 	QSharedPointer<BleRcuDeviceBluez> device =
 			QSharedPointer<BleRcuDeviceBluez>::create(bdaddr, name,
 			                                          m_bluezDBusConn, path,
-			                                          m_servicesFactory);
+			                                          m_servicesFactory,
+			                                          m_gattCache,
+			                                          m_objectIndex);
 	if (!device || !device->isValid()) {
 		qWarning() << "failed to create device with bdaddr" << bdaddr;
 		return;
@@ -27,6 +27,7 @@
 
 #include "../blercuadapter.h"
 #include "utils/statemachine.h"
+#include "utils/timerwheel.h"
 #include "utils/hcisocket.h"
 #include "dbus/dbusobjectmanager.h"
 #include "configsettings/configmodelsettings.h"
@@ -40,6 +41,8 @@
 class BleRcuNotifier;
 class BleRcuDeviceBluez;
 class BleRcuServicesFactory;
+class BleGattCache;
+class BluezObjectIndex;
 class ConfigSettings;
 
 class DBusObjectManagerInterface;
@@ -53,6 +56,7 @@ class BleRcuAdapterBluez : public BleRcuAdapter
 public:
 	BleRcuAdapterBluez(const QSharedPointer<const ConfigSettings> &config,
 	                   const QSharedPointer<BleRcuServicesFactory> &servicesFactory,
+	                   const QSharedPointer<BleGattCache> &gattCache,
 	                   const QDBusConnection &bluezBusConn,
 	                   QObject *parent = nullptr);
 	~BleRcuAdapterBluez();
@@ -130,11 +134,13 @@ private slots:
 
 private:
 	const QSharedPointer<BleRcuServicesFactory> m_servicesFactory;
+	const QSharedPointer<BleGattCache> m_gattCache;
 	const QDBusConnection m_bluezDBusConn;
 
 	const QString m_bluezService;
 	QSharedPointer<QDBusServiceWatcher> m_bluezServiceWatcher;
 	QSharedPointer<DBusObjectManagerInterface> m_bluezObjectMgr;
+	QSharedPointer<BluezObjectIndex> m_objectIndex;
 
 	BleAddress m_address;
 	QDBusObjectPath m_adapterObjectPath;
@@ -150,7 +156,7 @@ private:
 
 	int m_discoveryRequests;
 	enum { StartDiscovery, StopDiscovery } m_discoveryRequested;
-	QTimer m_discoveryWatchdog;
+	WheelTimer m_discoveryWatchdog;
 
 private:
 	static QSet<quint32> getSupportedOuis(const QList<ConfigModelSettings> &details);
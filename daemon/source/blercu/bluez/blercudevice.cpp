@@ -55,6 +55,8 @@ BleRcuDeviceBluez::BleRcuDeviceBluez(const BleAddress &bdaddr,
                                      const QDBusConnection &bluezDBusConn,
                                      const QDBusObjectPath &bluezDBusPath,
                                      const QSharedPointer<BleRcuServicesFactory> &servicesFactory,
+                                     const QSharedPointer<BleGattCache> &gattCache,
+                                     const QSharedPointer<const BluezObjectIndex> &objectIndex,
                                      QObject *parent)
 	: BleRcuDevice(parent)
 	, m_bluezObjectPath(bluezDBusPath)
@@ -76,10 +78,14 @@ BleRcuDeviceBluez::BleRcuDeviceBluez(const BleAddress &bdaddr,
 		return;
 
 	// create an empty GATT profile, this will be populated when the services
-	// are resolved
+	// are resolved (or from the gatt cache if we've seen the device before),
+	// the bluez objects for the device are taken from the shared object index
 	m_gattProfile =
 		QSharedPointer<BleGattProfileBluez>::create(bluezDBusConn,
-		                                            bluezDBusPath);
+		                                            bluezDBusPath,
+		                                            m_address,
+		                                            gattCache,
+		                                            objectIndex);
 
 	// create the services object for the device (this may fail if there is
 	// no daemon on the box to support the given device, uei vs ruwido)
@@ -294,63 +300,83 @@ void BleRcuDeviceBluez::onCancelPairingRequestReply(QDBusPendingCallWatcher *cal
 
 // -----------------------------------------------------------------------------
 /*!
+	\internal
 
-
+	Returns the state graph shared by all the RCU device objects.
 
  */
-void BleRcuDeviceBluez::setupStateMachine()
+QSharedPointer<const StateGraph> BleRcuDeviceBluez::stateGraph()
 {
-	// set the name of the state machine for logging
-	m_stateMachine.setObjectName(QStringLiteral("DeviceStateMachine"));
+	// all the states and the super state groupings, parent states first
+	static constexpr StateGraph::StateDef states[] = {
+		{ -1,                  IdleState,                   "Idle"                  },
+		{ -1,                  PairedState,                 "Paired"                },
+		{ -1,                  ConnectedState,              "Connected"             },
+		{ -1,                  ResolvingServicesState,      "ResolvingServices"     },
 
-	// on debug builds to milestone logging of this state machine
-#if (AI_BUILD_TYPE == AI_DEBUG)
-	m_stateMachine.setTransistionLogLevel(QtInfoMsg, &milestone());
-#endif
+		{ -1,                  RecoverySuperState,          "RecoverySuperState"    },
+		{ RecoverySuperState,  RecoveryDisconnectingState,  "RecoveryDisconnecting" },
+		{ RecoverySuperState,  RecoveryReconnectingState,   "RecoveryReconnecting"  },
+
+		{ -1,                  SetupSuperState,             "SetupSuperState"       },
+		{ SetupSuperState,     StartingServicesState,       "StartingServices"      },
+		{ SetupSuperState,     ReadyState,                  "ReadyState"            },
+	};
+
+	// the transitions, from state -> event -> to state
+	static constexpr StateGraph::TransitionDef transitions[] = {
+		{ IdleState,                   DevicePairedEvent,            PairedState                },
+		{ IdleState,                   DeviceConnectedEvent,         ConnectedState             },
+
+		{ PairedState,                 DeviceUnpairedEvent,          IdleState                  },
+		{ PairedState,                 DeviceConnectedEvent,         ResolvingServicesState     },
+
+		{ ConnectedState,              DeviceDisconnectedEvent,      IdleState                  },
+		{ ConnectedState,              DevicePairedEvent,            ResolvingServicesState     },
 
-	// add all the states and the super state groupings
-	m_stateMachine.addState(IdleState, QStringLiteral("Idle"));
-	m_stateMachine.addState(PairedState, QStringLiteral("Paired"));
-	m_stateMachine.addState(ConnectedState, QStringLiteral("Connected"));
-	m_stateMachine.addState(ResolvingServicesState, QStringLiteral("ResolvingServices"));
+		{ ResolvingServicesState,      DeviceDisconnectedEvent,      PairedState                },
+		{ ResolvingServicesState,      DeviceUnpairedEvent,          ConnectedState             },
+		{ ResolvingServicesState,      ServicesResolvedEvent,        StartingServicesState      },
+		{ ResolvingServicesState,      ServicesResolveTimeoutEvent,  RecoveryDisconnectingState },
 
-	m_stateMachine.addState(RecoverySuperState, QStringLiteral("RecoverySuperState"));
-	m_stateMachine.addState(RecoverySuperState, RecoveryDisconnectingState, QStringLiteral("RecoveryDisconnecting"));
-	m_stateMachine.addState(RecoverySuperState, RecoveryReconnectingState, QStringLiteral("RecoveryReconnecting"));
+		{ RecoverySuperState,          DeviceUnpairedEvent,          ConnectedState             },
+		{ RecoverySuperState,          DeviceConnectedEvent,         ResolvingServicesState     },
+		{ RecoverySuperState,          ServicesResolvedEvent,        StartingServicesState      },
+		{ RecoveryDisconnectingState,  DeviceDisconnectedEvent,      RecoveryReconnectingState  },
 
-	m_stateMachine.addState(SetupSuperState, QStringLiteral("SetupSuperState"));
-	m_stateMachine.addState(SetupSuperState, StartingServicesState, QStringLiteral("StartingServices"));
-	m_stateMachine.addState(SetupSuperState, ReadyState, QStringLiteral("ReadyState"));
+		{ SetupSuperState,             ServicesNotResolvedEvent,     ResolvingServicesState     },
+		{ SetupSuperState,             DeviceDisconnectedEvent,      PairedState                },
+		{ SetupSuperState,             DeviceUnpairedEvent,          ConnectedState             },
 
+		{ StartingServicesState,       ServicesStartedEvent,         ReadyState                 },
+	};
 
-	// set the initial state of the state machine
-	m_stateMachine.setInitialState(IdleState);
+	static_assert(StateGraph::isValid(states, transitions, IdleState),
+	              "invalid BleRcuDeviceBluez state graph");
 
-	// add the transitions:      From State            ->   Event                    ->  To State
-	m_stateMachine.addTransition(IdleState,                 DevicePairedEvent,           PairedState);
-	m_stateMachine.addTransition(IdleState,                 DeviceConnectedEvent,        ConnectedState);
+	static const QSharedPointer<const StateGraph> graph =
+		StateGraph::create(states, transitions, IdleState);
+	return graph;
+}
 
-	m_stateMachine.addTransition(PairedState,               DeviceUnpairedEvent,         IdleState);
-	m_stateMachine.addTransition(PairedState,               DeviceConnectedEvent,        ResolvingServicesState);
+// -----------------------------------------------------------------------------
+/*!
 
-	m_stateMachine.addTransition(ConnectedState,            DeviceDisconnectedEvent,     IdleState);
-	m_stateMachine.addTransition(ConnectedState,            DevicePairedEvent,           ResolvingServicesState);
 
-	m_stateMachine.addTransition(ResolvingServicesState,    DeviceDisconnectedEvent,     PairedState);
-	m_stateMachine.addTransition(ResolvingServicesState,    DeviceUnpairedEvent,         ConnectedState);
-	m_stateMachine.addTransition(ResolvingServicesState,    ServicesResolvedEvent,       StartingServicesState);
-	m_stateMachine.addTransition(ResolvingServicesState,    ServicesResolveTimeoutEvent, RecoveryDisconnectingState);
 
-	m_stateMachine.addTransition(RecoverySuperState,        DeviceUnpairedEvent,         ConnectedState);
-	m_stateMachine.addTransition(RecoverySuperState,        DeviceConnectedEvent,        ResolvingServicesState);
-	m_stateMachine.addTransition(RecoverySuperState,        ServicesResolvedEvent,       StartingServicesState);
-	m_stateMachine.addTransition(RecoveryDisconnectingState,DeviceDisconnectedEvent,     RecoveryReconnectingState);
+ */
+void BleRcuDeviceBluez::setupStateMachine()
+{
+	// set the name of the state machine for logging
+	m_stateMachine.setObjectName(QStringLiteral("DeviceStateMachine"));
 
-	m_stateMachine.addTransition(SetupSuperState,           ServicesNotResolvedEvent,    ResolvingServicesState);
-	m_stateMachine.addTransition(SetupSuperState,           DeviceDisconnectedEvent,     PairedState);
-	m_stateMachine.addTransition(SetupSuperState,           DeviceUnpairedEvent,         ConnectedState);
+	// on debug builds to milestone logging of this state machine
+#if (AI_BUILD_TYPE == AI_DEBUG)
+	m_stateMachine.setTransistionLogLevel(QtInfoMsg, &milestone());
+#endif
 
-	m_stateMachine.addTransition(StartingServicesState,     ServicesStartedEvent,        ReadyState);
+	// use the state graph shared by all instances
+	m_stateMachine.setStateGraph(stateGraph());
 
 
 	// connect to the state entry and exit signals
@@ -952,6 +978,8 @@ void BleRcuDeviceBluez::dump(Dumper out) const
 	// out.printBoolean("input device attached:", m_inputDeviceConnected);
 	out.printBoolean("ready:     ", isReady());
 
+	m_stateMachine.dump(out);
+
 	out.printLine("Services:");
 	if (m_services) {
 		out.pushIndent(2);
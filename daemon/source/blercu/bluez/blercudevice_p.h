@@ -43,6 +43,8 @@
 
 
 class BleRcuServicesFactory;
+class BleGattCache;
+class BluezObjectIndex;
 
 class DeviceInfoService;
 class BatteryService;
@@ -87,6 +89,8 @@ public:
 	                  const QDBusConnection &bluezDBusConn,
 	                  const QDBusObjectPath &bluezDBusPath,
 	                  const QSharedPointer<BleRcuServicesFactory> &servicesFactory,
+	                  const QSharedPointer<BleGattCache> &gattCache,
+	                  const QSharedPointer<const BluezObjectIndex> &objectIndex,
 	                  QObject *parent = nullptr);
 	~BleRcuDeviceBluez() final;
 
@@ -131,6 +135,7 @@ private:
 	bool init(const QDBusConnection &bluezDBusConn,
 	          const QDBusObjectPath &bluezDBusPath);
 
+	static QSharedPointer<const StateGraph> stateGraph();
 	void setupStateMachine();
 
 	void getInitialDeviceProperties();
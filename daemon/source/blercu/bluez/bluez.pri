@@ -1,13 +1,16 @@
 
 HEADERS += \
+	$$PWD/blegattcache.h \
 	$$PWD/blegattprofile_p.h \
 	$$PWD/blegattservice_p.h \
 	$$PWD/blegattcharacteristic_p.h \
 	$$PWD/blegattdescriptor_p.h \
 	$$PWD/blegattnotifypipe.h \
+	$$PWD/blegattwritepipe.h \
 	$$PWD/blercuadapter_p.h \
 	$$PWD/blercudevice_p.h \
-	$$PWD/blercurecovery.h
+	$$PWD/blercurecovery.h \
+	$$PWD/bluezobjectindex.h
 
 HEADERS += \
 	$$PWD/interfaces/bluezadapterinterface.h \
@@ -17,14 +20,17 @@ HEADERS += \
 
 SOURCES += \
 	$$PWD/blegattmanager.cpp \
+	$$PWD/blegattcache.cpp \
 	$$PWD/blegattprofile.cpp \
 	$$PWD/blegattservice.cpp \
 	$$PWD/blegattcharacteristic.cpp \
 	$$PWD/blegattdescriptor.cpp \
 	$$PWD/blegattnotifypipe.cpp \
+	$$PWD/blegattwritepipe.cpp \
 	$$PWD/blercuadapter.cpp \
 	$$PWD/blercudevice.cpp \
-	$$PWD/blercurecovery.cpp
+	$$PWD/blercurecovery.cpp \
+	$$PWD/bluezobjectindex.cpp
 
 OTHER_FILES += \
 	$$PWD/CMakeLists.txt
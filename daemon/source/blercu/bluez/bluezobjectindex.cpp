@@ -0,0 +1,223 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  bluezobjectindex.cpp
+//  SkyBluetoothRcu
+//
+
+#include "bluezobjectindex.h"
+
+#include "utils/logging.h"
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class BluezObjectIndex
+	\brief Daemon wide copy of the objects managed by bluez, kept up to date
+	from the \c InterfacesAdded and \c InterfacesRemoved signals.
+
+	The index is populated once from a \c GetManagedObjects call when the
+	adapter is attached and from then on is updated incrementally.  This means
+	the GATT profile of a device can be built by looking up just the objects
+	under the device's path, rather than fetching and scanning every object
+	bluez has, which in busy environments can be thousands of objects.
+
+	The objects are stored in a map ordered by path, so all the objects under
+	a given path are contiguous and found with a single lower bound search.
+	There is also a secondary index from interface name to the objects that
+	implement it.
+
+	\note Only the properties supplied when the interface was added are
+	stored, property changes are not tracked.  This is fine for the GATT
+	objects as the properties we use are fixed, but anyone needing the
+	current value of a changeable property should query bluez.
+
+ */
+
+
+
+BluezObjectIndex::BluezObjectIndex(QObject *parent)
+	: QObject(parent)
+	, m_populated(false)
+{
+}
+
+BluezObjectIndex::~BluezObjectIndex()
+{
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns \c true if the index has been populated from bluez, if \c false
+	then the index is empty and callers should query bluez directly.
+
+ */
+bool BluezObjectIndex::isPopulated() const
+{
+	return m_populated;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the number of objects in the index.
+
+ */
+int BluezObjectIndex::size() const
+{
+	return m_objects.size();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Replaces the contents of the index with the \a objects returned from a
+	\c GetManagedObjects call.
+
+ */
+void BluezObjectIndex::populate(const DBusManagedObjectList &objects)
+{
+	m_objects = objects;
+	m_interfaceObjects.clear();
+
+	DBusManagedObjectList::const_iterator object = m_objects.begin();
+	for (; object != m_objects.end(); ++object) {
+
+		const QString path = object.key().path();
+
+		DBusInterfaceList::const_iterator interface = object.value().begin();
+		for (; interface != object.value().end(); ++interface)
+			m_interfaceObjects[interface.key()].insert(path);
+	}
+
+	m_populated = true;
+
+	qDebug("bluez object index populated with %d objects", m_objects.size());
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Clears the index, typically called when bluez falls off the bus.
+
+ */
+void BluezObjectIndex::clear()
+{
+	m_objects.clear();
+	m_interfaceObjects.clear();
+
+	m_populated = false;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the object at \a path and all the objects below it, i.e. for a
+	device path this returns the device and all it's GATT services,
+	characteristics and descriptors.
+
+ */
+DBusManagedObjectList BluezObjectIndex::objectsUnder(const QDBusObjectPath &path) const
+{
+	DBusManagedObjectList objects;
+
+	const QString prefix = path.path();
+
+	// paths are ordered as strings, so everything starting with the prefix
+	// follows on from the prefix itself
+	DBusManagedObjectList::const_iterator object = m_objects.lowerBound(path);
+	for (; object != m_objects.end(); ++object) {
+		if (!object.key().path().startsWith(prefix))
+			break;
+
+		objects.insert(object.key(), object.value());
+	}
+
+	return objects;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns all the objects that implement the given \a interface.
+
+ */
+DBusManagedObjectList BluezObjectIndex::objectsWithInterface(const QString &interface) const
+{
+	DBusManagedObjectList objects;
+
+	const QSet<QString> paths = m_interfaceObjects.value(interface);
+	for (const QString &path : paths) {
+		const QDBusObjectPath objectPath(path);
+		objects.insert(objectPath, m_objects.value(objectPath));
+	}
+
+	return objects;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Slot expected to be connected to the \c InterfacesAdded signal from the
+	bluez object manager, adds the interfaces to the object at \a objectPath,
+	creating the object if it didn't exist.
+
+ */
+void BluezObjectIndex::onInterfacesAdded(const QDBusObjectPath &objectPath,
+                                         const DBusInterfaceList &interfacesAndProperties)
+{
+	if (!m_populated)
+		return;
+
+	const QString path = objectPath.path();
+	DBusInterfaceList &interfaces = m_objects[objectPath];
+
+	DBusInterfaceList::const_iterator it = interfacesAndProperties.begin();
+	for (; it != interfacesAndProperties.end(); ++it) {
+		interfaces.insert(it.key(), it.value());
+		m_interfaceObjects[it.key()].insert(path);
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Slot expected to be connected to the \c InterfacesRemoved signal from the
+	bluez object manager, removes the \a interfaces from the object at
+	\a objectPath and the object itself if it has no interfaces left.
+
+ */
+void BluezObjectIndex::onInterfacesRemoved(const QDBusObjectPath &objectPath,
+                                           const QStringList &interfaces)
+{
+	DBusManagedObjectList::iterator object = m_objects.find(objectPath);
+	if (object == m_objects.end())
+		return;
+
+	const QString path = objectPath.path();
+
+	for (const QString &interface : interfaces) {
+		object.value().remove(interface);
+
+		QMap<QString, QSet<QString>>::iterator it = m_interfaceObjects.find(interface);
+		if (it != m_interfaceObjects.end()) {
+			it.value().remove(path);
+			if (it.value().isEmpty())
+				m_interfaceObjects.erase(it);
+		}
+	}
+
+	if (object.value().isEmpty())
+		m_objects.erase(object);
+}
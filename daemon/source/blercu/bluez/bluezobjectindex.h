@@ -0,0 +1,70 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  bluezobjectindex.h
+//  SkyBluetoothRcu
+//
+
+#ifndef BLUEZOBJECTINDEX_H
+#define BLUEZOBJECTINDEX_H
+
+#include "dbus/dbusobjectmanager.h"
+
+#include <QObject>
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QDBusObjectPath>
+
+
+class BluezObjectIndex : public QObject
+{
+	Q_OBJECT
+
+public:
+	explicit BluezObjectIndex(QObject *parent = nullptr);
+	~BluezObjectIndex() final;
+
+public:
+	bool isPopulated() const;
+	int size() const;
+
+	void populate(const DBusManagedObjectList &objects);
+	void clear();
+
+	DBusManagedObjectList objectsUnder(const QDBusObjectPath &path) const;
+	DBusManagedObjectList objectsWithInterface(const QString &interface) const;
+
+public slots:
+	void onInterfacesAdded(const QDBusObjectPath &objectPath,
+	                       const DBusInterfaceList &interfacesAndProperties);
+	void onInterfacesRemoved(const QDBusObjectPath &objectPath,
+	                         const QStringList &interfaces);
+
+private:
+	bool m_populated;
+
+	DBusManagedObjectList m_objects;
+	QMap<QString, QSet<QString>> m_interfaceObjects;
+};
+
+
+#endif // !defined(BLUEZOBJECTINDEX_H)
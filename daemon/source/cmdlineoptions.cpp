@@ -104,6 +104,9 @@ CmdLineOptions::CmdLineOptions()
 		{ QCommandLineOption( { "f", "audio-fifo-dir" }, "Directory to use for audio fifos </tmp>", "path" ),
 			std::bind(&CmdLineOptions::setAudioFifoDirectory, this, std::placeholders::_1) },
 
+		{ QCommandLineOption(        "gatt-cache-dir", "Directory to store the GATT profile cache and interrupted f/w upgrade progress of paired RCUs in, if not set the cache is disabled and upgrades can't be resumed", "path" ),
+			std::bind(&CmdLineOptions::setGattCacheDirectory, this, std::placeholders::_1) },
+
 		{ QCommandLineOption( { "i", "irdb" }, "Path to the IR database QT plugin", "path" ),
 			std::bind(&CmdLineOptions::setIrDatabasePluginFile, this, std::placeholders::_1) },
 
@@ -288,6 +291,19 @@ QString CmdLineOptions::audioFifoDirectory() const
 	return m_audioFifoPath;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	Returns the directory to store the persistent GATT profile cache in, if
+	empty then the cache is disabled.
+
+	\note Calling this before CmdLineOptions::process() will just return the
+	default value which is an empty string.
+ */
+QString CmdLineOptions::gattCacheDirectory() const
+{
+	return m_gattCachePath;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	Returns the path to the IR database QT plugin file to use.
@@ -699,6 +715,37 @@ void CmdLineOptions::setAudioFifoDirectory(const QString &audioFifoPath)
 	m_audioFifoPath = audioFifoPath;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+
+ */
+void CmdLineOptions::setGattCacheDirectory(const QString &gattCachePath)
+{
+	const QByteArray _gattCachePath = gattCachePath.toLatin1();
+
+	// check if the path exists, if not create it with 'drwxr-x---' perms
+	QFileInfo info(gattCachePath);
+	if (!info.exists()) {
+
+		if (mkdir(_gattCachePath.constData(), 0750) != 0) {
+			qErrnoWarning(errno, "failed to create dir '%s'", _gattCachePath.constData());
+			return;
+		}
+
+	} else if (!info.isDir()) {
+		qWarning("supplied path for gatt cache is not a directory");
+		return;
+
+	} else if (!info.isWritable()) {
+		qWarning("supplied path for gatt cache is not writable");
+		return;
+	}
+
+	m_gattCachePath = gattCachePath;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -741,3 +788,4 @@ void CmdLineOptions::setEnablePairingWebServer(const QString &ignore)
 
 	m_enablePairingWebServer = true;
 }
+
@@ -63,6 +63,8 @@ public:
 
 	QString audioFifoDirectory() const;
 
+	QString gattCacheDirectory() const;
+
 	QString irDatabasePluginPath() const;
 
 	bool enableScanMonitor() const;
@@ -99,6 +101,8 @@ private:
 
 	void setAudioFifoDirectory(const QString &audioFifoPath);
 
+	void setGattCacheDirectory(const QString &gattCachePath);
+
 	void setIrDatabasePluginFile(const QString &irDatabasePluginPath);
 
 	void setDisableScanMonitor(const QString &ignore);
@@ -126,6 +130,8 @@ private:
 
 	QString m_audioFifoPath;
 
+	QString m_gattCachePath;
+
 	QString m_irDatabasePluginPath;
 
 	bool m_enableScanMonitor;
@@ -37,6 +37,9 @@
 ConfigModelSettingsData::ConfigModelSettingsData()
 	: m_valid(false)
 	, m_disabled(false)
+	, m_upgradeBlockSize(18)
+	, m_upgradeResume(false)
+	, m_upgradeAdaptiveWindow(false)
 	, m_servicesType(ConfigModelSettings::DBusServiceType)
 	, m_servicesSupported(0)
 {
@@ -51,6 +54,9 @@ ConfigModelSettingsData::ConfigModelSettingsData(const ConfigModelSettingsData &
 	, m_pairingNameFormat(other.m_pairingNameFormat)
 	, m_filterBytes(other.m_filterBytes)
 	, m_standbyMode(other.m_standbyMode)
+	, m_upgradeBlockSize(other.m_upgradeBlockSize)
+	, m_upgradeResume(other.m_upgradeResume)
+	, m_upgradeAdaptiveWindow(other.m_upgradeAdaptiveWindow)
 	, m_hasConnParams(other.m_hasConnParams)
 	, m_connParams(other.m_connParams)
 	, m_servicesType(other.m_servicesType)
@@ -137,6 +143,9 @@ bool ConfigModelSettingsData::stringToServiceFlag(const QString &name,
 ConfigModelSettingsData::ConfigModelSettingsData(const QJsonObject &json)
 	: m_valid(false)
 	, m_disabled(false)
+	, m_upgradeBlockSize(18)
+	, m_upgradeResume(false)
+	, m_upgradeAdaptiveWindow(false)
 	, m_hasConnParams(false)
 	, m_servicesSupported(0)
 {
@@ -263,6 +272,40 @@ ConfigModelSettingsData::ConfigModelSettingsData(const QJsonObject &json)
 		}
 	}
 
+	// upgradeBlockSize field
+	{
+		const QJsonValue upgradeBlockSize = json["upgradeBlockSize"];
+		if (!upgradeBlockSize.isUndefined()) {
+			const int blockSize = upgradeBlockSize.toInt(-1);
+			if (!upgradeBlockSize.isDouble() || (blockSize < 18) || (blockSize > 242))
+				qWarning("invalid 'upgradeBlockSize' field, reverting to default");
+			else
+				m_upgradeBlockSize = blockSize;
+		}
+	}
+
+	// upgradeResume field
+	{
+		const QJsonValue upgradeResume = json["upgradeResume"];
+		if (!upgradeResume.isUndefined()) {
+			if (!upgradeResume.isBool())
+				qWarning("invalid 'upgradeResume' field, reverting to default");
+			else
+				m_upgradeResume = upgradeResume.toBool();
+		}
+	}
+
+	// upgradeAdaptiveWindow field
+	{
+		const QJsonValue upgradeAdaptiveWindow = json["upgradeAdaptiveWindow"];
+		if (!upgradeAdaptiveWindow.isUndefined()) {
+			if (!upgradeAdaptiveWindow.isBool())
+				qWarning("invalid 'upgradeAdaptiveWindow' field, reverting to default");
+			else
+				m_upgradeAdaptiveWindow = upgradeAdaptiveWindow.toBool();
+		}
+	}
+
 	// services field
 	{
 		const QJsonValue services = json["services"];
@@ -523,6 +566,43 @@ QString ConfigModelSettings::standbyMode() const
 	return d->m_standbyMode;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	The largest number of firmware bytes the RCU accepts in a single OTA DATA
+	packet.  All RCUs support the 18 byte blocks of the original protocol,
+	if the model's firmware supports larger blocks then they are used when
+	the negotiated MTU is big enough.
+ */
+int ConfigModelSettings::upgradeBlockSize() const
+{
+	return d->m_upgradeBlockSize;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns \c true if the model's firmware can resume an interrupted OTA
+	transfer, in which case the WRQ packet offers to carry on from the last
+	block the RCU ACKed.  Off by default as it's not part of the original
+	protocol.
+ */
+bool ConfigModelSettings::upgradeResume() const
+{
+	return d->m_upgradeResume;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns \c true if the model's firmware ACKs every OTA DATA packet it
+	receives, rather than once per window, in which case the send window is
+	adapted to the RTT and packet loss.  Off by default as the original
+	protocol only ACKs the last block of each window, so the window must
+	stay at the size read from the RCU.
+ */
+bool ConfigModelSettings::upgradeAdaptiveWindow() const
+{
+	return d->m_upgradeAdaptiveWindow;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	Returns \c true if the special connection parameters should be set for
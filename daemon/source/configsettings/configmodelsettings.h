@@ -66,6 +66,10 @@ public:
 
 	QString standbyMode() const;
 
+	int upgradeBlockSize() const;
+	bool upgradeResume() const;
+	bool upgradeAdaptiveWindow() const;
+
 public:
 	enum ServicesType {
 		DBusServiceType,
@@ -57,6 +57,9 @@ public:
 	QRegExp m_connectNameMatcher;
 	QSet<quint8> m_filterBytes;
 	QString m_standbyMode;
+	int m_upgradeBlockSize;
+	bool m_upgradeResume;
+	bool m_upgradeAdaptiveWindow;
 
 	bool m_hasConnParams;
 	BleConnectionParameters m_connParams;
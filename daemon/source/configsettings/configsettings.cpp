@@ -84,6 +84,213 @@ ConfigSettings::TimeOuts ConfigSettings::parseTimeouts(const QJsonObject &json)
 	return timeouts;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Parses the \a json object to extract the voice audio settings.  The object
+	is optional and all the fields within it are optional, it should be
+	formatted like the following
+
+	\code{.json}
+		{
+			"workerThread": false,
+			"workerThreadPolicy": "fifo",
+			"workerThreadPriority": 10,
+			"outputBufferSize": 480,
+			"outputBufferHighWaterMark": 360,
+			"outputBufferLowWaterMark": 120,
+			"outputBufferDropPolicy": "oldest",
+			"concealment": "none",
+			"concealmentMaxGap": 96,
+			"preEnableNotifications": false,
+			"preRollSize": 0
+		}
+	\endcode
+
+	If \c workerThread is \c true then the voice audio for every RCU is read,
+	decoded and written to the client on a dedicated thread rather than on the
+	main event loop.  The policy can be one of \c "fifo", \c "rr" or
+	\c "other".
+
+	The \c outputBuffer values are in milliseconds of audio and set the size
+	of the buffer used to hold decoded audio when the client isn't reading
+	the pipe fast enough, a size of \c 0 disables the buffer.  When full
+	either the \c "oldest" or \c "newest" frame is dropped.
+
+	The \c concealment value sets how gaps in the audio due to lost frames
+	are filled, it can be one of \c "none", \c "silence", \c "repeat" or
+	\c "fade".  Only gaps up to \c concealmentMaxGap milliseconds long are
+	filled, longer gaps are left as a discontinuity.
+
+	If \c preEnableNotifications is \c true then the voice data notifications
+	are enabled as soon as the RCU is ready and kept enabled while it is
+	connected, so starting a stream only needs the audio control write.
+
+	The \c preRollSize is the milliseconds of audio received from the RCU
+	before a stream has fully started that is kept and sent to the client
+	when it does start, \c 0 disables it.  It's off by default as it changes
+	the audio every client receives, so should be enabled per deployment.
+
+	\see fromJsonFile()
+ */
+ConfigSettings::AudioSettings ConfigSettings::parseAudioSettings(const QJsonObject &json)
+{
+	AudioSettings settings = { false, ThreadRtSched::SchedFifo, 10,
+	                           480, 360, 120, true,
+	                           AudioSettings::NoConcealment, 96, false, 0 };
+
+	const QJsonValue workerThread = json["workerThread"];
+	if (!workerThread.isUndefined()) {
+		if (!workerThread.isBool())
+			qWarning("invalid 'workerThread' field, reverting to default");
+		else
+			settings.workerThread = workerThread.toBool();
+	}
+
+	const QJsonValue policy = json["workerThreadPolicy"];
+	if (!policy.isUndefined()) {
+		const QString policyStr = policy.toString();
+		if (policyStr.compare("fifo", Qt::CaseInsensitive) == 0)
+			settings.workerThreadPolicy = ThreadRtSched::SchedFifo;
+		else if (policyStr.compare("rr", Qt::CaseInsensitive) == 0)
+			settings.workerThreadPolicy = ThreadRtSched::SchedRoundRobin;
+		else if (policyStr.compare("other", Qt::CaseInsensitive) == 0)
+			settings.workerThreadPolicy = ThreadRtSched::SchedOther;
+		else
+			qWarning("invalid 'workerThreadPolicy' field, reverting to default");
+	}
+
+	const QJsonValue priority = json["workerThreadPriority"];
+	if (!priority.isUndefined()) {
+		if (!priority.isDouble())
+			qWarning("invalid 'workerThreadPriority' field, reverting to default");
+		else
+			settings.workerThreadPriority = priority.toInt(settings.workerThreadPriority);
+	}
+
+	struct {
+		const char *name;
+		int *storage;
+	} bufferFields[5] = {
+		{ "outputBufferSize",           &settings.outputBufferSize           },
+		{ "outputBufferHighWaterMark",  &settings.outputBufferHighWaterMark  },
+		{ "outputBufferLowWaterMark",   &settings.outputBufferLowWaterMark   },
+		{ "concealmentMaxGap",          &settings.concealmentMaxGap          },
+		{ "preRollSize",                &settings.preRollSize                },
+	};
+
+	for (unsigned int i = 0; i < (sizeof(bufferFields) / sizeof(bufferFields[0])); i++) {
+
+		const QJsonValue value = json[bufferFields[i].name];
+		if (!value.isUndefined()) {
+			if (!value.isDouble() || (value.toInt(-1) < 0))
+				qWarning("invalid '%s' field, reverting to default", bufferFields[i].name);
+			else
+				*(bufferFields[i].storage) = value.toInt();
+		}
+	}
+
+	const QJsonValue dropPolicy = json["outputBufferDropPolicy"];
+	if (!dropPolicy.isUndefined()) {
+		const QString dropPolicyStr = dropPolicy.toString();
+		if (dropPolicyStr.compare("oldest", Qt::CaseInsensitive) == 0)
+			settings.outputBufferDropOldest = true;
+		else if (dropPolicyStr.compare("newest", Qt::CaseInsensitive) == 0)
+			settings.outputBufferDropOldest = false;
+		else
+			qWarning("invalid 'outputBufferDropPolicy' field, reverting to default");
+	}
+
+	const QJsonValue concealment = json["concealment"];
+	if (!concealment.isUndefined()) {
+		const QString concealmentStr = concealment.toString();
+		if (concealmentStr.compare("none", Qt::CaseInsensitive) == 0)
+			settings.concealment = AudioSettings::NoConcealment;
+		else if (concealmentStr.compare("silence", Qt::CaseInsensitive) == 0)
+			settings.concealment = AudioSettings::SilenceConcealment;
+		else if (concealmentStr.compare("repeat", Qt::CaseInsensitive) == 0)
+			settings.concealment = AudioSettings::RepeatConcealment;
+		else if (concealmentStr.compare("fade", Qt::CaseInsensitive) == 0)
+			settings.concealment = AudioSettings::FadeConcealment;
+		else
+			qWarning("invalid 'concealment' field, reverting to default");
+	}
+
+	const QJsonValue preEnable = json["preEnableNotifications"];
+	if (!preEnable.isUndefined()) {
+		if (!preEnable.isBool())
+			qWarning("invalid 'preEnableNotifications' field, reverting to default");
+		else
+			settings.preEnableNotifications = preEnable.toBool();
+	}
+
+	return settings;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Parses the \a json object to extract the GATT settings.  The object is
+	optional and all the fields within it are optional, it should be
+	formatted like the following
+
+	\code{.json}
+		{
+			"serviceStart": "parallel",
+			"maxParallelServiceStarts": 3,
+			"deviceInfoReadDepth": 0
+		}
+	\endcode
+
+	The \c serviceStart value is either \c "parallel" or \c "sequential".
+	When parallel the services of an RCU are started at the same time, only
+	waiting on each other where there is a real dependency, up to
+	\c maxParallelServiceStarts at once.  Sequential starts them one after
+	the other, which is slower but may be needed for bluez stacks that don't
+	cope well with many outstanding GATT requests.
+
+	The \c deviceInfoReadDepth is the maximum number of device info
+	characteristic reads in flight at once, \c 0 means all of them are
+	issued together.
+
+	\see fromJsonFile()
+ */
+ConfigSettings::GattSettings ConfigSettings::parseGattSettings(const QJsonObject &json)
+{
+	GattSettings settings = { true, 3, 0 };
+
+	const QJsonValue serviceStart = json["serviceStart"];
+	if (!serviceStart.isUndefined()) {
+		const QString serviceStartStr = serviceStart.toString();
+		if (serviceStartStr.compare("parallel", Qt::CaseInsensitive) == 0)
+			settings.parallelServiceStart = true;
+		else if (serviceStartStr.compare("sequential", Qt::CaseInsensitive) == 0)
+			settings.parallelServiceStart = false;
+		else
+			qWarning("invalid 'serviceStart' field, reverting to default");
+	}
+
+	const QJsonValue maxStarts = json["maxParallelServiceStarts"];
+	if (!maxStarts.isUndefined()) {
+		if (!maxStarts.isDouble() || (maxStarts.toInt(-1) < 1))
+			qWarning("invalid 'maxParallelServiceStarts' field, reverting to default");
+		else
+			settings.maxParallelServiceStarts = maxStarts.toInt();
+	}
+
+	const QJsonValue readDepth = json["deviceInfoReadDepth"];
+	if (!readDepth.isUndefined()) {
+		if (!readDepth.isDouble() || (readDepth.toInt(-1) < 0))
+			qWarning("invalid 'deviceInfoReadDepth' field, reverting to default");
+		else
+			settings.deviceInfoReadDepth = readDepth.toInt();
+	}
+
+	return settings;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	Returns the default config settings.
@@ -158,6 +365,26 @@ QSharedPointer<ConfigSettings> ConfigSettings::fromJsonFile(QIODevice *file)
 	TimeOuts timeouts = parseTimeouts(timeoutsParam.toObject());
 
 
+	// find the (optional) audio params
+	QJsonValue audioParam = jsonObj["audio"];
+	if (!audioParam.isUndefined() && !audioParam.isObject()) {
+		qWarning("invalid 'audio' field in config");
+		return QSharedPointer<ConfigSettings>();
+	}
+
+	AudioSettings audioSettings = parseAudioSettings(audioParam.toObject());
+
+
+	// find the (optional) gatt params
+	QJsonValue gattParam = jsonObj["gatt"];
+	if (!gattParam.isUndefined() && !gattParam.isObject()) {
+		qWarning("invalid 'gatt' field in config");
+		return QSharedPointer<ConfigSettings>();
+	}
+
+	GattSettings gattSettings = parseGattSettings(gattParam.toObject());
+
+
 	// find the vendor details array
 	QJsonValue jsonVendors = jsonObj["models"];
 	if (!jsonVendors.isArray()) {
@@ -181,7 +408,8 @@ QSharedPointer<ConfigSettings> ConfigSettings::fromJsonFile(QIODevice *file)
 	}
 
 	// finally return the config
-	return QSharedPointer<ConfigSettings>::create(timeouts, std::move(models));
+	return QSharedPointer<ConfigSettings>::create(timeouts, audioSettings,
+	                                              gattSettings, std::move(models));
 }
 
 // -----------------------------------------------------------------------------
@@ -193,8 +421,12 @@ QSharedPointer<ConfigSettings> ConfigSettings::fromJsonFile(QIODevice *file)
 	\see fromJsonFile()
  */
 ConfigSettings::ConfigSettings(const TimeOuts &timeouts,
+                               const AudioSettings &audioSettings,
+                               const GattSettings &gattSettings,
                                QList<ConfigModelSettings> &&modelDetails)
 	: m_timeOuts(timeouts)
+	, m_audioSettings(audioSettings)
+	, m_gattSettings(gattSettings)
 	, m_modelDetails(std::move(modelDetails))
 {
 }
@@ -332,6 +564,30 @@ int ConfigSettings::hidrawWaitLimitTimeout() const
 	return m_timeOuts.hidrawWaitLimitMSecs;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	Returns the settings used for the voice audio streaming path.
+
+	By default the audio is processed on the main event loop, i.e.
+	\c AudioSettings::workerThread is \c false.
+ */
+ConfigSettings::AudioSettings ConfigSettings::audioSettings() const
+{
+	return m_audioSettings;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the settings used when setting up the GATT services of an RCU.
+
+	By default the services are started in parallel, i.e.
+	\c GattSettings::parallelServiceStart is \c true.
+ */
+ConfigSettings::GattSettings ConfigSettings::gattSettings() const
+{
+	return m_gattSettings;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	Debugging function to dump out the settings.
@@ -346,6 +602,8 @@ QDebug operator<<(QDebug dbg, const ConfigSettings &settings)
 	              << "pairingTimeout="   << settings.pairingTimeout() << "ms, "
 	              << "setupTimeout="     << settings.setupTimeout() << "ms, "
 	              << "upairingTimeout="  << settings.upairingTimeout() << "ms, "
+	              << "audioWorkerThread=" << settings.audioSettings().workerThread << ", "
+	              << "gattParallelServiceStart=" << settings.gattSettings().parallelServiceStart << ", "
 	              << "modelSettings="    << settings.modelSettings().length()
 	              << ")";
 
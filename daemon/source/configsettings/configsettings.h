@@ -26,6 +26,7 @@
 #define CONFIGSETTINGS_H
 
 #include "configmodelsettings.h"
+#include "utils/threadrtsched.h"
 
 #include <QDebug>
 #include <QString>
@@ -58,9 +59,42 @@ private:
 		int hidrawWaitLimitMSecs;
 	};
 
+public:
+	struct AudioSettings {
+		enum Concealment {
+			NoConcealment,
+			SilenceConcealment,
+			RepeatConcealment,
+			FadeConcealment
+		};
+
+		bool workerThread;
+		ThreadRtSched::Policy workerThreadPolicy;
+		int workerThreadPriority;
+
+		int outputBufferSize;
+		int outputBufferHighWaterMark;
+		int outputBufferLowWaterMark;
+		bool outputBufferDropOldest;
+
+		Concealment concealment;
+		int concealmentMaxGap;
+
+		bool preEnableNotifications;
+		int preRollSize;
+	};
+
+	struct GattSettings {
+		bool parallelServiceStart;
+		int maxParallelServiceStarts;
+		int deviceInfoReadDepth;
+	};
+
 private:
 	friend class QSharedPointer<ConfigSettings>;
 	ConfigSettings(const TimeOuts &timeouts,
+	               const AudioSettings &audioSettings,
+	               const GattSettings &gattSettings,
 	               QList<ConfigModelSettings> &&modelDetails);
 
 public:
@@ -72,15 +106,22 @@ public:
 	int hidrawWaitPollTimeout() const;
 	int hidrawWaitLimitTimeout() const;
 
+	AudioSettings audioSettings() const;
+	GattSettings gattSettings() const;
+
 	ConfigModelSettings modelSettings(quint32 oui) const;
 	ConfigModelSettings modelSettings(QString name) const;
 	QList<ConfigModelSettings> modelSettings() const;
 
 private:
 	static TimeOuts parseTimeouts(const QJsonObject &json);
+	static AudioSettings parseAudioSettings(const QJsonObject &json);
+	static GattSettings parseGattSettings(const QJsonObject &json);
 
 private:
 	const TimeOuts m_timeOuts;
+	const AudioSettings m_audioSettings;
+	const GattSettings m_gattSettings;
 	const QList<ConfigModelSettings> m_modelDetails;
 };
 
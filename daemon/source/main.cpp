@@ -41,7 +41,9 @@
 #include "blercu/blercucontroller_p.h"
 #include "blercu/bleservices/blercuservicesfactory.h"
 #include "blercu/bluez/blercuadapter_p.h"
+#include "blercu/bluez/blegattcache.h"
 #include "blercu/btrmgradapter.h"
+#include "blercu/bleservices/gatt/gatt_upgraderesume.h"
 
 #if defined(ENABLE_BLERCU_CONN_PARAM_CHANGER)
 #  include "bleconnparamchanger/bleconnparamchanger.h"
@@ -307,10 +309,20 @@ int main(int argc, char *argv[])
 	// initialize BTRMGR API before it is used in BleRcuController
 	const auto btrMgrInitializer = BtrMgrAdapter::ApiInitializer{};
 
+	// create the persistent gatt cache and the record of interrupted f/w
+	// upgrades (if enabled)
+	QSharedPointer<BleGattCache> gattCache;
+	QSharedPointer<GattUpgradeResumeStore> upgradeResumeStore;
+	if (!options->gattCacheDirectory().isEmpty()) {
+		gattCache = QSharedPointer<BleGattCache>::create(options->gattCacheDirectory());
+		upgradeResumeStore = QSharedPointer<GattUpgradeResumeStore>::create(options->gattCacheDirectory());
+	}
+
 	// create the factory for creating the BleRcu services for each device
 	QSharedPointer<BleRcuServicesFactory> servicesFactory =
 		QSharedPointer<BleRcuServicesFactory>::create(config,
-		                                              irDatabase);
+		                                              irDatabase,
+		                                              upgradeResumeStore);
 	if (!servicesFactory) {
 		qFatal("failed to setup the BLE services factory");
 	}
@@ -319,6 +331,7 @@ int main(int argc, char *argv[])
 	QSharedPointer<BleRcuAdapter> adapter =
 		QSharedPointer<BleRcuAdapterBluez>::create(config,
 		                                           servicesFactory,
+		                                           gattCache,
 		                                           QDBusConnection::systemBus());
 	if (!adapter || !adapter->isValid()) {
 		qFatal("failed to setup the BLE manager");
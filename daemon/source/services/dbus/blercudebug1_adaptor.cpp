@@ -24,10 +24,15 @@
 
 #include "blercudebug1_adaptor.h"
 #include "blercu/blercucontroller.h"
+#include "utils/dumper.h"
 #include "utils/logging.h"
 
 #include <QCoreApplication>
 
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+
 
 
 BleRcuDebug1Adaptor::BleRcuDebug1Adaptor(QObject *parent,
@@ -122,3 +127,42 @@ void BleRcuDebug1Adaptor::setLogLevels(quint32 levels)
 	::setLogLevels(mask);
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	DBus method call handler for com.sky.blercu.Debug1.Dump
+
+	Returns the same output as the daemon's dump, which includes the recent
+	transitions and time-in-state histograms of the state machines, so it
+	can be pulled from a box in the field without a debug build.
+
+ */
+QString BleRcuDebug1Adaptor::Dump(const QDBusMessage &message)
+{
+	// the dumper writes to a file descriptor so dump into an anonymous
+	// temporary file and read it back
+	FILE *file = tmpfile();
+	if (!file) {
+		qErrnoWarning(errno, "failed to create temporary file for dump");
+		sendErrorReply(message, QDBusError::errorString(QDBusError::Failed),
+		               QStringLiteral("Failed to create dump file"));
+		return QString();
+	}
+
+	const int fd = fileno(file);
+
+	m_controller->dump(Dumper(fd));
+
+	QByteArray contents;
+	if (lseek(fd, 0, SEEK_SET) == 0) {
+		char buffer[4096];
+		ssize_t rd;
+		while ((rd = TEMP_FAILURE_RETRY(::read(fd, buffer, sizeof(buffer)))) > 0)
+			contents.append(buffer, int(rd));
+	} else {
+		qErrnoWarning(errno, "failed to rewind dump file");
+	}
+
+	fclose(file);
+
+	return QString::fromUtf8(contents);
+}
@@ -52,6 +52,9 @@ class BleRcuDebug1Adaptor final : public DBusAbstractAdaptor
 	            "    </property>\n"
 	            "    <property name=\"LogLevels\" type=\"u\" access=\"readwrite\">\n"
 	            "    </property>\n"
+	            "    <method name=\"Dump\">\n"
+	            "      <arg direction=\"out\" type=\"s\" name=\"dump\"/>\n"
+	            "    </method>\n"
 	            "  </interface>\n"
 	            "")
 
@@ -79,6 +82,9 @@ public:
 	quint32 logLevels() const;
 	void setLogLevels(quint32 levels);
 
+public slots:
+	QString Dump(const QDBusMessage &message);
+
 private:
 	const QSharedPointer<BleRcuController> m_controller;
 
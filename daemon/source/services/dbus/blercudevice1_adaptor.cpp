@@ -459,6 +459,31 @@ void BleRcuDevice1Adaptor::StartAudioStreamingTo(quint32 encoding,
 void BleRcuDevice1Adaptor::StartAudioStreaming(quint32 encoding,
                                                const QDBusMessage &request)
 {
+	StartAudioStreamingWithLatency(encoding, 0, request);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	DBus method call handler for com.sky.BleRcuDevice1.StartAudioStreamingWithLatency,
+	the same as StartAudioStreaming but with a latency budget.
+
+	The \a latencyBudget is the number of milliseconds the client is willing
+	to let the audio frames be held for so they can be written to the pipe in
+	batches, trading a little latency for fewer wake-ups on both sides of the
+	pipe.  A value of \c 0 means every frame is written as soon as it arrives.
+
+ */
+void BleRcuDevice1Adaptor::StartAudioStreamingWithLatency(quint32 encoding,
+                                                          quint32 latencyBudget,
+                                                          const QDBusMessage &request)
+{
+	// sanity check the latency budget
+	if (latencyBudget > 1000) {
+		sendError(request, BleRcuError::InvalidArg,
+		          QStringLiteral("Invalid latency budget value"));
+		return;
+	}
+
 	// sanity check and convert the encoding value
 	BleRcuAudioService::Encoding audioEncoding = BleRcuAudioService::InvalidEncoding;
 	switch (encoding) {
@@ -476,7 +501,8 @@ void BleRcuDevice1Adaptor::StartAudioStreaming(quint32 encoding,
 
 	// get the service and request to start streaming
 	const QSharedPointer<BleRcuAudioService> service = m_device->audioService();
-	Future<FileDescriptor> result = service->startStreaming(audioEncoding);
+	Future<FileDescriptor> result =
+		service->startStreaming(audioEncoding, static_cast<int>(latencyBudget));
 
 	// need a custom converter to convert from a FileDescriptor object to
 	// real fd we can send over dbus
@@ -487,6 +513,74 @@ void BleRcuDevice1Adaptor::StartAudioStreaming(quint32 encoding,
 	connectFutureToDBusReply(request, result, convertor);
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Convertor function to convert a \l{BleRcuAudioService::SharedMemoryStream}
+	type to a pair of fds we can send over dbus.
+ */
+QList<QVariant> BleRcuDevice1Adaptor::convertSharedMemoryStream(const BleRcuAudioService::SharedMemoryStream &stream)
+{
+	// if either fd is not valid then don't return anything
+	if (!stream.memoryFd.isValid() || !stream.eventFd.isValid())
+		return QList<QVariant>();
+
+	QDBusUnixFileDescriptor dbusMemoryFd(stream.memoryFd.fd());
+	QDBusUnixFileDescriptor dbusEventFd(stream.eventFd.fd());
+	return QList<QVariant>( { QVariant::fromValue(dbusMemoryFd),
+	                          QVariant::fromValue(dbusEventFd) } );
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	DBus method call handler for
+	com.sky.BleRcuDevice1.StartAudioStreamingSharedMemory
+
+	Alternative to StartAudioStreaming that returns a sealed memfd containing
+	a ring of timestamped audio frames and an eventfd that is signalled when
+	frames are added to the ring, the \a latencyBudget is used to batch the
+	eventfd wake-ups.
+
+ */
+void BleRcuDevice1Adaptor::StartAudioStreamingSharedMemory(quint32 encoding,
+                                                           quint32 latencyBudget,
+                                                           const QDBusMessage &request)
+{
+	// sanity check the latency budget
+	if (latencyBudget > 1000) {
+		sendError(request, BleRcuError::InvalidArg,
+		          QStringLiteral("Invalid latency budget value"));
+		return;
+	}
+
+	// sanity check and convert the encoding value
+	BleRcuAudioService::Encoding audioEncoding = BleRcuAudioService::InvalidEncoding;
+	switch (encoding) {
+		case 1:
+			audioEncoding = BleRcuAudioService::ADPCM;
+			break;
+		case 2:
+			audioEncoding = BleRcuAudioService::PCM16;
+			break;
+		default:
+			sendError(request, BleRcuError::InvalidArg,
+			          QStringLiteral("Invalid encoding value"));
+			return;
+	}
+
+	// get the service and request to start streaming
+	const QSharedPointer<BleRcuAudioService> service = m_device->audioService();
+	Future<BleRcuAudioService::SharedMemoryStream> result =
+		service->startStreamingSharedMemory(audioEncoding, static_cast<int>(latencyBudget));
+
+	const std::function<QList<QVariant>(const BleRcuAudioService::SharedMemoryStream&)>
+		convertor = &BleRcuDevice1Adaptor::convertSharedMemoryStream;
+
+	// connect the result future to a dbus reply
+	connectFutureToDBusReply(request, result, convertor);
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	DBus method call handler for com.sky.BleRcuDevice1.StopAudioStreaming
@@ -507,7 +601,7 @@ void BleRcuDevice1Adaptor::StopAudioStreaming(const QDBusMessage &request)
 	\internal
 
 	Convertor function to convert a \l{BleRcuAudioService::PacketStats} type to
-	a couple of \c quint32 values.
+	a list of \c quint32 values.
  */
 QList<QVariant> BleRcuDevice1Adaptor::convertStatusInfo(const BleRcuAudioService::StatusInfo &info)
 {
@@ -540,6 +634,47 @@ void BleRcuDevice1Adaptor::GetAudioStatus(const QDBusMessage &request)
 	connectFutureToDBusReply(request, result, convertor);
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Convertor function to convert the voice buffer counters in a
+	\l{BleRcuAudioService::StatusInfo} type to a single dictionary argument.
+ */
+QList<QVariant> BleRcuDevice1Adaptor::convertAudioStats(const BleRcuAudioService::StatusInfo &info)
+{
+	QVariantMap stats;
+	stats[QStringLiteral("BufferedBytes")] = QVariant::fromValue<quint32>(info.bufferedBytes);
+	stats[QStringLiteral("PeakBufferedBytes")] = QVariant::fromValue<quint32>(info.peakBufferedBytes);
+	stats[QStringLiteral("FramesDropped")] = QVariant::fromValue<quint32>(info.droppedFrames);
+	stats[QStringLiteral("FramesConcealed")] = QVariant::fromValue<quint32>(info.concealedFrames);
+	stats[QStringLiteral("Discontinuities")] = QVariant::fromValue<quint32>(info.discontinuities);
+	stats[QStringLiteral("PreRollFrames")] = QVariant::fromValue<quint32>(info.preRollFrames);
+
+	return { QVariant::fromValue(stats) };
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	DBus method call handler for com.sky.BleRcuDevice1.GetAudioStats
+
+	Returns the output buffer counters of the current voice stream, or the
+	last one if not streaming.  These are kept out of GetAudioStatus so that
+	its reply signature stays the same for existing clients.
+
+ */
+void BleRcuDevice1Adaptor::GetAudioStats(const QDBusMessage &request)
+{
+	const QSharedPointer<BleRcuAudioService> service = m_device->audioService();
+	Future<BleRcuAudioService::StatusInfo> result = service->status();
+
+	const std::function<QList<QVariant> (const BleRcuAudioService::StatusInfo&)>
+		convertor = &BleRcuDevice1Adaptor::convertAudioStats;
+
+	// connect the result future to a dbus reply
+	connectFutureToDBusReply(request, result, convertor);
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	DBus get property call for com.sky.BleRcuDevice1.BatteryLevel
@@ -155,6 +155,17 @@ class BleRcuDevice1Adaptor : public DBusAbstractAdaptor
 	            "      <arg direction=\"in\" type=\"u\" name=\"encoding\"/>\n"
 	            "      <arg direction=\"out\" type=\"h\" name=\"stream\"/>\n"
 	            "    </method>\n"
+	            "    <method name=\"StartAudioStreamingWithLatency\">\n"
+	            "      <arg direction=\"in\" type=\"u\" name=\"encoding\"/>\n"
+	            "      <arg direction=\"in\" type=\"u\" name=\"latency_budget\"/>\n"
+	            "      <arg direction=\"out\" type=\"h\" name=\"stream\"/>\n"
+	            "    </method>\n"
+	            "    <method name=\"StartAudioStreamingSharedMemory\">\n"
+	            "      <arg direction=\"in\" type=\"u\" name=\"encoding\"/>\n"
+	            "      <arg direction=\"in\" type=\"u\" name=\"latency_budget\"/>\n"
+	            "      <arg direction=\"out\" type=\"h\" name=\"memory\"/>\n"
+	            "      <arg direction=\"out\" type=\"h\" name=\"event\"/>\n"
+	            "    </method>\n"
 	            "    <method name=\"StartAudioStreamingTo\">\n"
 	            "      <arg direction=\"in\" type=\"u\" name=\"encoding\"/>\n"
 	            "      <arg direction=\"in\" type=\"s\" name=\"file_path\"/>\n"
@@ -166,6 +177,9 @@ class BleRcuDevice1Adaptor : public DBusAbstractAdaptor
 	            "      <arg direction=\"out\" type=\"u\" name=\"packets_received\"/>\n"
 	            "      <arg direction=\"out\" type=\"u\" name=\"packets_expected\"/>\n"
 	            "    </method>\n"
+	            "    <method name=\"GetAudioStats\">\n"
+	            "      <arg direction=\"out\" type=\"a{sv}\" name=\"stats\"/>\n"
+	            "    </method>\n"
 	            "    <method name=\"SetTouchMode\">\n"
 	            "      <arg direction=\"in\" type=\"u\" name=\"flags\"/>\n"
 	            "    </method>\n"
@@ -249,11 +263,16 @@ public slots:
 	void FindMe(quint8 level, qint32 duration, const QDBusMessage &message);
 
 	void StartAudioStreaming(quint32 encoding, const QDBusMessage &message);
+	void StartAudioStreamingWithLatency(quint32 encoding, quint32 latencyBudget,
+	                                    const QDBusMessage &message);
+	void StartAudioStreamingSharedMemory(quint32 encoding, quint32 latencyBudget,
+	                                     const QDBusMessage &message);
 	void StartAudioStreamingTo(quint32 encoding, const QString &filePath,
 	                           const QDBusMessage &message);
 	void StopAudioStreaming(const QDBusMessage &message);
 
 	void GetAudioStatus(const QDBusMessage &message);
+	void GetAudioStats(const QDBusMessage &message);
 
 	void SetTouchMode(quint32 flags, const QDBusMessage &message);
 
@@ -304,7 +323,9 @@ private:
 	               const QString &errorMessage) const;
 
 	static QList<QVariant> convertStatusInfo(const BleRcuAudioService::StatusInfo &info);
+	static QList<QVariant> convertAudioStats(const BleRcuAudioService::StatusInfo &info);
 	static QList<QVariant> convertFileDescriptor(const FileDescriptor &fd);
+	static QList<QVariant> convertSharedMemoryStream(const BleRcuAudioService::SharedMemoryStream &stream);
 
 private:
 	const QSharedPointer<BleRcuDevice> m_device;
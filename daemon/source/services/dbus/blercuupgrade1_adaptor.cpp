@@ -26,7 +26,6 @@
 
 #include "blercu/blercudevice.h"
 #include "blercu/blercuerror.h"
-#include "blercu/bleservices/blercuupgradeservice.h"
 
 #include "utils/logging.h"
 #include "utils/filedescriptor.h"
@@ -112,6 +111,63 @@ void BleRcuUpgrade1Adaptor::CancelUpgrade(const QDBusMessage &request)
 	connectFutureToDBusReply(request, results);
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Convertor function to convert a \l{BleRcuUpgradeService::StatsInfo} type
+	to a single dictionary argument.
+ */
+QList<QVariant> BleRcuUpgrade1Adaptor::convertStatsInfo(const BleRcuUpgradeService::StatsInfo &info)
+{
+	QVariantMap stats;
+	stats[QStringLiteral("BlockSize")] = QVariant::fromValue<quint32>(info.blockSize);
+	stats[QStringLiteral("WindowSize")] = QVariant::fromValue<quint32>(info.windowSize);
+	stats[QStringLiteral("BytesAcked")] = QVariant::fromValue<quint32>(info.bytesAcked);
+	stats[QStringLiteral("ElapsedMsecs")] = QVariant::fromValue<quint32>(info.elapsedMsecs);
+	stats[QStringLiteral("Throughput")] = QVariant::fromValue<quint32>(info.throughput);
+	stats[QStringLiteral("PacketsSent")] = QVariant::fromValue<quint32>(info.packetsSent);
+	stats[QStringLiteral("Retransmits")] = QVariant::fromValue<quint32>(info.retransmits);
+	stats[QStringLiteral("Timeouts")] = QVariant::fromValue<quint32>(info.timeouts);
+	stats[QStringLiteral("MinRttMsecs")] = QVariant::fromValue<quint32>(info.minRttMsecs);
+	stats[QStringLiteral("AvgRttMsecs")] = QVariant::fromValue<quint32>(info.avgRttMsecs);
+	stats[QStringLiteral("MaxRttMsecs")] = QVariant::fromValue<quint32>(info.maxRttMsecs);
+	stats[QStringLiteral("BytesSent")] = QVariant::fromValue<quint32>(info.bytesSent);
+	stats[QStringLiteral("RetransmitBytes")] = QVariant::fromValue<quint32>(info.retransmitBytes);
+	stats[QStringLiteral("ResumedBytes")] = QVariant::fromValue<quint32>(info.resumedBytes);
+	stats[QStringLiteral("WastedBytes")] = QVariant::fromValue<quint32>(info.wastedBytes);
+	stats[QStringLiteral("Attempts")] = QVariant::fromValue<quint32>(info.attempts);
+
+	return { QVariant::fromValue(stats) };
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	DBus method call for com.sky.blercu.Upgrade1.GetUpgradeStats
+
+	Returns the transfer stats of the current upgrade, or the last one if an
+	upgrade isn't running.
+
+ */
+void BleRcuUpgrade1Adaptor::GetUpgradeStats(const QDBusMessage &request)
+{
+	// get the upgrade service, if doesn't exist then f/w upgrade is not
+	// supported on this device
+	const QSharedPointer<BleRcuUpgradeService> service = m_device->upgradeService();
+	if (!service) {
+		sendErrorReply(request, BleRcuError::errorString(BleRcuError::General),
+		               QStringLiteral("Upgrade not supported on this device"));
+		return;
+	}
+
+	const std::function<QList<QVariant> (const BleRcuUpgradeService::StatsInfo&)>
+		convertor = &BleRcuUpgrade1Adaptor::convertStatsInfo;
+
+	// connect the result future to a dbus reply
+	Future<BleRcuUpgradeService::StatsInfo> result = service->stats();
+	connectFutureToDBusReply(request, result, convertor);
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -26,6 +26,7 @@
 #define BLERCUUPGRADE1_ADAPTOR_H
 
 #include "dbus/dbusabstractadaptor.h"
+#include "blercu/bleservices/blercuupgradeservice.h"
 
 #include <QObject>
 #include <QtDBus>
@@ -44,6 +45,9 @@ class BleRcuUpgrade1Adaptor : public DBusAbstractAdaptor
 	            "    </method>\n"
 	            "    <method name=\"CancelUpgrade\">\n"
 	            "    </method>\n"
+	            "    <method name=\"GetUpgradeStats\">\n"
+	            "      <arg direction=\"out\" type=\"a{sv}\" name=\"stats\"/>\n"
+	            "    </method>\n"
 	            "    <signal name=\"UpgradeError\">\n"
 	            "      <arg type=\"s\" name=\"reason\"/>\n"
 	            "    </signal>\n"
@@ -70,6 +74,8 @@ public slots:
 
 	void CancelUpgrade(const QDBusMessage &message);
 
+	void GetUpgradeStats(const QDBusMessage &message);
+
 signals:
 	void UpgradeError(const QString &reason);
 
@@ -77,6 +83,9 @@ public:
 	bool upgrading() const;
 	qint32 progress() const;
 
+private:
+	static QList<QVariant> convertStatsInfo(const BleRcuUpgradeService::StatsInfo &info);
+
 private slots:
 	void onUpgradingChanged(bool upgrading);
 	void onProgressChanged(int progress);
@@ -69,7 +69,7 @@ QList<QVariant> BleRcuVoice1Adaptor::convertFileDescriptor(const FileDescriptor
 	\internal
 
 	Converter function to convert a \l{BleRcuAudioService::PacketStats} type to
-	a couple of \c quint32 values.
+	a list of \c quint32 values.
  */
 QList<QVariant> BleRcuVoice1Adaptor::convertStatusInfo(const BleRcuAudioService::StatusInfo &info)
 {
@@ -82,6 +82,26 @@ QList<QVariant> BleRcuVoice1Adaptor::convertStatusInfo(const BleRcuAudioService:
 	return packetStats;
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Converter function to convert the voice buffer counters in a
+	\l{BleRcuAudioService::StatusInfo} type to a single dictionary argument.
+ */
+QList<QVariant> BleRcuVoice1Adaptor::convertAudioStats(const BleRcuAudioService::StatusInfo &info)
+{
+	QVariantMap stats;
+	stats[QStringLiteral("BufferedBytes")] = QVariant::fromValue<quint32>(info.bufferedBytes);
+	stats[QStringLiteral("PeakBufferedBytes")] = QVariant::fromValue<quint32>(info.peakBufferedBytes);
+	stats[QStringLiteral("FramesDropped")] = QVariant::fromValue<quint32>(info.droppedFrames);
+	stats[QStringLiteral("FramesConcealed")] = QVariant::fromValue<quint32>(info.concealedFrames);
+	stats[QStringLiteral("Discontinuities")] = QVariant::fromValue<quint32>(info.discontinuities);
+	stats[QStringLiteral("PreRollFrames")] = QVariant::fromValue<quint32>(info.preRollFrames);
+
+	return { QVariant::fromValue(stats) };
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\internal
@@ -111,6 +131,31 @@ QSharedPointer<BleRcuDevice> BleRcuVoice1Adaptor::getDevice(const QString &bdadd
 void BleRcuVoice1Adaptor::StartAudioStreaming(const QString &bdaddr, uint encoding,
                                               const QDBusMessage &message)
 {
+	StartAudioStreamingWithLatency(bdaddr, encoding, 0, message);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	DBus method call for com.sky.blercu.Voice1.StartAudioStreamingWithLatency,
+	the same as StartAudioStreaming but with a latency budget.
+
+	The \a latencyBudget is the number of milliseconds the client is willing
+	to let the audio frames be held for so they can be written to the pipe in
+	batches, \c 0 means every frame is written as soon as it arrives.
+
+ */
+void BleRcuVoice1Adaptor::StartAudioStreamingWithLatency(const QString &bdaddr,
+                                                         uint encoding,
+                                                         uint latencyBudget,
+                                                         const QDBusMessage &message)
+{
+	// sanity check the latency budget
+	if (latencyBudget > 1000) {
+		sendErrorReply(message, BleRcuError::errorString(BleRcuError::InvalidArg),
+		               QStringLiteral("Invalid latency budget value"));
+		return;
+	}
+
 	// try and get the device with the given address, will fail if device not paired
 	QSharedPointer<BleRcuDevice> device = getDevice(bdaddr);
 	if (!device) {
@@ -136,7 +181,8 @@ void BleRcuVoice1Adaptor::StartAudioStreaming(const QString &bdaddr, uint encodi
 
 	// get the service and request to start streaming
 	const QSharedPointer<BleRcuAudioService> service = device->audioService();
-	Future<FileDescriptor> result = service->startStreaming(audioEncoding);
+	Future<FileDescriptor> result =
+		service->startStreaming(audioEncoding, static_cast<int>(latencyBudget));
 
 	// need a custom converter to convert from a FileDescriptor object to
 	// real fd we can send over dbus
@@ -177,4 +223,32 @@ void BleRcuVoice1Adaptor::GetAudioStatus(const QString &bdaddr,
 	connectFutureToDBusReply(message, result, converter);
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	DBus method call for com.sky.blercu.Voice1.GetAudioStats
+
+	Returns the output buffer counters of the current voice stream, or the
+	last one if not streaming.  These are kept out of GetAudioStatus so that
+	its reply signature stays the same for existing clients.
+
+ */
+void BleRcuVoice1Adaptor::GetAudioStats(const QString &bdaddr,
+                                        const QDBusMessage &message)
+{
+	// try and get the device with the given address, will fail if device not paired
+	QSharedPointer<BleRcuDevice> device = getDevice(bdaddr);
+	if (!device) {
+		sendErrorReply(message, BleRcuError::errorString(BleRcuError::General),
+		               QStringLiteral("Unknown device"));
+		return;
+	}
+
+	const QSharedPointer<BleRcuAudioService> service = device->audioService();
+	Future<BleRcuAudioService::StatusInfo> result = service->status();
+
+	const std::function<QList<QVariant> (const BleRcuAudioService::StatusInfo&)>
+		converter = &BleRcuVoice1Adaptor::convertAudioStats;
 
+	// connect the result future to a dbus reply
+	connectFutureToDBusReply(message, result, converter);
+}
@@ -50,12 +50,23 @@ Q_OBJECT
 	                                   "      <arg direction=\"in\" type=\"s\" name=\"bdaddr\"/>\n"
 	                                   "      <arg direction=\"in\" type=\"u\" name=\"encoding\"/>\n"
 	                                   "      <arg direction=\"out\" type=\"h\" name=\"stream\"/>\n"
+	                                   "    </method>\n"
+	                                   "    <method name=\"StartAudioStreamingWithLatency\">\n"
+	                                   "      <arg direction=\"in\" type=\"s\" name=\"bdaddr\"/>\n"
+	                                   "      <arg direction=\"in\" type=\"u\" name=\"encoding\"/>\n"
+	                                   "      <arg direction=\"in\" type=\"u\" name=\"latency_budget\"/>\n"
+	                                   "      <arg direction=\"out\" type=\"h\" name=\"stream\"/>\n"
+	                                   "    </method>\n"
 	                                   "    <method name=\"GetAudioStatus\">\n"
 	                                   "      <arg direction=\"in\" type=\"s\" name=\"bdaddr\"/>\n"
 	                                   "      <arg direction=\"out\" type=\"u\" name=\"error_status\"/>\n"
 	                                   "      <arg direction=\"out\" type=\"u\" name=\"packets_received\"/>\n"
 	                                   "      <arg direction=\"out\" type=\"u\" name=\"packets_expected\"/>\n"
 	                                   "    </method>\n"
+	                                   "    <method name=\"GetAudioStats\">\n"
+	                                   "      <arg direction=\"in\" type=\"s\" name=\"bdaddr\"/>\n"
+	                                   "      <arg direction=\"out\" type=\"a{sv}\" name=\"stats\"/>\n"
+	                                   "    </method>\n"
 	                                   "  </interface>\n"
 	                                   "")
 
@@ -66,12 +77,16 @@ public:
 
 public slots:
 	void StartAudioStreaming(const QString &bdaddr, uint encoding, const QDBusMessage &message);
+	void StartAudioStreamingWithLatency(const QString &bdaddr, uint encoding,
+	                                    uint latencyBudget, const QDBusMessage &message);
 	void GetAudioStatus(const QString &bdaddr, const QDBusMessage &message);
+	void GetAudioStats(const QString &bdaddr, const QDBusMessage &message);
 
 private:
 	QSharedPointer<BleRcuDevice> getDevice(const QString &bdaddr) const;
 
 	static QList<QVariant> convertStatusInfo(const BleRcuAudioService::StatusInfo &info);
+	static QList<QVariant> convertAudioStats(const BleRcuAudioService::StatusInfo &info);
 	static QList<QVariant> convertFileDescriptor(const FileDescriptor &fd);
 
 private:
@@ -26,6 +26,13 @@
 
 #include <QtEndian>
 
+#if defined(__ARM_FEATURE_SAT)
+#  include <arm_acle.h>
+#endif
+#if defined(__ARM_NEON) && (Q_BYTE_ORDER == Q_BIG_ENDIAN)
+#  include <arm_neon.h>
+#endif
+
 
 const int ADPCMCodec::m_indexTable[16] = {
 	-1, -1, -1, -1, 2, 4, 6, 8,
@@ -45,7 +52,27 @@ const int ADPCMCodec::m_stepSizeTable[89] = {
 };
 
 
-ADPCMCodec::ADPCMCodec()
+// -----------------------------------------------------------------------------
+/*!
+	\class ADPCMCodec
+	\brief IMA/DVI ADPCM to PCM16 decoder.
+
+	There are two decode engines; the \c ReferenceEngine is the original
+	sample-at-a-time implementation, the \c TableEngine uses a precomputed
+	89x16 table that maps every (step index, nibble) pair to the signed
+	difference and the next step index.  The latter removes all the data
+	dependent branches from the inner loop, which makes a measurable difference
+	on the low-end STB SoCs where voice is decoded on the main thread.
+
+	Both engines produce identical output, the engine is selected when the
+	codec is constructed, by default it's the value returned by
+	\l{defaultEngine()}.
+
+ */
+
+
+ADPCMCodec::ADPCMCodec(Engine engine)
+	: m_engine(engine)
 {
 	resetStream(0, 0);
 }
@@ -54,6 +81,130 @@ ADPCMCodec::~ADPCMCodec()
 {
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	Returns the engine that is used if one is not supplied to the constructor.
+
+	This is the \c TableEngine unless the \c BLERCU_ADPCM_ENGINE environment
+	variable is set to \c "reference", which is useful for comparing the
+	output and cost of the two decoders on a real box.
+
+ */
+ADPCMCodec::Engine ADPCMCodec::defaultEngine()
+{
+	static const Engine engine =
+		(qgetenv("BLERCU_ADPCM_ENGINE") == "reference") ? ReferenceEngine : TableEngine;
+
+	return engine;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the engine used by this codec to decode the samples.
+
+ */
+ADPCMCodec::Engine ADPCMCodec::engine() const
+{
+	return m_engine;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Clamps \a value to the signed 16-bit range without branching.  On ARM
+	cores with the DSP extensions this is a single SSAT instruction, elsewhere
+	the compiler turns the comparisons into conditional moves.
+
+ */
+static inline int saturate16(int value)
+{
+#if defined(__ARM_FEATURE_SAT)
+	return __ssat(value, 16);
+#else
+	value = (value < -32768) ? -32768 : value;
+	value = (value > 32767) ? 32767 : value;
+	return value;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Converts \a count native endian samples in \a pcmSamples to little endian
+	in place.  This is a no-op on little endian targets (x86, and every ARM STB
+	we ship on), on big endian ARM targets with NEON the swap is done 8 samples
+	at a time.
+
+ */
+static inline void toLittleEndian16(qint16 *pcmSamples, int count)
+{
+#if (Q_BYTE_ORDER == Q_LITTLE_ENDIAN)
+	Q_UNUSED(pcmSamples);
+	Q_UNUSED(count);
+#else
+	int i = 0;
+#  if defined(__ARM_NEON)
+	for (; (i + 8) <= count; i += 8) {
+		uint8_t *ptr = reinterpret_cast<uint8_t*>(pcmSamples + i);
+		vst1q_u8(ptr, vrev16q_u8(vld1q_u8(ptr)));
+	}
+#  endif
+	for (; i < count; i++)
+		pcmSamples[i] = qToLittleEndian<qint16>(pcmSamples[i]);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the precomputed decode table used by the table engine, the table is
+	built on first use.
+
+	Each entry is indexed by [stepIndex][nibble] and packs the signed
+	difference to apply to the previous value in the upper 24 bits, and the
+	(already clamped) next step index in the lower 8 bits.  Packing them into a
+	single 32-bit word keeps the whole table at ~5.6KB, so it sits comfortably
+	in the L1 cache of even the smallest cores.
+
+ */
+const qint32 (*ADPCMCodec::decodeTable())[16]
+{
+	struct DecodeTable {
+		qint32 entries[89][16];
+
+		DecodeTable()
+		{
+			for (int index = 0; index < 89; index++) {
+
+				const int step = m_stepSizeTable[index];
+
+				for (int nibble = 0; nibble < 16; nibble++) {
+
+					int diff = (step >> 3);
+					if (nibble & 0x1)
+						diff += (step >> 2);
+					if (nibble & 0x2)
+						diff += (step >> 1);
+					if (nibble & 0x4)
+						diff += (step >> 0);
+					if (nibble & 0x8)
+						diff = -diff;
+
+					const int nextIndex = qBound<int>(0, index + m_indexTable[nibble], 88);
+
+					entries[index][nibble] = (diff * 256) | nextIndex;
+				}
+			}
+		}
+	};
+
+	static const DecodeTable table;
+	return table.entries;
+}
+
 #if 0
 // -----------------------------------------------------------------------------
 /*!
@@ -132,12 +283,15 @@ void ADPCMCodec::decodeFrameAndUpdate(int &stepIndex, qint16 &prevValue,
 		if (sample & 0x4)
 			diff += (step >> 0);
 
+		// nb: do the maths as int so the clamp below actually catches the
+		// overflow, rather than the value wrapping when stored as a qint16
+		int value = prevValue;
 		if (sample & 0x8)
-			prevValue -= diff;
+			value -= diff;
 		else
-			prevValue += diff;
+			value += diff;
 
-		prevValue = qBound<int>(-32768, prevValue, 32767);
+		prevValue = qBound<int>(-32768, value, 32767);
 
 		// write the output value if space in the buffer
 		*pcmSamples++ = qToLittleEndian<qint16>(prevValue);
@@ -145,6 +299,64 @@ void ADPCMCodec::decodeFrameAndUpdate(int &stepIndex, qint16 &prevValue,
 
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Table driven version of \l{decodeFrameAndUpdate()}, the output is bit
+	exact with the reference version.
+
+	The loop processes a whole byte (two samples, upper nibble first) per
+	iteration, each sample is just a table load, an add, a saturate and a
+	mask; there are no data dependent branches.  The samples are decoded in
+	native byte order and converted to little endian at the end in one pass.
+
+ */
+void ADPCMCodec::decodeFrameAndUpdateTable(int &stepIndex, qint16 &prevValue,
+                                           const quint8 *samples, int numSamples,
+                                           qint16 *pcmSamples) const
+{
+	// sanity checks
+	if (Q_UNLIKELY(!samples || !pcmSamples || (numSamples <= 0)))
+		return;
+
+	const qint32 (*table)[16] = decodeTable();
+
+	int index = qBound<int>(0, stepIndex, 88);
+	int value = prevValue;
+
+	qint16 *output = pcmSamples;
+
+	const int numBytes = (numSamples / 2);
+	for (int i = 0; i < numBytes; i++) {
+
+		const quint8 byte = samples[i];
+
+		qint32 entry = table[index][(byte >> 4)];
+		value = saturate16(value + (entry >> 8));
+		index = (entry & 0xff);
+		*output++ = static_cast<qint16>(value);
+
+		entry = table[index][(byte & 0xf)];
+		value = saturate16(value + (entry >> 8));
+		index = (entry & 0xff);
+		*output++ = static_cast<qint16>(value);
+	}
+
+	// odd number of samples means the last byte only has its upper nibble used
+	if (Q_UNLIKELY(numSamples & 0x1)) {
+		const qint32 entry = table[index][(samples[numBytes] >> 4)];
+		value = saturate16(value + (entry >> 8));
+		index = (entry & 0xff);
+		*output++ = static_cast<qint16>(value);
+	}
+
+	toLittleEndian16(pcmSamples, numSamples);
+
+	stepIndex = index;
+	prevValue = static_cast<qint16>(value);
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	Decodes the ADPCM stored in \a samples with length \a numSamples to the
@@ -162,7 +374,10 @@ void ADPCMCodec::decodeFrame(int stepIndex, qint16 prevValue,
                              const quint8 *samples, int numSamples,
                              qint16 *pcmSamples) const
 {
-	decodeFrameAndUpdate(stepIndex, prevValue, samples, numSamples, pcmSamples);
+	if (m_engine == TableEngine)
+		decodeFrameAndUpdateTable(stepIndex, prevValue, samples, numSamples, pcmSamples);
+	else
+		decodeFrameAndUpdate(stepIndex, prevValue, samples, numSamples, pcmSamples);
 }
 
 // -----------------------------------------------------------------------------
@@ -194,7 +409,11 @@ void ADPCMCodec::resetStream(int stepIndex, qint16 prevValue)
 void ADPCMCodec::decodeStream(const quint8 *samples, int numSamples,
                               qint16 *pcmSamples)
 {
-	decodeFrameAndUpdate(m_streamStepIndex, m_streamPrevValue,
-	                     samples, numSamples, pcmSamples);
+	if (m_engine == TableEngine)
+		decodeFrameAndUpdateTable(m_streamStepIndex, m_streamPrevValue,
+		                          samples, numSamples, pcmSamples);
+	else
+		decodeFrameAndUpdate(m_streamStepIndex, m_streamPrevValue,
+		                     samples, numSamples, pcmSamples);
 }
 
@@ -31,9 +31,20 @@
 class ADPCMCodec : public VoiceCodec
 {
 public:
-	ADPCMCodec();
+	enum Engine {
+		ReferenceEngine,
+		TableEngine
+	};
+
+public:
+	explicit ADPCMCodec(Engine engine = defaultEngine());
 	~ADPCMCodec();
 
+public:
+	static Engine defaultEngine();
+
+	Engine engine() const;
+
 public:
 	void decodeFrame(int stepIndex, qint16 prevValue,
 	                 const quint8 *samples, int numSamples,
@@ -47,11 +58,18 @@ private:
 	void decodeFrameAndUpdate(int &stepIndex, qint16 &prevValue,
 	                          const quint8 *samples, int numSamples,
 	                          qint16 *pcmSamples) const;
+	void decodeFrameAndUpdateTable(int &stepIndex, qint16 &prevValue,
+	                               const quint8 *samples, int numSamples,
+	                               qint16 *pcmSamples) const;
+
+	static const qint32 (*decodeTable())[16];
 
 private:
 	static const int m_indexTable[16];
 	static const int m_stepSizeTable[89];
 
+	const Engine m_engine;
+
 	int m_streamStepIndex;
 	qint16 m_streamPrevValue;
 };
@@ -25,6 +25,24 @@
 //
 
 #include "crc32.h"
+#include "logging.h"
+
+#include <QtEndian>
+#include <QFileDevice>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#  include <immintrin.h>
+#  define CRC32_HAVE_PCLMUL
+#elif defined(__aarch64__) && defined(__GNUC__) && !defined(__clang__)
+#  include <sys/auxv.h>
+#  include <asm/hwcap.h>
+#  define CRC32_HAVE_ARMV8_CRC
+#endif
 
 
 /*-
@@ -117,14 +135,371 @@ static const uint32_t g_crcTable[] = {
 
 
 
+/// The amount of a file to map at once when hashing a file
+#define CRC32_MAP_WINDOW_SIZE         (1024 * 1024)
+
+/// The size of the reads when hashing something that can't be mapped
+#define CRC32_READ_CHUNK_SIZE         (16 * 1024)
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	The classic byte at a time update, used for short runs of data and the
+	unaligned head / tail of the other engines.  The \a crc and the returned
+	value are the inverted running crc.
+
+ */
+static quint32 updateByteTable(quint32 crc, const quint8 *data, size_t length)
+{
+	while (length-- > 0)
+		crc = g_crcTable[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the 8 lookup tables used by the slicing-by-8 algorithm, the first
+	table is the standard table above, each subsequent table is the crc of
+	the previous entry shifted in by another zero byte.
+
+	The tables are built on first use, the C++11 static init rules make that
+	thread safe.
+
+ */
+static const quint32 (*sliceBy8Tables())[256]
+{
+	struct Tables {
+		quint32 table[8][256];
+
+		Tables()
+		{
+			for (int i = 0; i < 256; i++)
+				table[0][i] = g_crcTable[i];
+
+			for (int k = 1; k < 8; k++) {
+				for (int i = 0; i < 256; i++) {
+					const quint32 prev = table[k - 1][i];
+					table[k][i] = (prev >> 8) ^ g_crcTable[prev & 0xff];
+				}
+			}
+		}
+	};
+
+	static const Tables tables;
+	return tables.table;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Slicing-by-8 update, processes 8 bytes per iteration using 8 table
+	lookups that are independent of each other, so unlike the byte at a time
+	version the loads can all be in flight at once.  The 8KB of tables fits
+	comfortably in the L1 cache of the boxes we run on.
+
+ */
+static quint32 updateSliceBy8(quint32 crc, const quint8 *data, size_t length)
+{
+	const quint32 (*table)[256] = sliceBy8Tables();
+
+	// align to 8 bytes
+	while ((length > 0) && (reinterpret_cast<quintptr>(data) & 0x7)) {
+		crc = table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+		length--;
+	}
+
+	while (length >= 8) {
+		const quint32 one = qFromLittleEndian<quint32>(data) ^ crc;
+		const quint32 two = qFromLittleEndian<quint32>(data + 4);
+
+		crc = table[7][(one >>  0) & 0xff] ^
+		      table[6][(one >>  8) & 0xff] ^
+		      table[5][(one >> 16) & 0xff] ^
+		      table[4][(one >> 24) & 0xff] ^
+		      table[3][(two >>  0) & 0xff] ^
+		      table[2][(two >>  8) & 0xff] ^
+		      table[1][(two >> 16) & 0xff] ^
+		      table[0][(two >> 24) & 0xff];
+
+		data += 8;
+		length -= 8;
+	}
+
+	return updateByteTable(crc, data, length);
+}
+
+#if defined(CRC32_HAVE_PCLMUL)
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Carry-less multiply version for x86 CPUs with PCLMULQDQ, this uses the
+	folding method described in the Intel paper "Fast CRC Computation for
+	Generic Polynomials Using PCLMULQDQ Instruction".  Four 128-bit lanes are
+	folded in parallel over 64 byte blocks, then folded down into a single
+	lane, then Barrett reduced to the 32-bit crc.
+
+	\a length must be at least 64 and a multiple of 16.
+
+ */
+__attribute__((target("pclmul,sse4.1")))
+static quint32 foldPclmul(quint32 crc, const quint8 *data, size_t length)
+{
+	// the bit-reflected fold constants and the crc32 / Barrett polynomials
+	alignas(16) static const quint64 k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+	alignas(16) static const quint64 k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+	alignas(16) static const quint64 k5k0[] = { 0x0163cd6124, 0x0000000000 };
+	alignas(16) static const quint64 poly[] = { 0x01db710641, 0x01f7011641 };
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x00));
+	x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x10));
+	x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x20));
+	x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+
+	data += 64;
+	length -= 64;
+
+	// fold 64 bytes at a time in four parallel lanes
+	while (length >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x00));
+		y6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x10));
+		y7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x20));
+		y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		data += 64;
+		length -= 64;
+	}
+
+	// fold the four lanes into one
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// fold in any remaining 16 byte blocks
+	while (length >= 16) {
+		x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		data += 16;
+		length -= 16;
+	}
+
+	// fold 128 bits down to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduce to 32 bits
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return static_cast<quint32>(_mm_extract_epi32(x1, 1));
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Hardware update for x86, the bulk of the data goes through the
+	PCLMULQDQ fold and anything left over through slicing-by-8.
+
+ */
+static quint32 updateHardware(quint32 crc, const quint8 *data, size_t length)
+{
+	if (length >= 64) {
+		const size_t bulk = length & ~size_t(0xf);
+		crc = foldPclmul(crc, data, bulk);
+
+		data += bulk;
+		length -= bulk;
+	}
+
+	return updateSliceBy8(crc, data, length);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns \c true if the CPU supports the instructions used by
+	updateHardware().
+
+ */
+static bool hardwareSupported()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+#elif defined(CRC32_HAVE_ARMV8_CRC)
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Hardware update for ARMv8 CPUs with the optional CRC32 instructions, these
+	use the same (IEEE 802.3) polynomial so can be applied directly 8 bytes at
+	a time.
+
+ */
+__attribute__((target("+crc")))
+static quint32 updateHardware(quint32 crc, const quint8 *data, size_t length)
+{
+	// align to 8 bytes
+	while ((length > 0) && (reinterpret_cast<quintptr>(data) & 0x7)) {
+		crc = __builtin_aarch64_crc32b(crc, *data++);
+		length--;
+	}
+
+	while (length >= 8) {
+		crc = __builtin_aarch64_crc32x(crc, *reinterpret_cast<const quint64*>(data));
+		data += 8;
+		length -= 8;
+	}
+
+	while (length-- > 0)
+		crc = __builtin_aarch64_crc32b(crc, *data++);
+
+	return crc;
+}
+
 // -----------------------------------------------------------------------------
 /*!
-	Constructs an object that can be used to create a CRC32 hash from data.
+	\internal
+
+	Returns \c true if the CPU supports the instructions used by
+	updateHardware().
 
  */
-Crc32::Crc32(quint32 initialValue)
-	: m_crc(initialValue)
+static bool hardwareSupported()
 {
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32);
+}
+
+#endif
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the update function for the given \a engine, or \c nullptr if the
+	engine isn't supported on this CPU.  For Crc32::Auto the fastest supported
+	engine is returned.
+
+ */
+static quint32 (*updateFunction(Crc32::Engine engine))(quint32, const quint8*, size_t)
+{
+	switch (engine) {
+		case Crc32::ByteTable:
+			return updateByteTable;
+		case Crc32::SliceBy8:
+			return updateSliceBy8;
+		case Crc32::Hardware:
+#if defined(CRC32_HAVE_PCLMUL) || defined(CRC32_HAVE_ARMV8_CRC)
+			{
+				static const bool supported = hardwareSupported();
+				if (supported)
+					return updateHardware;
+			}
+#endif
+			return nullptr;
+		case Crc32::Auto:
+			if (quint32 (*hardware)(quint32, const quint8*, size_t) = updateFunction(Crc32::Hardware))
+				return hardware;
+			return updateSliceBy8;
+	}
+
+	return nullptr;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class Crc32
+	\brief Calculates the standard (IEEE 802.3) CRC32 of some data.
+
+	There are a few engines that can be used to do the calculation, all of
+	them produce identical results.  By default the fastest engine supported
+	on the CPU is picked at runtime; that is the carry-less multiply version
+	on x86 CPUs with PCLMULQDQ, the CRC32 instructions on ARMv8 CPUs that have
+	them, otherwise the portable slicing-by-8 version.  The old byte at a time
+	version is still available, mostly for benchmarking.
+
+ */
+
+// -----------------------------------------------------------------------------
+/*!
+	Constructs an object that can be used to create a CRC32 hash from data
+	using the given \a engine.  If \a engine isn't supported on this CPU
+	then the fastest supported engine is used instead.
+
+ */
+Crc32::Crc32(quint32 initialValue, Engine engine)
+	: m_engine(engine)
+	, m_update(updateFunction(engine))
+	, m_crc(initialValue)
+{
+	if (Q_UNLIKELY(!m_update)) {
+		qWarning("crc32 engine %d not supported, using the default", int(engine));
+		m_engine = Auto;
+		m_update = updateFunction(Auto);
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -136,6 +511,39 @@ Crc32::~Crc32()
 {
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	Returns \c true if the given \a engine can be used on this CPU.
+
+ */
+bool Crc32::isSupported(Engine engine)
+{
+	return (updateFunction(engine) != nullptr);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the engine used to calculate the crc, this is the engine passed to
+	the constructor unless it wasn't supported.
+
+ */
+Crc32::Engine Crc32::engine() const
+{
+	return m_engine;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Adds \a length bytes to the running crc.
+
+ */
+void Crc32::addBlock(const quint8 *data, size_t length)
+{
+	m_crc = m_update(m_crc ^ ~0U, data, length) ^ ~0U;
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	Adds the first \a length chars of \a data to the CRC32 hash.
@@ -146,14 +554,7 @@ void Crc32::addData(const quint8 *data, int length)
 	if (Q_UNLIKELY(length <= 0))
 		return;
 
-	const quint8 *p = data;
-
-	m_crc = m_crc ^ ~0U;
-
-	while (length-- > 0)
-		m_crc = g_crcTable[(m_crc ^ *p++) & 0xFF] ^ (m_crc >> 8);
-
-	m_crc = m_crc ^ ~0U;
+	addBlock(data, size_t(length));
 }
 
 // -----------------------------------------------------------------------------
@@ -171,6 +572,9 @@ void Crc32::addData(const QByteArray &data)
 	Reads the data from the open QIODevice \a device until it ends and hashes it.
 	Returns true if reading was successful.
 
+	If the device is a file it is mapped into memory and hashed a window at a
+	time rather than being read.
+
  */
 bool Crc32::addData(QIODevice *device)
 {
@@ -180,15 +584,102 @@ bool Crc32::addData(QIODevice *device)
 	if (!device->isOpen())
 		return false;
 
-	quint8 buffer[1024];
+	// try and map files rather than read them
+	QFileDevice *file = qobject_cast<QFileDevice*>(device);
+	if (file && !file->isSequential()) {
+
+		qint64 offset = file->pos();
+		const qint64 size = file->size();
+
+		while (offset < size) {
+			const qint64 length = qMin<qint64>(size - offset, CRC32_MAP_WINDOW_SIZE);
+
+			const uchar *window = file->map(offset, length);
+			if (!window)
+				break;
+
+			addBlock(window, size_t(length));
+			file->unmap(const_cast<uchar*>(window));
+
+			offset += length;
+		}
+
+		if (offset >= size)
+			return file->seek(size);
+
+		// mapping failed so fall back to reading the rest
+		if (!file->seek(offset))
+			return false;
+	}
+
+	quint8 buffer[CRC32_READ_CHUNK_SIZE];
 	qint64 length;
 
 	while ((length = device->read((char*)buffer, sizeof(buffer))) > 0)
-		addData(buffer, int(length));
+		addBlock(buffer, size_t(length));
 
 	return device->atEnd();
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	Hashes the contents of the file referenced by \a fd from the start of the
+	file to the end.  Regular files are mapped into memory a window at a time
+	and hashed as they're mapped, anything else is read until EOF from the
+	current position.  Returns \c false on failure.
+
+	The file position of \a fd is not changed for regular files.
+
+ */
+bool Crc32::addFile(int fd)
+{
+	struct stat stat;
+	if (fstat(fd, &stat) != 0) {
+		qErrnoWarning(errno, "failed to stat file to hash");
+		return false;
+	}
+
+	if (S_ISREG(stat.st_mode)) {
+
+		off_t offset = 0;
+		while (offset < stat.st_size) {
+			const size_t length =
+				size_t(qMin<off_t>(stat.st_size - offset, CRC32_MAP_WINDOW_SIZE));
+
+			void *window = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, offset);
+			if (window == MAP_FAILED) {
+				qErrnoWarning(errno, "failed to mmap file to hash");
+				return false;
+			}
+
+			if (madvise(window, length, MADV_SEQUENTIAL) != 0)
+				qErrnoWarning(errno, "madvise failed on file to hash");
+
+			addBlock(static_cast<const quint8*>(window), length);
+
+			if (munmap(window, length) != 0)
+				qErrnoWarning(errno, "failed to unmap file to hash");
+
+			offset += length;
+		}
+
+		return true;
+	}
+
+	quint8 buffer[CRC32_READ_CHUNK_SIZE];
+	while (true) {
+		const ssize_t rd = TEMP_FAILURE_RETRY(::read(fd, buffer, sizeof(buffer)));
+		if (rd < 0) {
+			qErrnoWarning(errno, "failed to read file to hash");
+			return false;
+		}
+		if (rd == 0)
+			return true;
+
+		addBlock(buffer, size_t(rd));
+	}
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	Resets the object.
@@ -33,19 +33,39 @@
 class Crc32
 {
 public:
-	Crc32(quint32 initialValue = 0x00000000);
+	enum Engine {
+		Auto,
+		ByteTable,
+		SliceBy8,
+		Hardware
+	};
+
+public:
+	Crc32(quint32 initialValue = 0x00000000, Engine engine = Auto);
 	~Crc32();
 
 public:
 	void addData(const quint8 *data, int length);
 	void addData(const QByteArray &data);
 	bool addData(QIODevice *device);
+	bool addFile(int fd);
 
 	void reset();
 
 	quint32 result() const;
 
+	Engine engine() const;
+
+	static bool isSupported(Engine engine);
+
 private:
+	void addBlock(const quint8 *data, size_t length);
+
+private:
+	typedef quint32 (*UpdateFunction)(quint32, const quint8*, size_t);
+
+	Engine m_engine;
+	UpdateFunction m_update;
 	quint32 m_crc;
 };
 
@@ -23,29 +23,42 @@
 //
 
 #include "fwimagefile.h"
+#include "fwupgradeprotocol.h"
 
 #include "logging.h"
 #include "crc32.h"
 
 #include <QtEndian>
-#include <QBuffer>
-#include <QFile>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 
+// older C libraries don't have the sealing definitions
+#if !defined(F_GET_SEALS)
+#  define F_GET_SEALS           (1024 + 10)
+#  define F_SEAL_SHRINK         0x0002
+#endif
+
 
 // -----------------------------------------------------------------------------
 /*!
 	\class FwImageFile
-	\brief Wraps a QIODevice object that contains a f/w image file.
+	\brief Wraps the contents of a f/w image file.
 
 	Basic utility object to abstract away some of the details of a f/w image
 	file and to perform the integrity checks on said files.
 
+	Files are read in one go rather than through a QIODevice, and the image is
+	pre-sliced into a table of DATA packets with the headers already filled
+	in.  This means sending a block during an upgrade is just a lookup
+	into the table with packet(), no seeking or reading is needed.  The table
+	is built in the same pass over the image as the crc32 check.
+
  */
 
 
@@ -58,152 +71,203 @@ struct Q_PACKED FwFileHeader {
 	quint32 fwImageCrc32;
 };
 
-/// The maximum number of data bytes in a DATA packet
-#define FIRMWARE_PACKET_MTU           18
-
 
 // -----------------------------------------------------------------------------
 /*!
-	Constructs a FwImageFile object by wrapping the supplied \a data.
+	Constructs a FwImageFile object by wrapping the supplied \a data.  The
+	data is already in memory so it isn't copied, instead an implicitly
+	shared reference is kept.
 
 	Use isValid() to determine if the data is a valid f/w image file.
  */
 FwImageFile::FwImageFile(const QByteArray &data)
-	: m_valid(false)
+	: m_buffer(data)
+	, m_map(MAP_FAILED)
+	, m_mapSize(0)
+	, m_image(nullptr)
+	, m_pos(0)
+	, m_blockSize(0)
+	, m_packetCount(0)
+	, m_valid(false)
 {
-	// create and copy the data into the buffer
-	QBuffer *buffer = new QBuffer();
-	buffer->setData(data);
-	buffer->open(QIODevice::ReadOnly);
-
-	// store the buffer object
-	m_file.reset(buffer);
-
 	// check the file header / contents
-	m_valid = checkFile();
+	m_valid = checkFile(reinterpret_cast<const quint8*>(m_buffer.constData()),
+	                    m_buffer.size());
 	if (!m_valid)
-		m_file.reset();
+		m_buffer.clear();
 }
 
 // -----------------------------------------------------------------------------
 /*!
-	Constructs a FwImageFile object by attempting to open the file at the given
-	path.  Use isValid() to determine if the file could be opened and is a
-	valid f/w image file.
+	Constructs a FwImageFile object by attempting to open and read the file at
+	the given path.  Use isValid() to determine if the file could be opened and
+	is a valid f/w image file.
 
 
  */
 FwImageFile::FwImageFile(const QString &filePath)
-	: m_valid(false)
+	: m_map(MAP_FAILED)
+	, m_mapSize(0)
+	, m_image(nullptr)
+	, m_pos(0)
+	, m_blockSize(0)
+	, m_packetCount(0)
+	, m_valid(false)
 {
-	QFile *file = new QFile(filePath);
-
 	// try and open the file
-	if (!file->open(QFile::ReadOnly)) {
-		qWarning("failed to open fw file @ '%s'", qPrintable(filePath));
-		m_error = file->errorString();
-		delete file;
+	int fd = ::open(qPrintable(filePath), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		qErrnoWarning(errno, "failed to open fw file @ '%s'", qPrintable(filePath));
+		m_error = QString::fromLocal8Bit(strerror(errno));
 		return;
 	}
 
-	// store the file object
-	m_file.reset(file);
+	// read or map the file, neither holds on to the fd so it can be closed
+	// straight away
+	m_valid = loadFile(fd);
 
-	// sanity check the file is not a pipe or something we can't seek on
-	if (m_file->isSequential()) {
-		m_error = QStringLiteral("Invalid f/w file");
-		m_file.reset();
-		return;
-	}
-
-	// check the file header / contents
-	m_valid = checkFile();
-	if (!m_valid)
-		m_file.reset();
+	if (::close(fd) != 0)
+		qErrnoWarning(errno, "failed to close fd");
 }
 
 // -----------------------------------------------------------------------------
 /*!
-	Constructs a FwImageFile object wrapping the file descriptor, internally the
-	file descriptor is dup'd so it should be closed by the caller after the
-	object is created.
+	Constructs a FwImageFile object wrapping the file descriptor, the contents
+	are read or mapped when the object is created so the file descriptor
+	should be closed by the caller afterwards.
 
 	To check whether the file is valid use isValid().
 
  */
 FwImageFile::FwImageFile(int fd)
-	: m_valid(false)
+	: m_map(MAP_FAILED)
+	, m_mapSize(0)
+	, m_image(nullptr)
+	, m_pos(0)
+	, m_blockSize(0)
+	, m_packetCount(0)
+	, m_valid(false)
 {
-	// check the file descriptor by duping it
-	int fd_ = fcntl(fd, F_DUPFD_CLOEXEC, 3);
-	if (fd_ < 0) {
-		qErrnoWarning(errno, "failed to dup supplied fd");
-		m_error = QStringLiteral("Failed to access f/w file");
-		return;
-	}
+	m_valid = loadFile(fd);
+}
 
+FwImageFile::~FwImageFile()
+{
+	if ((m_map != MAP_FAILED) && (munmap(m_map, m_mapSize) != 0))
+		qErrnoWarning(errno, "failed to unmap f/w file");
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Loads the contents of the file referenced by \a fd and checks them with
+	checkFile().  The fd must correspond to a regular file, not a fifo or
+	something else we can't read.
+
+	The fd usually comes from a dbus client, which could truncate the file
+	while we're using it; if it was mapped that would raise a SIGBUS on the
+	next access to the lost pages.  So the file is only mapped if it's sealed
+	against shrinking (i.e. a sealed memfd), otherwise it's read into a
+	buffer.  The image is at most a few hundred KB and is copied into the
+	packet table anyway, so the extra copy is cheap.
+
+ */
+bool FwImageFile::loadFile(int fd)
+{
 	// check the fd corresponds to a real file, not a fifo or something else
 	struct stat stat;
-	if ((fstat(fd_, &stat) != 0) || !S_ISREG(stat.st_mode)) {
+	if ((fstat(fd, &stat) != 0) || !S_ISREG(stat.st_mode)) {
 		qWarning("supplied fd doesn't correspond to a regular file");
 		m_error = QStringLiteral("Invalid f/w file");
+		return false;
+	}
 
-		if (::close(fd_) != 0)
-			qErrnoWarning(errno, "failed to close fd");
+	// an empty file, or one only big enough for the header, would fail the
+	// checks anyway
+	if (stat.st_size <= qint64(sizeof(FwFileHeader))) {
+		m_error = QStringLiteral("Firmware file is empty");
+		return false;
+	}
 
-		return;
+	// and don't bother loading something that's obviously not a f/w image
+	if (stat.st_size > (qint64(sizeof(FwFileHeader)) +
+	                    ((FIRMWARE_MAX_BLOCK_ID - 1) * FIRMWARE_PACKET_MTU))) {
+		m_error = QStringLiteral("Firmware file is too large");
+		return false;
 	}
 
-	QFile *file = new QFile;
+	const size_t fileSize = size_t(stat.st_size);
 
-	// wrap the file descriptor in a QFile, the QFile will take ownership of
-	// the file descriptor
-	if (!file->open(fd_, QFile::ReadOnly, QFile::AutoCloseHandle)) {
-		qWarning("failed to open f/w file due to %s",
-		         qPrintable(file->errorString()));
-		delete file;
+	// only map the file if it can't be shrunk underneath us
+	const int seals = fcntl(fd, F_GET_SEALS);
+	if ((seals >= 0) && (seals & F_SEAL_SHRINK)) {
 
-		m_error = QStringLiteral("Failed to open f/w file");
+		void *map = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			qErrnoWarning(errno, "failed to mmap f/w file");
+			m_error = QStringLiteral("Failed to access f/w file");
+			return false;
+		}
 
-		if (::close(fd_) != 0)
-			qErrnoWarning(errno, "failed to close fd");
+		// the file is read once from start to end to check the crc
+		if (madvise(map, fileSize, MADV_SEQUENTIAL) != 0)
+			qErrnoWarning(errno, "madvise failed on f/w file");
 
-		return;
+		m_map = map;
+		m_mapSize = fileSize;
+
+		return checkFile(static_cast<const quint8*>(m_map), m_mapSize);
 	}
 
-	// take ownership of the file
-	m_file.reset(file);
+	// otherwise read the whole file, if it's been truncated since the fstat
+	// then it's treated as invalid
+	m_buffer.resize(int(fileSize));
+
+	size_t offset = 0;
+	while (offset < fileSize) {
+		const ssize_t rd = TEMP_FAILURE_RETRY(::pread(fd, m_buffer.data() + offset,
+		                                              fileSize - offset, off_t(offset)));
+		if (rd <= 0) {
+			if (rd < 0)
+				qErrnoWarning(errno, "failed to read f/w file");
+			else
+				qWarning("f/w file was truncated while reading");
+
+			m_error = QStringLiteral("Failed to access f/w file");
+			m_buffer.clear();
+			return false;
+		}
+
+		offset += size_t(rd);
+	}
 
-	// check the file header / contents
-	m_valid = checkFile();
-	if (!m_valid)
-		m_file.reset();
-}
+	if (!checkFile(reinterpret_cast<const quint8*>(m_buffer.constData()),
+	               m_buffer.size())) {
+		m_buffer.clear();
+		return false;
+	}
 
-FwImageFile::~FwImageFile()
-{
+	return true;
 }
 
 // -----------------------------------------------------------------------------
 /*!
 	\internal
 
-	Checks the open file has the correct header and the crc32 checksum matches.
+	Checks the file contents in \a data has the correct header and the crc32
+	checksum matches.  At the same time builds the packet table for the
+	default block size.
 
  */
-bool FwImageFile::checkFile()
+bool FwImageFile::checkFile(const quint8 *data, qint64 fileSize)
 {
-	if (Q_UNLIKELY(!m_file->isReadable())) {
-		m_error = QStringLiteral("Failed to read f/w file");
-		return false;
-	}
-
-
-	// get the size of the file, we may potential have a problem if the size
-	// of the file would mean that the block ids would wrap, for now we
-	// ignore that
-	const qint64 fileSize = m_file->size();
-	if (fileSize > (0x3fff * FIRMWARE_PACKET_MTU)) {
+	// check the size of the file, the block ids would wrap if the file is
+	// too large for the default block size; there is always a trailing short
+	// (possibly empty) packet so the image must fit in one less than the max
+	// number of blocks
+	if (fileSize > qint64(sizeof(FwFileHeader) +
+	                      ((FIRMWARE_MAX_BLOCK_ID - 1) * FIRMWARE_PACKET_MTU))) {
 		m_error = QStringLiteral("Firmware file is too large");
 		return false;
 	}
@@ -215,12 +279,7 @@ bool FwImageFile::checkFile()
 
 	// read the file header and verify the crc matches
 	FwFileHeader header;
-	qint64 read = m_file->read(reinterpret_cast<char*>(&header),
-	                           sizeof(FwFileHeader));
-	if (read != qint64(sizeof(FwFileHeader))) {
-		m_error = QStringLiteral("Firmware file header error");
-		return false;
-	}
+	memcpy(&header, data, sizeof(FwFileHeader));
 
 	// convert from little endian just in case we ever run on a big endain
 	m_hardwareVersion = qFromLittleEndian(header.hwIdent);
@@ -234,18 +293,145 @@ bool FwImageFile::checkFile()
 		return false;
 	}
 
-	// calculate the crc over the rest of the file after the header
-	Crc32 fileCrc;
-	fileCrc.addData(m_file.data());
+	m_image = data + sizeof(FwFileHeader);
+	m_pos = 0;
+
+	// calculate the crc over the rest of the file after the header while
+	// building the packet table
+	const int packetCount = (m_firmwareSize / FIRMWARE_PACKET_MTU) + 1;
 
-	if (m_firmwareCrc != fileCrc.result()) {
+	quint32 fileCrc = 0;
+	fillPacketTable(FIRMWARE_PACKET_MTU, packetCount, &fileCrc);
+
+	if (m_firmwareCrc != fileCrc) {
 		m_error = QStringLiteral("Firmware file header crc error");
+		m_image = nullptr;
+		m_packetTable.clear();
+		return false;
+	}
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Fills the packet table with \a packetCount DATA packets each holding up
+	to \a blockSize bytes of the image.  The packets are stored back to back,
+	block \c n starts at offset <tt>(n - 1) * (blockSize + 2)</tt>.  The last
+	packet is short, possibly just a header, which marks the end of the
+	transfer.
+
+	If \a crc is not \c nullptr the crc32 of the image is calculated while
+	copying and stored in it.
+
+ */
+void FwImageFile::fillPacketTable(int blockSize, int packetCount, quint32 *crc)
+{
+	const int stride = FIRMWARE_PACKET_HDR_SIZE + blockSize;
+	const int tableSize = (packetCount * FIRMWARE_PACKET_HDR_SIZE) + m_firmwareSize;
+
+	m_packetTable.resize(tableSize);
+	quint8 *table = reinterpret_cast<quint8*>(m_packetTable.data());
+
+	Crc32 imageCrc;
+
+	qint64 offset = 0;
+	for (int blockId = 1; blockId <= packetCount; blockId++) {
+
+		quint8 *packet = table + (qint64(blockId - 1) * stride);
+		const int length = static_cast<int>(qMin<qint64>(blockSize,
+		                                                 m_firmwareSize - offset));
+
+		packet[0] = OPCODE_DATA | quint8((blockId >> 8) & 0x3f);
+		packet[1] = quint8(blockId & 0xff);
+		memcpy(packet + FIRMWARE_PACKET_HDR_SIZE, m_image + offset, length);
+
+		if (crc)
+			imageCrc.addData(m_image + offset, length);
+
+		offset += length;
+	}
+
+	m_blockSize = blockSize;
+	m_packetCount = packetCount;
+
+	if (crc)
+		*crc = imageCrc.result();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Rebuilds the packet table so each DATA packet holds \a blockSize bytes of
+	the image.  Returns \c false if the image is invalid or is too large to be
+	sent with the given block size without the block ids wrapping, in which
+	case the existing table is left untouched.
+
+	The packet table for the default 18 byte block size is built when the
+	file is opened.
+
+ */
+bool FwImageFile::buildPacketTable(int blockSize)
+{
+	if (Q_UNLIKELY(!m_valid || (blockSize <= 0)))
+		return false;
+
+	if (blockSize == m_blockSize)
+		return true;
+
+	const int packetCount = (m_firmwareSize / blockSize) + 1;
+	if (packetCount > FIRMWARE_MAX_BLOCK_ID) {
+		qWarning("f/w image too large to send in %d byte blocks", blockSize);
 		return false;
 	}
 
+	fillPacketTable(blockSize, packetCount, nullptr);
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the number of data bytes in each packet in the current packet
+	table.
+
+ */
+int FwImageFile::blockSize() const
+{
+	return m_blockSize;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the number of packets in the current packet table, this includes
+	the final short (or empty) packet that marks the end of the transfer.
+
+ */
+int FwImageFile::packetCount() const
+{
+	return m_packetCount;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the complete DATA packet, including the header, for block
+	\a blockId.  Block ids start at 1.
+
+	The returned array references the packet table directly rather than
+	copying it, so it is only valid while this object exists and the table is
+	not rebuilt.  Returns an empty array if \a blockId is out of range.
 
-	// now need to rewind the file to the point right after the header
-	return m_file->seek(sizeof(FwFileHeader));
+ */
+QByteArray FwImageFile::packet(int blockId) const
+{
+	if (Q_UNLIKELY((blockId < 1) || (blockId > m_packetCount)))
+		return QByteArray();
+
+	const int stride = FIRMWARE_PACKET_HDR_SIZE + m_blockSize;
+	const int offset = (blockId - 1) * stride;
+	const int length = qMin(stride, m_packetTable.size() - offset);
+
+	return QByteArray::fromRawData(m_packetTable.constData() + offset, length);
 }
 
 // -----------------------------------------------------------------------------
@@ -341,7 +527,7 @@ qint64 FwImageFile::pos() const
 	if (Q_UNLIKELY(!m_valid))
 		return -1;
 
-	return m_file->pos() - sizeof(FwFileHeader);
+	return m_pos;
 }
 
 // -----------------------------------------------------------------------------
@@ -355,7 +541,7 @@ bool FwImageFile::atEnd() const
 	if (Q_UNLIKELY(!m_valid))
 		return true;
 
-	return m_file->atEnd();
+	return (m_pos >= m_firmwareSize);
 }
 
 // -----------------------------------------------------------------------------
@@ -369,10 +555,11 @@ bool FwImageFile::seek(qint64 pos)
 {
 	if (Q_UNLIKELY(!m_valid))
 		return false;
-	if (Q_UNLIKELY(pos < 0))
+	if (Q_UNLIKELY((pos < 0) || (pos > m_firmwareSize)))
 		return false;
 
-	return m_file->seek(sizeof(FwFileHeader) + pos);
+	m_pos = pos;
+	return true;
 }
 
 // -----------------------------------------------------------------------------
@@ -399,6 +586,13 @@ qint64 FwImageFile::read(void *data, qint64 len)
 	if (Q_UNLIKELY(!m_valid))
 		return -1;
 
-	return m_file->read(reinterpret_cast<char*>(data), len);
+	if (Q_UNLIKELY(len < 0))
+		return -1;
+
+	const qint64 rd = qMin<qint64>(len, m_firmwareSize - m_pos);
+	memcpy(data, m_image + m_pos, size_t(rd));
+	m_pos += rd;
+
+	return rd;
 }
 
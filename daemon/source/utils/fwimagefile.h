@@ -26,8 +26,7 @@
 #define FWIMAGEFILE_H
 
 #include <QString>
-#include <QScopedPointer>
-#include <QIODevice>
+#include <QByteArray>
 #include <QVersionNumber>
 
 
@@ -59,13 +58,33 @@ public:
 
 	qint64 read(void *data, qint64 len);
 
+public:
+	bool buildPacketTable(int blockSize);
+
+	int blockSize() const;
+	int packetCount() const;
+	QByteArray packet(int blockId) const;
+
 private:
-	bool checkFile();
+	bool loadFile(int fd);
+	bool checkFile(const quint8 *data, qint64 fileSize);
+
+	void fillPacketTable(int blockSize, int packetCount, quint32 *crc);
 
 private:
-	QScopedPointer<QIODevice> m_file;
 	QString m_error;
 
+	QByteArray m_buffer;
+	void *m_map;
+	size_t m_mapSize;
+
+	const quint8 *m_image;
+	qint64 m_pos;
+
+	int m_blockSize;
+	int m_packetCount;
+	QByteArray m_packetTable;
+
 	bool m_valid;
 	quint32 m_hardwareVersion = 0;
 	quint32 m_firmwareVersion = 0;
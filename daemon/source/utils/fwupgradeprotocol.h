@@ -0,0 +1,50 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  fwupgradeprotocol.h
+//  SkyBluetoothRcu
+//
+
+#ifndef FWUPGRADEPROTOCOL_H
+#define FWUPGRADEPROTOCOL_H
+
+#include <QtGlobal>
+
+
+/// Possible packet opcodes, stored in the top 2 bits of the first byte
+#define OPCODE_WRQ                    quint8(0x0 << 6)
+#define OPCODE_DATA                   quint8(0x1 << 6)
+#define OPCODE_ACK                    quint8(0x2 << 6)
+#define OPCODE_ERROR                  quint8(0x3 << 6)
+
+#define OPCODE_MASK                   quint8(0x3 << 6)
+
+/// The number of data bytes in a DATA packet supported by all RCUs
+#define FIRMWARE_PACKET_MTU           18
+
+/// The size of the DATA packet header
+#define FIRMWARE_PACKET_HDR_SIZE      2
+
+/// The maximum block id that can be put in a DATA packet, block ids are
+/// 14 bits and start at 1
+#define FIRMWARE_MAX_BLOCK_ID         0x3fff
+
+
+#endif // !defined(FWUPGRADEPROTOCOL_H)
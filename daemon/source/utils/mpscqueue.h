@@ -0,0 +1,206 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  mpscqueue.h
+//  SkyBluetoothRcu
+//
+
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <QtGlobal>
+#include <QAtomicInteger>
+#include <QScopedArrayPointer>
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class MpscQueue
+	\brief Bounded lock-free queue for many producer threads and a single
+	consumer thread.
+
+	Each cell in the ring has a sequence number that says whether it's free
+	for the producer at that position or holds a value for the consumer.
+	Producers claim a position with a single compare-and-swap, write the
+	value and then publish it by bumping the cell's sequence number, so
+	values from any one producer are dequeued in the order they were
+	enqueued.  Nothing is allocated after construction.
+
+	A producer that has claimed a position but not yet published it blocks
+	the consumer at that position, tryDequeue() returns \c false as if the
+	queue were empty.  Callers should arrange for the producer to wake the
+	consumer after publishing, and can use isEmpty() to tell a stalled queue
+	from an empty one.
+
+ */
+template <typename T>
+class MpscQueue
+{
+public:
+	explicit MpscQueue(int capacity);
+	~MpscQueue() = default;
+
+public:
+	int capacity() const;
+
+	bool tryEnqueue(const T &value);
+	bool tryDequeue(T *value);
+
+	bool isEmpty() const;
+
+private:
+	static quint32 roundUpPowerOf2(int value);
+
+private:
+	struct Cell {
+		QAtomicInteger<quint32> sequence;
+		T value;
+	};
+
+	const quint32 m_mask;
+	const QScopedArrayPointer<Cell> m_cells;
+
+	// keep the producer and consumer positions on separate cache lines
+	char m_padding0[64];
+	QAtomicInteger<quint32> m_enqueuePos;
+	char m_padding1[64];
+	quint32 m_dequeuePos;
+
+private:
+	Q_DISABLE_COPY(MpscQueue)
+};
+
+
+// -----------------------------------------------------------------------------
+/*!
+	Constructs a queue that can hold \a capacity values, rounded up to the
+	next power of 2.
+
+ */
+template <typename T>
+MpscQueue<T>::MpscQueue(int capacity)
+	: m_mask(roundUpPowerOf2(capacity) - 1)
+	, m_cells(new Cell[m_mask + 1])
+	, m_enqueuePos(0)
+	, m_dequeuePos(0)
+{
+	for (quint32 i = 0; i <= m_mask; i++)
+		m_cells[i].sequence.store(i);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the smallest power of 2 that is at least \a value, the minimum
+	is 2.
+
+ */
+template <typename T>
+quint32 MpscQueue<T>::roundUpPowerOf2(int value)
+{
+	quint32 size = 2;
+	while (size < quint32(value))
+		size <<= 1;
+
+	return size;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the number of values the queue can hold.
+
+ */
+template <typename T>
+int MpscQueue<T>::capacity() const
+{
+	return int(m_mask + 1);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Adds \a value to the tail of the queue, returns \c false if the queue is
+	full.
+
+	\threadsafe
+ */
+template <typename T>
+bool MpscQueue<T>::tryEnqueue(const T &value)
+{
+	quint32 pos = m_enqueuePos.load();
+
+	while (true) {
+		Cell &cell = m_cells[pos & m_mask];
+		const qint32 diff = qint32(cell.sequence.loadAcquire() - pos);
+
+		if (diff == 0) {
+			// the cell is free, try and claim the position
+			if (m_enqueuePos.testAndSetRelaxed(pos, pos + 1)) {
+				cell.value = value;
+				cell.sequence.storeRelease(pos + 1);
+				return true;
+			}
+
+		} else if (diff < 0) {
+			// the consumer hasn't taken the value from the last time round
+			// the ring, so full
+			return false;
+		}
+
+		// another producer got the position first
+		pos = m_enqueuePos.load();
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Takes the value at the head of the queue and stores it in \a value,
+	returns \c false if there is nothing to take.  Must only be called from
+	the consumer thread.
+
+ */
+template <typename T>
+bool MpscQueue<T>::tryDequeue(T *value)
+{
+	Cell &cell = m_cells[m_dequeuePos & m_mask];
+	if (cell.sequence.loadAcquire() != (m_dequeuePos + 1))
+		return false;
+
+	*value = cell.value;
+	cell.sequence.storeRelease(m_dequeuePos + m_mask + 1);
+	m_dequeuePos++;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns \c true if there are no positions claimed by producers that the
+	consumer hasn't taken yet.  Must only be called from the consumer thread.
+
+ */
+template <typename T>
+bool MpscQueue<T>::isEmpty() const
+{
+	return (m_enqueuePos.loadAcquire() == m_dequeuePos);
+}
+
+
+#endif // !defined(MPSCQUEUE_H)
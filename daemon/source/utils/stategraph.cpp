@@ -0,0 +1,579 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  stategraph.cpp
+//  SkyBluetoothRcu
+//
+
+#include "stategraph.h"
+
+#include <QDebug>
+
+#include <strings.h>
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class StateGraph
+	\brief The states and transitions of a StateMachine.
+
+	A graph can either be built a state and transition at a time, which is
+	what StateMachine does when states are added to it directly, or created
+	from static tables of StateGraph::StateDef and StateGraph::TransitionDef
+	entries.  The latter is intended for objects that have many instances
+	with the same graph, the graph is created once and shared between all
+	the state machines, which then only hold their current state and event
+	queues.  The tables can be checked at compile time with isValid().
+
+	Once frozen a graph is immutable and is safe to share between threads.
+
+ */
+
+
+StateGraph::StateGraph()
+	: m_initialState(-1)
+	, m_finalState(-1)
+	, m_frozen(false)
+	, m_ancestorWords(0)
+	, m_eventBase(QEvent::User)
+	, m_eventColumnCount(1)
+	, m_signalColumnCount(0)
+{
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Creates and freezes a new graph from the \a stateCount entries in
+	\a states and the \a transitionCount entries in \a transitions, with the
+	given \a initialState and \a finalState.  States must be listed after
+	their parent state.
+
+	Returns a null pointer if the definition is invalid, the reason is
+	logged.
+
+	\see StateGraph::isValid()
+ */
+QSharedPointer<const StateGraph> StateGraph::create(const StateDef *states, int stateCount,
+                                                    const TransitionDef *transitions, int transitionCount,
+                                                    int initialState, int finalState)
+{
+	QSharedPointer<StateGraph> graph = QSharedPointer<StateGraph>::create();
+
+	for (int i = 0; i < stateCount; i++) {
+		if (!graph->addState(states[i].parentState, states[i].state,
+		                     QString::fromLatin1(states[i].name)))
+			return QSharedPointer<const StateGraph>();
+	}
+
+	// set the initial states of the super states before adding any
+	// transitions, as the transitions check the target has one
+	for (int i = 0; i < stateCount; i++) {
+		if ((states[i].initialState != -1) &&
+		    !graph->setInitialState(states[i].state, states[i].initialState))
+			return QSharedPointer<const StateGraph>();
+	}
+
+	for (int i = 0; i < transitionCount; i++) {
+		if (!graph->addTransition(transitions[i].fromState,
+		                          transitions[i].eventType,
+		                          transitions[i].toState))
+			return QSharedPointer<const StateGraph>();
+	}
+
+	if (!graph->setInitialState(initialState))
+		return QSharedPointer<const StateGraph>();
+	if ((finalState != -1) && !graph->setFinalState(finalState))
+		return QSharedPointer<const StateGraph>();
+
+	if (!graph->freeze())
+		return QSharedPointer<const StateGraph>();
+
+	return graph;
+}
+
+bool StateGraph::addState(int parentState, int state, const QString &name)
+{
+	// check the state is a positive integer
+	if (Q_UNLIKELY(state < 0)) {
+		qWarning("state's must be positive integers");
+		return false;
+	}
+
+	// check we don't already have this state
+	if (Q_UNLIKELY(m_states.contains(state))) {
+		qWarning("already have state %s(%d), not adding again",
+		         qPrintable(m_states[state].name), state);
+		return false;
+	}
+
+	// if a parent was supplied then increment it's child count
+	if (parentState != -1) {
+		QMap<int, State>::iterator parent = m_states.find(parentState);
+
+		// if a parent was supplied make sure we have that parent state
+		if (Q_UNLIKELY(parent == m_states.end())) {
+			qWarning("try to add state %s(%d) with missing parent state %d",
+			         qPrintable(name), state, parentState);
+			return false;
+		}
+
+		// increment the number of child states
+		parent->hasChildren = true;
+	}
+
+	// add the state
+	State stateStruct;
+
+	stateStruct.parentState = parentState;
+	stateStruct.initialState = -1;
+	stateStruct.hasChildren = false;
+	stateStruct.isFinal = false;
+	stateStruct.name = name;
+
+	m_states.insert(state, std::move(stateStruct));
+	m_frozen = false;
+
+	return true;
+}
+
+bool StateGraph::addTransition(int fromState, QEvent::Type eventType, int toState)
+{
+	// sanity check the event type
+	if (Q_UNLIKELY(eventType == QEvent::None)) {
+		qWarning("eventType is invalid (%d)", int(eventType));
+		return false;
+	}
+
+	// sanity check we have a 'from' state
+	QMap<int, State>::iterator from = m_states.find(fromState);
+	if (Q_UNLIKELY(from == m_states.end())) {
+		qWarning("missing 'fromState' %d", fromState);
+		return false;
+	}
+
+	// and we have a 'to' state
+	QMap<int, State>::const_iterator to = m_states.find(toState);
+	if (Q_UNLIKELY(to == m_states.end())) {
+		qWarning("missing 'toState' %d", toState);
+		return false;
+	}
+
+	// also check if the to state is a super state that it has in initial
+	// state set
+	if (Q_UNLIKELY((to->hasChildren == true) && (to->initialState == -1))) {
+		qWarning("'toState' %s(%d) is a super state with no initial state set",
+		         qPrintable(to->name), toState);
+		return false;
+	}
+
+	// add the transition
+	Transition transition;
+	bzero(&transition, sizeof(transition));
+
+	transition.targetState = toState;
+	transition.type = Transition::EventTransition;
+	transition.eventType = eventType;
+
+	from->transitions.append(std::move(transition));
+	m_frozen = false;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called from StateMachine::addTransition(), it adds a \c Transition
+	structure with the given \a signalId to the given \a fromState.  The
+	signal ids are allocated by the state machine that connected the signal.
+
+ */
+bool StateGraph::addSignalTransition(int fromState, qint64 signalId, int toState)
+{
+	// sanity check we have a 'from' state
+	QMap<int, State>::iterator from = m_states.find(fromState);
+	if (Q_UNLIKELY(from == m_states.end())) {
+		qWarning("missing 'fromState' %d", fromState);
+		return false;
+	}
+
+	// and we have a 'to' state
+	QMap<int, State>::const_iterator to = m_states.find(toState);
+	if (Q_UNLIKELY(to == m_states.end())) {
+		qWarning("missing 'toState' %d", toState);
+		return false;
+	}
+
+	// also check if the to state is a super state that it has in initial
+	// state set
+	if (Q_UNLIKELY(to->hasChildren && (to->initialState == -1))) {
+		qWarning("'toState' %s(%d) is a super state with no initial state set",
+		         qPrintable(to->name), toState);
+		return false;
+	}
+
+	// add the transition
+	Transition transition;
+	transition.targetState = toState;
+	transition.type = Transition::SignalTransition;
+	transition.signalId = signalId;
+
+	from->transitions.append(std::move(transition));
+	m_frozen = false;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Sets the initial \a state of the state machine, this must be called before
+	starting the state machine.
+
+ */
+bool StateGraph::setInitialState(int state)
+{
+	// sanity check we know about the state
+	if (Q_UNLIKELY(!m_states.contains(state))) {
+		qWarning("can't set initial state to %d as don't have that state", state);
+		return false;
+	}
+
+	m_initialState = state;
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Sets the initial \a initialState of the super state \a parentState. This is
+	used when a transition has the super state as a target.
+
+	It is not necessary to define an initial state of the a super state, for
+	example if a super state is never a target for a transition there is no
+	need to call this method.
+
+ */
+bool StateGraph::setInitialState(int parentState, int initialState)
+{
+	// get the parent state
+	QMap<int, State>::iterator parent = m_states.find(parentState);
+	if (Q_UNLIKELY(parent == m_states.end())) {
+		qWarning("can't find parent state %d", parentState);
+		return false;
+	}
+
+	// sanity check we know about the given initial state
+	QMap<int, State>::const_iterator initial = m_states.find(initialState);
+	if (Q_UNLIKELY(initial == m_states.end())) {
+		qWarning("can't set initial state to %d as don't have that state",
+		         initialState);
+		return false;
+	}
+
+	// sanity check the given initial state has the same parent
+	if (Q_UNLIKELY(initial->parentState != parentState)) {
+		qWarning("can't set initial state to %d as parent state doesn't match",
+		         initialState);
+		return false;
+	}
+
+	// check if we already an initial state, this is not fatal but raise a warning
+	if (Q_UNLIKELY(parent->initialState != -1)) {
+		qWarning("replacing existing initial state %d to %d",
+		         parent->initialState, initialState);
+	}
+
+	parent->initialState = initialState;
+	m_frozen = false;
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Sets the final \a state of the state machine, this can't be a super state.
+	When the state machine reaches this state it is automatically stopped and
+	a finished() signal is emitted.
+
+	It is not necessary to define an final state if the state machine never
+	finishes.
+
+	\sa setFinalState(int, int)
+ */
+bool StateGraph::setFinalState(int state)
+{
+	// sanity check we know about the state
+	if (Q_UNLIKELY(!m_states.contains(state))) {
+		qWarning("can't set final state to %d as don't have that state", state);
+		return false;
+	}
+
+	m_finalState = state;
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Sets the final \a finalState of the super state \a parentState. This is used
+	when a transition has the super state as a source and an event of
+	type StateGraph::FinishedEvent.
+
+	It is not necessary to define an final state of the a super state, for
+	example if a super state is never a source for a transition with a
+	StateGraph::FinishedEvent event then there is no need to call this method.
+
+	\sa setFinalState(int)
+ */
+bool StateGraph::setFinalState(int parentState, int finalState)
+{
+	// get the parent state
+	QMap<int, State>::const_iterator parent = m_states.find(parentState);
+	if (Q_UNLIKELY(parent == m_states.end())) {
+		qWarning("can't find parent state %d", parentState);
+		return false;
+	}
+
+	// sanity check we know about the given final state
+	QMap<int, State>::iterator final = m_states.find(finalState);
+	if (Q_UNLIKELY(final == m_states.end())) {
+		qWarning("can't set final state to %d as don't have that state",
+		         finalState);
+		return false;
+	}
+
+	// sanity check the given initial state has the same parent
+	if (Q_UNLIKELY(final->parentState != parentState)) {
+		qWarning("can't set final state to %d as parent state doesn't match",
+		         finalState);
+		return false;
+	}
+
+	final->isFinal = true;
+	m_frozen = false;
+	return true;
+}
+
+
+// -----------------------------------------------------------------------------
+/*!
+	Flattens the states and transitions added into the tables used while a
+	state machine is running.  The graph must not be changed while any state
+	machine is using it, adding states or transitions after this marks the
+	graph as not frozen and it needs to be frozen again.
+
+	The tables are indexed by the state value, so each state gets a row in
+	the event transition table with a column for every event used by the
+	graph and a row in the signal transition table with a column per signal
+	transition.  Each cell holds the target state with the transitions of
+	any parent states already folded in, so finding the state to move to is a
+	single lookup.  In addition each state gets a bitset of itself and all its
+	parent states and the list of those states from the top down, which are
+	used for StateMachine::inState() and to work out the states entered and
+	exited.
+
+ */
+bool StateGraph::freeze()
+{
+	const int stateCount = m_states.isEmpty() ? 0 : (m_states.lastKey() + 1);
+	if (Q_UNLIKELY(stateCount > MaxStates)) {
+		qWarning("state values must be less than %d", MaxStates);
+		return false;
+	}
+
+	// find the range of user events used by all the transitions
+	int minEvent = QEvent::MaxUser;
+	int maxEvent = QEvent::User - 1;
+
+	for (const State &stateStruct : m_states) {
+		for (const Transition &transition : stateStruct.transitions) {
+			if ((transition.type == Transition::EventTransition) &&
+			    (transition.eventType != FinishedEvent)) {
+				minEvent = qMin<int>(minEvent, transition.eventType);
+				maxEvent = qMax<int>(maxEvent, transition.eventType);
+			}
+		}
+	}
+
+	// map the user events onto columns, column 0 is the finished event
+	m_eventBase = minEvent;
+	m_eventColumns.fill(-1, qMax(0, (maxEvent - minEvent) + 1));
+	m_eventColumnCount = 1;
+
+	for (const State &stateStruct : m_states) {
+		for (const Transition &transition : stateStruct.transitions) {
+			if ((transition.type == Transition::EventTransition) &&
+			    (transition.eventType != FinishedEvent)) {
+				int &column = m_eventColumns[transition.eventType - m_eventBase];
+				if (column < 0)
+					column = m_eventColumnCount++;
+			}
+		}
+	}
+
+	// signal ids are handed out sequentially from 1 by the state machine so
+	// just need a column for each up to the highest
+	qint64 maxSignalId = 0;
+
+	for (const State &stateStruct : m_states) {
+		for (const Transition &transition : stateStruct.transitions) {
+			if (transition.type == Transition::SignalTransition)
+				maxSignalId = qMax(maxSignalId, transition.signalId);
+		}
+	}
+
+	m_signalColumnCount = int(maxSignalId);
+
+	// reset the tables
+	m_stateTable.fill({ -1, -1, 0, 0, false, false, false }, stateCount);
+	m_statePaths.clear();
+	m_statePaths.reserve(stateCount * 2);
+
+	m_ancestorWords = (stateCount + 63) / 64;
+	m_ancestorBits.fill(0, stateCount * m_ancestorWords);
+
+	m_eventTransitions.fill(-1, stateCount * m_eventColumnCount);
+	m_signalTransitions.fill(-1, stateCount * m_signalColumnCount);
+
+
+	QMap<int, State>::const_iterator it = m_states.begin();
+	for (; it != m_states.end(); ++it) {
+
+		const int state = it.key();
+		StateEntry &entry = m_stateTable[state];
+
+		entry.parentState = it->parentState;
+		entry.initialState = it->initialState;
+		entry.isValid = true;
+		entry.hasChildren = it->hasChildren;
+		entry.isFinal = it->isFinal;
+
+		int *eventRow = m_eventTransitions.data() + (state * m_eventColumnCount);
+		int *signalRow = m_signalTransitions.data() + (state * m_signalColumnCount);
+		quint64 *bits = m_ancestorBits.data() + (state * m_ancestorWords);
+
+		// walk up from the state through it's parents, transitions in a child
+		// state take precedence over the same transition in a parent, and for
+		// a given state the first transition added wins
+		int depth = 0;
+		int state_ = state;
+		do {
+
+			const State &stateStruct = m_states[state_];
+			for (const Transition &transition : stateStruct.transitions) {
+
+				if (transition.type == Transition::EventTransition) {
+					const int column = eventColumn(transition.eventType);
+					if (eventRow[column] < 0)
+						eventRow[column] = transition.targetState;
+
+				} else {
+					const int column = int(transition.signalId - 1);
+					if ((column >= 0) && (column < m_signalColumnCount) &&
+					    (signalRow[column] < 0))
+						signalRow[column] = transition.targetState;
+				}
+
+				// this can happen if children were added to the target state
+				// after the transition was added
+				const State &target = m_states[transition.targetState];
+				if (Q_UNLIKELY(target.hasChildren && (target.initialState == -1))) {
+					qWarning("transition to super state %s(%d) with no initial state set",
+					         qPrintable(target.name), transition.targetState);
+				}
+			}
+
+			bits[state_ >> 6] |= (Q_UINT64_C(1) << (state_ & 63));
+			depth++;
+
+			state_ = stateStruct.parentState;
+
+		} while (state_ != -1);
+
+		// store the list of states from the top down
+		entry.pathOffset = m_statePaths.size();
+		entry.depth = depth;
+
+		m_statePaths.resize(entry.pathOffset + depth);
+
+		state_ = state;
+		for (int i = depth - 1; i >= 0; i--) {
+			m_statePaths[entry.pathOffset + i] = state_;
+			state_ = m_states[state_].parentState;
+		}
+	}
+
+	m_frozen = true;
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns \c true if the graph has been frozen and not changed since.
+
+ */
+bool StateGraph::isFrozen() const
+{
+	return m_frozen;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the initial state of the graph, or \c -1 if not set.
+
+ */
+int StateGraph::initialState() const
+{
+	return m_initialState;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the final state of the graph, or \c -1 if not set.
+
+ */
+int StateGraph::finalState() const
+{
+	return m_finalState;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns \c true if the graph has the given \a state.
+
+ */
+bool StateGraph::contains(int state) const
+{
+	return m_states.contains(state);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the name of the \a state, or an empty string if the graph doesn't
+	have the state.
+
+ */
+QString StateGraph::stateName(int state) const
+{
+	QMap<int, State>::const_iterator it = m_states.find(state);
+	if (it == m_states.end())
+		return QString();
+
+	return it->name;
+}
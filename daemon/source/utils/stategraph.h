@@ -0,0 +1,313 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  stategraph.h
+//  SkyBluetoothRcu
+//
+
+#ifndef STATEGRAPH_H
+#define STATEGRAPH_H
+
+#include <QEvent>
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QMap>
+#include <QSharedPointer>
+
+#include <cstddef>
+
+
+class StateGraph
+{
+public:
+	struct StateDef {
+		int parentState;
+		int state;
+		const char *name;
+		int initialState = -1;
+	};
+
+	struct TransitionDef {
+		int fromState;
+		QEvent::Type eventType;
+		int toState;
+	};
+
+	struct StateEntry {
+		int parentState;
+		int initialState;
+		int pathOffset;
+		int depth;
+		bool isValid;
+		bool hasChildren;
+		bool isFinal;
+	};
+
+public:
+	static const QEvent::Type FinishedEvent = QEvent::StateMachineWrapped;
+
+	// the tables are indexed by state so the states need to be reasonably
+	// dense, in practice they're all small enum values
+	static const int MaxStates = 4096;
+
+public:
+	StateGraph();
+	~StateGraph() = default;
+
+public:
+	template <std::size_t S, std::size_t T>
+	static constexpr bool isValid(const StateDef (&states)[S],
+	                              const TransitionDef (&transitions)[T],
+	                              int initialState, int finalState = -1);
+
+	template <std::size_t S, std::size_t T>
+	static inline QSharedPointer<const StateGraph> create(const StateDef (&states)[S],
+	                                                      const TransitionDef (&transitions)[T],
+	                                                      int initialState, int finalState = -1)
+	{
+		return create(states, int(S), transitions, int(T), initialState, finalState);
+	}
+
+	static QSharedPointer<const StateGraph> create(const StateDef *states, int stateCount,
+	                                               const TransitionDef *transitions, int transitionCount,
+	                                               int initialState, int finalState);
+
+public:
+	bool addState(int parentState, int state, const QString &name);
+	bool addTransition(int fromState, QEvent::Type eventType, int toState);
+	bool addSignalTransition(int fromState, qint64 signalId, int toState);
+
+	bool setInitialState(int state);
+	bool setInitialState(int parentState, int state);
+
+	bool setFinalState(int state);
+	bool setFinalState(int parentState, int state);
+
+	bool freeze();
+	bool isFrozen() const;
+
+public:
+	int initialState() const;
+	int finalState() const;
+
+	bool contains(int state) const;
+	QString stateName(int state) const;
+
+	inline int stateCount() const
+	{
+		return m_stateTable.size();
+	}
+
+	inline const StateEntry &stateEntry(int state) const
+	{
+		return m_stateTable.at(state);
+	}
+
+	inline const int *statePath(int state) const
+	{
+		return m_statePaths.constData() + m_stateTable.at(state).pathOffset;
+	}
+
+	inline int eventTarget(int state, QEvent::Type eventType) const
+	{
+		const int column = eventColumn(eventType);
+		if (column < 0)
+			return -1;
+
+		return m_eventTransitions.at((state * m_eventColumnCount) + column);
+	}
+
+	inline int signalTarget(int state, qint64 signalId) const
+	{
+		const qint64 column = signalId - 1;
+		if ((column < 0) || (column >= m_signalColumnCount))
+			return -1;
+
+		return m_signalTransitions.at((state * m_signalColumnCount) + int(column));
+	}
+
+	inline bool isWithinState(int state, int superState) const
+	{
+		const quint64 *bits = m_ancestorBits.constData() + (state * m_ancestorWords);
+		return (bits[superState >> 6] >> (superState & 63)) & 0x1;
+	}
+
+private:
+	inline int eventColumn(QEvent::Type eventType) const
+	{
+		if (eventType == FinishedEvent)
+			return 0;
+
+		const uint offset = uint(eventType) - uint(m_eventBase);
+		if (offset >= uint(m_eventColumns.size()))
+			return -1;
+
+		return m_eventColumns.at(int(offset));
+	}
+
+	static constexpr int findState(const StateDef *states, std::size_t count, int state);
+	static constexpr bool hasChildren(const StateDef *states, std::size_t count, int state);
+
+private:
+	struct Transition {
+		int targetState;
+		enum { EventTransition, SignalTransition } type;
+		union {
+			QEvent::Type eventType;
+			qint64 signalId;
+		};
+	};
+
+	struct State {
+		int parentState;
+		int initialState;
+		bool hasChildren;
+		bool isFinal;
+		QString name;
+		QList<Transition> transitions;
+	};
+
+	QMap<int, State> m_states;
+
+	int m_initialState;
+	int m_finalState;
+
+	bool m_frozen;
+
+private:
+	QVector<StateEntry> m_stateTable;
+	QVector<int> m_statePaths;
+
+	int m_ancestorWords;
+	QVector<quint64> m_ancestorBits;
+
+	int m_eventBase;
+	QVector<int> m_eventColumns;
+	int m_eventColumnCount;
+	QVector<int> m_eventTransitions;
+
+	int m_signalColumnCount;
+	QVector<int> m_signalTransitions;
+
+private:
+	Q_DISABLE_COPY(StateGraph)
+};
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the index of \a state in the first \a count entries of \a states,
+	or \c -1 if not found.
+
+ */
+constexpr int StateGraph::findState(const StateDef *states, std::size_t count, int state)
+{
+	for (std::size_t i = 0; i < count; i++) {
+		if (states[i].state == state)
+			return int(i);
+	}
+
+	return -1;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns \c true if any of the \a count entries in \a states has \a state
+	as its parent.
+
+ */
+constexpr bool StateGraph::hasChildren(const StateDef *states, std::size_t count, int state)
+{
+	for (std::size_t i = 0; i < count; i++) {
+		if (states[i].parentState == state)
+			return true;
+	}
+
+	return false;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Checks that the graph defined by \a states and \a transitions with the
+	given \a initialState and \a finalState is valid, this is intended to be
+	used in a \c static_assert so mistakes in a static graph are caught at
+	compile time rather than when the graph is created.
+
+	The checks are the same as done when building a graph a state at a time;
+	states must be unique and within range, a parent state must be defined
+	before its children, the initial state of a super state must be one of
+	its children and the states used in the transitions must exist.  In
+	addition any super state that is the target of a transition must have
+	an initial state.
+
+ */
+template <std::size_t S, std::size_t T>
+constexpr bool StateGraph::isValid(const StateDef (&states)[S],
+                                   const TransitionDef (&transitions)[T],
+                                   int initialState, int finalState)
+{
+	for (std::size_t i = 0; i < S; i++) {
+		const StateDef &def = states[i];
+
+		if ((def.state < 0) || (def.state >= MaxStates) || (def.name == nullptr))
+			return false;
+		if (findState(states, i, def.state) >= 0)
+			return false;
+		if ((def.parentState != -1) && (findState(states, i, def.parentState) < 0))
+			return false;
+
+		if (def.initialState != -1) {
+			const int initial = findState(states, S, def.initialState);
+			if ((initial < 0) || (states[initial].parentState != def.state))
+				return false;
+		}
+	}
+
+	for (std::size_t i = 0; i < T; i++) {
+		const TransitionDef &def = transitions[i];
+
+		if ((def.eventType != FinishedEvent) &&
+		    ((def.eventType < QEvent::User) || (def.eventType > QEvent::MaxUser)))
+			return false;
+		if (findState(states, S, def.fromState) < 0)
+			return false;
+
+		const int to = findState(states, S, def.toState);
+		if (to < 0)
+			return false;
+		if (hasChildren(states, S, def.toState) && (states[to].initialState == -1))
+			return false;
+	}
+
+	if (findState(states, S, initialState) < 0)
+		return false;
+	if ((finalState != -1) && (findState(states, S, finalState) < 0))
+		return false;
+
+	return true;
+}
+
+
+#endif // !defined(STATEGRAPH_H)
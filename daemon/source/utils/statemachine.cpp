@@ -23,32 +23,41 @@
 //
 
 #include "statemachine.h"
+#include "dumper.h"
 
 #include <QCoreApplication>
-#include <QTimerEvent>
 #include <QThread>
 #include <QLoggingCategory>
 #include <QStringBuilder>
 
+#include <string.h>
+#include <time.h>
+
 
 StateMachine::StateMachine(QObject *parent)
 	: QObject(parent)
 	, m_transitionLogLevel(QtDebugMsg)
 	, m_transitionLogCategory(QLoggingCategory::defaultCategory())
 	, m_currentState(-1)
-	, m_initialState(-1)
-	, m_finalState(-1)
 	, m_running(false)
 	, m_signalIdCounter(1)
 	, m_stopPending(false)
 	, m_withinStateMover(false)
-	, m_delayedEventIdCounter(1)
+	, m_timerWheel(TimerWheel::instance())
+	, m_postedEvents(nullptr)
+	, m_postedWakeupPending(0)
+	, m_overflowing(0)
+	, m_transitionCount(0)
+	, m_stateEnteredNsecs(0)
 {
+	memset(m_transitions, 0x00, sizeof(m_transitions));
 }
 
 StateMachine::~StateMachine()
 {
 	cleanUpEvents();
+
+	delete m_postedEvents.loadAcquire();
 }
 
 // -----------------------------------------------------------------------------
@@ -76,21 +85,21 @@ void StateMachine::logTransition(int oldState, int newState) const
 	if (oldState == newState) {
 		message = QString("[%1] re-entering state %2(%3)")
 			.arg(objectName())
-			.arg(m_states[newState].name)
+			.arg(m_graph->stateName(newState))
 			.arg(newState);
 
 	} else if (oldState == -1) {
 		message = QString("[%1] moving to state %2(%3)")
 			.arg(objectName())
-			.arg(m_states[newState].name)
+			.arg(m_graph->stateName(newState))
 			.arg(newState);
 
 	} else {
 		message = QString("[%1] moving from state %2(%3) to %4(%5)")
 			.arg(objectName())
-			.arg(m_states[oldState].name)
+			.arg(m_graph->stateName(oldState))
 			.arg(oldState)
-			.arg(m_states[newState].name)
+			.arg(m_graph->stateName(newState))
 			.arg(newState);
 	}
 
@@ -130,46 +139,263 @@ void StateMachine::setTransistionLogLevel(QtMsgType type, const QLoggingCategory
 		m_transitionLogCategory = QLoggingCategory::defaultCategory();
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the current monotonic time in nanoseconds.
+
+ */
+qint64 StateMachine::monotonicNsecs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (qint64(ts.tv_sec) * 1000000000LL) + qint64(ts.tv_nsec);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Adds a transition from \a oldState to \a newState caused by \a trigger to
+	the ring of recent transitions, and adds the time spent in \a oldState to
+	its histogram.  Either state may be \c -1 for the machine starting or
+	stopping.
+
+	This is always on so it's kept to a clock read and a handful of stores,
+	nothing is allocated or formatted until the records are dumped.
+
+ */
+void StateMachine::recordTransition(int oldState, int newState, int trigger)
+{
+	const qint64 now = monotonicNsecs();
+
+	if (oldState >= 0) {
+		const qint64 nsecs = now - m_stateEnteredNsecs;
+
+		// bucket 0 is under 1ms, after that bucket n is [2^(n-1), 2^n) ms
+		const quint64 msecs = quint64(nsecs) / 1000000;
+		int bucket = (msecs == 0) ? 0 : (64 - __builtin_clzll(msecs));
+		if (bucket >= HistogramBuckets)
+			bucket = HistogramBuckets - 1;
+
+		m_stateHistograms.data()[(oldState * HistogramBuckets) + bucket]++;
+		m_stateTotalNsecs.data()[oldState] += nsecs;
+	}
+
+	m_stateEnteredNsecs = now;
+
+	TransitionRecord &record = m_transitions[m_transitionCount % RecorderSize];
+	record.timestamp = now;
+	record.fromState = qint16(oldState);
+	record.toState = qint16(newState);
+	record.trigger = trigger;
+
+	m_transitionCount++;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns a readable description of the \a trigger of a recorded
+	transition.
+
+ */
+QString StateMachine::triggerName(int trigger) const
+{
+	switch (trigger) {
+		case SignalTrigger:     return QStringLiteral("signal");
+		case StartTrigger:      return QStringLiteral("start");
+		case StopTrigger:       return QStringLiteral("stop");
+		case FinishedEvent:     return QStringLiteral("finished");
+		default:
+			return QString("event User+%1").arg(trigger - QEvent::User);
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Dumps the current state, the most recent transitions and how long the
+	machine has spent in each of its states to \a out.  Only completed
+	visits are in the time-in-state counts, the time in the current state
+	is shown separately.
+
+	Must be called from the state machine's thread.
+
+ */
+void StateMachine::dump(Dumper out) const
+{
+	const qint64 now = monotonicNsecs();
+
+	out.printLine("state machine '%s':", qPrintable(objectName()));
+	out.pushIndent(2);
+
+	if (m_running)
+		out.printLine("state: %s (for %lldms)", qPrintable(stateName()),
+		              (now - m_stateEnteredNsecs) / 1000000);
+	else
+		out.printLine("state: not running");
+
+	if (!m_graph || (m_transitionCount == 0)) {
+		out.popIndent();
+		return;
+	}
+
+	// the ring of recent transitions, oldest first
+	const quint32 count = qMin<quint32>(m_transitionCount, RecorderSize);
+	out.printLine("transitions (last %u of %u):", count, m_transitionCount);
+	out.pushIndent(2);
+
+	for (quint32 i = m_transitionCount - count; i < m_transitionCount; i++) {
+		const TransitionRecord &record = m_transitions[i % RecorderSize];
+
+		const QString from = (record.fromState < 0) ? QStringLiteral("-") :
+		                     m_graph->stateName(record.fromState);
+		const QString to = (record.toState < 0) ? QStringLiteral("-") :
+		                   m_graph->stateName(record.toState);
+
+		out.printLine("%9.3fs  %s -> %s (%s)",
+		              double(record.timestamp - now) / 1000000000.0,
+		              qPrintable(from), qPrintable(to),
+		              qPrintable(triggerName(record.trigger)));
+	}
+
+	out.popIndent();
+
+	// the time-in-state histograms, only non-zero buckets are shown
+	out.printLine("time in state:");
+	out.pushIndent(2);
+
+	for (int state = 0; state < m_stateTotalNsecs.size(); state++) {
+
+		const quint32 *buckets = m_stateHistograms.constData() + (state * HistogramBuckets);
+
+		quint32 visits = 0;
+		QString histogram;
+		for (int i = 0; i < HistogramBuckets; i++) {
+			if (buckets[i] == 0)
+				continue;
+
+			visits += buckets[i];
+
+			if (i == 0)
+				histogram += QString(" <1ms:%1").arg(buckets[i]);
+			else
+				histogram += QString(" %1ms+:%2").arg(Q_INT64_C(1) << (i - 1)).arg(buckets[i]);
+		}
+
+		if (visits == 0)
+			continue;
+
+		out.printLine("%s: %u visits, %lldms total,%s",
+		              qPrintable(m_graph->stateName(state)), visits,
+		              m_stateTotalNsecs[state] / 1000000, qPrintable(histogram));
+	}
+
+	out.popIndent();
+	out.popIndent();
+}
+
 void StateMachine::cleanUpEvents()
 {
 	// clear all the queued events
 	m_localEvents.clear();
 
-	// clean up any delayed events with lock held
-	QMutexLocker locker(&m_delayedEventsLock);
+	// and any delayed events still in the timer wheel
+	m_timerWheel->cancelAll(this);
+
+	// and discard anything posted from other threads that hasn't been
+	// processed yet, so it isn't delivered if the state machine is restarted
+	MpscQueue<QEvent::Type> *queue = m_postedEvents.loadAcquire();
+	if (queue) {
+		QEvent::Type eventType;
+		while (queue->tryDequeue(&eventType))
+			continue;
+	}
+
+	if (m_overflowing.loadAcquire()) {
+		QMutexLocker locker(&m_overflowLock);
+		m_overflowEvents.clear();
+		m_overflowing.storeRelease(0);
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the graph to add states or transitions to, if the state machine
+	doesn't have a graph yet a new one is created that is owned by this
+	state machine.  Returns \c nullptr if the state machine is running or is
+	using a shared graph, \a what is used for the warning message.
+
+ */
+StateGraph *StateMachine::editableGraph(const char *what)
+{
+	// can't change the graph while running (really - we're single threaded, why not?)
+	if (Q_UNLIKELY(m_running)) {
+		qWarning("can't %s while running", what);
+		return nullptr;
+	}
 
-	QMap<qint64, DelayedEvent>::iterator it = m_delayedEvents.begin();
-	for (; it != m_delayedEvents.end(); ++it) {
+	// shared graphs are immutable
+	if (Q_UNLIKELY(m_graph && !m_ownGraph)) {
+		qWarning("can't %s as using a shared state graph", what);
+		return nullptr;
+	}
 
-		// kill the timer (safe to do in destructor ?)
-		if (it->timerId >= 0)
-			killTimer(it->timerId);
+	if (!m_ownGraph) {
+		m_ownGraph = QSharedPointer<StateGraph>::create();
+		m_graph = m_ownGraph;
 	}
 
-	m_delayedEvents.clear();
+	return m_ownGraph.data();
 }
 
-QList<int> StateMachine::stateTreeFor(int state, bool bottomUp) const
+// -----------------------------------------------------------------------------
+/*!
+	Sets the \a graph of states and transitions for the state machine to
+	use, this is an alternative to adding the states and transitions to the
+	state machine directly.  The graph must be frozen and once set no more
+	states or transitions can be added, as the graph may be shared with other
+	state machines.
+
+	Can't be called while the state machine is running.
+
+	\see StateGraph::create()
+ */
+bool StateMachine::setStateGraph(const QSharedPointer<const StateGraph> &graph)
 {
-	QList<int> tree;
+	if (Q_UNLIKELY(m_running)) {
+		qWarning("can't set state graph while running");
+		return false;
+	}
 
-	// to speed this up we don't do any checks on the state values, we assume
-	// this is done when the states are added
-	do {
+	if (Q_UNLIKELY(!graph || !graph->isFrozen())) {
+		qWarning("state graph is invalid or not frozen");
+		return false;
+	}
 
-		if (bottomUp)
-			tree.append(state);
-		else
-			tree.prepend(state);
+	m_ownGraph.reset();
+	m_graph = graph;
 
-		state = m_states[state].parentState;
+	return true;
+}
 
-	} while (state >= 0);
+// -----------------------------------------------------------------------------
+/*!
+	Returns the graph of states and transitions used by the state machine,
+	this may be a null pointer if no states have been added.
 
-	return tree;
+ */
+QSharedPointer<const StateGraph> StateMachine::stateGraph() const
+{
+	return m_graph;
 }
 
-void StateMachine::moveToState(int newState)
+void StateMachine::moveToState(int newState, int trigger)
 {
 	// if the new state is equal to the current state then this is not an error
 	// and just means we haveto issue the exited, transistion and entered
@@ -177,6 +403,7 @@ void StateMachine::moveToState(int newState)
 	if (newState == m_currentState) {
 
 		logTransition(m_currentState, newState);
+		recordTransition(m_currentState, newState, trigger);
 
 		emit exited(m_currentState);
 		emit transition(m_currentState, m_currentState);
@@ -187,21 +414,21 @@ void StateMachine::moveToState(int newState)
 	} else {
 
 		// lookup the new state to check if we should be moving to an initial state
-		QMap<int, State>::const_iterator it = m_states.find(newState);
+		const StateGraph::StateEntry &entry = m_graph->stateEntry(newState);
 
 		// if the state has one or more children then it's a super state and
 		// we should be moving to the initial state
-		if (it->hasChildren) {
+		if (entry.hasChildren) {
 
 			// sanity check we have an initial state
-			if (Q_UNLIKELY(it->initialState == -1)) {
+			if (Q_UNLIKELY(entry.initialState == -1)) {
 				qWarning("try to move to super state %s(%d) but no initial state set",
-				         qPrintable(it->name), newState);
+				         qPrintable(m_graph->stateName(newState)), newState);
 				return;
 			}
 
 			// set the new state to be the initial state of the super state
-			newState = it->initialState;
+			newState = entry.initialState;
 		}
 
 		//
@@ -209,51 +436,61 @@ void StateMachine::moveToState(int newState)
 		m_currentState = newState;
 
 		logTransition(oldState, newState);
+		recordTransition(oldState, newState, trigger);
+
+
+		// get the states we were in and are now in (includes parents), the
+		// paths are stored from the top down
+		const StateGraph *graph = m_graph.data();
 
+		const int oldDepth = graph->stateEntry(oldState).depth;
+		const int newDepth = graph->stateEntry(newState).depth;
 
-		// get the set of states we're currently in (includes parents)
-		QList<int> newStates = stateTreeFor(newState, false);
-		QList<int> oldStates = stateTreeFor(oldState, true);
+		const int *oldStates = graph->statePath(oldState);
+		const int *newStates = graph->statePath(newState);
 
 
-		// emit the exit signal for any states we left
-		for (const int &_oldState : oldStates) {
-			if (!newStates.contains(_oldState))
-				emit exited(_oldState);
+		// emit the exit signal for any states we left, from the bottom up
+		for (int i = oldDepth - 1; i >= 0; i--) {
+			if (!graph->isWithinState(newState, oldStates[i]))
+				emit exited(oldStates[i]);
 		}
 
 		// emit a transition signal
 		emit transition(oldState, m_currentState);
 
 		// emit the entry signal for any states we've now entered
-		for (const int &_newState : newStates) {
-			if (!oldStates.contains(_newState))
-				emit entered(_newState);
+		for (int i = 0; i < newDepth; i++) {
+			if (!graph->isWithinState(oldState, newStates[i]))
+				emit entered(newStates[i]);
 		}
 	}
 
 
 	// check if the new state is a final state of a super state, in which case
 	// post a FinishedEvent to the message loop
-	if (m_states[newState].isFinal) {
+	if (m_graph->stateEntry(newState).isFinal) {
 		postEvent(FinishedEvent);
 	}
 
 
 	// check if the new state is a final state for the state machine and if so
 	// stop the state machine
-	if ((m_currentState == m_finalState) || m_stopPending) {
+	const int finalState = m_graph->finalState();
+	if ((m_currentState == finalState) || m_stopPending) {
+
+		recordTransition(m_currentState, -1, StopTrigger);
 
 		m_running = false;
 		cleanUpEvents();
 
-		if (m_currentState == m_finalState)
+		if (m_currentState == finalState)
 			emit finished();
 		m_currentState = -1;
 	}
 }
 
-void StateMachine::triggerStateMove(int newState)
+void StateMachine::triggerStateMove(int newState, int trigger)
 {
 	Q_ASSERT(QObject::thread() == QThread::currentThread());
 
@@ -261,7 +498,7 @@ void StateMachine::triggerStateMove(int newState)
 
 	// move to the new state, this will emit signals that may result in more
 	// events being added to local event queue
-	moveToState(newState);
+	moveToState(newState, trigger);
 
 	// then check if we have any other events on the queue, note we can get
 	// into an infinite loop here if the code using the statemachine is
@@ -273,7 +510,7 @@ void StateMachine::triggerStateMove(int newState)
 		// move the state once again
 		newState = shouldMoveState(eventType);
 		if (newState != -1)
-			moveToState(newState);
+			moveToState(newState, eventType);
 	}
 
 	m_withinStateMover = false;
@@ -281,47 +518,9 @@ void StateMachine::triggerStateMove(int newState)
 
 int StateMachine::shouldMoveState(QEvent::Type eventType) const
 {
-	// check if this event triggers any transactions
-	int state = m_currentState;
-	do {
-
-		// find the current state and sanity check it is in the map
-		QMap<int, State>::const_iterator it = m_states.find(state);
-		if (Q_UNLIKELY(it == m_states.end())) {
-			qCritical("invalid state %d (this shouldn't happen)", state);
-			return -1;
-		}
-
-		// iterate through the transitions of this state and see if any trigger
-		// on this event
-		for (const Transition &transition : it->transitions) {
-			if ((transition.type == Transition::EventTransition) &&
-			    (transition.eventType == eventType)) {
-
-				// some extra sanity checks that the target state is valid
-				// on debug builds
-#if (AI_BUILD_TYPE == AI_DEBUG)
-				if (Q_UNLIKELY(!m_states.contains(transition.targetState))) {
-					qCritical("invalid target state %d (this shouldn't happen)",
-					           transition.targetState);
-				} else if (Q_UNLIKELY((m_states[transition.targetState].hasChildren == true) &&
-				                      (m_states[transition.targetState].initialState == -1))) {
-					qCritical("trying to move to a super state with no initial state set");
-				}
-#endif // (AI_BUILD_TYPE == AI_DEBUG)
-
-				// return the state we should be moving to
-				return transition.targetState;
-			}
-		}
-
-		// if this state had a parent state, then see if that matches the
-		// event and therefore should transition
-		state = it->parentState;
-
-	} while (state != -1);
-
-	return -1;
+	// check if this event triggers any transactions, the graph's table
+	// already has the transitions of the parent states folded in
+	return m_graph->eventTarget(m_currentState, eventType);
 }
 
 void StateMachine::customEvent(QEvent *event)
@@ -338,51 +537,28 @@ void StateMachine::customEvent(QEvent *event)
 	// check if this event triggers any transactions
 	int newState = shouldMoveState(eventType);
 	if (newState != -1)
-		triggerStateMove(newState);
+		triggerStateMove(newState, eventType);
 }
 
-void StateMachine::timerEvent(QTimerEvent *event)
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called by the timer wheel when a delayed event expires, \a data is the
+	event type.
+
+ */
+void StateMachine::timerWheelExpired(qint64 timerId, quintptr data)
 {
-	if (Q_UNLIKELY(event == nullptr))
-		return;
+	Q_UNUSED(timerId);
 
 	if (!m_running)
 		return;
 
-	const int timerId = event->timerId();
-
-	// take the lock before accessing the delay events map
-	QMutexLocker locker(&m_delayedEventsLock);
-
-	// if a timer then use the id to look-up the actual event the was
-	// put in the delayed queue
-	QMap<qint64, DelayedEvent>::iterator it = m_delayedEvents.begin();
-	for (; it != m_delayedEvents.end(); ++it) {
-
-		if (it->timerId == timerId) {
-
-			// if we have a valid delayed event then swap out the event type
-			// to the one in the delayed list
-			QEvent::Type delayedEventType = it->eventType;
-
-			// free the delayed entry
-			m_delayedEvents.erase(it);
-
-			// release the lock so clients can add other delayed events in
-			// their state change callbacks
-			locker.unlock();
-
-			// kill the timer
-			killTimer(timerId);
-
-			// check if this event triggers any transactions
-			int newState = shouldMoveState(delayedEventType);
-			if (newState != -1)
-				triggerStateMove(newState);
-
-			break;
-		}
-	}
+	// check if this event triggers any transactions
+	int newState = shouldMoveState(static_cast<QEvent::Type>(data));
+	if (newState != -1)
+		triggerStateMove(newState, int(data));
 }
 
 void StateMachine::onSignalTransition(qint64 signalId)
@@ -390,35 +566,11 @@ void StateMachine::onSignalTransition(qint64 signalId)
 	if (!m_running)
 		return;
 
-	int state = m_currentState;
-	do {
-
-		// find the current state and sanity check it is in the map
-		QMap<int, State>::const_iterator it = m_states.find(m_currentState);
-		if (Q_UNLIKELY(it == m_states.end())) {
-			qCritical("invalid state %d (this shouldn't happen)", state);
-			return;
-		}
-
-		// iterate through the transitions of this state and see if any trigger
-		// on this event
-		const State &stateStruct = it.value();
-		for (const Transition &transition : stateStruct.transitions) {
-			if ((transition.type == Transition::SignalTransition) &&
-			    (transition.signalId == signalId)) {
-
-				// move to the new state
-				triggerStateMove(transition.targetState);
-				return;
-			}
-		}
-
-		// if this state had a parent state, then see if that matches the
-		// event and therefore should transition
-		state = stateStruct.parentState;
-
-	} while (state != -1);
-
+	// check if the signal triggers a transition from the current state or
+	// any of its parents
+	const int newState = m_graph->signalTarget(m_currentState, signalId);
+	if (newState != -1)
+		triggerStateMove(newState, SignalTrigger);
 }
 
 bool StateMachine::addState(int state, const QString &name)
@@ -428,101 +580,20 @@ bool StateMachine::addState(int state, const QString &name)
 
 bool StateMachine::addState(int parentState, int state, const QString &name)
 {
-	// can't add states while running (really - we're single threaded, why not?)
-	if (Q_UNLIKELY(m_running)) {
-		qWarning("can't add states while running");
-		return false;
-	}
-
-	// check the state is a positive integer
-	if (Q_UNLIKELY(state < 0)) {
-		qWarning("state's must be positive integers");
+	StateGraph *graph = editableGraph("add states");
+	if (!graph)
 		return false;
-	}
 
-	// check we don't already have this state
-	if (Q_UNLIKELY(m_states.contains(state))) {
-		qWarning("already have state %s(%d), not adding again",
-		         qPrintable(m_states[state].name), state);
-		return false;
-	}
-
-	// if a parent was supplied then increment it's child count
-	if (parentState != -1) {
-		QMap<int, State>::iterator parent = m_states.find(parentState);
-
-		// if a parent was supplied make sure we have that parent state
-		if (Q_UNLIKELY(parent == m_states.end())) {
-			qWarning("try to add state %s(%d) with missing parent state %d",
-			         qPrintable(name), state, parentState);
-			return false;
-		}
-
-		// increment the number of child states
-		parent->hasChildren = true;
-	}
-
-	// add the state
-	State stateStruct;
-
-	stateStruct.parentState = parentState;
-	stateStruct.initialState = -1;
-	stateStruct.hasChildren = false;
-	stateStruct.isFinal = false;
-	stateStruct.name = name;
-
-	m_states.insert(state, std::move(stateStruct));
-
-	return true;
+	return graph->addState(parentState, state, name);
 }
 
 bool StateMachine::addTransition(int fromState, QEvent::Type eventType, int toState)
 {
-	// can't add transitions while running (really - we're single threaded, why not?)
-	if (Q_UNLIKELY(m_running)) {
-		qWarning("can't add transitions while running");
+	StateGraph *graph = editableGraph("add transitions");
+	if (!graph)
 		return false;
-	}
 
-	// sanity check the event type
-	if (Q_UNLIKELY(eventType == QEvent::None)) {
-		qWarning("eventType is invalid (%d)", int(eventType));
-		return false;
-	}
-
-	// sanity check we have a 'from' state
-	QMap<int, State>::iterator from = m_states.find(fromState);
-	if (Q_UNLIKELY(from == m_states.end())) {
-		qWarning("missing 'fromState' %d", fromState);
-		return false;
-	}
-
-	// and we have a 'to' state
-	QMap<int, State>::const_iterator to = m_states.find(toState);
-	if (Q_UNLIKELY(to == m_states.end())) {
-		qWarning("missing 'toState' %d", toState);
-		return false;
-	}
-
-	// also check if the to state is a super state that it has in initial
-	// state set
-	if (Q_UNLIKELY((to->hasChildren == true) && (to->initialState == -1))) {
-		qWarning("'toState' %s(%d) is a super state with no initial state set",
-		         qPrintable(to->name), toState);
-		return false;
-	}
-
-	// add the transition
-	Transition transition;
-	bzero(&transition, sizeof(transition));
-
-	transition.targetState = toState;
-	transition.type = Transition::EventTransition;
-	transition.eventType = eventType;
-
-	from->transitions.append(std::move(transition));
-
-	return true;
+	return graph->addTransition(fromState, eventType, toState);
 }
 
 // -----------------------------------------------------------------------------
@@ -537,42 +608,11 @@ bool StateMachine::setSignalTransition(int fromState, int toState, qint64 signal
 {
 	// TODO: this needs to be made thread safe
 
-	// can't add transitions while running (really - we're single threaded, why not?)
-	if (Q_UNLIKELY(m_running)) {
-		qWarning("can't add transitions while running");
-		return false;
-	}
-
-	// sanity check we have a 'from' state
-	QMap<int, State>::iterator from = m_states.find(fromState);
-	if (Q_UNLIKELY(from == m_states.end())) {
-		qWarning("missing 'fromState' %d", fromState);
-		return false;
-	}
-
-	// and we have a 'to' state
-	QMap<int, State>::const_iterator to = m_states.find(toState);
-	if (Q_UNLIKELY(to == m_states.end())) {
-		qWarning("missing 'toState' %d", toState);
-		return false;
-	}
-
-	// also check if the to state is a super state that it has in initial
-	// state set
-	if (Q_UNLIKELY(to->hasChildren && (to->initialState == -1))) {
-		qWarning("'toState' %s(%d) is a super state with no initial state set",
-		         qPrintable(to->name), toState);
+	StateGraph *graph = editableGraph("add transitions");
+	if (!graph)
 		return false;
-	}
-
-	// add the transition
-	Transition transition;
-	transition.type = Transition::SignalTransition;
-	transition.signalId = signalId;
 
-	from->transitions.append(std::move(transition));
-
-	return true;
+	return graph->addSignalTransition(fromState, signalId, toState);
 }
 
 // -----------------------------------------------------------------------------
@@ -583,20 +623,11 @@ bool StateMachine::setSignalTransition(int fromState, int toState, qint64 signal
  */
 bool StateMachine::setInitialState(int state)
 {
-	// can't set initial state while running (really - we're single threaded, why not?)
-	if (Q_UNLIKELY(m_running)) {
-		qWarning("can't set initial state while running");
+	StateGraph *graph = editableGraph("set initial state");
+	if (!graph)
 		return false;
-	}
 
-	// sanity check we know about the state
-	if (Q_UNLIKELY(!m_states.contains(state))) {
-		qWarning("can't set initial state to %d as don't have that state", state);
-		return false;
-	}
-
-	m_initialState = state;
-	return true;
+	return graph->setInitialState(state);
 }
 
 // -----------------------------------------------------------------------------
@@ -611,42 +642,11 @@ bool StateMachine::setInitialState(int state)
  */
 bool StateMachine::setInitialState(int parentState, int initialState)
 {
-	// can't set initial state while running (really - we're single threaded, why not?)
-	if (Q_UNLIKELY(m_running)) {
-		qWarning("can't set initial state while running");
-		return false;
-	}
-
-	// get the parent state
-	QMap<int, State>::iterator parent = m_states.find(parentState);
-	if (Q_UNLIKELY(parent == m_states.end())) {
-		qWarning("can't find parent state %d", parentState);
-		return false;
-	}
-
-	// sanity check we know about the given initial state
-	QMap<int, State>::const_iterator initial = m_states.find(initialState);
-	if (Q_UNLIKELY(initial == m_states.end())) {
-		qWarning("can't set initial state to %d as don't have that state",
-		         initialState);
+	StateGraph *graph = editableGraph("set initial state");
+	if (!graph)
 		return false;
-	}
-
-	// sanity check the given initial state has the same parent
-	if (Q_UNLIKELY(initial->parentState != parentState)) {
-		qWarning("can't set initial state to %d as parent state doesn't match",
-		         initialState);
-		return false;
-	}
-
-	// check if we already an initial state, this is not fatal but raise a warning
-	if (Q_UNLIKELY(parent->initialState != -1)) {
-		qWarning("replacing existing initial state %d to %d",
-		         parent->initialState, initialState);
-	}
 
-	parent->initialState = initialState;
-	return true;
+	return graph->setInitialState(parentState, initialState);
 }
 
 // -----------------------------------------------------------------------------
@@ -662,20 +662,11 @@ bool StateMachine::setInitialState(int parentState, int initialState)
  */
 bool StateMachine::setFinalState(int state)
 {
-	// can't set final state while running (really - we're single threaded, why not?)
-	if (Q_UNLIKELY(m_running)) {
-		qWarning("can't set final state while running");
+	StateGraph *graph = editableGraph("set final state");
+	if (!graph)
 		return false;
-	}
 
-	// sanity check we know about the state
-	if (Q_UNLIKELY(!m_states.contains(state))) {
-		qWarning("can't set final state to %d as don't have that state", state);
-		return false;
-	}
-
-	m_finalState = state;
-	return true;
+	return graph->setFinalState(state);
 }
 
 // -----------------------------------------------------------------------------
@@ -692,43 +683,25 @@ bool StateMachine::setFinalState(int state)
  */
 bool StateMachine::setFinalState(int parentState, int finalState)
 {
-	// can't set final state while running (really - we're single threaded, why not?)
-	if (Q_UNLIKELY(m_running)) {
-		qWarning("can't set final state while running");
-		return false;
-	}
-
-	// get the parent state
-	QMap<int, State>::const_iterator parent = m_states.find(parentState);
-	if (Q_UNLIKELY(parent == m_states.end())) {
-		qWarning("can't find parent state %d", parentState);
-		return false;
-	}
-
-	// sanity check we know about the given final state
-	QMap<int, State>::iterator final = m_states.find(finalState);
-	if (Q_UNLIKELY(final == m_states.end())) {
-		qWarning("can't set final state to %d as don't have that state",
-		         finalState);
-		return false;
-	}
-
-	// sanity check the given initial state has the same parent
-	if (Q_UNLIKELY(final->parentState != parentState)) {
-		qWarning("can't set final state to %d as parent state doesn't match",
-		         finalState);
+	StateGraph *graph = editableGraph("set final state");
+	if (!graph)
 		return false;
-	}
 
-	final->isFinal = true;
-	return true;
+	return graph->setFinalState(parentState, finalState);
 }
 
 // -----------------------------------------------------------------------------
 /*!
-	\threadsafe
+	Posts an event of \a eventType to the state machine.
 
+	If called on the state machine's thread the event is processed straight
+	away, or if called from within a state change handler it is queued and
+	processed once the handler returns.  If called from any other thread the
+	event is put on a lock-free queue and processed on the state machine's
+	thread, events posted from the same thread are always processed in the
+	order they were posted.
 
+	\threadsafe
  */
 void StateMachine::postEvent(QEvent::Type eventType)
 {
@@ -766,17 +739,140 @@ void StateMachine::postEvent(QEvent::Type eventType)
 
 			// check if we should be moving to a new state
 			if (newState != -1)
-				triggerStateMove(newState);
+				triggerStateMove(newState, eventType);
 		}
 
 	} else {
 
-		// being called from a different thread so post the message back to
-		// us through the main application event loop
-		QCoreApplication::postEvent(this, new QEvent(eventType));
+		// being called from a different thread so put the event on the
+		// lock-free queue for our thread to pick up
+		postCrossThreadEvent(eventType);
 	}
 }
 
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Adds \a eventType to the queue of events posted from other threads and
+	wakes up the state machine's thread if it isn't already due to drain
+	the queue, so a burst of events only costs one wakeup.
+
+	The queue is a fixed size ring allocated on the first cross-thread
+	post, after that posting doesn't allocate.  If the ring fills up the
+	events go on a locked overflow list, and keep going there until the
+	state machine has drained it, so events from any one thread are always
+	delivered in the order they were posted.
+
+	\threadsafe
+ */
+void StateMachine::postCrossThreadEvent(QEvent::Type eventType)
+{
+	MpscQueue<QEvent::Type> *queue = m_postedEvents.loadAcquire();
+	if (Q_UNLIKELY(!queue)) {
+		queue = new MpscQueue<QEvent::Type>(PostedEventsCapacity);
+		if (!m_postedEvents.testAndSetOrdered(nullptr, queue)) {
+			delete queue;
+			queue = m_postedEvents.loadAcquire();
+		}
+	}
+
+	if (Q_UNLIKELY(m_overflowing.loadAcquire() || !queue->tryEnqueue(eventType))) {
+		QMutexLocker locker(&m_overflowLock);
+
+		// just for debugging
+		if (Q_UNLIKELY(m_overflowEvents.size() > 1024))
+			qWarning("state machine cross-thread event queue getting large");
+
+		m_overflowEvents.enqueue(eventType);
+		m_overflowing.storeRelease(1);
+	}
+
+	// only the first event posted since the last drain needs to wake the
+	// state machine
+	if (m_postedWakeupPending.testAndSetOrdered(0, 1))
+		QMetaObject::invokeMethod(this, "onPostedEvents", Qt::QueuedConnection);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called on the state machine's thread after events have been posted from
+	other threads, processes all the events on the queue in order.
+
+ */
+void StateMachine::onPostedEvents()
+{
+	// clear the pending flag before draining, anything posted after this
+	// point will either be picked up below or will post another wakeup, this
+	// needs to be a full barrier so the flag is cleared before reading the
+	// queue
+	m_postedWakeupPending.fetchAndStoreOrdered(0);
+
+	MpscQueue<QEvent::Type> *queue = m_postedEvents.loadAcquire();
+	if (Q_UNLIKELY(!queue))
+		return;
+
+	// limit the number of events processed in one go so a busy producer
+	// can't starve the event loop, if there are more we just wake ourselves
+	// again
+	int budget = queue->capacity();
+
+	QEvent::Type eventType;
+	while (queue->tryDequeue(&eventType)) {
+		dispatchPostedEvent(eventType);
+
+		if (--budget == 0) {
+			if (m_postedWakeupPending.testAndSetOrdered(0, 1))
+				QMetaObject::invokeMethod(this, "onPostedEvents", Qt::QueuedConnection);
+			return;
+		}
+	}
+
+	// the overflow events were all posted after the ones in the ring, so can
+	// only be processed once the ring is empty, if it's not empty then a
+	// producer is still writing to it and will wake us again when done
+	if (Q_UNLIKELY(m_overflowing.loadAcquire()) && queue->isEmpty()) {
+
+		QMutexLocker locker(&m_overflowLock);
+
+		QQueue<QEvent::Type> overflowEvents;
+		overflowEvents.swap(m_overflowEvents);
+		m_overflowing.storeRelease(0);
+
+		locker.unlock();
+
+		for (const QEvent::Type overflowEvent : overflowEvents)
+			dispatchPostedEvent(overflowEvent);
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Processes a single \a eventType that was posted from another thread.
+
+ */
+void StateMachine::dispatchPostedEvent(QEvent::Type eventType)
+{
+	if (!m_running)
+		return;
+
+	// if a nested event loop in one of the state handlers got us here then
+	// the event has to go on the back of the local queue, the same as if it
+	// had been posted by the handler
+	if (Q_UNLIKELY(m_withinStateMover)) {
+		m_localEvents.enqueue(eventType);
+		return;
+	}
+
+	int newState = shouldMoveState(eventType);
+	if (newState != -1)
+		triggerStateMove(newState, eventType);
+}
+
 // -----------------------------------------------------------------------------
 /*!
 	\threadsafe
@@ -800,21 +896,14 @@ qint64 StateMachine::postDelayedEvent(QEvent::Type eventType, int delay)
 		return -1;
 	}
 
-	// create a timer and then pin the event to the timer
-	const int timerId = startTimer(delay);
-	if (Q_UNLIKELY(timerId < 0)) {
+	// arm a timer in the wheel with the event type as the data, the timer id
+	// is the delayed event id
+	const qint64 id = m_timerWheel->arm(this, delay, quintptr(eventType));
+	if (Q_UNLIKELY(id < 0)) {
 		qWarning("failed to create timer for delayed event");
 		return -1;
 	}
 
-	// take the lock before accessing the delay events map
-	QMutexLocker locker(&m_delayedEventsLock);
-
-	// get a unique id
-	qint64 id = m_delayedEventIdCounter++;
-
-	// map the id to the event
-	m_delayedEvents.insert(id, { timerId, eventType });
 	return id;
 }
 
@@ -835,23 +924,8 @@ bool StateMachine::cancelDelayedEvent(qint64 id)
 		return false;
 	}
 
-	// take the lock before accessing the delay events map
-	QMutexLocker locker(&m_delayedEventsLock);
-
-	// try and find the id in the delayed events map
-	QMap<qint64, DelayedEvent>::iterator it = m_delayedEvents.find(id);
-	if (it == m_delayedEvents.end())
-		return false;
-
-	const int timerId = it->timerId;
-
-	m_delayedEvents.erase(it);
-
-	locker.unlock();
-
-	killTimer(timerId);
-
-	return true;
+	// the wheel checks the id belongs to us
+	return m_timerWheel->cancel(this, id);
 }
 
 // -----------------------------------------------------------------------------
@@ -873,32 +947,7 @@ bool StateMachine::cancelDelayedEvents(QEvent::Type eventType)
 		return false;
 	}
 
-	// take the lock before accessing the delay events map
-	QMutexLocker locker(&m_delayedEventsLock);
-
-	// vector of all the timers to kill
-	QVector<int> timersToKill(m_delayedEvents.size());
-
-	// try and find the id in the delayed events map
-	QMap<qint64, DelayedEvent>::iterator it = m_delayedEvents.begin();
-	while (it != m_delayedEvents.end()) {
-
-		if (it->eventType == eventType) {
-			timersToKill.append(it->timerId);
-			it = m_delayedEvents.erase(it);
-		} else {
-			++it;
-		}
-	}
-
-	locker.unlock();
-
-	// clean-up all the timers
-	for (int timerId : timersToKill) {
-		killTimer(timerId);
-	}
-
-	return !timersToKill.isEmpty();
+	return (m_timerWheel->cancelAll(this, quintptr(eventType)) > 0);
 }
 
 // -----------------------------------------------------------------------------
@@ -929,28 +978,11 @@ bool StateMachine::inState(const int state) const
 		return false;
 	}
 
-	// we first check the current state and then walk back up the parent
-	// states to check for a match
-	int state_ = m_currentState;
-	do {
-
-		// check for a match to this state
-		if (state_ == state)
-			return true;
-
-		// find the current state and sanity check it is in the map
-		QMap<int, State>::const_iterator it = m_states.find(state_);
-		if (Q_UNLIKELY(it == m_states.end())) {
-			qCritical("invalid state %d (this shouldn't happen)", state_);
-			return false;
-		}
-
-		// if this state had a parent state then try that on the next loop
-		state_ = it->parentState;
-
-	} while (state_ != -1);
+	if ((state < 0) || (state >= m_graph->stateCount()))
+		return false;
 
-	return false;
+	// check the current state's bitset of itself and its parent states
+	return m_graph->isWithinState(m_currentState, state);
 }
 
 // -----------------------------------------------------------------------------
@@ -967,26 +999,14 @@ bool StateMachine::inState(const QSet<int> &states) const
 		return false;
 	}
 
-	// we first check the current state and then walk back up the parent
-	// states to check for a match
-	int state_ = m_currentState;
-	do {
-
-		// check for a match to this state
-		if (states.contains(state_))
+	// check each of the states against the current state's bitset of itself
+	// and its parent states
+	const StateGraph *graph = m_graph.data();
+	for (const int state : states) {
+		if ((state >= 0) && (state < graph->stateCount()) &&
+		    graph->isWithinState(m_currentState, state))
 			return true;
-
-		// find the current state and sanity check it is in the map
-		QMap<int, State>::const_iterator it = m_states.find(state_);
-		if (Q_UNLIKELY(it == m_states.end())) {
-			qCritical("invalid state %d (this shouldn't happen)", state_);
-			return false;
-		}
-
-		// if this state had a parent state then try that on the next loop
-		state_ = it->parentState;
-
-	} while (state_ != -1);
+	}
 
 	return false;
 }
@@ -1000,12 +1020,12 @@ bool StateMachine::inState(const QSet<int> &states) const
 QString StateMachine::stateName(int state) const
 {
 	if (state > 0) {
-		if (!m_states.contains(state))
+		if (!m_graph)
 			return QString();
 		else
-			return m_states[state].name;
+			return m_graph->stateName(state);
 	} else if (m_running) {
-		return m_states[m_currentState].name;
+		return m_graph->stateName(m_currentState);
 	} else {
 		return QString();
 	}
@@ -1023,16 +1043,34 @@ bool StateMachine::start()
 		return false;
 	}
 
-	if (Q_UNLIKELY(m_initialState == -1)) {
+	if (Q_UNLIKELY(!m_graph || (m_graph->initialState() == -1))) {
 		qWarning("no initial state set, not starting state machine");
 		return false;
 	}
 
+	// (re)build the transition tables if states or transitions have been
+	// added to our own graph since the last start, shared graphs are always
+	// frozen
+	if (m_ownGraph && !m_ownGraph->isFrozen() && !m_ownGraph->freeze()) {
+		qWarning("failed to build transition tables, not starting state machine");
+		return false;
+	}
+
+	// size the time-in-state histograms for the graph, the counts are kept
+	// across restarts so they cover every run of the state machine, unless
+	// the graph has changed underneath them
+	const int stateCount = m_graph->stateCount();
+	if (m_stateTotalNsecs.size() != stateCount) {
+		m_stateHistograms.fill(0, stateCount * HistogramBuckets);
+		m_stateTotalNsecs.fill(0, stateCount);
+	}
+
 	m_stopPending = false;
-	m_currentState = m_initialState;
+	m_currentState = m_graph->initialState();
 	m_running = true;
 
 	logTransition(-1, m_currentState);
+	recordTransition(-1, m_currentState, StartTrigger);
 
 	emit entered(m_currentState);
 
@@ -1054,6 +1092,8 @@ void StateMachine::stop()
 
 	} else {
 
+		recordTransition(m_currentState, -1, StopTrigger);
+
 		m_currentState = -1;
 		m_running = false;
 
@@ -25,9 +25,14 @@
 #ifndef STATEMACHINE_H
 #define STATEMACHINE_H
 
+#include "stategraph.h"
+#include "timerwheel.h"
+#include "mpscqueue.h"
+
 #include <QObject>
 #include <QDebug>
 #include <QAtomicInteger>
+#include <QAtomicPointer>
 #include <QLoggingCategory>
 #include <QMutex>
 #include <QEvent>
@@ -35,6 +40,8 @@
 #include <QList>
 #include <QMap>
 #include <QSet>
+#include <QSharedPointer>
+#include <QVector>
 
 #include <functional>
 
@@ -52,7 +59,10 @@
 #endif
 
 
-class StateMachine : public QObject
+class Dumper;
+
+
+class StateMachine : public QObject, private TimerWheel::Client
 {
 	Q_OBJECT
 
@@ -62,9 +72,11 @@ public:
 
 protected:
 	void customEvent(QEvent *event) override;
-	void timerEvent(QTimerEvent *event) override;
 
 public:
+	bool setStateGraph(const QSharedPointer<const StateGraph> &graph);
+	QSharedPointer<const StateGraph> stateGraph() const;
+
 	bool addState(int state, const QString &name = QString());
 	bool addState(int parentState, int state, const QString &name = QString());
 
@@ -119,8 +131,10 @@ public:
 	const QLoggingCategory* transistionLogCategory() const;
 	void setTransistionLogLevel(QtMsgType type, const QLoggingCategory *category = nullptr);
 
+	void dump(Dumper out) const;
+
 public:
-	static const QEvent::Type FinishedEvent = QEvent::StateMachineWrapped;
+	static const QEvent::Type FinishedEvent = StateGraph::FinishedEvent;
 
 public slots:
 	bool start();
@@ -138,43 +152,38 @@ private:
 	void onSignalTransition(qint64 signalId);
 
 	int shouldMoveState(QEvent::Type eventType) const;
-	void triggerStateMove(int newState);
-	void moveToState(int newState);
+	void triggerStateMove(int newState, int trigger);
+	void moveToState(int newState, int trigger);
+
+	StateGraph *editableGraph(const char *what);
+
+	void timerWheelExpired(qint64 timerId, quintptr data) override;
 
-	QList<int> stateTreeFor(int state, bool bottomUp) const;
+	void postCrossThreadEvent(QEvent::Type eventType);
+	void dispatchPostedEvent(QEvent::Type eventType);
+
+private slots:
+	void onPostedEvents();
 
 	void cleanUpEvents();
 
 	void logTransition(int oldState, int newState) const;
 
+private:
+	static qint64 monotonicNsecs();
+
+	void recordTransition(int oldState, int newState, int trigger);
+	QString triggerName(int trigger) const;
+
 private:
 	QtMsgType m_transitionLogLevel;
 	QLoggingCategory const *m_transitionLogCategory;
 
 private:
-	struct Transition {
-		int targetState;
-		enum { EventTransition, SignalTransition } type;
-		union {
-			QEvent::Type eventType;
-			qint64 signalId;
-		};
-	};
-
-	struct State {
-		int parentState;
-		int initialState;
-		bool hasChildren;
-		bool isFinal;
-		QString name;
-		QList<Transition> transitions;
-	};
-
-	QMap<int, State> m_states;
+	QSharedPointer<StateGraph> m_ownGraph;
+	QSharedPointer<const StateGraph> m_graph;
 
 	int m_currentState;
-	int m_initialState;
-	int m_finalState;
 
 	bool m_running;
 
@@ -185,14 +194,43 @@ private:
 	QQueue<QEvent::Type> m_localEvents;
 
 private:
-	struct DelayedEvent {
-		int timerId;
-		QEvent::Type eventType;
+	const QSharedPointer<TimerWheel> m_timerWheel;
+
+private:
+	static const int PostedEventsCapacity = 256;
+
+	QAtomicPointer< MpscQueue<QEvent::Type> > m_postedEvents;
+	QAtomicInt m_postedWakeupPending;
+
+	QMutex m_overflowLock;
+	QAtomicInt m_overflowing;
+	QQueue<QEvent::Type> m_overflowEvents;
+
+private:
+	// the trigger recorded for a transition is either the event type or one
+	// of these
+	enum {
+		SignalTrigger = -1,
+		StartTrigger = -2,
+		StopTrigger = -3
+	};
+
+	struct TransitionRecord {
+		qint64 timestamp;
+		qint16 fromState;
+		qint16 toState;
+		qint32 trigger;
 	};
 
-	QMutex m_delayedEventsLock;
-	qint64 m_delayedEventIdCounter;
-	QMap<qint64, DelayedEvent> m_delayedEvents;
+	static const int RecorderSize = 32;
+	static const int HistogramBuckets = 18;
+
+	TransitionRecord m_transitions[RecorderSize];
+	quint32 m_transitionCount;
+
+	qint64 m_stateEnteredNsecs;
+	QVector<quint32> m_stateHistograms;
+	QVector<qint64> m_stateTotalNsecs;
 };
 
 
@@ -0,0 +1,900 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  timerwheel.cpp
+//  SkyBluetoothRcu
+//
+
+#include "timerwheel.h"
+#include "dumper.h"
+#include "logging.h"
+
+#include <QThreadStorage>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__linux__)
+#  include <sys/timerfd.h>
+#endif
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class TimerWheel
+	\brief Hierarchical timer wheel shared by all the state machines and
+	service timeouts running on a thread.
+
+	Every QTimer and QObject::startTimer() call registers and unregisters a
+	timer with the event dispatcher, and each one is a separate wakeup of the
+	main loop.  The wheel replaces them with a single kernel timer per
+	thread, on Linux a timerfd, which is only ever armed for the next tick
+	that has something to do.
+
+	The wheel has 5 levels of 64 slots with a 1ms tick, so it covers about
+	12 days.  Timers further out than that are parked in the last level and
+	re-inserted when it cascades.  Arming and cancelling a timer is O(1),
+	the timers are kept in a pool of nodes linked into the slot lists, and
+	the next tick to wake up for is found from a bitmap of the occupied
+	slots at each level.  Cancelling a timer doesn't re-arm the kernel
+	timer, if it was the next to expire the wheel just wakes up and finds
+	nothing to do, which is cheaper than a syscall on every cancel.
+
+	All the timers that are due when the wheel wakes up are expired as one
+	batch.  As with the default Qt::CoarseTimer type, timers longer than
+	40ms may expire up to 5% late, this is used to round their expiry time
+	so that timers armed around the same time expire on the same tick.
+
+	The wheel is thread safe, timers can be armed and cancelled from any
+	thread, however the clients are always called on the thread that owns
+	the wheel.
+
+ */
+
+// -----------------------------------------------------------------------------
+/*!
+	\class TimerWheel::Client
+	\brief Interface for objects that arm timers on the TimerWheel.
+
+	TimerWheel::Client::timerWheelExpired() is called on the wheel's thread
+	when a timer expires, with the \c data value the timer was armed with.
+	Clients must cancel all their timers before they are destroyed.
+
+ */
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the timer wheel for the calling thread, creating it if this is
+	the first call on the thread.
+
+	The wheel is deleted when the thread exits and the last reference to it
+	is released, so clients should hold on to the returned pointer for as
+	long as they have timers armed.
+
+ */
+QSharedPointer<TimerWheel> TimerWheel::instance()
+{
+	static QThreadStorage< QSharedPointer<TimerWheel> > wheels;
+
+	if (Q_UNLIKELY(!wheels.hasLocalData()))
+		wheels.setLocalData(QSharedPointer<TimerWheel>(new TimerWheel));
+
+	return wheels.localData();
+}
+
+TimerWheel::TimerWheel()
+	: QObject(nullptr)
+	, m_epochNsecs(monotonicNsecs())
+	, m_now(0)
+	, m_armedTick(-1)
+	, m_freeNodes(-1)
+#if defined(__linux__)
+	, m_timerFd(-1)
+	, m_notifier(nullptr)
+#else
+	, m_timer(nullptr)
+#endif
+{
+	for (List &list : m_lists) {
+		list.head = -1;
+		list.tail = -1;
+	}
+
+	memset(m_occupied, 0x00, sizeof(m_occupied));
+	memset(&m_stats, 0x00, sizeof(m_stats));
+
+#if defined(__linux__)
+	m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (m_timerFd < 0) {
+		qErrnoWarning(errno, "failed to create timerfd");
+		return;
+	}
+
+	m_notifier = new QSocketNotifier(m_timerFd, QSocketNotifier::Read, this);
+	QObject::connect(m_notifier, &QSocketNotifier::activated,
+	                 this, &TimerWheel::onKernelTimerExpired);
+#else
+	m_timer = new QTimer(this);
+	m_timer->setSingleShot(true);
+	m_timer->setTimerType(Qt::PreciseTimer);
+	QObject::connect(m_timer, &QTimer::timeout,
+	                 this, &TimerWheel::onKernelTimerExpired);
+#endif
+}
+
+TimerWheel::~TimerWheel()
+{
+#if defined(__linux__)
+	if (m_notifier) {
+		m_notifier->setEnabled(false);
+		delete m_notifier;
+	}
+
+	if ((m_timerFd >= 0) && (::close(m_timerFd) != 0))
+		qErrnoWarning(errno, "failed to close timerfd");
+#endif
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the current monotonic time in nanoseconds.
+
+ */
+qint64 TimerWheel::monotonicNsecs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (qint64(ts.tv_sec) * 1000000000LL) + qint64(ts.tv_nsec);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the current time in wheel ticks, i.e. the number of whole
+	milliseconds since the wheel was created.
+
+ */
+qint64 TimerWheel::currentTick() const
+{
+	return (monotonicNsecs() - m_epochNsecs) / 1000000;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Arms a single shot timer that expires in \a msecs milliseconds, when it
+	does TimerWheel::Client::timerWheelExpired() is called on \a client with
+	the timer id and \a data.
+
+	Returns the id of the timer, which is always positive, or \c -1 if the
+	arguments are invalid.
+
+	\threadsafe
+ */
+qint64 TimerWheel::arm(Client *client, int msecs, quintptr data)
+{
+	if (Q_UNLIKELY(!client || (msecs < 0))) {
+		qWarning("invalid timer client or interval");
+		return -1;
+	}
+
+	const qint64 nowNsecs = monotonicNsecs() - m_epochNsecs;
+
+	// round up so the timer never expires early
+	qint64 expiry = (nowNsecs + (qint64(msecs) * 1000000) + 999999) / 1000000;
+
+	// and then up to the largest power of 2 that is within 5% of the
+	// interval, so timers armed at about the same time expire together
+	const int slack = (msecs / 20);
+	if (slack >= 2) {
+		const qint64 granularity = Q_INT64_C(1) << (31 - __builtin_clz(uint(slack)));
+		expiry = (expiry + granularity - 1) & ~(granularity - 1);
+	}
+
+	QMutexLocker locker(&m_lock);
+
+	// bring the wheel up to date before inserting, otherwise after a long
+	// idle period a short timer would go into one of the upper levels and
+	// need cascading down
+	advance(nowNsecs / 1000000);
+
+	int index = m_freeNodes;
+	if (index >= 0) {
+		m_freeNodes = m_nodes[index].next;
+	} else {
+		const Node blank = { 0, nullptr, 0, 1, -1, -1, -1 };
+
+		index = m_nodes.size();
+		m_nodes.append(blank);
+	}
+
+	Node &node = m_nodes[index];
+	node.expiry = expiry;
+	node.client = client;
+	node.data = data;
+
+	insertNode(index);
+
+	const qint64 timerId = (qint64(node.generation) << 32) | qint64(index);
+
+	m_stats.armed++;
+	m_stats.active++;
+	if (m_stats.active > m_stats.peakActive)
+		m_stats.peakActive = m_stats.active;
+
+	rearm();
+
+	return timerId;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Cancels the timer with \a timerId that was armed by \a client.  Returns
+	\c true if the timer was cancelled, or \c false if it had already expired,
+	been cancelled or belongs to another client.
+
+	\threadsafe
+ */
+bool TimerWheel::cancel(Client *client, qint64 timerId)
+{
+	const int index = int(timerId & 0xffffffff);
+	const quint32 generation = quint32(timerId >> 32);
+
+	QMutexLocker locker(&m_lock);
+
+	if (Q_UNLIKELY((timerId <= 0) || (index >= m_nodes.size())))
+		return false;
+
+	const Node &node = m_nodes[index];
+	if ((node.generation != generation) || (node.list < 0) ||
+	    (node.client != client))
+		return false;
+
+	unlinkNode(index);
+	freeNode(index);
+
+	m_stats.cancelled++;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Cancels all the timers armed by \a client, this should be called by
+	clients before they're destroyed.  Returns the number of timers
+	cancelled.
+
+	Unlike arming and cancelling a single timer this walks all the timers in
+	the wheel.
+
+	\threadsafe
+ */
+int TimerWheel::cancelAll(Client *client)
+{
+	QMutexLocker locker(&m_lock);
+
+	int cancelled = 0;
+
+	for (int index = 0; index < m_nodes.size(); index++) {
+		const Node &node = m_nodes[index];
+		if ((node.list >= 0) && (node.client == client)) {
+			unlinkNode(index);
+			freeNode(index);
+			cancelled++;
+		}
+	}
+
+	m_stats.cancelled += cancelled;
+
+	return cancelled;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Cancels all the timers armed by \a client with the given \a data value.
+	Returns the number of timers cancelled.
+
+	\threadsafe
+ */
+int TimerWheel::cancelAll(Client *client, quintptr data)
+{
+	QMutexLocker locker(&m_lock);
+
+	int cancelled = 0;
+
+	for (int index = 0; index < m_nodes.size(); index++) {
+		const Node &node = m_nodes[index];
+		if ((node.list >= 0) && (node.client == client) && (node.data == data)) {
+			unlinkNode(index);
+			freeNode(index);
+			cancelled++;
+		}
+	}
+
+	m_stats.cancelled += cancelled;
+
+	return cancelled;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the number of milliseconds until the timer with \a timerId
+	expires, or \c -1 if the timer isn't armed.
+
+	\threadsafe
+ */
+int TimerWheel::remainingTime(qint64 timerId) const
+{
+	const int index = int(timerId & 0xffffffff);
+	const quint32 generation = quint32(timerId >> 32);
+
+	QMutexLocker locker(&m_lock);
+
+	if ((timerId <= 0) || (index >= m_nodes.size()))
+		return -1;
+
+	const Node &node = m_nodes[index];
+	if ((node.generation != generation) || (node.list < 0))
+		return -1;
+
+	const qint64 remaining = (node.expiry * 1000000) - (monotonicNsecs() - m_epochNsecs);
+	if (remaining <= 0)
+		return 0;
+
+	return int((remaining + 999999) / 1000000);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Inserts the node at \a index into the slot for its expiry time, the level
+	is picked by how far away the expiry is from the current wheel time.
+
+ */
+void TimerWheel::insertNode(int index)
+{
+	qint64 delta = m_nodes[index].expiry - m_now;
+	if (delta < 0)
+		delta = 0;
+	else if (delta >= MaxRange)
+		delta = MaxRange - 1;
+
+	int level = 0;
+	while ((level < (Levels - 1)) && ((delta >> (LevelBits * (level + 1))) != 0))
+		level++;
+
+	const int slot = int((m_now + delta) >> (LevelBits * level)) & SlotMask;
+
+	appendNode((level * SlotsPerLevel) + slot, index);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Adds the node at \a index to the tail of \a list.
+
+ */
+void TimerWheel::appendNode(int list, int index)
+{
+	Node &node = m_nodes[index];
+	List &nodes = m_lists[list];
+
+	node.list = list;
+	node.prev = nodes.tail;
+	node.next = -1;
+
+	if (nodes.tail >= 0)
+		m_nodes[nodes.tail].next = index;
+	else
+		nodes.head = index;
+
+	nodes.tail = index;
+
+	if (list < ExpiredList)
+		m_occupied[list >> LevelBits] |= (Q_UINT64_C(1) << (list & SlotMask));
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Removes the node at \a index from whichever list it's on.
+
+ */
+void TimerWheel::unlinkNode(int index)
+{
+	Node &node = m_nodes[index];
+	List &nodes = m_lists[node.list];
+
+	if (node.prev >= 0)
+		m_nodes[node.prev].next = node.next;
+	else
+		nodes.head = node.next;
+
+	if (node.next >= 0)
+		m_nodes[node.next].prev = node.prev;
+	else
+		nodes.tail = node.prev;
+
+	if ((nodes.head < 0) && (node.list < ExpiredList))
+		m_occupied[node.list >> LevelBits] &= ~(Q_UINT64_C(1) << (node.list & SlotMask));
+
+	node.list = -1;
+	node.prev = -1;
+	node.next = -1;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Puts the unlinked node at \a index back on the free list, the generation
+	is bumped so any stale ids for the node no longer match.
+
+ */
+void TimerWheel::freeNode(int index)
+{
+	Node &node = m_nodes[index];
+
+	node.client = nullptr;
+	node.generation = (node.generation + 1) & 0x7fffffff;
+	if (node.generation == 0)
+		node.generation = 1;
+
+	node.next = m_freeNodes;
+	m_freeNodes = index;
+
+	m_stats.active--;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Returns the next tick at or after the current wheel time at which either
+	a level 0 slot expires or an upper level slot cascades, or \c -1 if the
+	wheel is empty.
+
+ */
+qint64 TimerWheel::nextEventTick() const
+{
+	qint64 next = -1;
+
+	for (int level = 0; level < Levels; level++) {
+
+		const quint64 occupied = m_occupied[level];
+		if (!occupied)
+			continue;
+
+		// the first block at this level that starts at or after now, for
+		// level 0 it's just now
+		const int shift = LevelBits * level;
+		const qint64 block = (m_now + (Q_INT64_C(1) << shift) - 1) >> shift;
+
+		// rotate the occupied bits so the bit 0 is the slot for that block
+		const int rotate = int(block) & SlotMask;
+		const quint64 rotated = (occupied >> rotate) | (occupied << ((SlotsPerLevel - rotate) & SlotMask));
+
+		const qint64 tick = (block + __builtin_ctzll(rotated)) << shift;
+		if ((next < 0) || (tick < next))
+			next = tick;
+	}
+
+	return next;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Moves the wheel time forward to just after \a target, any timers that
+	expire on or before \a target are moved to the expired list.  The wheel
+	jumps straight between the ticks that have something to do rather than
+	stepping through every tick.
+
+ */
+void TimerWheel::advance(qint64 target)
+{
+	while (m_now <= target) {
+
+		const qint64 next = nextEventTick();
+		if ((next < 0) || (next > target)) {
+			m_now = target + 1;
+			break;
+		}
+
+		m_now = next;
+
+		// cascade the upper levels down when crossing their boundaries, lower
+		// levels first
+		for (int level = 1; level < Levels; level++) {
+			const int shift = LevelBits * level;
+			if ((m_now & ((Q_INT64_C(1) << shift) - 1)) != 0)
+				break;
+
+			cascade(level, int(m_now >> shift) & SlotMask);
+		}
+
+		// everything in the level 0 slot has expired
+		List &nodes = m_lists[int(m_now) & SlotMask];
+		while (nodes.head >= 0) {
+			const int index = nodes.head;
+			unlinkNode(index);
+			appendNode(ExpiredList, index);
+		}
+
+		m_now++;
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Re-inserts all the nodes in \a slot of \a level, which will put them in a
+	lower level now the wheel time has moved on.
+
+ */
+void TimerWheel::cascade(int level, int slot)
+{
+	List &nodes = m_lists[(level * SlotsPerLevel) + slot];
+
+	// detach the whole list first as nodes may be re-inserted into the same
+	// slot if their expiry is beyond the range of the wheel
+	int index = nodes.head;
+	nodes.head = -1;
+	nodes.tail = -1;
+	m_occupied[level] &= ~(Q_UINT64_C(1) << slot);
+
+	while (index >= 0) {
+		const int next = m_nodes[index].next;
+		insertNode(index);
+		m_stats.cascaded++;
+		index = next;
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Arms the kernel timer for the next tick the wheel needs to wake up for,
+	or disarms it if the wheel is empty.  The kernel timer is only touched
+	if the tick has changed.
+
+ */
+void TimerWheel::rearm()
+{
+	qint64 tick;
+	if (m_lists[ExpiredList].head >= 0)
+		tick = qMax<qint64>(m_now - 1, 0);
+	else
+		tick = nextEventTick();
+
+	if (tick == m_armedTick)
+		return;
+
+	m_armedTick = tick;
+	m_stats.kernelRearms++;
+
+#if defined(__linux__)
+	struct itimerspec spec;
+	memset(&spec, 0x00, sizeof(spec));
+
+	if (tick >= 0) {
+		const qint64 nsecs = m_epochNsecs + (tick * 1000000);
+		spec.it_value.tv_sec = nsecs / 1000000000LL;
+		spec.it_value.tv_nsec = nsecs % 1000000000LL;
+	}
+
+	if (Q_UNLIKELY(timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr) != 0))
+		qErrnoWarning(errno, "failed to set timerfd");
+#else
+	if (tick < 0) {
+		QMetaObject::invokeMethod(m_timer, "stop");
+	} else {
+		const int msecs = int(qMax<qint64>(tick - currentTick(), 0));
+		QMetaObject::invokeMethod(m_timer, "start", Q_ARG(int, msecs));
+	}
+#endif
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when the kernel timer expires, moves the wheel up to the current
+	time and then expires everything that is due.
+
+ */
+void TimerWheel::onKernelTimerExpired()
+{
+#if defined(__linux__)
+	quint64 expirations;
+	if (TEMP_FAILURE_RETRY(::read(m_timerFd, &expirations, sizeof(expirations))) < 0) {
+		if (errno != EAGAIN)
+			qErrnoWarning(errno, "failed to read timerfd");
+	}
+#endif
+
+	QMutexLocker locker(&m_lock);
+
+	m_stats.wakeups++;
+	m_armedTick = -1;
+
+	advance(currentTick());
+
+	if (m_lists[ExpiredList].head < 0) {
+		m_stats.idleWakeups++;
+		rearm();
+		return;
+	}
+
+	locker.unlock();
+
+	fireExpired();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Calls the clients of all the timers on the expired list, in the order
+	they expired.  The lock is dropped around each call so clients can arm
+	and cancel timers, including ones further down the expired list.
+
+	Only the timers that were on the list when this was called are expired,
+	anything that expires while the clients are being called is left for
+	the next wakeup so a client re-arming a 0ms timer can't starve the
+	event loop.
+
+ */
+void TimerWheel::fireExpired()
+{
+	QMutexLocker locker(&m_lock);
+
+	int remaining = 0;
+	for (int index = m_lists[ExpiredList].head; index >= 0; index = m_nodes[index].next)
+		remaining++;
+
+	while ((remaining-- > 0) && (m_lists[ExpiredList].head >= 0)) {
+
+		const int index = m_lists[ExpiredList].head;
+		const Node &node = m_nodes[index];
+
+		Client *client = node.client;
+		const quintptr data = node.data;
+		const qint64 timerId = (qint64(node.generation) << 32) | qint64(index);
+
+		unlinkNode(index);
+		freeNode(index);
+
+		m_stats.expired++;
+
+		locker.unlock();
+
+		client->timerWheelExpired(timerId, data);
+
+		locker.relock();
+	}
+
+	rearm();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns a snapshot of the wheel's counters.
+
+	\threadsafe
+ */
+TimerWheel::Stats TimerWheel::stats() const
+{
+	QMutexLocker locker(&m_lock);
+	return m_stats;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Dumps the wheel's counters to \a out.
+
+ */
+void TimerWheel::dump(Dumper out) const
+{
+	const Stats stats = this->stats();
+
+	out.printLine("active timers: %d (peak %d)", stats.active, stats.peakActive);
+	out.printLine("armed: %llu", stats.armed);
+	out.printLine("cancelled: %llu", stats.cancelled);
+	out.printLine("expired: %llu", stats.expired);
+	out.printLine("cascaded: %llu", stats.cascaded);
+	out.printLine("wakeups: %llu (%llu with nothing due)", stats.wakeups,
+	              stats.idleWakeups);
+	out.printLine("kernel timer updates: %llu", stats.kernelRearms);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class WheelTimer
+	\brief Drop-in replacement for QTimer that runs on the thread's
+	TimerWheel.
+
+	Only the subset of the QTimer API used by the daemon is provided, the
+	timer type is always the equivalent of Qt::CoarseTimer.  Starting and
+	stopping the timer doesn't register anything with the event dispatcher,
+	it just links or unlinks a node in the wheel.
+
+ */
+
+WheelTimer::WheelTimer(QObject *parent)
+	: QObject(parent)
+	, m_wheel(TimerWheel::instance())
+	, m_interval(0)
+	, m_singleShot(false)
+	, m_timerId(-1)
+{
+}
+
+WheelTimer::~WheelTimer()
+{
+	stop();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns \c true if the timer is running.
+
+ */
+bool WheelTimer::isActive() const
+{
+	return (m_timerId > 0);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the timeout interval in milliseconds.
+
+ */
+int WheelTimer::interval() const
+{
+	return m_interval;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Sets the timeout interval to \a msecs milliseconds, if the timer is
+	running it is restarted with the new interval.
+
+ */
+void WheelTimer::setInterval(int msecs)
+{
+	m_interval = qMax(msecs, 0);
+
+	if (m_timerId > 0)
+		start();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns \c true if this is a single shot timer.
+
+ */
+bool WheelTimer::isSingleShot() const
+{
+	return m_singleShot;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Sets whether the timer fires once, if \a singleShot is \c true, or
+	repeatedly.
+
+ */
+void WheelTimer::setSingleShot(bool singleShot)
+{
+	m_singleShot = singleShot;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Returns the number of milliseconds until the timer fires, or \c -1 if
+	the timer isn't running.
+
+ */
+int WheelTimer::remainingTime() const
+{
+	if (m_timerId <= 0)
+		return -1;
+
+	return m_wheel->remainingTime(m_timerId);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Starts or restarts the timer with the current interval.
+
+ */
+void WheelTimer::start()
+{
+	if (m_timerId > 0)
+		m_wheel->cancel(this, m_timerId);
+
+	m_timerId = m_wheel->arm(this, m_interval);
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Sets the interval to \a msecs milliseconds and starts or restarts the
+	timer.
+
+ */
+void WheelTimer::start(int msecs)
+{
+	m_interval = qMax(msecs, 0);
+	start();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Stops the timer.
+
+ */
+void WheelTimer::stop()
+{
+	if (m_timerId > 0) {
+		m_wheel->cancel(this, m_timerId);
+		m_timerId = -1;
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called by the wheel when the timer expires, re-arms the timer if it's
+	repeating and then emits the timeout() signal.
+
+ */
+void WheelTimer::timerWheelExpired(qint64 timerId, quintptr data)
+{
+	Q_UNUSED(data);
+
+	if (timerId != m_timerId)
+		return;
+
+	if (m_singleShot)
+		m_timerId = -1;
+	else
+		m_timerId = m_wheel->arm(this, m_interval);
+
+	emit timeout();
+}
@@ -0,0 +1,187 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//
+//  timerwheel.h
+//  SkyBluetoothRcu
+//
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <QObject>
+#include <QMutex>
+#include <QVector>
+#include <QSharedPointer>
+
+class Dumper;
+class QSocketNotifier;
+class QTimer;
+
+
+class TimerWheel : public QObject
+{
+	Q_OBJECT
+
+public:
+	class Client
+	{
+	public:
+		virtual ~Client() = default;
+		virtual void timerWheelExpired(qint64 timerId, quintptr data) = 0;
+	};
+
+	struct Stats {
+		quint64 armed;
+		quint64 cancelled;
+		quint64 expired;
+		quint64 cascaded;
+		quint64 wakeups;
+		quint64 idleWakeups;
+		quint64 kernelRearms;
+		int active;
+		int peakActive;
+	};
+
+public:
+	static QSharedPointer<TimerWheel> instance();
+
+	~TimerWheel() final;
+
+public:
+	qint64 arm(Client *client, int msecs, quintptr data = 0);
+	bool cancel(Client *client, qint64 timerId);
+	int cancelAll(Client *client);
+	int cancelAll(Client *client, quintptr data);
+
+	int remainingTime(qint64 timerId) const;
+
+	Stats stats() const;
+	void dump(Dumper out) const;
+
+private:
+	TimerWheel();
+
+	static qint64 monotonicNsecs();
+	qint64 currentTick() const;
+
+	void insertNode(int index);
+	void appendNode(int list, int index);
+	void unlinkNode(int index);
+	void freeNode(int index);
+
+	qint64 nextEventTick() const;
+	void advance(qint64 target);
+	void cascade(int level, int slot);
+	void rearm();
+
+	void onKernelTimerExpired();
+	void fireExpired();
+
+private:
+	static const int LevelBits = 6;
+	static const int SlotsPerLevel = (1 << LevelBits);
+	static const int SlotMask = (SlotsPerLevel - 1);
+	static const int Levels = 5;
+	static const qint64 MaxRange = (Q_INT64_C(1) << (LevelBits * Levels));
+
+	static const int ExpiredList = (Levels * SlotsPerLevel);
+	static const int ListCount = (ExpiredList + 1);
+
+	struct Node {
+		qint64 expiry;
+		Client *client;
+		quintptr data;
+		quint32 generation;
+		int list;
+		int prev;
+		int next;
+	};
+
+	struct List {
+		int head;
+		int tail;
+	};
+
+	mutable QMutex m_lock;
+
+	const qint64 m_epochNsecs;
+	qint64 m_now;
+	qint64 m_armedTick;
+
+	QVector<Node> m_nodes;
+	int m_freeNodes;
+
+	List m_lists[ListCount];
+	quint64 m_occupied[Levels];
+
+	Stats m_stats;
+
+#if defined(__linux__)
+	int m_timerFd;
+	QSocketNotifier *m_notifier;
+#else
+	QTimer *m_timer;
+#endif
+
+private:
+	Q_DISABLE_COPY(TimerWheel)
+};
+
+
+class WheelTimer : public QObject, private TimerWheel::Client
+{
+	Q_OBJECT
+
+public:
+	explicit WheelTimer(QObject *parent = nullptr);
+	~WheelTimer() final;
+
+public:
+	bool isActive() const;
+
+	int interval() const;
+	void setInterval(int msecs);
+
+	bool isSingleShot() const;
+	void setSingleShot(bool singleShot);
+
+	int remainingTime() const;
+
+public slots:
+	void start();
+	void start(int msecs);
+	void stop();
+
+signals:
+	void timeout();
+
+private:
+	void timerWheelExpired(qint64 timerId, quintptr data) override;
+
+private:
+	const QSharedPointer<TimerWheel> m_wheel;
+
+	int m_interval;
+	bool m_singleShot;
+	qint64 m_timerId;
+};
+
+
+#endif // !defined(TIMERWHEEL_H)
@@ -0,0 +1,159 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+//
+//  unixpacketreader.cpp
+//  SkyBluetoothRcu
+//
+
+#include "unixpacketreader.h"
+#include "logging.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+
+
+// -----------------------------------------------------------------------------
+/*!
+	\class UnixPacketReader
+	\brief Reads batches of packets from a packetised pipe or socket.
+
+	bluez hands out the GATT notification pipes as either a real pipe opened
+	with \c O_DIRECT (older versions) or a \c SOCK_SEQPACKET socket (newer
+	versions), either way each read returns a single notification.  This
+	reads up to \c MaxBatchSize packets at a time into a fixed buffer, with a
+	single \c recvmmsg call for sockets, falling back to a \c read per
+	packet if the fd turns out not to be a socket.
+
+	The packets are stored back to back every stride() bytes in packets(),
+	with their sizes in lengths().  All the buffers are allocated on
+	construction so nothing is allocated when reading.
+
+ */
+
+UnixPacketReader::UnixPacketReader(size_t stride)
+	: m_stride(stride)
+	, m_useRecvMMsg(true)
+	, m_buffer(new quint8[MaxBatchSize * stride])
+	, m_ioVecs(new struct iovec[MaxBatchSize])
+	, m_msgs(new struct mmsghdr[MaxBatchSize])
+{
+	memset(m_msgs, 0x00, sizeof(struct mmsghdr) * MaxBatchSize);
+
+	for (int i = 0; i < MaxBatchSize; i++) {
+		m_ioVecs[i].iov_base = m_buffer + (i * m_stride);
+		m_ioVecs[i].iov_len = m_stride;
+
+		m_msgs[i].msg_hdr.msg_iov = &m_ioVecs[i];
+		m_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+UnixPacketReader::~UnixPacketReader()
+{
+	delete [] m_msgs;
+	delete [] m_ioVecs;
+	delete [] m_buffer;
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Reads up to \c MaxBatchSize packets from the non-blocking \a fd, returning
+	the number of packets read.  If the remote end was closed then \a closed
+	is set to \c true, any packets read before the close are still returned.
+
+	If fewer than \c MaxBatchSize packets are returned the fd has been
+	drained, unless a packet was dropped because it was larger than the
+	stride.  In that case anything left is picked up on the next wake-up.
+
+ */
+int UnixPacketReader::read(int fd, bool *closed)
+{
+	*closed = false;
+
+	int count = 0;
+
+	if (m_useRecvMMsg) {
+
+		int ret = TEMP_FAILURE_RETRY(::recvmmsg(fd, m_msgs, MaxBatchSize,
+		                                        MSG_DONTWAIT, nullptr));
+		if (ret >= 0) {
+			for (int i = 0; i < ret; i++) {
+
+				// a zero length message means the remote end has closed
+				if (m_msgs[i].msg_len == 0) {
+					*closed = true;
+					break;
+				}
+
+				// don't pass on a packet that didn't fit in the buffer
+				if (Q_UNLIKELY(m_msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+					qWarning("dropped packet larger than %zu bytes", m_stride);
+					continue;
+				}
+
+				// keep the packets back to back if any were dropped
+				if (i != count)
+					memcpy(m_buffer + (count * m_stride), m_buffer + (i * m_stride),
+					       m_msgs[i].msg_len);
+
+				m_lengths[count++] = static_cast<quint16>(m_msgs[i].msg_len);
+			}
+
+			return count;
+		}
+
+		if (errno != ENOTSOCK) {
+			// check if the socket is empty, if not the error is valid
+			if ((errno != EWOULDBLOCK) && (errno != EAGAIN))
+				qErrnoWarning(errno, "failed to read from packet socket");
+
+			return 0;
+		}
+
+		// not a socket so fall back to reading the pipe
+		qInfo("packet fd is not a socket, batching using read()");
+		m_useRecvMMsg = false;
+	}
+
+	while (count < MaxBatchSize) {
+
+		quint8 *buffer = m_buffer + (count * m_stride);
+
+		ssize_t rd = TEMP_FAILURE_RETRY(::read(fd, buffer, m_stride));
+		if (rd < 0) {
+			if ((errno != EWOULDBLOCK) && (errno != EAGAIN))
+				qErrnoWarning(errno, "failed to read from packet pipe");
+			break;
+
+		} else if (rd == 0) {
+			*closed = true;
+			break;
+		}
+
+		m_lengths[count++] = static_cast<quint16>(rd);
+	}
+
+	return count;
+}
@@ -0,0 +1,79 @@
+/*
+* If not stated otherwise in this file or this component's LICENSE file the
+* following copyright and licenses apply:
+*
+* Copyright 2017-2020 Sky UK
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+
+//
+//  unixpacketreader.h
+//  SkyBluetoothRcu
+//
+
+#ifndef UNIXPACKETREADER_H
+#define UNIXPACKETREADER_H
+
+#include <QtGlobal>
+
+#include <cstddef>
+
+struct iovec;
+struct mmsghdr;
+
+
+class UnixPacketReader
+{
+public:
+	static const int MaxBatchSize = 32;
+
+public:
+	explicit UnixPacketReader(size_t stride);
+	~UnixPacketReader();
+
+public:
+	int read(int fd, bool *closed);
+
+	inline const quint8 *packets() const
+	{
+		return m_buffer;
+	}
+
+	inline size_t stride() const
+	{
+		return m_stride;
+	}
+
+	inline const quint16 *lengths() const
+	{
+		return m_lengths;
+	}
+
+private:
+	const size_t m_stride;
+
+	bool m_useRecvMMsg;
+
+	quint8 *m_buffer;
+	struct iovec *m_ioVecs;
+	struct mmsghdr *m_msgs;
+	quint16 m_lengths[MaxBatchSize];
+
+private:
+	Q_DISABLE_COPY(UnixPacketReader)
+};
+
+
+#endif // !defined(UNIXPACKETREADER_H)
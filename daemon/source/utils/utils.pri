@@ -10,14 +10,19 @@ HEADERS += \
 	$$PWD/filedescriptor.h \
 	$$PWD/unixpipenotifier.h \
 	$$PWD/unixpipesplicer.h \
+	$$PWD/unixpacketreader.h \
 	$$PWD/unixsignalnotifier.h \
 	$$PWD/unixsignalnotifier_p.h \
 	$$PWD/statemachine.h \
+	$$PWD/stategraph.h \
+	$$PWD/timerwheel.h \
+	$$PWD/mpscqueue.h \
 	$$PWD/voicecodec.h \
 	$$PWD/adpcmcodec.h \
 	$$PWD/edid.h \
 	$$PWD/crc32.h \
 	$$PWD/fwimagefile.h \
+	$$PWD/fwupgradeprotocol.h \
 	$$PWD/linuxinputdevice.h \
 	$$PWD/linuxinputdeviceinfo.h \
 	$$PWD/inputdevicemanager.h \
@@ -34,8 +39,11 @@ SOURCES += \
 	$$PWD/filedescriptor.cpp \
 	$$PWD/unixpipenotifier.cpp \
 	$$PWD/unixpipesplicer.cpp \
+	$$PWD/unixpacketreader.cpp \
 	$$PWD/unixsignalnotifier.cpp \
 	$$PWD/statemachine.cpp \
+	$$PWD/stategraph.cpp \
+	$$PWD/timerwheel.cpp \
 	$$PWD/adpcmcodec.cpp \
 	$$PWD/edid.cpp \
 	$$PWD/crc32.cpp \
@@ -61,6 +61,16 @@ public:
 	Q_ENUMS(AudioStreamingCodec);
 #endif
 
+	enum AudioStreamingTransport {
+		PipeTransport = 0,
+		SharedMemoryTransport = 1,
+	};
+#if QT_VERSION > QT_VERSION_CHECK(5, 4, 0)
+	Q_ENUM(AudioStreamingTransport);
+#else
+	Q_ENUMS(AudioStreamingTransport);
+#endif
+
 	enum IrLookupType {
 		Invalid = 0,
 		Any = 1,
@@ -94,7 +104,8 @@ public slots:
 
 	virtual void findMe(const BleAddress &device, FindMeLevel level) = 0;
 
-	virtual void startAudioStreaming(const BleAddress &device, AudioStreamingCodec codec, const QString &filePath) = 0;
+	virtual void startAudioStreaming(const BleAddress &device, AudioStreamingCodec codec, const QString &filePath,
+	                                 AudioStreamingTransport transport) = 0;
 	virtual void stopAudioStreaming(const BleAddress &device) = 0;
 	virtual void setAudioStreamingGain(const BleAddress &device, int level) = 0;
 
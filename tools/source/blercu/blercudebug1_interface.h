@@ -73,6 +73,11 @@ public:
 
 
 public Q_SLOTS: // METHODS
+	inline QDBusPendingReply<QString> Dump()
+	{
+		QList<QVariant> argumentList;
+		return asyncCallWithArgumentList(QStringLiteral("Dump"), argumentList);
+	}
 
 Q_SIGNALS: // SIGNALS
 };
@@ -132,6 +132,12 @@ public Q_SLOTS: // METHODS
 		return asyncCallWithArgumentList(QStringLiteral("GetAudioStatus"), argumentList);
 	}
 
+	inline QDBusPendingReply<QVariantMap> GetAudioStats()
+	{
+		QList<QVariant> argumentList;
+		return asyncCallWithArgumentList(QStringLiteral("GetAudioStats"), argumentList);
+	}
+
 	inline QDBusPendingReply<> ProgramIrSignals(qint32 code, QList<quint16> signals_)
 	{
 		QList<QVariant> argumentList;
@@ -153,6 +159,20 @@ public Q_SLOTS: // METHODS
 		return asyncCallWithArgumentList(QStringLiteral("StartAudioStreaming"), argumentList);
 	}
 
+	inline QDBusPendingReply<QDBusUnixFileDescriptor> StartAudioStreamingWithLatency(quint32 encoding, quint32 latency_budget)
+	{
+		QList<QVariant> argumentList;
+		argumentList << QVariant::fromValue(encoding) << QVariant::fromValue(latency_budget);
+		return asyncCallWithArgumentList(QStringLiteral("StartAudioStreamingWithLatency"), argumentList);
+	}
+
+	inline QDBusPendingReply<QDBusUnixFileDescriptor, QDBusUnixFileDescriptor> StartAudioStreamingSharedMemory(quint32 encoding, quint32 latency_budget)
+	{
+		QList<QVariant> argumentList;
+		argumentList << QVariant::fromValue(encoding) << QVariant::fromValue(latency_budget);
+		return asyncCallWithArgumentList(QStringLiteral("StartAudioStreamingSharedMemory"), argumentList);
+	}
+
 	inline QDBusPendingReply<> StartAudioStreamingTo(quint32 encoding, const QString &file_path)
 	{
 		QList<QVariant> argumentList;
@@ -69,6 +69,12 @@ public Q_SLOTS: // METHODS
 		return asyncCallWithArgumentList(QStringLiteral("CancelUpgrade"), argumentList);
 	}
 
+	inline QDBusPendingReply<QVariantMap> GetUpgradeStats()
+	{
+		QList<QVariant> argumentList;
+		return asyncCallWithArgumentList(QStringLiteral("GetUpgradeStats"), argumentList);
+	}
+
 Q_SIGNALS: // SIGNALS
 	void upgradingChanged(bool upgrading);
 	void progressChanged(qint32 progress);
@@ -486,6 +486,16 @@ void BleRcuCmdHandler::deviceInfo(const BleAddress &device)
 		qWarning() << "\tAudio: PacketsReceived:" << reply.argumentAt<1>();
 		qWarning() << "\tAudio: PacketsExpected:" << reply.argumentAt<2>();
 	}
+
+	QDBusPendingReply<QVariantMap> statsReply = proxy->GetAudioStats();
+	statsReply.waitForFinished();
+	if (statsReply.isError()) {
+		showDBusError(statsReply.error());
+	} else {
+		const QVariantMap stats = statsReply.value();
+		for (QVariantMap::const_iterator it = stats.constBegin(); it != stats.constEnd(); ++it)
+			qWarning() << "\tAudio:" << qPrintable(it.key() + ':') << it.value().toUInt();
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -515,12 +525,15 @@ void BleRcuCmdHandler::findMe(const BleAddress &device, FindMeLevel level)
 /*!
 	Slot called when the user types 'audio <dev> <start/stop>'.
 
-	This sends a dbus request to the daemon to start / stop audio streaming.
+	This sends a dbus request to the daemon to start / stop audio streaming,
+	the audio is either read from a pipe or a shared memory ring depending on
+	the \a transport.
 
  */
 void BleRcuCmdHandler::startAudioStreaming(const BleAddress &device,
                                            AudioStreamingCodec codec,
-                                           const QString &filePath)
+                                           const QString &filePath,
+                                           AudioStreamingTransport transport)
 {
 	// get the dbus proxy for the device
 	QSharedPointer<ComSkyBleRcuDevice1Interface> proxy = m_devices.value(device);
@@ -549,6 +562,22 @@ void BleRcuCmdHandler::startAudioStreaming(const BleAddress &device,
 		case PCM:   encoding = 2;   break;
 	}
 
+	// for shared memory the daemon returns the memfd and eventfd for the ring
+	if (transport == SharedMemoryTransport) {
+
+		QDBusPendingReply<QDBusUnixFileDescriptor, QDBusUnixFileDescriptor> reply =
+			proxy->StartAudioStreamingSharedMemory(encoding, 0);
+		reply.waitForFinished();
+		if (reply.isError()) {
+			showDBusError(reply.error());
+			return;
+		}
+
+		m_wavFile->setSharedMemorySource(reply.argumentAt<0>().fileDescriptor(),
+		                                 reply.argumentAt<1>().fileDescriptor());
+		return;
+	}
+
 	// send the request to the daemon
 	QDBusPendingReply<QDBusUnixFileDescriptor> reply = proxy->StartAudioStreaming(encoding);
 	reply.waitForFinished();
@@ -1346,6 +1375,22 @@ void BleRcuCmdHandler::onAudioGainLevelChanged(const BleAddress &device, qint32
 void BleRcuCmdHandler::onFwUpgradeStateChanged(const BleAddress &device, bool isUpgrading)
 {
 	qWarning() << "[CHG] Device" << device << "F/W Upgrading:" << isUpgrading;
+
+	// once finished print out the transfer stats
+	QSharedPointer<ComSkyBleRcuUpgrade1Interface> proxy = m_deviceUpgrades.value(device);
+	if (isUpgrading || !proxy || !proxy->isValid())
+		return;
+
+	QDBusPendingReply<QVariantMap> reply = proxy->GetUpgradeStats();
+	reply.waitForFinished();
+	if (reply.isError()) {
+		showDBusError(reply.error());
+		return;
+	}
+
+	const QVariantMap stats = reply.value();
+	for (QVariantMap::const_iterator it = stats.constBegin(); it != stats.constEnd(); ++it)
+		qWarning() << "\tF/W Upgrade:" << qPrintable(it.key() + ':') << it.value().toUInt();
 }
 
 // -----------------------------------------------------------------------------
@@ -83,7 +83,8 @@ public slots:
 
 	void findMe(const BleAddress &device, FindMeLevel level) override;
 
-	void startAudioStreaming(const BleAddress &device, AudioStreamingCodec codec, const QString &filePath) override;
+	void startAudioStreaming(const BleAddress &device, AudioStreamingCodec codec, const QString &filePath,
+	                         AudioStreamingTransport transport) override;
 	void stopAudioStreaming(const BleAddress &device) override;
 	void setAudioStreamingGain(const BleAddress &device, int level) override;
 
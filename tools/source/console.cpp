@@ -71,7 +71,7 @@ void Console::initReadLine()
 	m_readLine.addCommand("findme", { "<dev>", "<off/mid/high>" }, "Turn on/off find me for device",
 	                      this, &Console::onFindMeCommand);
 
-	m_readLine.addCommand("audio", { "<dev>", "<start/stop>", "[filepath]" }, "Turn on/off audio streaming",
+	m_readLine.addCommand("audio", { "<dev>", "<start/stop>", "[filepath]", "[pipe/shm]" }, "Turn on/off audio streaming",
 	                      this, &Console::onAudioStreamingCommand);
 	m_readLine.addCommand("set-audio-gain-level", { "<dev>", "<level>" }, "Set the audio gain level",
 	                      this, &Console::onSetAudioGainCommand);
@@ -346,9 +346,11 @@ void Console::onFindMeCommand(const QStringList &args)
 
 // -----------------------------------------------------------------------------
 /*!
-	Slot called when the user types 'audio <dev> <start/stop> [filepath]'.
+	Slot called when the user types 'audio <dev> <start/stop> [filepath] [pipe/shm]'.
 
-	This sends a dbus request to the daemon to start / stop audio streaming.
+	This sends a dbus request to the daemon to start / stop audio streaming,
+	by default the audio is read from a pipe, if \c shm is given it's read
+	from a shared memory ring instead.
 
  */
 void Console::onAudioStreamingCommand(const QStringList &args)
@@ -389,7 +391,20 @@ void Console::onAudioStreamingCommand(const QStringList &args)
 		}
 
 		const QString filePath = args[2];
-		m_cmdHandler->startAudioStreaming(address, BaseCmdHandler::PCM, filePath);
+
+		BaseCmdHandler::AudioStreamingTransport transport = BaseCmdHandler::PipeTransport;
+		if (args.length() > 3) {
+			const QString transportStr = args[3].toLower();
+			if (transportStr == "shm") {
+				transport = BaseCmdHandler::SharedMemoryTransport;
+			} else if (transportStr != "pipe") {
+				qWarning("Invalid transport argument '%s', it must be either 'pipe' or 'shm'",
+				         qPrintable(transportStr));
+				return;
+			}
+		}
+
+		m_cmdHandler->startAudioStreaming(address, BaseCmdHandler::PCM, filePath, transport);
 	}
 }
 
@@ -31,7 +31,10 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 
@@ -60,6 +63,43 @@ struct __attribute__((packed)) WaveFileHeader {
 #define data   quint32(0x64617461)   // 'data'
 
 
+// layout of the shared memory ring used by the daemon for voice audio, must
+// match the GattAudioRing layout in the daemon
+struct AudioRingHeader {
+	quint32 magic;              // 'BRAR'
+	quint32 version;            // 1
+	quint32 headerSize;
+	quint32 slotSize;
+	quint32 slotCount;
+	quint32 frameSize;
+	quint32 encoding;           // 1 = ADPCM, 2 = PCM16
+	quint32 writerFlags;
+	quint8  reserved0[32];
+
+	quint32 writeIndex;
+	quint8  reserved1[60];
+
+	quint32 readIndex;
+	quint32 readerFlags;
+	quint8  reserved2[56];
+};
+
+struct AudioRingSlot {
+	quint64 timestamp;          // CLOCK_MONOTONIC time in nanoseconds
+	quint16 length;
+	quint16 flags;
+	quint32 reserved;
+};
+
+static_assert(sizeof(AudioRingHeader) == 192, "invalid ring header size");
+static_assert(sizeof(AudioRingSlot) == 16, "invalid ring slot size");
+
+#define BRAR   quint32(0x42524152)   // 'BRAR'
+
+#define RING_WRITER_CLOSED    0x0001
+#define RING_READER_CLOSED    0x0001
+
+
 
 
 
@@ -68,6 +108,14 @@ AudioWavFile::AudioWavFile(const QString &filePath)
 	: m_file(filePath)
 	, m_pipeFd(-1)
 	, m_pipeNotifier(nullptr)
+	, m_eventFd(-1)
+	, m_eventNotifier(nullptr)
+	, m_ringSize(0)
+	, m_ring(nullptr)
+	, m_wakeups(0)
+	, m_frames(0)
+	, m_totalLatencyUsecs(0)
+	, m_maxLatencyUsecs(0)
 {
 
 	// try and open / create the output file
@@ -102,6 +150,9 @@ AudioWavFile::~AudioWavFile()
 	if ((m_pipeFd >= 0) && (close(m_pipeFd) != 0))
 		qErrnoWarning(errno, "failed to close audio pipe");
 
+	// let the daemon know we're no longer reading the ring
+	closeSharedMemorySource();
+
 	// if the output file was opened then go back and update the WAV header
 	if (m_file.isOpen()) {
 
@@ -181,6 +232,203 @@ void AudioWavFile::setPipeSource(int pipeFd)
 	QObject::connect(m_pipeNotifier, &QSocketNotifier::activated,
 	                 this, &AudioWavFile::onPipeData,
 	                 Qt::QueuedConnection);
+
+	m_wakeups = m_frames = 0;
+	m_totalLatencyUsecs = m_maxLatencyUsecs = 0;
+	m_timer.start();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	Sets the source of the audio to be the shared memory ring in \a memoryFd,
+	the \a eventFd is signalled by the daemon whenever frames are added to
+	the ring.  Both descriptors are dup'ed.
+
+	The frames in the ring are copied straight from the shared memory into
+	the file, the time each frame spent in the ring is recorded and shown
+	along with the number of wake-ups when the stream is closed.
+
+ */
+void AudioWavFile::setSharedMemorySource(int memoryFd, int eventFd)
+{
+	// clean up the old source
+	onPipeClosed();
+
+	struct stat details;
+	if (fstat(memoryFd, &details) != 0) {
+		qErrnoWarning(errno, "failed to get the size of the audio ring");
+		return;
+	}
+
+	if (static_cast<size_t>(details.st_size) < sizeof(AudioRingHeader)) {
+		qWarning("audio ring is too small");
+		return;
+	}
+
+	void *map = mmap(nullptr, details.st_size, (PROT_READ | PROT_WRITE),
+	                 MAP_SHARED, memoryFd, 0);
+	if (map == MAP_FAILED) {
+		qErrnoWarning(errno, "failed to map audio ring");
+		return;
+	}
+
+	m_ring = reinterpret_cast<quint8*>(map);
+	m_ringSize = details.st_size;
+
+	// sanity check the header
+	const AudioRingHeader *header = reinterpret_cast<const AudioRingHeader*>(m_ring);
+	if ((header->magic != BRAR) || (header->version != 1) ||
+	    (header->slotCount == 0) || ((header->slotCount & (header->slotCount - 1)) != 0) ||
+	    ((header->headerSize + (quint64(header->slotSize) * header->slotCount)) > m_ringSize) ||
+	    (header->slotSize < (sizeof(AudioRingSlot) + header->frameSize))) {
+		qWarning("invalid audio ring header");
+		closeSharedMemorySource();
+		return;
+	}
+
+	if (header->encoding != 2) {
+		qWarning("audio ring doesn't contain PCM16 audio");
+		closeSharedMemorySource();
+		return;
+	}
+
+	m_eventFd = fcntl(eventFd, F_DUPFD_CLOEXEC, 3);
+	if (m_eventFd < 0) {
+		qErrnoWarning(errno, "failed to dup audio ring eventfd");
+		closeSharedMemorySource();
+		return;
+	}
+
+	if (fcntl(m_eventFd, F_SETFL, O_NONBLOCK) != 0)
+		qErrnoWarning(errno, "failed to to set the eventfd to be non-blocking");
+
+	m_eventNotifier = new QSocketNotifier(m_eventFd, QSocketNotifier::Read);
+	QObject::connect(m_eventNotifier, &QSocketNotifier::activated,
+	                 this, &AudioWavFile::onRingEvent,
+	                 Qt::QueuedConnection);
+
+	m_wakeups = m_frames = 0;
+	m_totalLatencyUsecs = m_maxLatencyUsecs = 0;
+	m_timer.start();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Called when the daemon has signalled the eventfd, reads all the frames
+	currently in the ring into the file.
+
+ */
+void AudioWavFile::onRingEvent(int eventFd)
+{
+	if (Q_UNLIKELY((eventFd != m_eventFd) || !m_ring))
+		return;
+
+	// clear the eventfd
+	quint64 value;
+	if ((TEMP_FAILURE_RETRY(::read(m_eventFd, &value, sizeof(value))) < 0) &&
+	    (errno != EAGAIN))
+		qErrnoWarning(errno, "failed to read audio ring eventfd");
+
+	m_wakeups++;
+
+	AudioRingHeader *header = reinterpret_cast<AudioRingHeader*>(m_ring);
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	const quint64 now = (quint64(ts.tv_sec) * 1000000000ULL) + quint64(ts.tv_nsec);
+
+	// nb: the flags must be read before the write index, otherwise frames
+	// written just before the close could be missed
+	const quint32 writerFlags = __atomic_load_n(&header->writerFlags, __ATOMIC_ACQUIRE);
+	const quint32 writeIndex = __atomic_load_n(&header->writeIndex, __ATOMIC_ACQUIRE);
+	quint32 readIndex = header->readIndex;
+
+	while (readIndex != writeIndex) {
+
+		const quint8 *slotPtr = m_ring + header->headerSize
+		                      + ((readIndex & (header->slotCount - 1)) * header->slotSize);
+		const AudioRingSlot *slot = reinterpret_cast<const AudioRingSlot*>(slotPtr);
+
+		const quint16 length = qMin<quint16>(slot->length, header->frameSize);
+		if (m_file.write(reinterpret_cast<const char*>(slotPtr + sizeof(AudioRingSlot)),
+		                 length) != length) {
+			qWarning("failed to write audio sample data");
+		}
+
+		m_dataWritten += length;
+		m_frames++;
+
+		const quint64 latencyUsecs = (now - slot->timestamp) / 1000;
+		m_totalLatencyUsecs += latencyUsecs;
+		m_maxLatencyUsecs = qMax(m_maxLatencyUsecs, latencyUsecs);
+
+		readIndex++;
+	}
+
+	// give the slots back to the daemon
+	__atomic_store_n(&header->readIndex, readIndex, __ATOMIC_RELEASE);
+
+	if (writerFlags & RING_WRITER_CLOSED)
+		onPipeClosed();
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Sets the reader closed flag in the ring, so the daemon stops writing to
+	it, then unmaps the ring and closes the eventfd.
+
+ */
+void AudioWavFile::closeSharedMemorySource()
+{
+	if (m_eventNotifier) {
+		m_eventNotifier->setEnabled(false);
+		delete m_eventNotifier;
+		m_eventNotifier = nullptr;
+	}
+
+	if ((m_eventFd >= 0) && (close(m_eventFd) != 0))
+		qErrnoWarning(errno, "failed to close audio ring eventfd");
+	m_eventFd = -1;
+
+	if (m_ring) {
+		AudioRingHeader *header = reinterpret_cast<AudioRingHeader*>(m_ring);
+		__atomic_store_n(&header->readerFlags, quint32(RING_READER_CLOSED),
+		                 __ATOMIC_RELEASE);
+
+		if (munmap(m_ring, m_ringSize) != 0)
+			qErrnoWarning(errno, "failed to unmap audio ring");
+
+		m_ring = nullptr;
+		m_ringSize = 0;
+	}
+}
+
+// -----------------------------------------------------------------------------
+/*!
+	\internal
+
+	Shows the wake-up and latency stats for the last stream, used to compare
+	the pipe and shared memory transports.
+
+ */
+void AudioWavFile::showStats()
+{
+	if (!m_timer.isValid())
+		return;
+
+	const qint64 msecs = qMax<qint64>(m_timer.elapsed(), 1);
+	m_timer.invalidate();
+
+	qWarning("audio: %zu bytes in %llu wakeups over %lldms (%.1f wakeups/s)",
+	         m_dataWritten, m_wakeups, msecs, (m_wakeups * 1000.0) / msecs);
+
+	if (m_frames > 0)
+		qWarning("audio: %llu frames from ring, avg latency %lluus, max %lluus",
+		         m_frames, (m_totalLatencyUsecs / m_frames), m_maxLatencyUsecs);
 }
 
 // -----------------------------------------------------------------------------
@@ -193,6 +441,8 @@ void AudioWavFile::onPipeData(int pipeFd)
 	if (Q_UNLIKELY(pipeFd != m_pipeFd))
 		return;
 
+	m_wakeups++;
+
 	quint8 buffer[512];
 	while (true) {
 
@@ -233,6 +483,9 @@ void AudioWavFile::onPipeData(int pipeFd)
 /*!
 	\internal
 
+	Called when the pipe or shared memory ring has been closed by the daemon,
+	or the source is being replaced.
+
  */
 void AudioWavFile::onPipeClosed()
 {
@@ -248,6 +501,11 @@ void AudioWavFile::onPipeClosed()
 		qErrnoWarning(errno, "failed to close audio pipe");
 	m_pipeFd = -1;
 
+	// or release the shared memory ring
+	closeSharedMemorySource();
+
+	showStats();
+
 	// if the output file was opened then go back and update the WAV header
 	if (m_file.isOpen()) {
 
@@ -28,6 +28,7 @@
 #include <QObject>
 #include <QString>
 #include <QFile>
+#include <QElapsedTimer>
 
 
 class QSocketNotifier;
@@ -44,6 +45,7 @@ public:
 	bool isOpen() const;
 
 	void setPipeSource(int pipeFd);
+	void setSharedMemorySource(int memoryFd, int eventFd);
 
 private:
 	bool writeFileHeader();
@@ -51,13 +53,29 @@ private:
 	void onPipeData(int pipeFd);
 	void onPipeClosed();
 
+	void onRingEvent(int eventFd);
+	void closeSharedMemorySource();
+
+	void showStats();
+
 private:
 	QFile m_file;
 
 	int m_pipeFd;
 	QSocketNotifier *m_pipeNotifier;
 
+	int m_eventFd;
+	QSocketNotifier *m_eventNotifier;
+	size_t m_ringSize;
+	quint8 *m_ring;
+
 	size_t m_dataWritten;
+
+	QElapsedTimer m_timer;
+	quint64 m_wakeups;
+	quint64 m_frames;
+	quint64 m_totalLatencyUsecs;
+	quint64 m_maxLatencyUsecs;
 };
 
 #endif // !defined(AUDIOWAVFILE_H)